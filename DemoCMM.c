@@ -17,6 +17,15 @@
 				If the first and the last profile are RGB or if the first and the 
 				last profile are CMYK, then this CMM leaves the colors unchanged.
 				
+				Profiles in between take the colors through their own colorspace
+				on the way, so an RGB to Gray to RGB proofing chain shows RGB
+				colors as the gray device would print them.
+				
+				A color is out of gamut when its conversion has to clamp it.
+				
+				The conversions themselves live in DemoCMMEngine.c; this file
+				only adapts the component calls to the engine.
+
 	Version:	ColorSync 2 or later
 
 	Copyright:	2002 by Apple Computer, Inc., all rights reserved.
@@ -46,7 +55,9 @@
 #endif
 
 
-#include <math.h>
+#include <string.h>
+
+#include "DemoCMMEngine.h"
 
 
 #define CMM_ENTRY		pascal
@@ -55,43 +66,31 @@
 #define 	kCMCodeVersion		1
 #define		kCMMVersion			((CMMInterfaceVersion << 16) | kCMCodeVersion)
 
-typedef void (*MatchOneProc) (UInt16* chan);
+// Float and half float bitmaps, native endian. ColorSync has no packing
+// for them, so these take the bits above its 16 bits of space and
+// packing, added to cmGraySpace, cmRGBSpace, cmCMYKSpace, cmLABSpace or
+// cmXYZSpace.
+enum
+{
+	kDemoFloatPacking			= 0x00010000,
+	kDemoHalfPacking			= 0x00020000
+};
 
 
 // Component storage
 typedef struct
 {
-	OSType				srcSpace;
-	OSType				srcClass;
-	OSType				dstSpace;
-	OSType				dstClass;
-	MatchOneProc		proc;
+	EngineTransformRef	transform;		// set by PublishTransform, nil before init
 } CMMStorageRec, *CMMStoragePtr, **CMMStorageHdl;
 
 
-// Match stuff
+// Progress proc of a CMMMatchBitmap call
 typedef struct
 {
-	CMMStorageHdl		storage;
-	
-	UInt32				height;
-	UInt32				width;
-	
-	OSType				srcSpace;
-	UInt8*				srcBuf[4];
-	UInt32				srcChanBits;
-	UInt32				srcRowBytes;
-	UInt32				srcColBytes;
-	Boolean				srcSwap;
-	
-	OSType				dstSpace;
-	UInt8*				dstBuf[4];
-	UInt32				dstChanBits;
-	UInt32				dstRowBytes;
-	UInt32				dstColBytes;
-	Boolean				dstSwap;
-	
-} CMMMatchRec, *CMMMatchPtr, **CMMMatchHdl;
+	CMBitmapCallBackUPP	proc;
+	void*				refCon;
+} ProgressRec;
+
 
 
 
@@ -105,28 +104,14 @@ static CMError DoCMMMatchColors		(CMMStorageHdl storage, CMColor *colorBuf, UInt
 static CMError DoCMMCheckColors		(CMMStorageHdl storage, CMColor *colorBuf, UInt32 count, UInt32 *gamutResult);
 static CMError DoCMMMatchBitmap		(CMMStorageHdl storage, const CMBitmap * srcMap, CMBitmapCallBackUPP progressProc, void* refCon, CMBitmap* dstMap);
 static CMError DoCMMCheckBitmap		(CMMStorageHdl storage, const CMBitmap * srcMap, CMBitmapCallBackUPP progressProc, void* refCon, CMBitmap* chkMap);
-static CMError CheckStorage			(CMMStorageHdl storage);
-static void    MatchAll				(CMMMatchPtr pMatchInfo);
-static void MatchOne_RGB_CMYK	(UInt16* chan);
-static void MatchOne_CMYK_RGB	(UInt16* chan);
-static void MatchOne_RGB_XYZ	(UInt16* chan);
-static void MatchOne_XYZ_RGB	(UInt16* chan);
-static void MatchOne_RGB_LAB	(UInt16* chan);
-static void MatchOne_LAB_RGB	(UInt16* chan);
-static void MatchOne_XYZ_LAB	(UInt16* chan);
-static void MatchOne_LAB_XYZ	(UInt16* chan);
-static void MatchOne_XYZ_Gray	(UInt16* chan);
-static void MatchOne_Gray_XYZ	(UInt16* chan);
-static void MatchOne_CMYK_LAB	(UInt16* chan);
-static void MatchOne_LAB_CMYK	(UInt16* chan);
-static void MatchOne_CMYK_XYZ	(UInt16* chan);
-static void MatchOne_XYZ_CMYK	(UInt16* chan);
-static void MatchOne_RGB_Gray	(UInt16* chan);
-static void MatchOne_Gray_RGB	(UInt16* chan);
-static void MatchOne_LAB_Gray	(UInt16* chan);
-static void MatchOne_Gray_LAB	(UInt16* chan);
-static void MatchOne_CMYK_Gray	(UInt16* chan);
-static void MatchOne_Gray_CMYK	(UInt16* chan);
+static CMError InitTransform		(CMMStorageHdl storage, EngineTransformKey* key,
+									 CMProfileRef srcProfile, CMProfileRef dstProfile);
+static Boolean AddChainSpace		(OSType* spaces, UInt32* count, OSType space);
+static void    SetChainSpaces		(EngineTransformKey* key, const OSType* spaces, UInt32 count);
+static void    PublishTransform		(CMMStorageHdl storage, EngineTransformRef xform);
+static EngineTransformRef CurrentTransform	(CMMStorageHdl storage);
+static Boolean LayoutForSpace		(UInt32 space, EngineLayout* layout);
+static CMError EngineToCMError		(EngineError err);
 
 
 
@@ -145,6 +130,9 @@ CMMOpen ( UInt32 *cmmRefcon,
 { 
 #pragma unused (hInstance)
 	*cmmRefcon = (UInt32)calloc(1,sizeof(CMMStorageRec));
+#if DO_CHECKACCURACY
+	EngineCheckAccuracy(kEngineNormalMode, kEnginePrecisionDefault);
+#endif
 	//{
 	//	CFBundleRef ref = nil;
 	//	ref = CFBundleGetBundleWithIdentifier(CFSTR("com.apple.ColorSync.DemoCMM"));
@@ -162,7 +150,10 @@ CMM_ENTRY CMError
 CMMClose ( UInt32 *cmmRefcon ) 
 {
 	if (*cmmRefcon)
-	free((void*)*cmmRefcon);
+	{
+		PublishTransform((CMMStorageHdl)cmmRefcon, nil);
+		free((void*)*cmmRefcon);
+	}
 	return noErr;
 }
 
@@ -243,6 +234,9 @@ DoNCMMInit (CMMStorageHdl storage, CMProfileRef srcProfile, CMProfileRef dstProf
 
 
 //--------------------------------------------------------------------- DoCMMConcatInit
+//	Every profile in between is used both ways, so the colors pass
+//	through its colorspace.
+//---------------------------------------------------------------------
 
 static CMError
 DoCMMConcatInit (CMMStorageHdl storage, CMConcatProfileSet* profileSet)
@@ -250,11 +244,16 @@ DoCMMConcatInit (CMMStorageHdl storage, CMConcatProfileSet* profileSet)
 	ComponentResult			result = noErr;
 	CMAppleProfileHeader	srcHdr;
 	CMAppleProfileHeader	dstHdr;
+	CMAppleProfileHeader	hdr;
 	CMProfileRef			srcProfile;
 	CMProfileRef			dstProfile;
+	OSType					spaces[kEngineMaxVia + 2];
+	UInt32					count = 0;
+	UInt32					i;
+	EngineTransformKey		key;
 	
 	// Check params
-	if (profileSet==nil)
+	if (profileSet==nil || profileSet->count==0)
 		return paramErr;
 	
 	srcProfile = profileSet->profileSet[0];
@@ -268,15 +267,29 @@ DoCMMConcatInit (CMMStorageHdl storage, CMConcatProfileSet* profileSet)
 	if (result == noErr)
 		result = CMGetProfileHeader(dstProfile, &dstHdr);
 	
-	if (result == noErr)
+	for (i=0; result == noErr && i < profileSet->count; i++)
 	{
-		(**storage).srcSpace = srcHdr.cm2.dataColorSpace;
-		(**storage).srcClass = srcHdr.cm2.profileClass;
+		if (profileSet->profileSet[i] == nil)
+			result = paramErr;
 		
-		(**storage).dstSpace = dstHdr.cm2.dataColorSpace;
-		(**storage).dstClass = dstHdr.cm2.profileClass;
+		if (result == noErr)
+			result = CMGetProfileHeader(profileSet->profileSet[i], &hdr);
 		
-		result = CheckStorage(storage);
+		if (result == noErr && !AddChainSpace(spaces, &count, hdr.cm2.dataColorSpace))
+			result = paramErr;
+	}
+	
+	if (result == noErr)
+	{
+		memset(&key, 0, sizeof(key));
+		SetChainSpaces(&key, spaces, count);
+		key.srcClass		= srcHdr.cm2.profileClass;
+		key.dstClass		= dstHdr.cm2.profileClass;
+		key.srcTransform	= kDeviceToPCS;
+		key.dstTransform	= kPCSToDevice;
+		key.quality			= (srcHdr.cm2.flags & cmQualityMask) >> 16;
+		
+		result = InitTransform(storage, &key, srcProfile, dstProfile);
 	}
 		
 	return result ;
@@ -284,6 +297,13 @@ DoCMMConcatInit (CMMStorageHdl storage, CMConcatProfileSet* profileSet)
 
 
 //--------------------------------------------------------------------- DoNCMMConcatInit
+//	Each profile takes the colors into or out of its colorspace as its
+//	transformTag says. The PCS only counts at the ends of the chain:
+//	every conversion goes straight from one colorspace to the next, so a
+//	profile to the PCS followed by one from the PCS is a single step.
+//	kNoTransform means whatever the position implies, to the PCS for the
+//	first profile, from it for the last and both ways in between.
+//---------------------------------------------------------------------
 
 static CMError
 DoNCMMConcatInit (CMMStorageHdl storage, NCMConcatProfileSet* profileSet, CMConcatCallBackUPP proc, void* refcon)
@@ -292,22 +312,30 @@ DoNCMMConcatInit (CMMStorageHdl storage, NCMConcatProfileSet* profileSet, CMConc
 	ComponentResult			result = noErr;
 	CMAppleProfileHeader	srcHdr;
 	CMAppleProfileHeader	dstHdr;
+	CMAppleProfileHeader	hdr;
 	CMProfileRef			srcProfile;
 	CMProfileRef			dstProfile;
 	UInt32 					srcTransform;
 	UInt32 					dstTransform;
+	UInt32					transform;
+	OSType					spaces[kEngineMaxVia + 2];
+	UInt32					count = 0;
+	UInt32					i, last;
+	Boolean					fits = true;
+	EngineTransformKey		key;
 	
 	// Check params
-	if (profileSet==nil)
+	if (profileSet==nil || profileSet->profileCount==0)
 		return paramErr;
 	
+	last = profileSet->profileCount-1;
 	srcProfile = profileSet->profileSpecs[0].profile;
-	dstProfile = profileSet->profileSpecs[profileSet->profileCount-1].profile;
+	dstProfile = profileSet->profileSpecs[last].profile;
 	if ((srcProfile == nil) || (dstProfile == nil))
 		return paramErr;
 	
 	srcTransform = profileSet->profileSpecs[0].transformTag;
-	dstTransform = profileSet->profileSpecs[profileSet->profileCount-1].transformTag;
+	dstTransform = profileSet->profileSpecs[last].transformTag;
 	
 	if (result == noErr)
 		result = CMGetProfileHeader(srcProfile, &srcHdr);
@@ -315,15 +343,67 @@ DoNCMMConcatInit (CMMStorageHdl storage, NCMConcatProfileSet* profileSet, CMConc
 	if (result == noErr)
 		result = CMGetProfileHeader(dstProfile, &dstHdr);
 	
-	if (result == noErr)
+	for (i=0; result == noErr && i <= last; i++)
 	{
-		(**storage).srcSpace = (kDeviceToPCS) ? srcHdr.cm2.dataColorSpace : srcHdr.cm2.profileConnectionSpace;
-		(**storage).srcClass = srcHdr.cm2.profileClass;
+		if (profileSet->profileSpecs[i].profile == nil)
+			result = paramErr;
+		
+		if (result == noErr)
+			result = CMGetProfileHeader(profileSet->profileSpecs[i].profile, &hdr);
 		
-		(**storage).dstSpace = (kPCSToDevice) ? dstHdr.cm2.dataColorSpace : dstHdr.cm2.profileConnectionSpace;
-		(**storage).dstClass = dstHdr.cm2.profileClass;
+		if (result != noErr)
+			break;
 		
-		result = CheckStorage(storage);
+		transform = profileSet->profileSpecs[i].transformTag;
+		if (transform == kNoTransform && i == 0)
+			transform = kDeviceToPCS;
+		else if (transform == kNoTransform && i == last)
+			transform = kPCSToDevice;
+		
+		switch (transform)
+		{
+			case kDeviceToPCS:
+				fits = fits && AddChainSpace(spaces, &count, hdr.cm2.dataColorSpace);
+				if (i == last)
+					fits = fits && AddChainSpace(spaces, &count, hdr.cm2.profileConnectionSpace);
+				break;
+			
+			case kPCSToDevice:
+				if (i == 0)
+					fits = fits && AddChainSpace(spaces, &count, hdr.cm2.profileConnectionSpace);
+				fits = fits && AddChainSpace(spaces, &count, hdr.cm2.dataColorSpace);
+				break;
+			
+			case kPCSToPCS:
+				// Abstract profiles leave the colors unchanged
+				if (i == 0 || i == last)
+					fits = fits && AddChainSpace(spaces, &count, hdr.cm2.profileConnectionSpace);
+				break;
+			
+			case kNoTransform:
+				fits = fits && AddChainSpace(spaces, &count, hdr.cm2.dataColorSpace);
+				break;
+			
+			default:
+				result = paramErr;
+				break;
+		}
+	}
+	
+	if (result == noErr && !fits)
+		result = paramErr;
+	
+	if (result == noErr)
+	{
+		memset(&key, 0, sizeof(key));
+		SetChainSpaces(&key, spaces, count);
+		key.srcClass		= srcHdr.cm2.profileClass;
+		key.dstClass		= dstHdr.cm2.profileClass;
+		key.srcTransform	= srcTransform;
+		key.dstTransform	= dstTransform;
+		key.quality			= (srcHdr.cm2.flags & cmQualityMask) >> 16;
+		
+		result = InitTransform(storage, &key, srcProfile, dstProfile);
 	}
 		
 	return result ;
@@ -335,346 +415,65 @@ DoNCMMConcatInit (CMMStorageHdl storage, NCMConcatProfileSet* profileSet, CMConc
 static CMError
 DoCMMMatchColors (CMMStorageHdl storage, CMColor *colorBuf, UInt32 count)
 {
-	CMMMatchRec			matchInfo;
-	
-	matchInfo.storage		= storage;
-	matchInfo.height		= count;
-	matchInfo.width			= 1;
-	matchInfo.srcSpace		= (**storage).srcSpace;
-	matchInfo.srcBuf[0]		= ((UInt8*)colorBuf) + 0;
-	matchInfo.srcBuf[1]		= ((UInt8*)colorBuf) + 2;
-	matchInfo.srcBuf[2]		= ((UInt8*)colorBuf) + 4;
-	matchInfo.srcBuf[3]		= ((UInt8*)colorBuf) + 6;
-	matchInfo.srcChanBits	= 16;
-	matchInfo.srcRowBytes	= sizeof(CMColor);
-	matchInfo.srcColBytes	= sizeof(CMColor);
-	matchInfo.srcSwap		= false;
-	
-	matchInfo.dstSpace		= (**storage).dstSpace;
-	matchInfo.dstBuf[0]		= ((UInt8*)colorBuf) + 0;
-	matchInfo.dstBuf[1]		= ((UInt8*)colorBuf) + 2;
-	matchInfo.dstBuf[2]		= ((UInt8*)colorBuf) + 4;
-	matchInfo.dstBuf[3]		= ((UInt8*)colorBuf) + 6;
-	matchInfo.dstChanBits	= 16;
-	matchInfo.dstRowBytes	= sizeof(CMColor);
-	matchInfo.dstColBytes	= sizeof(CMColor);
-	matchInfo.dstSwap		= false;
-	
-	MatchAll(&matchInfo);
-	
-	return noErr;
+	return EngineToCMError(EngineMatchColors(CurrentTransform(storage), colorBuf, count, sizeof(CMColor)));
 }
 								
 
 //--------------------------------------------------------------------- DoCMMCheckColors
+//	A bit per color, set when the color is out of gamut.
+//---------------------------------------------------------------------
 
 static CMError
 DoCMMCheckColors (CMMStorageHdl storage,  CMColor *colorBuf, UInt32 count, UInt32* gamutResult)
 {
-#pragma unused (storage, colorBuf)
-	
-	UInt32		longCount;
-	
-	/* Everything is in gamut. This is just sample code. */
-	
-	longCount = (count + 31) / 32;
-	
-	while (longCount--)
-		*gamutResult++ = 0xFFFFFFFF;
-	
-	return noErr;
+	return EngineToCMError(EngineCheckColors(CurrentTransform(storage), colorBuf, count, sizeof(CMColor), gamutResult));
 }
 
 
 //--------------------------------------------------------------------- DoCMMMatchBitmap
 
+static int
+CallProgress (uint32_t rowsLeft, void* refCon)
+{
+	ProgressRec*		progress = (ProgressRec*)refCon;
+	
+	return InvokeCMBitmapCallBackUPP(rowsLeft, progress->refCon, progress->proc);
+}
+
 static CMError
 DoCMMMatchBitmap (CMMStorageHdl storage,  const CMBitmap * srcMap,
 				 CMBitmapCallBackUPP progressProc, void * refCon,
 				 CMBitmap* dstMap)
 {
-#pragma unused (progressProc, refCon)
-	
-	CMMMatchRec			matchInfo;
+	EngineBitmap		src;
+	EngineBitmap		dst;
+	ProgressRec			progress;
 	
 	// Check params
 	if (srcMap==nil || dstMap==nil)
 		return paramErr;
 	
-	matchInfo.storage		= storage;
-	matchInfo.height		= srcMap->height;
-	matchInfo.width			= srcMap->width;
-	matchInfo.srcRowBytes	= srcMap->rowBytes;
-	matchInfo.dstRowBytes	= dstMap->rowBytes;
-	
-	switch (srcMap->space)
-	{
-		case cmGray8Space:
-		matchInfo.srcSpace		= cmGrayData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= nil;
-		matchInfo.srcBuf[2]		= nil;
-		matchInfo.srcBuf[3]		= nil;
-		matchInfo.srcChanBits	= 8;
-		matchInfo.srcColBytes	= 1;
-		break;
-		
-		case cmGray16Space:
-		case cmGray16LSpace:
-		matchInfo.srcSpace		= cmGrayData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= nil;
-		matchInfo.srcBuf[2]		= nil;
-		matchInfo.srcBuf[3]		= nil;
-		matchInfo.srcChanBits	= 16;
-		matchInfo.srcColBytes	= 2;
-		break;
-	
-		case cmRGB24Space:
-		matchInfo.srcSpace		= cmRGBData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= (UInt8*)srcMap->image + 1;
-		matchInfo.srcBuf[2]		= (UInt8*)srcMap->image + 2;
-		matchInfo.srcBuf[3]		= nil;
-		matchInfo.srcChanBits	= 8;
-		matchInfo.srcColBytes	= 3;
-		break;
-		
-		case cmRGB32Space:
-		matchInfo.srcSpace		= cmRGBData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 1;
-		matchInfo.srcBuf[1]		= (UInt8*)srcMap->image + 2;
-		matchInfo.srcBuf[2]		= (UInt8*)srcMap->image + 3;
-		matchInfo.srcBuf[3]		= nil;
-		matchInfo.srcChanBits	= 8;
-		matchInfo.srcColBytes	= 4;
-		break;
-		
-		case cmRGB48Space:
-		case cmRGB48LSpace:
-		matchInfo.srcSpace		= cmRGBData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= (UInt8*)srcMap->image + 2;
-		matchInfo.srcBuf[2]		= (UInt8*)srcMap->image + 4;
-		matchInfo.srcBuf[3]		= nil;
-		matchInfo.srcChanBits	= 16;
-		matchInfo.srcColBytes	= 6;
-		break;
-		
-		case cmCMYK32Space:
-		matchInfo.srcSpace		= cmCMYKData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= (UInt8*)srcMap->image + 1;
-		matchInfo.srcBuf[2]		= (UInt8*)srcMap->image + 2;
-		matchInfo.srcBuf[3]		= (UInt8*)srcMap->image + 3;
-		matchInfo.srcChanBits	= 8;
-		matchInfo.srcColBytes	= 4;
-		break;
-		
-		case cmCMYK64Space:
-		case cmCMYK64LSpace:
-		matchInfo.srcSpace		= cmCMYKData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= (UInt8*)srcMap->image + 2;
-		matchInfo.srcBuf[2]		= (UInt8*)srcMap->image + 4;
-		matchInfo.srcBuf[3]		= (UInt8*)srcMap->image + 6;
-		matchInfo.srcChanBits	= 16;
-		matchInfo.srcColBytes	= 8;
-		break;
-		
-		case cmLAB24Space:
-		matchInfo.srcSpace		= cmLabData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= (UInt8*)srcMap->image + 1;
-		matchInfo.srcBuf[2]		= (UInt8*)srcMap->image + 2;
-		matchInfo.srcBuf[3]		= nil;
-		matchInfo.srcChanBits	= 8;
-		matchInfo.srcColBytes	= 3;
-		break;
-		
-		case cmLAB48Space:
-		case cmLAB48LSpace:
-		matchInfo.srcSpace		= cmLabData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= (UInt8*)srcMap->image + 2;
-		matchInfo.srcBuf[2]		= (UInt8*)srcMap->image + 4;
-		matchInfo.srcBuf[3]		= nil;
-		matchInfo.srcChanBits	= 16;
-		matchInfo.srcColBytes	= 6;
-		break;
-		
-		case cmXYZ24Space:
-		matchInfo.srcSpace		= cmXYZData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= (UInt8*)srcMap->image + 1;
-		matchInfo.srcBuf[2]		= (UInt8*)srcMap->image + 2;
-		matchInfo.srcBuf[3]		= nil;
-		matchInfo.srcChanBits	= 8;
-		matchInfo.srcColBytes	= 3;
-		break;
-		
-		case cmXYZ48Space:
-		case cmXYZ48LSpace:
-		matchInfo.srcSpace		= cmXYZData;
-		matchInfo.srcBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.srcBuf[1]		= (UInt8*)srcMap->image + 2;
-		matchInfo.srcBuf[2]		= (UInt8*)srcMap->image + 4;
-		matchInfo.srcBuf[3]		= nil;
-		matchInfo.srcChanBits	= 16;
-		matchInfo.srcColBytes	= 6;
-		break;
-		
-		default:
+	if (!LayoutForSpace(srcMap->space, &src.layout))
 		return cmInvalidSrcMap;
-		break;
-	}
-	
-	#if TARGET_RT_LITTLE_ENDIAN
-		matchInfo.srcSwap = ((srcMap->space & cmLittleEndianPacking) == 0);
-	#else
-		matchInfo.srcSwap = ((srcMap->space & cmLittleEndianPacking) == cmLittleEndianPacking);
-	#endif
-	
 	
-	switch (dstMap->space)
-	{
-		case cmGray8Space:
-		matchInfo.dstSpace		= cmGrayData;
-		matchInfo.dstBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.dstBuf[1]		= nil;
-		matchInfo.dstBuf[2]		= nil;
-		matchInfo.dstBuf[3]		= nil;
-		matchInfo.dstChanBits	= 8;
-		matchInfo.dstColBytes	= 1;
-		break;
-		
-		case cmGray16Space:
-		case cmGray16LSpace:
-		matchInfo.dstSpace		= cmGrayData;
-		matchInfo.dstBuf[0]		= (UInt8*)srcMap->image + 0;
-		matchInfo.dstBuf[1]		= nil;
-		matchInfo.dstBuf[2]		= nil;
-		matchInfo.dstBuf[3]		= nil;
-		matchInfo.dstChanBits	= 16;
-		matchInfo.dstColBytes	= 2;
-		break;
-	
-		case cmRGB24Space:
-		matchInfo.dstSpace		= cmRGBData;
-		matchInfo.dstBuf[0]		= (UInt8*)dstMap->image + 0;
-		matchInfo.dstBuf[1]		= (UInt8*)dstMap->image + 1;
-		matchInfo.dstBuf[2]		= (UInt8*)dstMap->image + 2;
-		matchInfo.dstBuf[3]		= nil;
-		matchInfo.dstChanBits	= 8;
-		matchInfo.dstColBytes	= 3;
-		break;
-		
-		case cmRGB32Space:
-		matchInfo.dstSpace		= cmRGBData;
-		matchInfo.dstBuf[0]		= (UInt8*)dstMap->image + 1;
-		matchInfo.dstBuf[1]		= (UInt8*)dstMap->image + 2;
-		matchInfo.dstBuf[2]		= (UInt8*)dstMap->image + 3;
-		matchInfo.dstBuf[3]		= nil;
-		matchInfo.dstChanBits	= 8;
-		matchInfo.dstColBytes	= 4;
-		break;
-		
-		case cmRGB48Space:
-		case cmRGB48LSpace:
-		matchInfo.dstSpace		= cmRGBData;
-		matchInfo.dstBuf[0]		= (UInt8*)dstMap->image + 0;
-		matchInfo.dstBuf[1]		= (UInt8*)dstMap->image + 2;
-		matchInfo.dstBuf[2]		= (UInt8*)dstMap->image + 4;
-		matchInfo.dstBuf[3]		= nil;
-		matchInfo.dstChanBits	= 16;
-		matchInfo.dstColBytes	= 6;
-		break;
-		
-		case cmCMYK32Space:
-		matchInfo.dstSpace		= cmCMYKData;
-		matchInfo.dstBuf[0]		= (UInt8*)dstMap->image + 0;
-		matchInfo.dstBuf[1]		= (UInt8*)dstMap->image + 1;
-		matchInfo.dstBuf[2]		= (UInt8*)dstMap->image + 2;
-		matchInfo.dstBuf[3]		= (UInt8*)dstMap->image + 3;
-		matchInfo.dstChanBits	= 8;
-		matchInfo.dstColBytes	= 4;
-		break;
-		
-		case cmCMYK64Space:
-		case cmCMYK64LSpace:
-		matchInfo.dstSpace		= cmCMYKData;
-		matchInfo.dstBuf[0]		= (UInt8*)dstMap->image + 0;
-		matchInfo.dstBuf[1]		= (UInt8*)dstMap->image + 2;
-		matchInfo.dstBuf[2]		= (UInt8*)dstMap->image + 4;
-		matchInfo.dstBuf[3]		= (UInt8*)dstMap->image + 6;
-		matchInfo.dstChanBits	= 16;
-		matchInfo.dstColBytes	= 8;
-		break;
-		
-		case cmLAB24Space:
-		matchInfo.dstSpace		= cmLabData;
-		matchInfo.dstBuf[0]		= (UInt8*)dstMap->image + 0;
-		matchInfo.dstBuf[1]		= (UInt8*)dstMap->image + 1;
-		matchInfo.dstBuf[2]		= (UInt8*)dstMap->image + 2;
-		matchInfo.dstBuf[3]		= nil;
-		matchInfo.dstChanBits	= 8;
-		matchInfo.dstColBytes	= 3;
-		break;
-		
-		case cmLAB48Space:
-		case cmLAB48LSpace:
-		matchInfo.dstSpace		= cmLabData;
-		matchInfo.dstBuf[0]		= (UInt8*)dstMap->image + 0;
-		matchInfo.dstBuf[1]		= (UInt8*)dstMap->image + 2;
-		matchInfo.dstBuf[2]		= (UInt8*)dstMap->image + 4;
-		matchInfo.dstBuf[3]		= nil;
-		matchInfo.dstChanBits	= 16;
-		matchInfo.dstColBytes	= 6;
-		break;
-		
-		case cmXYZ24Space:
-		matchInfo.dstSpace		= cmXYZData;
-		matchInfo.dstBuf[0]		= (UInt8*)dstMap->image + 0;
-		matchInfo.dstBuf[1]		= (UInt8*)dstMap->image + 1;
-		matchInfo.dstBuf[2]		= (UInt8*)dstMap->image + 2;
-		matchInfo.dstBuf[3]		= nil;
-		matchInfo.dstChanBits	= 8;
-		matchInfo.dstColBytes	= 3;
-		break;
-		
-		case cmXYZ48Space:
-		case cmXYZ48LSpace:
-		matchInfo.dstSpace		= cmXYZData;
-		matchInfo.dstBuf[0]		= (UInt8*)dstMap->image + 0;
-		matchInfo.dstBuf[1]		= (UInt8*)dstMap->image + 2;
-		matchInfo.dstBuf[2]		= (UInt8*)dstMap->image + 4;
-		matchInfo.dstBuf[3]		= nil;
-		matchInfo.dstChanBits	= 16;
-		matchInfo.dstColBytes	= 6;
-		break;
-		
-		default:
-		return cmInvalidSrcMap;
-		break;
-	}
-	
-	#if TARGET_RT_LITTLE_ENDIAN
-		matchInfo.dstSwap = ((dstMap->space & cmLittleEndianPacking) == 0);
-	#else
-		matchInfo.dstSwap = ((dstMap->space & cmLittleEndianPacking) == cmLittleEndianPacking);
-	#endif
-	
-	
-	if ((**storage).srcSpace != matchInfo.srcSpace)
-		return cmInvalidSrcMap;
+	if (!LayoutForSpace(dstMap->space, &dst.layout))
+		return cmInvalidDstMap;
 	
+	src.image		= srcMap->image;
+	src.width		= srcMap->width;
+	src.height		= srcMap->height;
+	src.rowBytes	= srcMap->rowBytes;
 	
-	if ((**storage).dstSpace != matchInfo.dstSpace)
-		return cmInvalidDstMap;
+	dst.image		= dstMap->image;
+	dst.width		= dstMap->width;
+	dst.height		= dstMap->height;
+	dst.rowBytes	= dstMap->rowBytes;
 	
-	MatchAll(&matchInfo);
+	progress.proc	= progressProc;
+	progress.refCon	= refCon;
 	
-	return noErr;
+	return EngineToCMError(EngineMatchBitmap(CurrentTransform(storage), &src, &dst,
+											 progressProc ? &CallProgress : nil, &progress));
 }
 
 
@@ -685,8 +484,36 @@ DoCMMCheckBitmap (CMMStorageHdl storage,  const CMBitmap * srcMap,
 				 CMBitmapCallBackUPP progressProc, void * refCon,
 				 CMBitmap* chkMap)
 {
-#pragma unused (storage, srcMap, progressProc, refCon, chkMap)
-	return paramErr;
+	EngineBitmap		src;
+	EngineBitmap		chk;
+	ProgressRec			progress;
+	
+	// Check params
+	if (srcMap==nil || chkMap==nil)
+		return paramErr;
+	
+	if (!LayoutForSpace(srcMap->space, &src.layout))
+		return cmInvalidSrcMap;
+	
+	if (chkMap->space != cmGamutResult1Space)
+		return cmInvalidDstMap;
+	
+	src.image		= srcMap->image;
+	src.width		= srcMap->width;
+	src.height		= srcMap->height;
+	src.rowBytes	= srcMap->rowBytes;
+	
+	chk.image		= chkMap->image;
+	chk.width		= chkMap->width;
+	chk.height		= chkMap->height;
+	chk.rowBytes	= chkMap->rowBytes;
+	chk.layout		= kEngineGamut1;
+	
+	progress.proc	= progressProc;
+	progress.refCon	= refCon;
+	
+	return EngineToCMError(EngineCheckBitmap(CurrentTransform(storage), &src, &chk,
+											 progressProc ? &CallProgress : nil, &progress));
 }
 
 
@@ -694,446 +521,172 @@ DoCMMCheckBitmap (CMMStorageHdl storage,  const CMBitmap * srcMap,
 #pragma mark ----- utilities -----
 
 
-//--------------------------------------------------------------------- CheckStorage
+//--------------------------------------------------------------------- InitTransform
+//	Makes the transform for key, from the engine's cache when both profiles
+//	have a digest to tell them apart, the transform of the component.
+//---------------------------------------------------------------------
 
 static CMError
-CheckStorage (CMMStorageHdl storage)
+InitTransform (CMMStorageHdl storage, EngineTransformKey* key,
+			   CMProfileRef srcProfile, CMProfileRef dstProfile)
 {
-	OSType			srcSpace = (**storage).srcSpace;
-	OSType			dstSpace = (**storage).dstSpace;
-	
-	(**storage).proc = nil;
+	EngineTransformRef	xform;
+	EngineError			err;
 	
-	if (srcSpace == dstSpace)
-		return noErr;
-	
-	if      (srcSpace==cmRGBData  && dstSpace==cmCMYKData)		(**storage).proc = &MatchOne_RGB_CMYK;
-	else if (srcSpace==cmRGBData  && dstSpace==cmXYZData)		(**storage).proc = &MatchOne_RGB_XYZ;
-	else if (srcSpace==cmRGBData  && dstSpace==cmLabData)		(**storage).proc = &MatchOne_RGB_LAB;
-	else if (srcSpace==cmRGBData  && dstSpace==cmGrayData)		(**storage).proc = &MatchOne_RGB_Gray;
-	else if (srcSpace==cmCMYKData && dstSpace==cmRGBData)		(**storage).proc = &MatchOne_CMYK_RGB;
-	else if (srcSpace==cmCMYKData && dstSpace==cmLabData)		(**storage).proc = &MatchOne_CMYK_LAB;
-	else if (srcSpace==cmCMYKData && dstSpace==cmXYZData)		(**storage).proc = &MatchOne_CMYK_XYZ;
-	else if (srcSpace==cmCMYKData && dstSpace==cmGrayData)		(**storage).proc = &MatchOne_CMYK_Gray;
-	else if (srcSpace==cmXYZData  && dstSpace==cmRGBData)		(**storage).proc = &MatchOne_XYZ_RGB;
-	else if (srcSpace==cmXYZData  && dstSpace==cmLabData)		(**storage).proc = &MatchOne_XYZ_LAB;
-	else if (srcSpace==cmXYZData  && dstSpace==cmCMYKData)		(**storage).proc = &MatchOne_XYZ_CMYK;
-	else if (srcSpace==cmXYZData  && dstSpace==cmGrayData)		(**storage).proc = &MatchOne_XYZ_Gray;
-	else if (srcSpace==cmLabData  && dstSpace==cmRGBData)		(**storage).proc = &MatchOne_LAB_RGB;
-	else if (srcSpace==cmLabData  && dstSpace==cmXYZData)		(**storage).proc = &MatchOne_LAB_XYZ;
-	else if (srcSpace==cmLabData  && dstSpace==cmCMYKData)		(**storage).proc = &MatchOne_LAB_CMYK;
-	else if (srcSpace==cmLabData  && dstSpace==cmGrayData)		(**storage).proc = &MatchOne_LAB_Gray;
-	else if (srcSpace==cmGrayData && dstSpace==cmRGBData)		(**storage).proc = &MatchOne_Gray_RGB;
-	else if (srcSpace==cmGrayData && dstSpace==cmCMYKData)		(**storage).proc = &MatchOne_Gray_CMYK;
-	else if (srcSpace==cmGrayData && dstSpace==cmXYZData)		(**storage).proc = &MatchOne_Gray_XYZ;
-	else if (srcSpace==cmGrayData && dstSpace==cmLabData)		(**storage).proc = &MatchOne_Gray_LAB;
+	if (CMGetProfileMD5(srcProfile, key->srcMD5) == noErr &&
+		CMGetProfileMD5(dstProfile, key->dstMD5) == noErr)
+		err = EngineFindTransform(key, &xform);
 	else
-		return cmInvalidProfile;
-	
-	return noErr;
-}
-
-
-//--------------------------------------------------------------------- DebugColor4
-
-#if DO_DEBUGCOLOR
-static void
-DebugColor4( UInt16* color)
-{
-	char			s[] = " 0xXXXX, 0xXXXX, 0xXXXX, 0xXXXX\n";
-	char*			c = &(s[3]);
-	int				i;
-	int				v;
+		err = EngineNewTransform(key, &xform);
 	
-	for (i=0; i<4; i++)
+	if (err == kEngineNoErr)
 	{
-		v = (((*color)>>12) & 0x000F);	*c++ = (v<10) ? (v+'0') : (v+'A'-10);
-		v = (((*color)>>8) & 0x000F);	*c++ = (v<10) ? (v+'0') : (v+'A'-10);
-		v = (((*color)>>4) & 0x000F);	*c++ = (v<10) ? (v+'0') : (v+'A'-10);
-		v = (((*color)) & 0x000F);		*c++ = (v<10) ? (v+'0') : (v+'A'-10);
-		c += 4;
-		color++;
+		PublishTransform(storage, xform);
+		EngineReleaseTransform(xform);
 	}
 	
-	fprintf(stderr, s);
+	return EngineToCMError(err);
 }
-#endif
 
 
-//---------------------------------------------------------------------	MatchAll				
-//	Simple conversion of a bunch or colors.
+//--------------------------------------------------------------------- AddChainSpace
+//	Appends the next colorspace of a chain of profiles. A colorspace the
+//	colors stay in is only added once. Returns false when the chain is
+//	too long for the engine.
 //---------------------------------------------------------------------
 
-static void
-MatchAll (CMMMatchPtr pMatchInfo)
+static Boolean
+AddChainSpace (OSType* spaces, UInt32* count, OSType space)
 {
-	UInt32				r,c;
-	UInt16				chan[4];
-	UInt8**				sBuf;
-	UInt8**				dBuf;
+	if (*count > 0 && spaces[*count-1] == space)
+		return true;
 	
-	sBuf = pMatchInfo->srcBuf;
-	dBuf = pMatchInfo->dstBuf;
+	if (*count == kEngineMaxVia + 2)
+		return false;
 	
-	for (r=0; r < pMatchInfo->height; r++)
-	{
-		for (c=0; c < pMatchInfo->width; c++)
-		{
-			// read color in from source buffer
-			if (pMatchInfo->srcChanBits==16)
-			{
-				if (sBuf[0]) chan[0] = *(UInt16*)(sBuf[0] + (r * pMatchInfo->srcRowBytes) + (c * pMatchInfo->srcColBytes));
-				if (sBuf[1]) chan[1] = *(UInt16*)(sBuf[1] + (r * pMatchInfo->srcRowBytes) + (c * pMatchInfo->srcColBytes));
-				if (sBuf[2]) chan[2] = *(UInt16*)(sBuf[2] + (r * pMatchInfo->srcRowBytes) + (c * pMatchInfo->srcColBytes));
-				if (sBuf[3]) chan[3] = *(UInt16*)(sBuf[3] + (r * pMatchInfo->srcRowBytes) + (c * pMatchInfo->srcColBytes));
-			}
-			else
-			{
-				if (sBuf[0]) chan[0] = *(UInt8*)(sBuf[0] + (r * pMatchInfo->srcRowBytes) + (c * pMatchInfo->srcColBytes));
-				if (sBuf[1]) chan[1] = *(UInt8*)(sBuf[1] + (r * pMatchInfo->srcRowBytes) + (c * pMatchInfo->srcColBytes));
-				if (sBuf[2]) chan[2] = *(UInt8*)(sBuf[2] + (r * pMatchInfo->srcRowBytes) + (c * pMatchInfo->srcColBytes));
-				if (sBuf[3]) chan[3] = *(UInt8*)(sBuf[3] + (r * pMatchInfo->srcRowBytes) + (c * pMatchInfo->srcColBytes));
-				chan[0] = (chan[0] << 8) | chan[0];
-				chan[1] = (chan[1] << 8) | chan[1];
-				chan[2] = (chan[2] << 8) | chan[2];
-				chan[3] = (chan[3] << 8) | chan[3];
-			}
-			
-			if (pMatchInfo->srcSwap)
-			{
-				chan[0] = Endian16_Swap(chan[0]);
-				chan[1] = Endian16_Swap(chan[1]);
-				chan[2] = Endian16_Swap(chan[2]);
-				chan[3] = Endian16_Swap(chan[3]);
-			}
-
-#if DO_DEBUGCOLOR
-			DebugColor4(chan);
-#endif			
-			// Match the color
-			if ((**(pMatchInfo->storage)).proc)
-				((**(pMatchInfo->storage)).proc)(chan);
-
-#if DO_DEBUGCOLOR
-			DebugColor4(chan);
-#endif
-			
-			if (pMatchInfo->dstSwap)
-			{
-				chan[0] = Endian16_Swap(chan[0]);
-				chan[1] = Endian16_Swap(chan[1]);
-				chan[2] = Endian16_Swap(chan[2]);
-				chan[3] = Endian16_Swap(chan[3]);
-			}
-			
-			// Write color to destination buffer
-			if (pMatchInfo->dstChanBits==16)
-			{
-				if (dBuf[0]) *(UInt16*)(dBuf[0] + (r * pMatchInfo->dstRowBytes) + (c * pMatchInfo->dstColBytes)) = chan[0];
-				if (dBuf[1]) *(UInt16*)(dBuf[1] + (r * pMatchInfo->dstRowBytes) + (c * pMatchInfo->dstColBytes)) = chan[1];
-				if (dBuf[2]) *(UInt16*)(dBuf[2] + (r * pMatchInfo->dstRowBytes) + (c * pMatchInfo->dstColBytes)) = chan[2];
-				if (dBuf[3]) *(UInt16*)(dBuf[3] + (r * pMatchInfo->dstRowBytes) + (c * pMatchInfo->dstColBytes)) = chan[3];
-			}
-			else
-			{
-				if (dBuf[0]) *(UInt8*)(dBuf[0] + (r * pMatchInfo->dstRowBytes) + (c * pMatchInfo->dstColBytes)) = chan[0] >> 8;
-				if (dBuf[1]) *(UInt8*)(dBuf[1] + (r * pMatchInfo->dstRowBytes) + (c * pMatchInfo->dstColBytes)) = chan[1] >> 8;
-				if (dBuf[2]) *(UInt8*)(dBuf[2] + (r * pMatchInfo->dstRowBytes) + (c * pMatchInfo->dstColBytes)) = chan[2] >> 8;
-				if (dBuf[3]) *(UInt8*)(dBuf[3] + (r * pMatchInfo->dstRowBytes) + (c * pMatchInfo->dstColBytes)) = chan[3] >> 8;
-			}
-		}
-	}
-}
-
-
-//---------------------------------------------------------------------					
-//	Simple conversions of one color with 16 bits-per-channel.
-//---------------------------------------------------------------------
-
-
-static void
-MatchOne_RGB_CMYK (UInt16* chan)
-{
-	chan[0] = 0xFFFF - chan[0];
-	chan[1] = 0xFFFF - chan[1];
-	chan[2] = 0xFFFF - chan[2];
-	chan[3] = (chan[0] < chan[1]) ?
-				( (chan[0] < chan[2]) ? (chan[0]) : (chan[2]) ) :
-				( (chan[1] < chan[2]) ? (chan[1]) : (chan[2]) );
-	chan[0] -= chan[3];
-	chan[1] -= chan[3];
-	chan[2] -= chan[3];
+	spaces[(*count)++] = space;
+	return true;
 }
 
-static void
-MatchOne_CMYK_RGB (UInt16* chan)
-{
-	chan[0] = 0xFFFF - chan[0];
-	chan[1] = 0xFFFF - chan[1];
-	chan[2] = 0xFFFF - chan[2];
-	chan[0] = (chan[0] > chan[3]) ? (chan[0] - chan[3]) : 0;
-	chan[1] = (chan[1] > chan[3]) ? (chan[1] - chan[3]) : 0;
-	chan[2] = (chan[2] > chan[3]) ? (chan[2] - chan[3]) : 0;
-	chan[3] = 0;
-}
 
-#define DoubToUInt16(x)		(((x)<=0.0)?(0):(((x)>=1.0)?(65535):((x)*65535.0 + 0.5)))
-#define UInt16ToDoub(x)		((double)(x)/65535.0)
-#define DoubToFract(x)		(((x)<=0.0)?(0):(((x)>=2.0)?(65535):((x)*32768.0 + 0.5)))
-#define FractToDoub(x)		((double)(x)/32768.0)
-#define UInt16ToFract(x)	((x)>>1)
-#define FractToUInt16(x)	((x)<<1)
+//--------------------------------------------------------------------- SetChainSpaces
 
 static void
-MatchOne_RGB_XYZ (UInt16* chan)
+SetChainSpaces (EngineTransformKey* key, const OSType* spaces, UInt32 count)
 {
-	double r,g,b;
-	double X,Y,Z;
-	
-	r = UInt16ToDoub(chan[0]);
-	g = UInt16ToDoub(chan[1]);
-	b = UInt16ToDoub(chan[2]);
+	UInt32				i;
 	
-	// map through 2.2 gamma
-	// r = pow( r, 2.2)
-	// g = pow( g, 2.2)
-	// b = pow( b, 2.2)
-	
-	// sRGB phosphors matrix
-	X = (0.418 * r) + (0.363 * g) + (0.183 * b);
-	Y = (0.213 * r) + (0.715 * g) + (0.072 * b);
-	Z = (0.015 * r) + (0.090 * g) + (0.720 * b);
-	
-	chan[0] = DoubToFract(X);
-	chan[1] = DoubToFract(Y);
-	chan[2] = DoubToFract(Z);
+	key->srcSpace = spaces[0];
+	key->dstSpace = spaces[count-1];
+	key->viaCount = (count > 2) ? count - 2 : 0;
+	for (i=0; i < key->viaCount; i++)
+		key->via[i] = spaces[i+1];
 }
 
-static void
-MatchOne_XYZ_RGB (UInt16* chan)
-{
-	double r,g,b;
-	double X,Y,Z;
-	
-	X = FractToDoub(chan[0]);
-	Y = FractToDoub(chan[1]);
-	Z = FractToDoub(chan[2]);
-	
-	// sRGB phosphors inverse matrix
-	r = ( 3.202 * X) + (-1.543 * Y) + (-0.660 * Z);
-	g = (-0.959 * X) + ( 1.879 * Y) + ( 0.056 * Z);
-	b = ( 0.053 * X) + (-0.203 * Y) + ( 1.396 * Z);
-	
-	// map through inverse of 2.2 gamma
-	// r = pow( r, 1.0 / 2.2)
-	// g = pow( g, 1.0 / 2.2)
-	// b = pow( b, 1.0 / 2.2)
-	
-	chan[0] = DoubToUInt16(r);
-	chan[1] = DoubToUInt16(g);
-	chan[2] = DoubToUInt16(b);
-}
-
-static void
-MatchOne_RGB_LAB (UInt16* chan)
-{
-	MatchOne_RGB_XYZ(chan);
-	MatchOne_XYZ_LAB(chan);
-}
-
-static void
-MatchOne_LAB_RGB (UInt16* chan)
-{
-	MatchOne_LAB_XYZ(chan);
-	MatchOne_XYZ_RGB(chan);
-}
 
-static void
-MatchOne_XYZ_LAB (UInt16* chan)
-{
-#if 0
-	CMXYZColor white;
-	white.X = 31594;
-	white.Y = 32768;
-	white.Z = 27030;
-	CMConvertXYZToLab( (CMColor*)chan, &white, (CMColor*)chan,1);
-#else
-	double				X, Y, Z;
-	double				L, a, b;
-	double				fx, fy, fz;
-
-	X = FractToDoub(chan[0]);
-	Y = FractToDoub(chan[1]);
-	Z = FractToDoub(chan[2]);
-	
-	// Assume XYZ white is D50
-	X /= 0.9642;
-	Z /= 0.8249;
-
-	if (X > 0.008856)
-		fx = pow(X, 0.3333);
-	else
-		fx = 7.787 * X + 16.0 / 116.0;
-	
-	if (Y > 0.008856)
-		fy = pow(Y, 0.3333);
-	else
-		fy = 7.787 * Y + 16.0 / 116.0;
-	
-	if (Z > 0.008856)
-		fz = pow(Z, 0.3333);
-	else
-		fz = 7.787 * Z + 16.0 / 116.0;
-
-	L = 116.0 * fy - 16;
-	a = 500.0 * (fx - fy);
-	b = 200.0 * (fy - fz);
-	
-	L = L / 100.0;
-	a = (a + 128.0) / 256.0;
-	b = (b + 128.0) / 256.0;
-	
-	chan[0] = DoubToUInt16(L);
-	chan[1] = DoubToUInt16(a);
-	chan[2] = DoubToUInt16(b);
-#endif
-}
+//--------------------------------------------------------------------- LayoutForSpace
 
-static void
-MatchOne_LAB_XYZ (UInt16* chan)
+static Boolean
+LayoutForSpace (UInt32 space, EngineLayout* layout)
 {
-#if 0
-	CMXYZColor white;
-	white.X = 31594;
-	white.Y = 32768;
-	white.Z = 27030;
-	CMConvertLabToXYZ( (CMColor*)chan, &white, (CMColor*)chan,1);
-#else
-	double				X, Y, Z;
-	double				L, a, b;
-	double				fx, fy, fz;
-
-	L = UInt16ToDoub(chan[0]) * 100.0;
-	a = UInt16ToDoub(chan[1]) * 256.0 - 128.0;
-	b = UInt16ToDoub(chan[2]) * 256.0 - 128.0;
-	
-	fy = (L + 16.0) / 116.0;
-	fx = a / 500.0 + fy;
-	fz = fy - b / 200.0;
-	
-	if (fx > 0.20696) 
-		X = pow(fx, 3);
-	else
-		X = (fx - 16.0 / 116.0) / 7.787;
-	
-	if (fy > 0.20696) 
-		Y = pow(fy, 3);
-	else
-		Y = (fy - 16.0 / 116.0) / 7.787;
-	
-	if (fz > 0.20696) 
-		Z = pow(fz, 3);
-	else
-		Z = (fz - 16.0 / 116.0) / 7.787;
+	switch (space)
+	{
+		case cmGray8Space:		*layout = kEngineGray8;		break;
+		case cmGray16Space:		*layout = kEngineGray16;	break;
+		case cmGray16LSpace:	*layout = kEngineGray16L;	break;
+		case cmRGB24Space:		*layout = kEngineRGB24;		break;
+		case cmRGB32Space:		*layout = kEngineRGB32;		break;
+		case cmRGB48Space:		*layout = kEngineRGB48;		break;
+		case cmRGB48LSpace:		*layout = kEngineRGB48L;	break;
+		case cmRGB16Space:		*layout = kEngineRGB555;	break;
+		case cmRGB16LSpace:		*layout = kEngineRGB555L;	break;
+		case cmRGB565Space:		*layout = kEngineRGB565;	break;
+		case cmRGB565LSpace:	*layout = kEngineRGB565L;	break;
+		case cmRGB101010Space:	*layout = kEngineRGB101010;	break;
+		case cmARGB32Space:		*layout = kEngineARGB32;	break;
+		case cmRGBA32Space:		*layout = kEngineRGBA32;	break;
+		case cmARGB64Space:		*layout = kEngineARGB64;	break;
+		case cmARGB64LSpace:	*layout = kEngineARGB64L;	break;
+		case cmRGBA64Space:		*layout = kEngineRGBA64;	break;
+		case cmRGBA64LSpace:	*layout = kEngineRGBA64L;	break;
+		case cmARGB32PmulSpace:	*layout = kEngineARGB32Pmul;	break;
+		case cmRGBA32PmulSpace:	*layout = kEngineRGBA32Pmul;	break;
+		case cmARGB64PmulSpace:	*layout = kEngineARGB64Pmul;	break;
+		case cmARGB64LPmulSpace:	*layout = kEngineARGB64LPmul;	break;
+		case cmRGBA64PmulSpace:	*layout = kEngineRGBA64Pmul;	break;
+		case cmRGBA64LPmulSpace:	*layout = kEngineRGBA64LPmul;	break;
+		case cmCMYK32Space:		*layout = kEngineCMYK32;	break;
+		case cmCMYK64Space:		*layout = kEngineCMYK64;	break;
+		case cmCMYK64LSpace:	*layout = kEngineCMYK64L;	break;
+		case cmLAB24Space:		*layout = kEngineLAB24;		break;
+		case cmLAB48Space:		*layout = kEngineLAB48;		break;
+		case cmLAB48LSpace:		*layout = kEngineLAB48L;	break;
+		case cmXYZ24Space:		*layout = kEngineXYZ24;		break;
+		case cmXYZ48Space:		*layout = kEngineXYZ48;		break;
+		case cmXYZ48LSpace:		*layout = kEngineXYZ48L;	break;
+		case cmGraySpace + kDemoFloatPacking:	*layout = kEngineGrayFloat;	break;
+		case cmGraySpace + kDemoHalfPacking:	*layout = kEngineGrayHalf;	break;
+		case cmRGBSpace + kDemoFloatPacking:	*layout = kEngineRGBFloat;	break;
+		case cmRGBSpace + kDemoHalfPacking:		*layout = kEngineRGBHalf;	break;
+		case cmCMYKSpace + kDemoFloatPacking:	*layout = kEngineCMYKFloat;	break;
+		case cmCMYKSpace + kDemoHalfPacking:	*layout = kEngineCMYKHalf;	break;
+		case cmLABSpace + kDemoFloatPacking:	*layout = kEngineLABFloat;	break;
+		case cmLABSpace + kDemoHalfPacking:		*layout = kEngineLABHalf;	break;
+		case cmXYZSpace + kDemoFloatPacking:	*layout = kEngineXYZFloat;	break;
+		case cmXYZSpace + kDemoHalfPacking:		*layout = kEngineXYZHalf;	break;
+		default:				return false;
+	}
 	
-	X *= 0.9642;
-	Z *= 0.8249;
-
-	chan[0] = DoubToFract(X);
-	chan[1] = DoubToFract(Y);
-	chan[2] = DoubToFract(Z);
-#endif
-}
-
-static void
-MatchOne_CMYK_LAB (UInt16* chan)
-{
-	MatchOne_CMYK_RGB(chan);
-	MatchOne_RGB_LAB(chan);
+	return true;
 }
 
-static void
-MatchOne_LAB_CMYK (UInt16* chan)
-{
-	MatchOne_LAB_RGB(chan);
-	MatchOne_RGB_CMYK(chan);
-}
 
-static void
-MatchOne_CMYK_XYZ (UInt16* chan)
-{
-	MatchOne_CMYK_RGB(chan);
-	MatchOne_RGB_XYZ(chan);
-}
+//--------------------------------------------------------------------- EngineToCMError
 
-static void
-MatchOne_XYZ_CMYK (UInt16* chan)
-{
-	MatchOne_XYZ_RGB(chan);
-	MatchOne_RGB_CMYK(chan);
-}
-
-static void
-MatchOne_RGB_Gray (UInt16* chan)
-{
-	UInt16 alpha;
-	alpha = chan[3]; // preserve alpha
-	MatchOne_RGB_XYZ(chan);
-	MatchOne_XYZ_Gray(chan);
-	chan[1] = alpha; // preserve alpha
-}
-
-static void
-MatchOne_Gray_RGB (UInt16* chan)
+static CMError
+EngineToCMError (EngineError err)
 {
-	chan[3] = chan[1]; // preserve alpha
-	chan[1] = chan[2] = chan[0];
+	switch (err)
+	{
+		case kEngineNoErr:				return noErr;
+		case kEngineMemFullErr:			return memFullErr;
+		case kEngineUnsupportedErr:		return cmInvalidProfile;
+		case kEngineInvalidSrcMapErr:	return cmInvalidSrcMap;
+		case kEngineInvalidDstMapErr:	return cmInvalidDstMap;
+		case kEngineCanceledErr:		return userCanceledErr;
+		default:						return paramErr;
+	}
 }
 
-static void
-MatchOne_LAB_Gray (UInt16* chan)
-{
-#pragma unused (chan)
-	// nothing to do gray = L
-}
 
-static void
-MatchOne_Gray_LAB (UInt16* chan)
-{
-	chan[1] = chan[2] = 0;
-}
+//--------------------------------------------------------------------- PublishTransform
+//	Makes xform the transform of the component, retaining it, and releases
+//	the previous one. The swap is a full barrier, so a thread that reads
+//	the new pointer also sees the finished transform. An init may not run
+//	while another thread is matching through the same component instance.
+//---------------------------------------------------------------------
 
 static void
-MatchOne_CMYK_Gray (UInt16* chan)
+PublishTransform (CMMStorageHdl storage, EngineTransformRef xform)
 {
-	MatchOne_CMYK_XYZ(chan);
-	MatchOne_XYZ_Gray(chan);
+	EngineTransformRef		old;
+	
+	EngineRetainTransform(xform);
+	do
+		old = (**storage).transform;
+	while (!__sync_bool_compare_and_swap(&(**storage).transform, old, xform));
+	EngineReleaseTransform(old);
 }
 
-static void
-MatchOne_Gray_CMYK (UInt16* chan)
-{
-	chan[3] = chan[0]; // K = gray
-	chan[0] = chan[1] = chan[2] = 0; // CMY = 0
-}
 
-static void
-MatchOne_XYZ_Gray (UInt16* chan)
-{
-	chan[0] = FractToUInt16(chan[1]); // gray = Y
-}
+//--------------------------------------------------------------------- CurrentTransform
 
-static void
-MatchOne_Gray_XYZ (UInt16* chan)
+static EngineTransformRef
+CurrentTransform (CMMStorageHdl storage)
 {
-	double X,Y,Z;
-	
-	Y = UInt16ToDoub(chan[0]);
-	X = Y * 0.96417;
-	Z = Y * 0.82489;
+	EngineTransformRef		xform = (**storage).transform;
 	
-	chan[0] = DoubToFract(X);
-	chan[1] = DoubToFract(Y);
-	chan[2] = DoubToFract(Z);
+	__sync_synchronize();
+	return xform;
 }
 
@@ -0,0 +1,90 @@
+/*
+	File:		DemoCMMAccuracy.c
+
+	Contains:	Accuracy check of the Demo CMM engine.
+
+				Runs EngineCheckAccuracy at every quality and precision, so
+				every conversion of each arithmetic is compared against the
+				exact procs and the bounds published in DemoCMMEngine.h,
+				dE*ab to Lab included. Needs nothing but the engine:
+
+					cc -O2 -o DemoCMMAccuracy DemoCMMAccuracy.c DemoCMMEngine.c -lm -lpthread
+
+				Prints the largest error of every conversion on stderr and
+				one line per quality and precision on stdout, and exits 1
+				if any conversion exceeds its bound. Options:
+
+					-q quality		0 normal, 1 draft, 2 best; all three by default
+					-p precision	0 default, 1 exact, 2 float, 3 fixed; all four
+									by default
+
+	Version:	ColorSync 2 or later
+
+	Copyright:	2002 by Apple Computer, Inc., all rights reserved.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DemoCMMEngine.h"
+
+
+static const char*		gQualityNames[] = { "normal", "draft", "best" };
+static const char*		gPrecisionNames[] = { "default", "exact", "float", "fixed" };
+
+
+//--------------------------------------------------------------------- main
+
+int
+main (int argc, char** argv)
+{
+	uint32_t		firstQuality = kEngineNormalMode;
+	uint32_t		lastQuality = kEngineBestMode;
+	uint32_t		firstPrecision = kEnginePrecisionDefault;
+	uint32_t		lastPrecision = kEnginePrecisionFixed;
+	uint32_t		quality, precision;
+	int				failures, total = 0;
+	int				i;
+	
+	for (i=1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+			firstQuality = lastQuality = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			firstPrecision = lastPrecision = (uint32_t)atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: %s [-q quality] [-p precision]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	if (lastQuality > kEngineBestMode)
+	{
+		fprintf(stderr, "%s: quality must be 0, 1 or 2\n", argv[0]);
+		return 1;
+	}
+	
+	if (lastPrecision > kEnginePrecisionFixed)
+	{
+		fprintf(stderr, "%s: precision must be 0, 1, 2 or 3\n", argv[0]);
+		return 1;
+	}
+	
+	for (quality=firstQuality; quality <= lastQuality; quality++)
+	{
+		for (precision=firstPrecision; precision <= lastPrecision; precision++)
+		{
+			fprintf(stderr, "quality %s, precision %s\n", gQualityNames[quality], gPrecisionNames[precision]);
+			failures = EngineCheckAccuracy(quality, precision);
+			printf("%-8s %-8s %s\n", gQualityNames[quality], gPrecisionNames[precision],
+				   failures ? "exceeds bounds" : "ok");
+			fflush(stdout);
+			total += failures;
+		}
+	}
+	
+	return total ? 1 : 0;
+}
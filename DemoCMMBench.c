@@ -0,0 +1,710 @@
+/*
+	File:		DemoCMMBench.c
+
+	Contains:	Throughput benchmark for the Demo CMM engine.
+
+				Times every conversion the engine supports, plus the identity
+				match of each space, on lists of colors and on bitmaps in every
+				engine layout, at sizes from a few colors up to 100 megapixels
+				and more. Needs nothing but the engine, so it builds on any
+				system with a C compiler and POSIX threads:
+
+					cc -O2 -o DemoCMMBench DemoCMMBench.c DemoCMMEngine.c -lm -lpthread
+
+				Prints one comma separated line per case, after a header line:
+
+					kind,src,dst,quality,precision,srcLayout,dstLayout,width,height,
+					pixels,iterations,seconds,MPps,nsPerPixel,bytesPerSecond
+
+				kind is "colors" for EngineMatchColors, "layouts" for the sweep
+				over every pair of bitmap layouts at one size, "sizes" for the
+				sweep over bitmap sizes in the 8 bit layouts, "check" for
+				EngineCheckBitmap from the 8 bit layouts at one size,
+				"indexed" for Indexed8 bitmaps of 256 colors matched into the
+				8 bit layouts at one size, and "planar" for EngineMatchPlanar
+				between the 8 bit layouts with a plane per channel.
+				bytesPerSecond counts the source and destination bytes touched.
+				Options:
+
+					-q quality		0 normal, 1 draft, 2 best; all three by default
+					-p precision	0 default, 1 exact, 2 float, 3 fixed
+					-m megapixels	largest bitmap of the size sweep, 128 by default
+					-t seconds		least time spent on each case, 0.2 by default
+					-k kind			run only "colors", "layouts", "sizes", "check", "indexed"
+									or "planar"
+
+	Version:	ColorSync 2 or later
+
+	Copyright:	2002 by Apple Computer, Inc., all rights reserved.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "DemoCMMEngine.h"
+
+
+// Every layout of whole pixels, those before Gamut1, in EngineLayout
+// order, filled in by main
+#define		kBenchLayoutCount	((uint32_t)kEngineGamut1)
+static EngineLayoutInfo	gBenchLayouts[kBenchLayoutCount];
+
+static const uint32_t	gSpaces[] =
+{
+	kEngineRGBData, kEngineCMYKData, kEngineLabData, kEngineXYZData, kEngineGrayData
+};
+
+#define		kSpaceCount			(sizeof(gSpaces) / sizeof(gSpaces[0]))
+
+// Color counts of the EngineMatchColors sweep
+static const uint32_t	gColorCounts[] = { 1, 4, 16, 256, 4096, 65536 };
+
+// Square bitmap sides of the size sweep, the last is 104.9 megapixels
+static const uint32_t	gSides[] = { 4, 64, 256, 1024, 4096, 10240 };
+
+// Side of the bitmaps of the layout sweep
+#define		kLayoutSweepSide	1024
+
+// Precision of every transform, set with -p
+static uint32_t			gPrecision = kEnginePrecisionDefault;
+
+// Kinds of case -k may choose
+static const char*		gKinds[] = { "colors", "layouts", "sizes", "check", "indexed", "planar" };
+
+
+// function prototypes
+static double	Now				(void);
+static void		FillRandom		(void* buf, size_t bytes);
+static void		FillRandomFloat	(void* buf, size_t bytes, uint32_t floatBytes);
+static const char* SpaceName	(uint32_t space, char* name);
+static EngineLayout Layout8		(uint32_t space);
+static int		NewTransform	(uint32_t srcSpace, uint32_t dstSpace, uint32_t quality, EngineTransformRef* xform);
+static void		Report			(const char* kind, uint32_t srcSpace, uint32_t dstSpace, uint32_t quality,
+								 const char* srcLayout, const char* dstLayout, uint32_t width, uint32_t height,
+								 uint32_t bytesPerPixel, uint32_t iterations, double seconds);
+static void		BenchColors		(uint32_t quality, double minTime);
+static void		BenchBitmap		(const char* kind, EngineTransformRef xform, uint32_t quality,
+								 EngineLayout srcLayout, EngineLayout dstLayout, uint32_t width, uint32_t height, double minTime);
+static void		BenchLayouts	(uint32_t quality, double minTime);
+static void		BenchSizes		(uint32_t quality, double maxMegapixels, double minTime);
+static void		BenchCheck		(uint32_t quality, double minTime);
+static void		BenchIndexed	(uint32_t quality, double minTime);
+static void		BenchPlanar		(uint32_t quality, double minTime);
+
+
+//--------------------------------------------------------------------- main
+
+int
+main (int argc, char** argv)
+{
+	uint32_t		firstQuality = kEngineNormalMode;
+	uint32_t		lastQuality = kEngineBestMode;
+	uint32_t		quality;
+	double			maxMegapixels = 128.0;
+	double			minTime = 0.2;
+	const char*		kind = NULL;
+	size_t			k;
+	int				i;
+	
+	for (i=1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+			firstQuality = lastQuality = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			gPrecision = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			maxMegapixels = atof(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			minTime = atof(argv[++i]);
+		else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+			kind = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: %s [-q quality] [-p precision] [-m megapixels] [-t seconds] [-k colors|layouts|sizes|check|indexed|planar]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	if (lastQuality > kEngineBestMode)
+	{
+		fprintf(stderr, "%s: quality must be 0, 1 or 2\n", argv[0]);
+		return 1;
+	}
+	
+	if (gPrecision > kEnginePrecisionFixed)
+	{
+		fprintf(stderr, "%s: precision must be 0, 1, 2 or 3\n", argv[0]);
+		return 1;
+	}
+	
+	for (k=0; kind != NULL && k < sizeof(gKinds) / sizeof(gKinds[0]); k++)
+		if (strcmp(kind, gKinds[k]) == 0)
+			break;
+	if (k == sizeof(gKinds) / sizeof(gKinds[0]))
+	{
+		fprintf(stderr, "%s: unknown kind %s\n", argv[0], kind);
+		return 1;
+	}
+	
+	for (k=0; k < kBenchLayoutCount; k++)
+		EngineGetLayoutInfo((EngineLayout)k, &gBenchLayouts[k]);
+	
+	printf("kind,src,dst,quality,precision,srcLayout,dstLayout,width,height,"
+		   "pixels,iterations,seconds,MPps,nsPerPixel,bytesPerSecond\n");
+	
+	for (quality=firstQuality; quality <= lastQuality; quality++)
+	{
+		if (kind == NULL || strcmp(kind, "colors") == 0)
+			BenchColors(quality, minTime);
+		if (kind == NULL || strcmp(kind, "layouts") == 0)
+			BenchLayouts(quality, minTime);
+		if (kind == NULL || strcmp(kind, "sizes") == 0)
+			BenchSizes(quality, maxMegapixels, minTime);
+		if (kind == NULL || strcmp(kind, "check") == 0)
+			BenchCheck(quality, minTime);
+		if (kind == NULL || strcmp(kind, "indexed") == 0)
+			BenchIndexed(quality, minTime);
+		if (kind == NULL || strcmp(kind, "planar") == 0)
+			BenchPlanar(quality, minTime);
+	}
+	
+	return 0;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- benchmarks -----
+#endif
+
+
+//--------------------------------------------------------------------- BenchColors
+//	Matches lists of 16 bit colors in place, as CMMMatchColors does. The
+//	colors are refilled before every pass so the grid and the fast
+//	kernels never see their own output.
+//---------------------------------------------------------------------
+
+static void
+BenchColors (uint32_t quality, double minTime)
+{
+	EngineTransformRef	xform;
+	uint16_t*			colors;
+	uint16_t*			source;
+	uint32_t			s, d, n, count, iterations;
+	double				start, seconds;
+	size_t				bytes;
+	
+	bytes = gColorCounts[sizeof(gColorCounts) / sizeof(gColorCounts[0]) - 1] * 4 * sizeof(uint16_t);
+	colors = (uint16_t*)malloc(bytes);
+	source = (uint16_t*)malloc(bytes);
+	if (colors == NULL || source == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	FillRandom(source, bytes);
+	
+	for (s=0; s < kSpaceCount; s++)
+	{
+		for (d=0; d < kSpaceCount; d++)
+		{
+			if (NewTransform(gSpaces[s], gSpaces[d], quality, &xform) != 0)
+				continue;
+			
+			for (n=0; n < sizeof(gColorCounts) / sizeof(gColorCounts[0]); n++)
+			{
+				count = gColorCounts[n];
+				iterations = 0;
+				seconds = 0.0;
+				do
+				{
+					memcpy(colors, source, count * 4 * sizeof(uint16_t));
+					start = Now();
+					EngineMatchColors(xform, colors, count, 4 * sizeof(uint16_t));
+					seconds += Now() - start;
+					iterations++;
+				} while (seconds < minTime);
+				
+				Report("colors", gSpaces[s], gSpaces[d], quality, "CMColor", "CMColor",
+					   count, 1, 2 * 4 * sizeof(uint16_t), iterations, seconds);
+			}
+			
+			EngineReleaseTransform(xform);
+		}
+	}
+	
+	free(source);
+	free(colors);
+}
+
+
+//--------------------------------------------------------------------- BenchLayouts
+//	Every pair of source and destination layouts, which covers all
+//	conversions, the identity of each space and all the 8 and 16 bit,
+//	big and little endian, word and float row kernels.
+//---------------------------------------------------------------------
+
+static void
+BenchLayouts (uint32_t quality, double minTime)
+{
+	EngineTransformRef	xform;
+	uint32_t			s, d;
+	
+	for (s=0; s < kBenchLayoutCount; s++)
+	{
+		for (d=0; d < kBenchLayoutCount; d++)
+		{
+			if (NewTransform(gBenchLayouts[s].space, gBenchLayouts[d].space, quality, &xform) != 0)
+				continue;
+			
+			BenchBitmap("layouts", xform, quality, (EngineLayout)s, (EngineLayout)d,
+						kLayoutSweepSide, kLayoutSweepSide, minTime);
+			
+			EngineReleaseTransform(xform);
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------- BenchSizes
+//	Every conversion and identity in the 8 bit layouts, on square bitmaps
+//	from a handful of pixels up to maxMegapixels.
+//---------------------------------------------------------------------
+
+static void
+BenchSizes (uint32_t quality, double maxMegapixels, double minTime)
+{
+	EngineTransformRef	xform;
+	uint32_t			s, d, n;
+	
+	for (s=0; s < kSpaceCount; s++)
+	{
+		for (d=0; d < kSpaceCount; d++)
+		{
+			if (NewTransform(gSpaces[s], gSpaces[d], quality, &xform) != 0)
+				continue;
+			
+			for (n=0; n < sizeof(gSides) / sizeof(gSides[0]); n++)
+			{
+				if ((double)gSides[n] * gSides[n] > maxMegapixels * 1e6)
+					break;
+				BenchBitmap("sizes", xform, quality, Layout8(gSpaces[s]), Layout8(gSpaces[d]),
+							gSides[n], gSides[n], minTime);
+			}
+			
+			EngineReleaseTransform(xform);
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------- BenchCheck
+//	Every conversion and identity checked from the 8 bit layouts into a
+//	Gamut1 bitmap, to compare with the same conversion in the sizes sweep.
+//---------------------------------------------------------------------
+
+static void
+BenchCheck (uint32_t quality, double minTime)
+{
+	const EngineLayoutInfo*	src;
+	EngineTransformRef		xform;
+	EngineBitmap			srcMap, chkMap;
+	uint32_t				s, d, iterations;
+	double					start, seconds;
+	EngineError				err;
+	
+	for (s=0; s < kSpaceCount; s++)
+	{
+		src = &gBenchLayouts[Layout8(gSpaces[s])];
+		
+		srcMap.width	= chkMap.width	= kLayoutSweepSide;
+		srcMap.height	= chkMap.height	= kLayoutSweepSide;
+		srcMap.rowBytes	= kLayoutSweepSide * src->pixelBytes;
+		chkMap.rowBytes	= kLayoutSweepSide / 8;
+		srcMap.layout	= Layout8(gSpaces[s]);
+		chkMap.layout	= kEngineGamut1;
+		srcMap.image	= malloc((size_t)srcMap.rowBytes * kLayoutSweepSide);
+		chkMap.image	= malloc((size_t)chkMap.rowBytes * kLayoutSweepSide);
+		if (srcMap.image == NULL || chkMap.image == NULL)
+		{
+			fprintf(stderr, "out of memory for check\n");
+			exit(1);
+		}
+		FillRandom(srcMap.image, (size_t)srcMap.rowBytes * kLayoutSweepSide);
+		
+		for (d=0; d < kSpaceCount; d++)
+		{
+			if (NewTransform(gSpaces[s], gSpaces[d], quality, &xform) != 0)
+				continue;
+			
+			iterations = 0;
+			start = Now();
+			do
+			{
+				err = EngineCheckBitmap(xform, &srcMap, &chkMap, NULL, NULL);
+				if (err != kEngineNoErr)
+				{
+					fprintf(stderr, "check %s failed with %d\n", src->name, (int)err);
+					break;
+				}
+				iterations++;
+				seconds = Now() - start;
+			} while (seconds < minTime);
+			
+			if (iterations)
+				Report("check", gSpaces[s], gSpaces[d], quality, src->name, "Gamut1",
+					   kLayoutSweepSide, kLayoutSweepSide, src->pixelBytes, iterations, seconds);
+			
+			EngineReleaseTransform(xform);
+		}
+		
+		free(srcMap.image);
+		free(chkMap.image);
+	}
+}
+
+
+//--------------------------------------------------------------------- BenchIndexed
+//	Random indexes into a table of 256 random colors of each space, matched
+//	into the 8 bit layout of every space, to compare with the sizes sweep.
+//---------------------------------------------------------------------
+
+static void
+BenchIndexed (uint32_t quality, double minTime)
+{
+	const EngineLayoutInfo*	dst;
+	EngineTransformRef		xform;
+	EngineBitmap			srcMap, dstMap;
+	uint16_t				colors[256 * 4];
+	uint32_t				s, d, iterations;
+	double					start, seconds;
+	EngineError				err;
+	
+	FillRandom(colors, sizeof(colors));
+	
+	srcMap.width		= kLayoutSweepSide;
+	srcMap.height		= kLayoutSweepSide;
+	srcMap.rowBytes		= kLayoutSweepSide;
+	srcMap.layout		= kEngineIndexed8;
+	srcMap.colors		= colors;
+	srcMap.colorCount	= 256;
+	srcMap.image		= malloc((size_t)srcMap.rowBytes * kLayoutSweepSide);
+	if (srcMap.image == NULL)
+	{
+		fprintf(stderr, "out of memory for indexed\n");
+		exit(1);
+	}
+	FillRandom(srcMap.image, (size_t)srcMap.rowBytes * kLayoutSweepSide);
+	
+	for (d=0; d < kSpaceCount; d++)
+	{
+		dst = &gBenchLayouts[Layout8(gSpaces[d])];
+		
+		dstMap.width	= kLayoutSweepSide;
+		dstMap.height	= kLayoutSweepSide;
+		dstMap.rowBytes	= kLayoutSweepSide * dst->pixelBytes;
+		dstMap.layout	= Layout8(gSpaces[d]);
+		dstMap.image	= malloc((size_t)dstMap.rowBytes * kLayoutSweepSide);
+		if (dstMap.image == NULL)
+		{
+			fprintf(stderr, "out of memory for indexed\n");
+			exit(1);
+		}
+		
+		for (s=0; s < kSpaceCount; s++)
+		{
+			if (NewTransform(gSpaces[s], gSpaces[d], quality, &xform) != 0)
+				continue;
+			
+			iterations = 0;
+			start = Now();
+			do
+			{
+				err = EngineMatchBitmap(xform, &srcMap, &dstMap, NULL, NULL);
+				if (err != kEngineNoErr)
+				{
+					fprintf(stderr, "indexed -> %s failed with %d\n", dst->name, (int)err);
+					break;
+				}
+				iterations++;
+				seconds = Now() - start;
+			} while (seconds < minTime);
+			
+			if (iterations)
+				Report("indexed", gSpaces[s], gSpaces[d], quality, "Indexed8", dst->name,
+					   kLayoutSweepSide, kLayoutSweepSide, 1 + dst->pixelBytes, iterations, seconds);
+			
+			EngineReleaseTransform(xform);
+		}
+		
+		free(dstMap.image);
+	}
+	
+	free(srcMap.image);
+}
+
+
+//--------------------------------------------------------------------- BenchPlanar
+//	Every conversion and identity between the 8 bit layouts with each
+//	channel in a plane of its own, to compare with the same layouts
+//	interleaved in the layouts sweep.
+//---------------------------------------------------------------------
+
+static void
+BenchPlanar (uint32_t quality, double minTime)
+{
+	const EngineLayoutInfo*	src;
+	const EngineLayoutInfo*	dst;
+	EngineTransformRef		xform;
+	EnginePlanarBitmap		srcMap, dstMap;
+	uint8_t*				planes;
+	size_t					planeBytes = (size_t)kLayoutSweepSide * kLayoutSweepSide;
+	uint32_t				s, d, k, iterations;
+	double					start, seconds;
+	EngineError				err;
+	
+	// Four planes on each side, whatever the channels of the space
+	planes = (uint8_t*)malloc(8 * planeBytes);
+	if (planes == NULL)
+	{
+		fprintf(stderr, "out of memory for planar\n");
+		exit(1);
+	}
+	FillRandom(planes, 4 * planeBytes);
+	
+	for (k=0; k < 4; k++)
+	{
+		srcMap.planes[k]	= planes + k * planeBytes;
+		dstMap.planes[k]	= planes + (4 + k) * planeBytes;
+		srcMap.rowBytes[k]	= dstMap.rowBytes[k]	= kLayoutSweepSide;
+		srcMap.colBytes[k]	= dstMap.colBytes[k]	= 1;
+	}
+	srcMap.width	= dstMap.width	= kLayoutSweepSide;
+	srcMap.height	= dstMap.height	= kLayoutSweepSide;
+	
+	for (s=0; s < kSpaceCount; s++)
+	{
+		for (d=0; d < kSpaceCount; d++)
+		{
+			if (NewTransform(gSpaces[s], gSpaces[d], quality, &xform) != 0)
+				continue;
+			
+			srcMap.layout = Layout8(gSpaces[s]);
+			dstMap.layout = Layout8(gSpaces[d]);
+			src = &gBenchLayouts[srcMap.layout];
+			dst = &gBenchLayouts[dstMap.layout];
+			
+			iterations = 0;
+			start = Now();
+			do
+			{
+				err = EngineMatchPlanar(xform, &srcMap, &dstMap, NULL, NULL);
+				if (err != kEngineNoErr)
+				{
+					fprintf(stderr, "planar %s -> %s failed with %d\n", src->name, dst->name, (int)err);
+					break;
+				}
+				iterations++;
+				seconds = Now() - start;
+			} while (seconds < minTime);
+			
+			if (iterations)
+				Report("planar", gSpaces[s], gSpaces[d], quality, src->name, dst->name,
+					   kLayoutSweepSide, kLayoutSweepSide, src->pixelBytes + dst->pixelBytes, iterations, seconds);
+			
+			EngineReleaseTransform(xform);
+		}
+	}
+	
+	free(planes);
+}
+
+
+//--------------------------------------------------------------------- BenchBitmap
+//	Matches a random source bitmap into a separate destination until
+//	minTime has passed, at least once.
+//---------------------------------------------------------------------
+
+static void
+BenchBitmap (const char* kind, EngineTransformRef xform, uint32_t quality,
+			 EngineLayout srcLayout, EngineLayout dstLayout, uint32_t width, uint32_t height, double minTime)
+{
+	const EngineLayoutInfo*	src = &gBenchLayouts[srcLayout];
+	const EngineLayoutInfo*	dst = &gBenchLayouts[dstLayout];
+	EngineBitmap			srcMap, dstMap;
+	uint32_t				iterations = 0;
+	double					start, seconds;
+	EngineError				err;
+	
+	srcMap.width	= dstMap.width	= width;
+	srcMap.height	= dstMap.height	= height;
+	srcMap.rowBytes	= width * src->pixelBytes;
+	dstMap.rowBytes	= width * dst->pixelBytes;
+	srcMap.layout	= srcLayout;
+	dstMap.layout	= dstLayout;
+	srcMap.image	= malloc((size_t)srcMap.rowBytes * height);
+	dstMap.image	= malloc((size_t)dstMap.rowBytes * height);
+	if (srcMap.image == NULL || dstMap.image == NULL)
+	{
+		fprintf(stderr, "out of memory for %s %ux%u\n", kind, width, height);
+		free(srcMap.image);
+		free(dstMap.image);
+		return;
+	}
+	
+	if (src->floating)
+		FillRandomFloat(srcMap.image, (size_t)srcMap.rowBytes * height, src->channelBits / 8);
+	else
+		FillRandom(srcMap.image, (size_t)srcMap.rowBytes * height);
+	memset(dstMap.image, 0, (size_t)dstMap.rowBytes * height);
+	
+	start = Now();
+	do
+	{
+		err = EngineMatchBitmap(xform, &srcMap, &dstMap, NULL, NULL);
+		if (err != kEngineNoErr)
+		{
+			fprintf(stderr, "%s %s -> %s failed with %d\n", kind, src->name, dst->name, (int)err);
+			break;
+		}
+		iterations++;
+		seconds = Now() - start;
+	} while (seconds < minTime);
+	
+	if (iterations)
+		Report(kind, src->space, dst->space, quality, src->name, dst->name,
+			   width, height, src->pixelBytes + dst->pixelBytes, iterations, seconds);
+	
+	free(srcMap.image);
+	free(dstMap.image);
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- utilities -----
+#endif
+
+
+//--------------------------------------------------------------------- Report
+
+static void
+Report (const char* kind, uint32_t srcSpace, uint32_t dstSpace, uint32_t quality,
+		const char* srcLayout, const char* dstLayout, uint32_t width, uint32_t height,
+		uint32_t bytesPerPixel, uint32_t iterations, double seconds)
+{
+	char				srcName[5], dstName[5];
+	double				pixels = (double)width * height * iterations;
+	
+	printf("%s,%s,%s,%u,%u,%s,%s,%u,%u,%.0f,%u,%.6f,%.3f,%.3f,%.0f\n",
+		   kind, SpaceName(srcSpace, srcName), SpaceName(dstSpace, dstName), quality, gPrecision,
+		   srcLayout, dstLayout, width, height, (double)width * height, iterations, seconds,
+		   pixels / seconds / 1e6, seconds * 1e9 / pixels, pixels * bytesPerPixel / seconds);
+	fflush(stdout);
+}
+
+
+//--------------------------------------------------------------------- NewTransform
+
+static int
+NewTransform (uint32_t srcSpace, uint32_t dstSpace, uint32_t quality, EngineTransformRef* xform)
+{
+	EngineTransformKey	key;
+	
+	memset(&key, 0, sizeof(key));
+	key.srcSpace = srcSpace;
+	key.dstSpace = dstSpace;
+	key.srcTransform = kEngineDeviceToPCS;
+	key.dstTransform = kEnginePCSToDevice;
+	key.quality = quality;
+	key.precision = gPrecision;
+	
+	return EngineNewTransform(&key, xform) != kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- Layout8
+
+static EngineLayout
+Layout8 (uint32_t space)
+{
+	switch (space)
+	{
+		case kEngineGrayData:	return kEngineGray8;
+		case kEngineCMYKData:	return kEngineCMYK32;
+		case kEngineLabData:	return kEngineLAB24;
+		case kEngineXYZData:	return kEngineXYZ24;
+		default:				return kEngineRGB24;
+	}
+}
+
+
+//--------------------------------------------------------------------- SpaceName
+
+static const char*
+SpaceName (uint32_t space, char* name)
+{
+	int					i, n = 0;
+	
+	for (i=24; i >= 0; i -= 8)
+	{
+		if ((char)(space >> i) != ' ')
+			name[n++] = (char)(space >> i);
+	}
+	name[n] = 0;
+	return name;
+}
+
+
+//--------------------------------------------------------------------- FillRandom
+
+static void
+FillRandom (void* buf, size_t bytes)
+{
+	uint8_t*			p = (uint8_t*)buf;
+	uint32_t			seed = 1;
+	size_t				i;
+	
+	for (i=0; i < bytes; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		p[i] = (uint8_t)(seed >> 24);
+	}
+}
+
+
+//--------------------------------------------------------------------- FillRandomFloat
+//	Random float or half float channels from 0.5 to 1, so the conversions
+//	see no NaNs, infinities or denormals.
+//---------------------------------------------------------------------
+
+static void
+FillRandomFloat (void* buf, size_t bytes, uint32_t floatBytes)
+{
+	uint32_t*			f = (uint32_t*)buf;
+	uint16_t*			h = (uint16_t*)buf;
+	size_t				i;
+	
+	FillRandom(buf, bytes);
+	if (floatBytes == 4)
+		for (i=0; i < bytes / 4; i++)
+			f[i] = 0x3F000000 | (f[i] & 0x007FFFFF);
+	else
+		for (i=0; i < bytes / 2; i++)
+			h[i] = (uint16_t)(0x3800 | (h[i] & 0x03FF));
+}
+
+
+//--------------------------------------------------------------------- Now
+
+static double
+Now (void)
+{
+	struct timespec		ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
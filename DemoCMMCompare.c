@@ -0,0 +1,768 @@
+/*
+	File:		DemoCMMCompare.c
+
+	Contains:	Comparison check of the Demo CMM engine.
+
+				Matches the same bitmap two ways the engine promises agree
+				byte for byte, and compares the results. Needs nothing but
+				the engine:
+
+					cc -O2 -o DemoCMMCompare DemoCMMCompare.c DemoCMMEngine.c -lm -lpthread
+
+				Usage:
+
+					DemoCMMCompare [kind]
+
+				kind is one of
+
+					memo	the memo on and off, from images of few colors, of
+							many and too small for it, and the memo counters
+					8bit	8 bit layouts matched through the byte kernels and
+							into the 16 bit layouts, narrowed after
+					strips	bitmaps matched whole and a strip at a time
+							through a session, in place too
+					planar	interleaved bitmaps matched as they are and split
+							into planes, one per channel and semi-planar
+
+				all of them by default. Prints one line per case on stdout
+				and exits 1 if any results differ or a counter is not what
+				the case expects.
+
+	Version:	ColorSync 2 or later
+
+	Copyright:	2002 by Apple Computer, Inc., all rights reserved.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DemoCMMEngine.h"
+
+
+// Images of the memo cases; a band of the small one is one pixel short
+// of the 4096 it needs to use the memo
+#define		kMemoWidth			256
+#define		kMemoHeight			256
+#define		kSmallWidth			63
+#define		kSmallHeight		65
+
+// Colors of the images of few colors
+#define		kFewColors			64
+
+// Image of the 8 bit cases, odd so rows end in a part of a block
+#define		kByteWidth			263
+#define		kByteHeight			17
+
+// Image of the strip cases, which is not a whole number of strips of
+// any of their heights; the rows of the strips are padded by an odd
+// number of bytes, and start one byte into their buffer
+#define		kStripWidth			301
+#define		kStripHeight		150
+#define		kStripPad			3
+
+// Image of the planar cases, odd so rows end in a part of a vector
+#define		kPlanarWidth		257
+#define		kPlanarHeight		9
+
+typedef int (*CompareProc) (void);
+
+// function prototypes
+static int		CompareMemo		(void);
+static int		CompareBytes	(void);
+static int		CompareStrips	(void);
+static int		ComparePlanar	(void);
+static void		FillRandom		(void* buf, size_t bytes, uint32_t seed);
+static void		FillFewColors	(uint16_t* buf, uint32_t width, uint32_t height, uint32_t chans);
+static void		DescribePlanes	(const EngineLayoutInfo* info, EngineLayout layout, int semi, uint8_t* buf,
+								 EnginePlanarBitmap* map);
+static void		CopyPlanes		(const EnginePlanarBitmap* map, const EngineLayoutInfo* info, const uint8_t* order,
+								 uint8_t* image, int toPlanes);
+static int		MatchNew		(const EngineTransformKey* key, const EngineBitmap* srcMap, const EngineBitmap* dstMap,
+								 EngineMemoStats* stats);
+static int		Report			(const char* kind, const char* name, int failed, const char* why);
+
+static const struct
+{
+	const char*			name;
+	CompareProc			proc;
+} gKinds[] =
+{
+	{ "memo",	&CompareMemo },
+	{ "8bit",	&CompareBytes },
+	{ "strips",	&CompareStrips },
+	{ "planar",	&ComparePlanar },
+};
+
+#define		kKindCount			(sizeof(gKinds) / sizeof(gKinds[0]))
+
+
+//--------------------------------------------------------------------- main
+
+int
+main (int argc, char** argv)
+{
+	int					failures = 0;
+	size_t				k;
+	
+	if (argc > 2)
+	{
+		fprintf(stderr, "usage: %s [memo|8bit|strips|planar]\n", argv[0]);
+		return 1;
+	}
+	
+	for (k=0; argc == 2 && k < kKindCount; k++)
+		if (strcmp(argv[1], gKinds[k].name) == 0)
+			break;
+	if (k == kKindCount)
+	{
+		fprintf(stderr, "%s: unknown kind %s\n", argv[0], argv[1]);
+		return 1;
+	}
+	
+	for (k=0; k < kKindCount; k++)
+		if (argc < 2 || strcmp(argv[1], gKinds[k].name) == 0)
+			failures += gKinds[k].proc();
+	
+	return failures ? 1 : 0;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- comparisons -----
+#endif
+
+
+//--------------------------------------------------------------------- CompareMemo
+//	Matches RGB48 and CMYK64 to LAB48 at exact precision with the memo
+//	on and off. The results must be the same bytes. Every color of an
+//	image of one band goes through the memo, so its counters add up to
+//	the pixels: an image of few colors is found in the memo and repeats
+//	the color before, one of random colors turns the memo off, and the
+//	small image never uses it. Off, the counters stay zero.
+//---------------------------------------------------------------------
+
+static int
+CompareMemo (void)
+{
+	static const struct
+	{
+		const char*			name;
+		uint32_t			space;
+		EngineLayout		layout;
+		uint32_t			chans;
+	} sources[] =
+	{
+		{ "RGB48",	kEngineRGBData,		kEngineRGB48,	3 },
+		{ "CMYK64",	kEngineCMYKData,	kEngineCMYK64,	4 },
+	};
+	static const char*	images[] = { "few colors", "many colors", "small" };
+	EngineTransformKey	key;
+	EngineBitmap		srcMap, onMap, offMap;
+	EngineMemoStats		on, off;
+	uint16_t*			src;
+	uint8_t*			dstOn;
+	uint8_t*			dstOff;
+	uint64_t			pixels, total;
+	uint32_t			s, i, width, height;
+	char				name[64];
+	int					failures = 0;
+	
+	src = (uint16_t*)malloc((size_t)kMemoWidth * kMemoHeight * 4 * 2);
+	dstOn = (uint8_t*)malloc((size_t)kMemoWidth * kMemoHeight * 3 * 2);
+	dstOff = (uint8_t*)malloc((size_t)kMemoWidth * kMemoHeight * 3 * 2);
+	if (src == NULL || dstOn == NULL || dstOff == NULL)
+	{
+		fprintf(stderr, "memo: out of memory\n");
+		free(src);
+		free(dstOn);
+		free(dstOff);
+		return 1;
+	}
+	
+	for (s=0; s < sizeof(sources) / sizeof(sources[0]); s++)
+	{
+		for (i=0; i < sizeof(images) / sizeof(images[0]); i++)
+		{
+			width = (i == 2) ? kSmallWidth : kMemoWidth;
+			height = (i == 2) ? kSmallHeight : kMemoHeight;
+			pixels = (uint64_t)width * height;
+			
+			if (i == 1)
+				FillRandom(src, (size_t)pixels * sources[s].chans * 2, s + 1);
+			else
+				FillFewColors(src, width, height, sources[s].chans);
+			
+			memset(&key, 0, sizeof(key));
+			key.srcSpace = sources[s].space;
+			key.dstSpace = kEngineLabData;
+			key.quality = kEngineNormalMode;
+			key.precision = kEnginePrecisionExact;
+			
+			srcMap.image = src;
+			srcMap.width = width;
+			srcMap.height = height;
+			srcMap.rowBytes = width * sources[s].chans * 2;
+			srcMap.layout = sources[s].layout;
+			srcMap.colors = NULL;
+			srcMap.colorCount = 0;
+			
+			onMap = offMap = srcMap;
+			onMap.image = dstOn;
+			offMap.image = dstOff;
+			onMap.rowBytes = offMap.rowBytes = width * 3 * 2;
+			onMap.layout = offMap.layout = kEngineLAB48;
+			memset(dstOn, 0, (size_t)pixels * 3 * 2);
+			memset(dstOff, 0xFF, (size_t)pixels * 3 * 2);
+			
+			key.memo = kEngineMemoOn;
+			failures += MatchNew(&key, &srcMap, &onMap, &on);
+			key.memo = kEngineMemoOff;
+			failures += MatchNew(&key, &srcMap, &offMap, &off);
+			
+			snprintf(name, sizeof(name), "%s to LAB48, %s", sources[s].name, images[i]);
+			total = on.runs + on.hits + on.misses + on.bypassed;
+			
+			if (memcmp(dstOn, dstOff, (size_t)pixels * 3 * 2) != 0)
+				failures += Report("memo", name, 1, "results differ");
+			else if (off.runs + off.hits + off.misses + off.bypassed != 0)
+				failures += Report("memo", name, 1, "counted with the memo off");
+			else if (i == 2)
+				failures += Report("memo", name, total != 0, "a band too small used the memo");
+			else if (total != pixels)
+				failures += Report("memo", name, 1, "counters do not add up to the pixels");
+			else if (i == 0)
+				failures += Report("memo", name, on.runs == 0 || on.hits == 0 || on.misses > pixels / 2 || on.bypassed != 0,
+								   "few colors missed the memo");
+			else
+				failures += Report("memo", name, on.bypassed < pixels / 2, "many colors kept the memo on");
+		}
+	}
+	
+	free(src);
+	free(dstOn);
+	free(dstOff);
+	return failures;
+}
+
+
+//--------------------------------------------------------------------- CompareBytes
+//	Matches the conversions that have byte kernels, and the copy of RGB,
+//	from random 8 bit colors into the 8 bit layout of the destination and
+//	into its 16 bit layout. The byte kernels must give the high byte of
+//	every 16 bit sample.
+//---------------------------------------------------------------------
+
+static int
+CompareBytes (void)
+{
+	static const struct
+	{
+		const char*			name;
+		uint32_t			srcSpace;
+		uint32_t			dstSpace;
+		EngineLayout		srcLayout;
+		EngineLayout		dstLayout;
+		EngineLayout		wideLayout;
+		uint32_t			srcChans;
+		uint32_t			dstChans;
+	} cases[] =
+	{
+		{ "RGB24 to CMYK32",	kEngineRGBData,		kEngineCMYKData,	kEngineRGB24,	kEngineCMYK32,	kEngineCMYK64,	3,	4 },
+		{ "CMYK32 to RGB24",	kEngineCMYKData,	kEngineRGBData,		kEngineCMYK32,	kEngineRGB24,	kEngineRGB48,	4,	3 },
+		{ "Gray8 to RGB24",		kEngineGrayData,	kEngineRGBData,		kEngineGray8,	kEngineRGB24,	kEngineRGB48,	1,	3 },
+		{ "Gray8 to CMYK32",	kEngineGrayData,	kEngineCMYKData,	kEngineGray8,	kEngineCMYK32,	kEngineCMYK64,	1,	4 },
+		{ "LAB24 to Gray8",		kEngineLabData,		kEngineGrayData,	kEngineLAB24,	kEngineGray8,	kEngineGray16,	3,	1 },
+		{ "Gray8 to LAB24",		kEngineGrayData,	kEngineLabData,		kEngineGray8,	kEngineLAB24,	kEngineLAB48,	1,	3 },
+		{ "RGB24 to RGB24",		kEngineRGBData,		kEngineRGBData,		kEngineRGB24,	kEngineRGB24,	kEngineRGB48,	3,	3 },
+	};
+	EngineTransformKey	key;
+	EngineBitmap		srcMap, dstMap, wideMap;
+	EngineMemoStats		stats;
+	uint8_t				src[kByteWidth * kByteHeight * 4];
+	uint8_t				dst[kByteWidth * kByteHeight * 4];
+	uint8_t				wide[kByteWidth * kByteHeight * 4 * 2];
+	uint32_t			c, i, samples;
+	int					failures = 0;
+	int					differ;
+	
+	for (c=0; c < sizeof(cases) / sizeof(cases[0]); c++)
+	{
+		FillRandom(src, sizeof(src), c + 1);
+		
+		memset(&key, 0, sizeof(key));
+		key.srcSpace = cases[c].srcSpace;
+		key.dstSpace = cases[c].dstSpace;
+		key.quality = kEngineNormalMode;
+		
+		srcMap.image = src;
+		srcMap.width = kByteWidth;
+		srcMap.height = kByteHeight;
+		srcMap.rowBytes = kByteWidth * cases[c].srcChans;
+		srcMap.layout = cases[c].srcLayout;
+		srcMap.colors = NULL;
+		srcMap.colorCount = 0;
+		
+		dstMap = wideMap = srcMap;
+		dstMap.image = dst;
+		dstMap.rowBytes = kByteWidth * cases[c].dstChans;
+		dstMap.layout = cases[c].dstLayout;
+		wideMap.image = wide;
+		wideMap.rowBytes = kByteWidth * cases[c].dstChans * 2;
+		wideMap.layout = cases[c].wideLayout;
+		
+		failures += MatchNew(&key, &srcMap, &dstMap, &stats);
+		failures += MatchNew(&key, &srcMap, &wideMap, &stats);
+		
+		// The 16 bit layouts are big endian, the high byte first
+		samples = kByteWidth * kByteHeight * cases[c].dstChans;
+		differ = 0;
+		for (i=0; i < samples; i++)
+			differ |= (dst[i] != wide[i * 2]);
+		
+		failures += Report("8bit", cases[c].name, differ, "differs from the 16 bit match");
+	}
+	
+	return failures;
+}
+
+
+//--------------------------------------------------------------------- CompareStrips
+//	Matches random bitmaps whole with EngineMatchBitmap, then a strip at
+//	a time through a session, copying each strip in and out of buffers of
+//	their own, as a reader and writer of scanlines would. The strips must
+//	put together the same bytes. Layouts of the same pixel size are
+//	matched in place as well, the destination strip the source strip.
+//---------------------------------------------------------------------
+
+static int
+CompareStrips (void)
+{
+	static const struct
+	{
+		uint32_t			srcSpace;
+		uint32_t			dstSpace;
+		EngineLayout		srcLayout;
+		EngineLayout		dstLayout;
+	} cases[] =
+	{
+		{ kEngineRGBData,	kEngineCMYKData,	kEngineRGB24,	kEngineCMYK32 },
+		{ kEngineRGBData,	kEngineLabData,		kEngineRGB48,	kEngineLAB48 },
+		{ kEngineCMYKData,	kEngineRGBData,		kEngineCMYK64L,	kEngineRGB48 },
+		{ kEngineRGBData,	kEngineRGBData,		kEngineRGBA32,	kEngineARGB64 },
+	};
+	static const uint32_t	stripRows[] = { 1, 7, 64 };
+	EngineTransformKey	key;
+	EngineTransformRef	xform;
+	EngineSessionRef	session;
+	EngineLayoutInfo	srcInfo, dstInfo;
+	EngineBitmap		srcMap, dstMap;
+	EngineMemoStats		stats;
+	uint8_t*			src;
+	uint8_t*			whole;
+	uint8_t*			pieced;
+	uint8_t*			srcStrip;
+	uint8_t*			dstStrip;
+	uint8_t*			strip;
+	uint32_t			c, h, inPlace, row, rows, r;
+	uint32_t			srcBytes, dstBytes, srcStripBytes, dstStripBytes;
+	EngineError			err;
+	char				name[64];
+	int					failures = 0;
+	
+	src = (uint8_t*)malloc((size_t)kStripWidth * kStripHeight * 8);
+	whole = (uint8_t*)malloc((size_t)kStripWidth * kStripHeight * 8);
+	pieced = (uint8_t*)malloc((size_t)kStripWidth * kStripHeight * 8);
+	srcStrip = (uint8_t*)malloc(1 + (size_t)(kStripWidth * 8 + kStripPad) * 64);
+	dstStrip = (uint8_t*)malloc(1 + (size_t)(kStripWidth * 8 + kStripPad) * 64);
+	if (src == NULL || whole == NULL || pieced == NULL || srcStrip == NULL || dstStrip == NULL)
+	{
+		fprintf(stderr, "strips: out of memory\n");
+		free(src);
+		free(whole);
+		free(pieced);
+		free(srcStrip);
+		free(dstStrip);
+		return 1;
+	}
+	
+	for (c=0; c < sizeof(cases) / sizeof(cases[0]); c++)
+	{
+		EngineGetLayoutInfo(cases[c].srcLayout, &srcInfo);
+		EngineGetLayoutInfo(cases[c].dstLayout, &dstInfo);
+		srcBytes = kStripWidth * srcInfo.pixelBytes;
+		dstBytes = kStripWidth * dstInfo.pixelBytes;
+		FillRandom(src, (size_t)srcBytes * kStripHeight, c + 1);
+		
+		memset(&key, 0, sizeof(key));
+		key.srcSpace = cases[c].srcSpace;
+		key.dstSpace = cases[c].dstSpace;
+		key.quality = kEngineNormalMode;
+		
+		srcMap.image = src;
+		srcMap.width = kStripWidth;
+		srcMap.height = kStripHeight;
+		srcMap.rowBytes = srcBytes;
+		srcMap.layout = cases[c].srcLayout;
+		srcMap.colors = NULL;
+		srcMap.colorCount = 0;
+		
+		dstMap = srcMap;
+		dstMap.image = whole;
+		dstMap.rowBytes = dstBytes;
+		dstMap.layout = cases[c].dstLayout;
+		failures += MatchNew(&key, &srcMap, &dstMap, &stats);
+		
+		err = EngineNewTransform(&key, &xform);
+		if (err != kEngineNoErr)
+		{
+			fprintf(stderr, "EngineNewTransform failed, error %d\n", (int)err);
+			failures++;
+			continue;
+		}
+		
+		for (inPlace=0; inPlace < ((srcInfo.pixelBytes == dstInfo.pixelBytes) ? 2u : 1u); inPlace++)
+		{
+			for (h=0; h < sizeof(stripRows) / sizeof(stripRows[0]); h++)
+			{
+				srcStripBytes = srcBytes + kStripPad;
+				dstStripBytes = inPlace ? srcStripBytes : dstBytes + kStripPad;
+				strip = inPlace ? srcStrip + 1 : dstStrip + 1;
+				memset(pieced, 0, (size_t)dstBytes * kStripHeight);
+				
+				err = EngineBeginSession(xform, cases[c].srcLayout, cases[c].dstLayout, kStripWidth, &session);
+				if (err == kEngineNoErr)
+				{
+					for (row=0; err == kEngineNoErr && row < kStripHeight; row += rows)
+					{
+						rows = kStripHeight - row;
+						if (rows > stripRows[h])
+							rows = stripRows[h];
+						
+						for (r=0; r < rows; r++)
+							memcpy(srcStrip + 1 + r * srcStripBytes, src + (row + r) * srcBytes, srcBytes);
+						err = EngineMatchStrip(session, srcStrip + 1, srcStripBytes, strip, dstStripBytes, rows);
+						for (r=0; r < rows; r++)
+							memcpy(pieced + (row + r) * dstBytes, strip + r * dstStripBytes, dstBytes);
+					}
+					EngineEndSession(session);
+				}
+				
+				snprintf(name, sizeof(name), "%s to %s, strips of %u%s", srcInfo.name, dstInfo.name,
+						 (unsigned)stripRows[h], inPlace ? ", in place" : "");
+				if (err != kEngineNoErr)
+					failures += Report("strips", name, 1, "session failed");
+				else
+					failures += Report("strips", name, memcmp(whole, pieced, (size_t)dstBytes * kStripHeight) != 0,
+									   "differs from the whole bitmap");
+			}
+		}
+		
+		EngineReleaseTransform(xform);
+	}
+	
+	free(src);
+	free(whole);
+	free(pieced);
+	free(srcStrip);
+	free(dstStrip);
+	return failures;
+}
+
+
+//--------------------------------------------------------------------- ComparePlanar
+//	Matches random interleaved bitmaps with EngineMatchBitmap, then the
+//	same colors split into planes with EngineMatchPlanar, into planes as
+//	well, once with a plane per channel and once semi-planar, the first
+//	channel in a plane of its own and the others interleaved in a second.
+//	The planes put back together must be the same bytes.
+//---------------------------------------------------------------------
+
+static int
+ComparePlanar (void)
+{
+	static const struct
+	{
+		uint32_t			srcSpace;
+		uint32_t			dstSpace;
+		EngineLayout		srcLayout;
+		EngineLayout		dstLayout;
+		uint8_t				srcOrder[4];	// sample of each channel in a pixel,
+		uint8_t				dstOrder[4];	// the color channels, then alpha
+	} cases[] =
+	{
+		{ kEngineCMYKData,	kEngineRGBData,		kEngineCMYK32,	kEngineRGB24,	{ 0, 1, 2, 3 },	{ 0, 1, 2, 3 } },
+		{ kEngineRGBData,	kEngineCMYKData,	kEngineRGB24,	kEngineCMYK32,	{ 0, 1, 2, 3 },	{ 0, 1, 2, 3 } },
+		{ kEngineRGBData,	kEngineLabData,		kEngineRGB48,	kEngineLAB48,	{ 0, 1, 2, 3 },	{ 0, 1, 2, 3 } },
+		{ kEngineCMYKData,	kEngineRGBData,		kEngineCMYK64L,	kEngineRGB48L,	{ 0, 1, 2, 3 },	{ 0, 1, 2, 3 } },
+		{ kEngineRGBData,	kEngineRGBData,		kEngineRGBA32,	kEngineARGB64,	{ 0, 1, 2, 3 },	{ 1, 2, 3, 0 } },
+	};
+	static const char*	modes[] = { "a plane per channel", "semi-planar" };
+	EngineTransformKey	key;
+	EngineTransformRef	xform;
+	EngineLayoutInfo	srcInfo, dstInfo;
+	EngineBitmap		srcMap, dstMap;
+	EnginePlanarBitmap	srcPlanes, dstPlanes;
+	EngineMemoStats		stats;
+	uint8_t*			src;
+	uint8_t*			whole;
+	uint8_t*			pieced;
+	uint8_t*			srcBuf;
+	uint8_t*			dstBuf;
+	uint32_t			c, semi, dstBytes;
+	size_t				bytes = (size_t)(kPlanarWidth + 1) * kPlanarHeight * 8;
+	EngineError			err;
+	char				name[64];
+	int					failures = 0;
+	
+	src = (uint8_t*)malloc(bytes);
+	whole = (uint8_t*)malloc(bytes);
+	pieced = (uint8_t*)malloc(bytes);
+	srcBuf = (uint8_t*)malloc(bytes);
+	dstBuf = (uint8_t*)malloc(bytes);
+	if (src == NULL || whole == NULL || pieced == NULL || srcBuf == NULL || dstBuf == NULL)
+	{
+		fprintf(stderr, "planar: out of memory\n");
+		free(src);
+		free(whole);
+		free(pieced);
+		free(srcBuf);
+		free(dstBuf);
+		return 1;
+	}
+	
+	for (c=0; c < sizeof(cases) / sizeof(cases[0]); c++)
+	{
+		EngineGetLayoutInfo(cases[c].srcLayout, &srcInfo);
+		EngineGetLayoutInfo(cases[c].dstLayout, &dstInfo);
+		dstBytes = kPlanarWidth * dstInfo.pixelBytes;
+		FillRandom(src, (size_t)kPlanarWidth * kPlanarHeight * srcInfo.pixelBytes, c + 1);
+		
+		memset(&key, 0, sizeof(key));
+		key.srcSpace = cases[c].srcSpace;
+		key.dstSpace = cases[c].dstSpace;
+		key.quality = kEngineNormalMode;
+		
+		srcMap.image = src;
+		srcMap.width = kPlanarWidth;
+		srcMap.height = kPlanarHeight;
+		srcMap.rowBytes = kPlanarWidth * srcInfo.pixelBytes;
+		srcMap.layout = cases[c].srcLayout;
+		srcMap.colors = NULL;
+		srcMap.colorCount = 0;
+		
+		dstMap = srcMap;
+		dstMap.image = whole;
+		dstMap.rowBytes = dstBytes;
+		dstMap.layout = cases[c].dstLayout;
+		failures += MatchNew(&key, &srcMap, &dstMap, &stats);
+		
+		err = EngineNewTransform(&key, &xform);
+		if (err != kEngineNoErr)
+		{
+			fprintf(stderr, "EngineNewTransform failed, error %d\n", (int)err);
+			failures++;
+			continue;
+		}
+		
+		for (semi=0; semi < 2; semi++)
+		{
+			DescribePlanes(&srcInfo, cases[c].srcLayout, semi, srcBuf, &srcPlanes);
+			DescribePlanes(&dstInfo, cases[c].dstLayout, semi, dstBuf, &dstPlanes);
+			CopyPlanes(&srcPlanes, &srcInfo, cases[c].srcOrder, src, 1);
+			memset(dstBuf, 0, bytes);
+			memset(pieced, 0xFF, (size_t)dstBytes * kPlanarHeight);
+			
+			err = EngineMatchPlanar(xform, &srcPlanes, &dstPlanes, NULL, NULL);
+			CopyPlanes(&dstPlanes, &dstInfo, cases[c].dstOrder, pieced, 0);
+			
+			snprintf(name, sizeof(name), "%s to %s, %s", srcInfo.name, dstInfo.name, modes[semi]);
+			if (err != kEngineNoErr)
+				failures += Report("planar", name, 1, "EngineMatchPlanar failed");
+			else
+				failures += Report("planar", name, memcmp(whole, pieced, (size_t)dstBytes * kPlanarHeight) != 0,
+								   "differs from the interleaved match");
+		}
+		
+		EngineReleaseTransform(xform);
+	}
+	
+	free(src);
+	free(whole);
+	free(pieced);
+	free(srcBuf);
+	free(dstBuf);
+	return failures;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- utilities -----
+#endif
+
+
+//--------------------------------------------------------------------- FillRandom
+
+static void
+FillRandom (void* buf, size_t bytes, uint32_t seed)
+{
+	uint8_t*			p = (uint8_t*)buf;
+	size_t				i;
+	
+	for (i=0; i < bytes; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		p[i] = (uint8_t)(seed >> 24);
+	}
+}
+
+
+//--------------------------------------------------------------------- FillFewColors
+//	Diagonal stripes of kFewColors random colors, five pixels wide, so a
+//	row has runs of one color and comes back to each color it left.
+//---------------------------------------------------------------------
+
+static void
+FillFewColors (uint16_t* buf, uint32_t width, uint32_t height, uint32_t chans)
+{
+	uint16_t			colors[kFewColors][4];
+	uint32_t			x, y;
+	
+	FillRandom(colors, sizeof(colors), 7);
+	for (y=0; y < height; y++)
+		for (x=0; x < width; x++, buf += chans)
+			memcpy(buf, colors[(x / 5 + y) % kFewColors], chans * 2);
+}
+
+
+//--------------------------------------------------------------------- DescribePlanes
+//	Lays out a planar bitmap of kPlanarWidth by kPlanarHeight in buf,
+//	either a plane per channel, each row a sample longer than it needs,
+//	or semi-planar, the first channel in a plane of its own and the
+//	others interleaved in a second.
+//---------------------------------------------------------------------
+
+static void
+DescribePlanes (const EngineLayoutInfo* info, EngineLayout layout, int semi, uint8_t* buf,
+				EnginePlanarBitmap* map)
+{
+	uint32_t			sampleBytes = info->channelBits / 8;
+	uint32_t			chans = info->channels + (info->alpha ? 1 : 0);
+	uint32_t			planeBytes;
+	uint32_t			i, k;
+	
+	memset(map, 0, sizeof(*map));
+	map->width = kPlanarWidth;
+	map->height = kPlanarHeight;
+	map->layout = layout;
+	
+	for (k=0; k < chans; k++)
+	{
+		// Alpha is in the plane after the color channels
+		i = (k < info->channels) ? k : 3;
+		if (!semi)
+		{
+			planeBytes = (kPlanarWidth + 1) * sampleBytes * kPlanarHeight;
+			map->planes[i] = buf + k * planeBytes;
+			map->rowBytes[i] = (kPlanarWidth + 1) * sampleBytes;
+			map->colBytes[i] = sampleBytes;
+		}
+		else if (k == 0)
+		{
+			map->planes[i] = buf;
+			map->rowBytes[i] = kPlanarWidth * sampleBytes;
+			map->colBytes[i] = sampleBytes;
+		}
+		else
+		{
+			map->planes[i] = buf + kPlanarWidth * sampleBytes * kPlanarHeight + (k - 1) * sampleBytes;
+			map->rowBytes[i] = kPlanarWidth * sampleBytes * (chans - 1);
+			map->colBytes[i] = sampleBytes * (chans - 1);
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------- CopyPlanes
+//	Copies the samples of an interleaved image of kPlanarWidth by
+//	kPlanarHeight, in which channel k is sample order[k] of a pixel, into
+//	the planes of map, or back out of them.
+//---------------------------------------------------------------------
+
+static void
+CopyPlanes (const EnginePlanarBitmap* map, const EngineLayoutInfo* info, const uint8_t* order,
+			uint8_t* image, int toPlanes)
+{
+	uint32_t			sampleBytes = info->channelBits / 8;
+	uint32_t			chans = info->channels + (info->alpha ? 1 : 0);
+	uint32_t			i, k, x, y;
+	uint8_t*			pixel;
+	uint8_t*			sample;
+	
+	for (k=0; k < chans; k++)
+	{
+		i = (k < info->channels) ? k : 3;
+		for (y=0; y < kPlanarHeight; y++)
+		{
+			for (x=0; x < kPlanarWidth; x++)
+			{
+				pixel = image + (y * kPlanarWidth + x) * info->pixelBytes + order[k] * sampleBytes;
+				sample = (uint8_t*)map->planes[i] + y * map->rowBytes[i] + x * map->colBytes[i];
+				if (toPlanes)
+					memcpy(sample, pixel, sampleBytes);
+				else
+					memcpy(pixel, sample, sampleBytes);
+			}
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------- MatchNew
+//	Matches srcMap into dstMap through a new transform of key, and returns
+//	its memo counters.
+//---------------------------------------------------------------------
+
+static int
+MatchNew (const EngineTransformKey* key, const EngineBitmap* srcMap, const EngineBitmap* dstMap,
+		  EngineMemoStats* stats)
+{
+	EngineTransformRef	xform;
+	EngineError			err;
+	
+	memset(stats, 0, sizeof(*stats));
+	err = EngineNewTransform(key, &xform);
+	if (err != kEngineNoErr)
+	{
+		fprintf(stderr, "EngineNewTransform failed, error %d\n", (int)err);
+		return 1;
+	}
+	
+	err = EngineMatchBitmap(xform, srcMap, dstMap, NULL, NULL);
+	EngineGetMemoStats(xform, stats);
+	EngineReleaseTransform(xform);
+	if (err != kEngineNoErr)
+	{
+		fprintf(stderr, "EngineMatchBitmap failed, error %d\n", (int)err);
+		return 1;
+	}
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------- Report
+//	Prints the result of a case and returns 1 if it failed.
+//---------------------------------------------------------------------
+
+static int
+Report (const char* kind, const char* name, int failed, const char* why)
+{
+	printf("%-8s %-40s %s\n", kind, name, failed ? why : "ok");
+	fflush(stdout);
+	return failed ? 1 : 0;
+}
+
@@ -0,0 +1,863 @@
+/*
+	File:		DemoCMMConvert.c
+
+	Contains:	Batch image converter built on the Demo CMM engine.
+
+				Converts PPM, PGM and PAM files, or headerless raw files in
+				any engine layout, from the color space of their pixels to
+				that of another layout. Both files are mapped into memory and
+				matched in strips straight from the source pages into the
+				destination pages with an engine session, so no image is
+				ever copied or held in memory whole. Needs nothing but the
+				engine and POSIX:
+
+					cc -O2 -o DemoCMMConvert DemoCMMConvert.c DemoCMMEngine.c -lm -lpthread
+
+				Usage:
+
+					DemoCMMConvert [options] -o layout src [dst]
+
+				src and dst are files or directories. Every file of a source
+				directory is converted into the destination directory under
+				the same name, several at once, so one file's pages are read
+				in and another's written back while a third is matched.
+				Without dst, or when dst is the source file, each file is
+				converted in place, which needs a destination layout of the
+				same pixel size and, for PNM, a header no longer than the
+				source's. Options:
+
+					-o layout		destination layout, named as in the benchmark,
+									like RGB24, CMYK64 or LAB48L
+					-r layout		source files are raw in this layout, -w and -h
+									give their size; otherwise they are PNM
+					-w width		width of raw source files
+					-h height		height of raw source files
+					-q quality		0 normal, 1 draft, 2 best; 0 by default
+					-p precision	0 default, 1 exact, 2 float, 3 fixed
+					-g points		nodes a channel of the grids of draft
+									quality, 17, 33 or 65; 33 by default
+					-j files		files converted at once, 4 by default
+					-s				print the memo counters of each transform
+
+				PNM sources may be P5 or P6 with a maxval of 255 or 65535,
+				or P7 with a TUPLTYPE of GRAYSCALE, RGB, CMYK, LAB or XYZ.
+				A PNM source is written as PNM, Gray and RGB as P5 and P6 and
+				the other spaces as P7, so the destination layout must be one
+				of the 8 or 16 bit big endian layouts other than RGB32. Raw
+				sources are written raw.
+
+	Version:	ColorSync 2 or later
+
+	Copyright:	2002 by Apple Computer, Inc., all rights reserved.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DemoCMMEngine.h"
+
+
+// The layouts with a PNM form, by the channels and TUPLTYPE of their PAM
+// form. Gray and RGB without alpha are written as P5 and P6.
+typedef struct
+{
+	EngineLayout		layout;
+	uint32_t			chans;
+	const char*			tupleType;
+} PNMFormRec;
+
+static const PNMFormRec	gPNMForms[] =
+{
+	{ kEngineGray8,		1,	"GRAYSCALE"	},
+	{ kEngineGray16,	1,	"GRAYSCALE"	},
+	{ kEngineRGB24,		3,	"RGB"		},
+	{ kEngineRGB48,		3,	"RGB"		},
+	{ kEngineCMYK32,	4,	"CMYK"		},
+	{ kEngineCMYK64,	4,	"CMYK"		},
+	{ kEngineLAB24,		3,	"LAB"		},
+	{ kEngineLAB48,		3,	"LAB"		},
+	{ kEngineXYZ24,		3,	"XYZ"		},
+	{ kEngineXYZ48,		3,	"XYZ"		},
+	{ kEngineRGBA32,	4,	"RGB_ALPHA"	},
+	{ kEngineRGBA64,	4,	"RGB_ALPHA"	},
+};
+
+// Every layout of whole pixels, those before Gamut1, in EngineLayout
+// order, filled in by main
+#define		kConvertLayoutCount	((uint32_t)kEngineGamut1)
+static EngineLayoutInfo	gConvertLayouts[kConvertLayoutCount];
+
+// Bytes of the larger of the two images matched per strip. The next source
+// strip is read ahead and the last destination strip written back while a
+// strip is matched.
+#define		kStripBytes			(8 << 20)
+
+// Longest PNM header
+#define		kMaxHeader			256
+
+// The image of a mapped file
+typedef struct
+{
+	EngineLayout		layout;
+	uint32_t			width;
+	uint32_t			height;
+	uint32_t			rowBytes;
+	size_t				offset;			// of the first pixel, after the header
+	int					pnm;
+} ImageRec;
+
+// What every file is converted with, set from the options
+static struct
+{
+	EngineLayout		dstLayout;
+	int					raw;
+	ImageRec			rawImage;		// size and layout of raw sources
+	uint32_t			quality;
+	uint32_t			precision;
+	uint32_t			gridPoints;
+	
+	pthread_mutex_t		lock;
+	EngineTransformRef	transforms[kConvertLayoutCount];	// by source layout
+	
+	char**				names;			// files of a directory, nil for a single file
+	uint32_t			nameCount;
+	uint32_t			nextName;
+	const char*			srcPath;
+	const char*			dstPath;		// nil to convert in place
+	uint32_t			failures;
+} gConvert;
+
+
+// function prototypes
+static int		ConvertFile		(const char* srcPath, const char* dstPath);
+static int		MatchMapped		(EngineTransformRef xform, const ImageRec* src, uint8_t* srcBase,
+								 const ImageRec* dst, uint8_t* dstBase);
+static void*	ConvertWorker	(void* arg);
+static void		ConvertDirectory(uint32_t threads);
+static int		GetTransform	(EngineLayout srcLayout, EngineTransformRef* xform);
+static int		ReadHeader		(const uint8_t* data, size_t size, ImageRec* image);
+static int		ReadPAMHeader	(const uint8_t* data, size_t size, ImageRec* image);
+static size_t	WriteHeader		(const ImageRec* image, size_t pad, char* header);
+static int		FindLayoutName	(const char* name, EngineLayout* layout);
+static EngineLayout PNMLayout	(uint32_t chans, uint32_t maxval, const char* tupleType);
+static const PNMFormRec* FindPNMForm (EngineLayout layout);
+static void		AdviseRange		(void* base, size_t offset, size_t bytes, int advice);
+static void		SyncRange		(void* base, size_t offset, size_t bytes);
+
+
+//--------------------------------------------------------------------- main
+
+int
+main (int argc, char** argv)
+{
+	struct stat			info;
+	const char*			dstName = NULL;
+	const char*			rawName = NULL;
+	EngineMemoStats		stats;
+	uint32_t			threads = 4;
+	int					printStats = 0;
+	uint32_t			i;
+	int					arg;
+	
+	for (arg=1; arg < argc && argv[arg][0] == '-'; arg++)
+	{
+		if (strcmp(argv[arg], "-s") == 0)
+			printStats = 1;
+		else if (arg + 1 >= argc)
+			break;
+		else if (strcmp(argv[arg], "-o") == 0)
+			dstName = argv[++arg];
+		else if (strcmp(argv[arg], "-r") == 0)
+			rawName = argv[++arg];
+		else if (strcmp(argv[arg], "-w") == 0)
+			gConvert.rawImage.width = (uint32_t)atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-h") == 0)
+			gConvert.rawImage.height = (uint32_t)atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-q") == 0)
+			gConvert.quality = (uint32_t)atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-p") == 0)
+			gConvert.precision = (uint32_t)atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-g") == 0)
+			gConvert.gridPoints = (uint32_t)atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-j") == 0)
+			threads = (uint32_t)atoi(argv[++arg]);
+		else
+			break;
+	}
+	
+	if (dstName == NULL || arg >= argc || argc - arg > 2)
+	{
+		fprintf(stderr, "usage: %s [-r layout -w width -h height] [-q quality] [-p precision] [-g points] [-j files] [-s] "
+				"-o layout src [dst]\n", argv[0]);
+		return 1;
+	}
+	
+	for (i=0; i < kConvertLayoutCount; i++)
+		EngineGetLayoutInfo((EngineLayout)i, &gConvertLayouts[i]);
+	
+	if (!FindLayoutName(dstName, &gConvert.dstLayout))
+	{
+		fprintf(stderr, "%s: unknown layout %s\n", argv[0], dstName);
+		return 1;
+	}
+	
+	if (rawName)
+	{
+		if (!FindLayoutName(rawName, &gConvert.rawImage.layout))
+		{
+			fprintf(stderr, "%s: unknown layout %s\n", argv[0], rawName);
+			return 1;
+		}
+		if (gConvert.rawImage.width == 0 || gConvert.rawImage.height == 0)
+		{
+			fprintf(stderr, "%s: raw sources need -w and -h\n", argv[0]);
+			return 1;
+		}
+		gConvert.raw = 1;
+		gConvert.rawImage.rowBytes = gConvert.rawImage.width * gConvertLayouts[gConvert.rawImage.layout].pixelBytes;
+	}
+	else if (FindPNMForm(gConvert.dstLayout) == NULL)
+	{
+		fprintf(stderr, "%s: %s has no PNM form\n", argv[0], dstName);
+		return 1;
+	}
+	
+	if (gConvert.quality > kEngineBestMode || gConvert.precision > kEnginePrecisionFixed || threads == 0 ||
+		(gConvert.gridPoints != 0 && gConvert.gridPoints != 17 && gConvert.gridPoints != 33 && gConvert.gridPoints != 65))
+	{
+		fprintf(stderr, "%s: quality must be 0 to 2, precision 0 to 3, points 17, 33 or 65 and files at least 1\n", argv[0]);
+		return 1;
+	}
+	
+	pthread_mutex_init(&gConvert.lock, NULL);
+	gConvert.srcPath = argv[arg];
+	gConvert.dstPath = (arg + 1 < argc) ? argv[arg + 1] : NULL;
+	
+	if (stat(gConvert.srcPath, &info) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", gConvert.srcPath, strerror(errno));
+		return 1;
+	}
+	
+	if (S_ISDIR(info.st_mode))
+		ConvertDirectory(threads);
+	else if (ConvertFile(gConvert.srcPath, gConvert.dstPath) != 0)
+		gConvert.failures++;
+	
+	for (i=0; i < kConvertLayoutCount; i++)
+	{
+		if (gConvert.transforms[i] == NULL)
+			continue;
+		if (printStats)
+		{
+			EngineGetMemoStats(gConvert.transforms[i], &stats);
+			printf("%s to %s: runs %llu, hits %llu, misses %llu, bypassed %llu\n",
+				   gConvertLayouts[i].name, gConvertLayouts[gConvert.dstLayout].name,
+				   (unsigned long long)stats.runs, (unsigned long long)stats.hits,
+				   (unsigned long long)stats.misses, (unsigned long long)stats.bypassed);
+		}
+		EngineReleaseTransform(gConvert.transforms[i]);
+	}
+	
+	return gConvert.failures != 0;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- conversion -----
+#endif
+
+
+//--------------------------------------------------------------------- ConvertFile
+//	Maps srcPath, and dstPath at its final size, and matches the pixels of
+//	one into the other. Without dstPath, or when it names the source file,
+//	the source is mapped writable and matched in place, its header
+//	rewritten to the same length.
+//---------------------------------------------------------------------
+
+static int
+ConvertFile (const char* srcPath, const char* dstPath)
+{
+	ImageRec			src, dst;
+	EngineTransformRef	xform;
+	struct stat			info, dstInfo;
+	char				header[kMaxHeader];
+	size_t				srcSize, dstSize, headerBytes = 0;
+	uint8_t*			srcBase = MAP_FAILED;
+	uint8_t*			dstBase = MAP_FAILED;
+	int					srcFile = -1, dstFile = -1;
+	int					inPlace;
+	int					result = 1;
+	
+	// Opening the source again as the destination would truncate it
+	if (dstPath && stat(srcPath, &info) == 0 && stat(dstPath, &dstInfo) == 0 &&
+		info.st_dev == dstInfo.st_dev && info.st_ino == dstInfo.st_ino)
+		dstPath = NULL;
+	inPlace = (dstPath == NULL);
+	
+	srcFile = open(srcPath, inPlace ? O_RDWR : O_RDONLY);
+	if (srcFile < 0 || fstat(srcFile, &info) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", srcPath, strerror(errno));
+		goto done;
+	}
+	
+	srcSize = (size_t)info.st_size;
+	if (srcSize > 0)
+		srcBase = (uint8_t*)mmap(NULL, srcSize, inPlace ? PROT_READ | PROT_WRITE : PROT_READ,
+								 MAP_SHARED, srcFile, 0);
+	if (srcBase == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: cannot map, %s\n", srcPath, srcSize ? strerror(errno) : "empty file");
+		goto done;
+	}
+	
+	// Find the source image
+	if (gConvert.raw)
+		src = gConvert.rawImage;
+	else if (!ReadHeader(srcBase, srcSize, &src))
+	{
+		fprintf(stderr, "%s: not a PNM file this converter reads\n", srcPath);
+		goto done;
+	}
+	
+	if (srcSize - src.offset < (size_t)src.rowBytes * src.height)
+	{
+		fprintf(stderr, "%s: %u by %u %s needs %zu bytes, has %zu\n", srcPath, src.width, src.height,
+				gConvertLayouts[src.layout].name, (size_t)src.rowBytes * src.height, srcSize - src.offset);
+		goto done;
+	}
+	
+	// Lay out the destination image
+	dst = src;
+	dst.layout = gConvert.dstLayout;
+	dst.rowBytes = dst.width * gConvertLayouts[dst.layout].pixelBytes;
+	if (!src.pnm)
+		dst.offset = 0;
+	else
+	{
+		headerBytes = WriteHeader(&dst, inPlace ? src.offset : 0, header);
+		if (headerBytes == 0)
+		{
+			fprintf(stderr, "%s: the %s header does not fit in place\n", srcPath, gConvertLayouts[dst.layout].name);
+			goto done;
+		}
+		dst.offset = headerBytes;
+	}
+	
+	if (GetTransform(src.layout, &xform) != 0)
+	{
+		fprintf(stderr, "%s: no conversion from %s to %s\n", srcPath,
+				gConvertLayouts[src.layout].name, gConvertLayouts[dst.layout].name);
+		goto done;
+	}
+	
+	if (inPlace)
+	{
+		if (dst.rowBytes != src.rowBytes)
+		{
+			fprintf(stderr, "%s: %s and %s pixels differ in size, give a destination\n", srcPath,
+					gConvertLayouts[src.layout].name, gConvertLayouts[dst.layout].name);
+			goto done;
+		}
+		memcpy(srcBase, header, headerBytes);
+		result = MatchMapped(xform, &src, srcBase, &dst, srcBase);
+	}
+	else
+	{
+		dstSize = dst.offset + (size_t)dst.rowBytes * dst.height;
+		dstFile = open(dstPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (dstFile < 0 || ftruncate(dstFile, (off_t)dstSize) != 0)
+		{
+			fprintf(stderr, "%s: %s\n", dstPath, strerror(errno));
+			goto done;
+		}
+		
+		dstBase = (uint8_t*)mmap(NULL, dstSize, PROT_READ | PROT_WRITE, MAP_SHARED, dstFile, 0);
+		if (dstBase == MAP_FAILED)
+		{
+			fprintf(stderr, "%s: cannot map, %s\n", dstPath, strerror(errno));
+			goto done;
+		}
+		
+		memcpy(dstBase, header, headerBytes);
+		result = MatchMapped(xform, &src, srcBase, &dst, dstBase);
+		munmap(dstBase, dstSize);
+	}
+	
+	if (result != 0)
+		fprintf(stderr, "%s: match failed\n", srcPath);
+		
+done:
+	if (srcBase != MAP_FAILED)
+		munmap(srcBase, srcSize);
+	if (srcFile >= 0)
+		close(srcFile);
+	if (dstFile >= 0)
+	{
+		close(dstFile);
+		if (result != 0)
+			unlink(dstPath);
+	}
+	
+	return result;
+}
+
+
+//--------------------------------------------------------------------- MatchMapped
+//	Matches the mapped images a strip at a time. The kernel is asked to
+//	read the next source strip in while this one is matched, and to start
+//	writing each destination strip out as soon as it is done, so the disk
+//	and the processors stay busy together.
+//---------------------------------------------------------------------
+
+static int
+MatchMapped (EngineTransformRef xform, const ImageRec* src, uint8_t* srcBase,
+			 const ImageRec* dst, uint8_t* dstBase)
+{
+	EngineSessionRef	session;
+	uint32_t			row, rows, nextRows, stripRows;
+	size_t				srcStrip, dstStrip;
+	EngineError			err;
+	
+	err = EngineBeginSession(xform, src->layout, dst->layout, src->width, &session);
+	if (err != kEngineNoErr)
+		return 1;
+	
+	stripRows = kStripBytes / (src->rowBytes > dst->rowBytes ? src->rowBytes : dst->rowBytes);
+	if (stripRows == 0)
+		stripRows = 1;
+	
+	AdviseRange(srcBase, src->offset, (size_t)src->rowBytes * src->height, MADV_SEQUENTIAL);
+	AdviseRange(srcBase, src->offset, (size_t)src->rowBytes * stripRows, MADV_WILLNEED);
+	
+	for (row=0; row < src->height && err == kEngineNoErr; row += rows)
+	{
+		rows = src->height - row;
+		if (rows > stripRows)
+			rows = stripRows;
+		srcStrip = src->offset + (size_t)src->rowBytes * row;
+		dstStrip = dst->offset + (size_t)dst->rowBytes * row;
+		
+		nextRows = src->height - row - rows;
+		if (nextRows > stripRows)
+			nextRows = stripRows;
+		if (nextRows)
+			AdviseRange(srcBase, srcStrip + (size_t)src->rowBytes * rows, (size_t)src->rowBytes * nextRows, MADV_WILLNEED);
+		
+		err = EngineMatchStrip(session, srcBase + srcStrip, src->rowBytes,
+							   dstBase + dstStrip, dst->rowBytes, rows);
+		
+		SyncRange(dstBase, dstStrip, (size_t)dst->rowBytes * rows);
+	}
+	
+	EngineEndSession(session);
+	
+	return err != kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- ConvertDirectory
+//	Converts every visible file of the source directory on a pool of
+//	threads. Each file is matched band parallel as well, so the pool
+//	is only there to keep one file's pages moving to or from the disk
+//	while another is matched.
+//---------------------------------------------------------------------
+
+static void
+ConvertDirectory (uint32_t threads)
+{
+	pthread_t*			pool;
+	struct dirent*		entry;
+	DIR*				dir;
+	char**				names;
+	uint32_t			i, started, capacity = 0;
+	
+	if (gConvert.dstPath && mkdir(gConvert.dstPath, 0755) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "%s: %s\n", gConvert.dstPath, strerror(errno));
+		gConvert.failures++;
+		return;
+	}
+	
+	dir = opendir(gConvert.srcPath);
+	if (dir == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", gConvert.srcPath, strerror(errno));
+		gConvert.failures++;
+		return;
+	}
+	
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		
+		if (gConvert.nameCount == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			names = (char**)realloc(gConvert.names, capacity * sizeof(char*));
+			if (names == NULL)
+				break;
+			gConvert.names = names;
+		}
+		gConvert.names[gConvert.nameCount] = strdup(entry->d_name);
+		if (gConvert.names[gConvert.nameCount] == NULL)
+			break;
+		gConvert.nameCount++;
+	}
+	closedir(dir);
+	
+	if (threads > gConvert.nameCount)
+		threads = gConvert.nameCount;
+	
+	pool = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	for (started=0; pool && started < threads; started++)
+		if (pthread_create(&pool[started], NULL, &ConvertWorker, NULL) != 0)
+			break;
+	
+	// Convert on this thread too if no worker could be started
+	if (started == 0)
+		ConvertWorker(NULL);
+	
+	for (i=0; i < started; i++)
+		pthread_join(pool[i], NULL);
+	
+	for (i=0; i < gConvert.nameCount; i++)
+		free(gConvert.names[i]);
+	free(gConvert.names);
+	free(pool);
+}
+
+
+//--------------------------------------------------------------------- ConvertWorker
+//	Takes the next file of the directory until there are none left.
+
+static void*
+ConvertWorker (void* arg)
+{
+	struct stat			info;
+	char				srcPath[PATH_MAX], dstPath[PATH_MAX];
+	const char*			name;
+	int					failed;
+	
+	(void)arg;
+	for (;;)
+	{
+		pthread_mutex_lock(&gConvert.lock);
+		name = (gConvert.nextName < gConvert.nameCount) ? gConvert.names[gConvert.nextName++] : NULL;
+		pthread_mutex_unlock(&gConvert.lock);
+		if (name == NULL)
+			break;
+		
+		snprintf(srcPath, sizeof(srcPath), "%s/%s", gConvert.srcPath, name);
+		if (stat(srcPath, &info) != 0 || !S_ISREG(info.st_mode))
+			continue;
+		
+		if (gConvert.dstPath)
+		{
+			snprintf(dstPath, sizeof(dstPath), "%s/%s", gConvert.dstPath, name);
+			failed = ConvertFile(srcPath, dstPath);
+		}
+		else
+			failed = ConvertFile(srcPath, NULL);
+		
+		if (failed)
+		{
+			pthread_mutex_lock(&gConvert.lock);
+			gConvert.failures++;
+			pthread_mutex_unlock(&gConvert.lock);
+		}
+	}
+	
+	return NULL;
+}
+
+
+//--------------------------------------------------------------------- GetTransform
+//	Transforms are made once for each source layout and shared by all the
+//	files and threads, so a draft grid is only ever sampled once.
+//---------------------------------------------------------------------
+
+static int
+GetTransform (EngineLayout srcLayout, EngineTransformRef* xform)
+{
+	EngineTransformKey	key;
+	EngineError			err = kEngineNoErr;
+	
+	pthread_mutex_lock(&gConvert.lock);
+	if (gConvert.transforms[srcLayout] == NULL)
+	{
+		memset(&key, 0, sizeof(key));
+		key.srcSpace = gConvertLayouts[srcLayout].space;
+		key.dstSpace = gConvertLayouts[gConvert.dstLayout].space;
+		key.srcTransform = kEngineDeviceToPCS;
+		key.dstTransform = kEnginePCSToDevice;
+		key.quality = gConvert.quality;
+		key.precision = gConvert.precision;
+		key.gridPoints = gConvert.gridPoints;
+		err = EngineNewTransform(&key, &gConvert.transforms[srcLayout]);
+	}
+	*xform = gConvert.transforms[srcLayout];
+	pthread_mutex_unlock(&gConvert.lock);
+	
+	return err != kEngineNoErr;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- PNM headers -----
+#endif
+
+
+//--------------------------------------------------------------------- ReadHeader
+//	Reads a P5, P6 or P7 header. Returns zero if data is not one or its
+//	pixels are not in an engine layout.
+//---------------------------------------------------------------------
+
+static int
+ReadHeader (const uint8_t* data, size_t size, ImageRec* image)
+{
+	uint32_t			value[3];
+	size_t				pos = 2;
+	int					i;
+	
+	if (size < 3 || data[0] != 'P')
+		return 0;
+	
+	if (data[1] == '7')
+		return ReadPAMHeader(data, size, image);
+	if (data[1] != '5' && data[1] != '6')
+		return 0;
+	
+	// Width, height and maxval, each after white space and comments
+	for (i=0; i < 3; i++)
+	{
+		for (;;)
+		{
+			if (pos >= size)
+				return 0;
+			if (data[pos] == '#')
+				while (pos < size && data[pos] != '\n')
+					pos++;
+			else if (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\r' || data[pos] == '\n')
+				pos++;
+			else
+				break;
+		}
+		
+		value[i] = 0;
+		if (data[pos] < '0' || data[pos] > '9')
+			return 0;
+		while (pos < size && data[pos] >= '0' && data[pos] <= '9')
+		{
+			value[i] = value[i] * 10 + (data[pos++] - '0');
+			if (value[i] > 100000)
+				return 0;
+		}
+	}
+	
+	// A single white space character ends the header
+	if (pos >= size || value[0] == 0 || value[1] == 0)
+		return 0;
+	
+	image->layout	= PNMLayout(data[1] == '5' ? 1 : 3, value[2], NULL);
+	image->width	= value[0];
+	image->height	= value[1];
+	image->rowBytes	= image->width * gConvertLayouts[image->layout].pixelBytes;
+	image->offset	= pos + 1;
+	image->pnm		= 1;
+	
+	return image->layout != kEngineGamut1;
+}
+
+
+//--------------------------------------------------------------------- ReadPAMHeader
+
+static int
+ReadPAMHeader (const uint8_t* data, size_t size, ImageRec* image)
+{
+	char				line[kMaxHeader];
+	char				tupleType[16] = "";
+	uint32_t			width = 0, height = 0, depth = 0, maxval = 0;
+	size_t				pos = 3, n;
+	
+	if (size < 3 || data[2] != '\n')
+		return 0;
+	
+	for (;;)
+	{
+		for (n=0; pos < size && data[pos] != '\n'; pos++)
+			if (n < sizeof(line) - 1)
+				line[n++] = (char)data[pos];
+		line[n] = 0;
+		if (pos++ >= size)
+			return 0;
+		
+		if (strcmp(line, "ENDHDR") == 0)
+			break;
+		
+		// One field a line, the first that reads stops the others; comments
+		// and unknown fields read as none
+		if (sscanf(line, " WIDTH %u", &width) != 1 && sscanf(line, " HEIGHT %u", &height) != 1 &&
+			sscanf(line, " DEPTH %u", &depth) != 1 && sscanf(line, " MAXVAL %u", &maxval) != 1)
+			sscanf(line, " TUPLTYPE %15s", tupleType);
+	}
+	
+	if (width == 0 || height == 0 || width > 100000 || height > 100000)
+		return 0;
+	
+	image->layout	= PNMLayout(depth, maxval, tupleType);
+	image->width	= width;
+	image->height	= height;
+	image->rowBytes	= width * gConvertLayouts[image->layout].pixelBytes;
+	image->offset	= pos;
+	image->pnm		= 1;
+	
+	return image->layout != kEngineGamut1;
+}
+
+
+//--------------------------------------------------------------------- WriteHeader
+//	Writes the header of image into header, without a terminating zero,
+//	and returns its length. With a length to pad to, white space is added
+//	after the first token to reach it exactly, or zero is returned if the
+//	header is longer.
+//---------------------------------------------------------------------
+
+static size_t
+WriteHeader (const ImageRec* image, size_t pad, char* header)
+{
+	const EngineLayoutInfo*	layout = &gConvertLayouts[image->layout];
+	const PNMFormRec*		form = FindPNMForm(image->layout);
+	uint32_t				maxval = (layout->pixelBytes / form->chans == 1) ? 255 : 65535;
+	char					rest[kMaxHeader];
+	const char*				first;
+	size_t					firstBytes, restBytes;
+	
+	// RGB with alpha has only the PAM form
+	if ((layout->space == kEngineGrayData || layout->space == kEngineRGBData) && !layout->alpha)
+	{
+		first = (layout->space == kEngineGrayData) ? "P5" : "P6";
+		snprintf(rest, sizeof(rest), "\n%u %u\n%u\n", image->width, image->height, maxval);
+	}
+	else
+	{
+		first = "P7\nWIDTH";
+		snprintf(rest, sizeof(rest), " %u\nHEIGHT %u\nDEPTH %u\nMAXVAL %u\nTUPLTYPE %s\nENDHDR\n",
+				 image->width, image->height, form->chans, maxval, form->tupleType);
+	}
+	
+	firstBytes = strlen(first);
+	restBytes = strlen(rest);
+	if (pad == 0)
+		pad = firstBytes + restBytes;
+	if (firstBytes + restBytes > pad || pad > kMaxHeader)
+		return 0;
+	
+	memcpy(header, first, firstBytes);
+	memset(header + firstBytes, ' ', pad - firstBytes - restBytes);
+	memcpy(header + pad - restBytes, rest, restBytes);
+	return pad;
+}
+
+
+//--------------------------------------------------------------------- PNMLayout
+//	Returns kEngineGamut1 if there is no layout for the PNM pixels.
+
+static EngineLayout
+PNMLayout (uint32_t chans, uint32_t maxval, const char* tupleType)
+{
+	const PNMFormRec*	form;
+	uint32_t			chanBytes = (maxval == 255) ? 1 : (maxval == 65535) ? 2 : 0;
+	
+	for (form=gPNMForms; form < gPNMForms + sizeof(gPNMForms) / sizeof(gPNMForms[0]); form++)
+	{
+		if (form->chans != chans || gConvertLayouts[form->layout].pixelBytes != chans * chanBytes)
+			continue;
+		if (tupleType == NULL || strcmp(tupleType, form->tupleType) == 0)
+			return form->layout;
+	}
+	
+	return kEngineGamut1;
+}
+
+
+//--------------------------------------------------------------------- FindPNMForm
+//	Returns NULL if layout has no PNM form.
+
+static const PNMFormRec*
+FindPNMForm (EngineLayout layout)
+{
+	uint32_t			i;
+	
+	for (i=0; i < sizeof(gPNMForms) / sizeof(gPNMForms[0]); i++)
+		if (gPNMForms[i].layout == layout)
+			return &gPNMForms[i];
+	
+	return NULL;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- utilities -----
+#endif
+
+
+//--------------------------------------------------------------------- FindLayoutName
+
+static int
+FindLayoutName (const char* name, EngineLayout* layout)
+{
+	uint32_t			i;
+	
+	for (i=0; i < kConvertLayoutCount; i++)
+	{
+		if (strcmp(name, gConvertLayouts[i].name) == 0)
+		{
+			*layout = (EngineLayout)i;
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------- AdviseRange
+//	madvise wants whole pages; the range is widened to them.
+
+static void
+AdviseRange (void* base, size_t offset, size_t bytes, int advice)
+{
+	size_t				page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t				start = offset & ~(page - 1);
+	
+	madvise((uint8_t*)base + start, offset + bytes - start, advice);
+}
+
+
+//--------------------------------------------------------------------- SyncRange
+//	Starts writing a matched strip back without waiting for it.
+
+static void
+SyncRange (void* base, size_t offset, size_t bytes)
+{
+	size_t				page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t				start = offset & ~(page - 1);
+	
+	msync((uint8_t*)base + start, offset + bytes - start, MS_ASYNC);
+}
@@ -0,0 +1,6742 @@
+/*
+	File:		DemoCMMEngine.c
+
+	Contains:	Color conversion engine of the Demo CMM.
+				
+				Converts between RGB, CMYK, Lab, XYZ and Gray with the simple
+				formulas described in DemoCMM.c, on single colors and on
+				bitmaps. Nothing here depends on ColorSync.
+				
+	Version:	ColorSync 2 or later
+
+	Copyright:	2002 by Apple Computer, Inc., all rights reserved.
+*/
+
+
+#if defined(__APPLE__)
+#include <MacTypes.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+typedef uint8_t			UInt8;
+typedef int16_t			SInt16;
+typedef uint16_t		UInt16;
+typedef uint32_t		UInt32;
+typedef int32_t			SInt32;
+typedef int64_t			SInt64;
+typedef uint64_t		UInt64;
+typedef uint32_t		OSType;
+typedef unsigned char	Boolean;
+enum { false = 0, true = 1 };
+#define nil				NULL
+#endif
+
+#ifndef TARGET_RT_LITTLE_ENDIAN
+#define TARGET_RT_LITTLE_ENDIAN		(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#endif
+
+#ifndef Endian16_Swap
+#define Endian16_Swap(v)	((UInt16)(((v) << 8) | ((v) >> 8)))
+#endif
+
+#ifndef Endian32_Swap
+#define Endian32_Swap(v)	((UInt32)(((v) << 24) | (((v) << 8) & 0x00FF0000) | (((v) >> 8) & 0x0000FF00) | ((v) >> 24)))
+#endif
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "DemoCMMEngine.h"
+
+
+#ifndef USE_SSE2
+#if defined(__SSE2__)
+#define USE_SSE2		1
+#else
+#define USE_SSE2		0
+#endif
+#endif // USE_SSE2
+
+#if USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifndef USE_F16C
+#if defined(__F16C__) && USE_SSE2
+#define USE_F16C		1
+#else
+#define USE_F16C		0
+#endif
+#endif // USE_F16C
+
+#if USE_F16C
+#include <immintrin.h>
+#endif
+
+
+typedef void (*MatchOneProc) (UInt16* chan);
+
+// Version of a MatchOneProc for the nodes of a grid, in output code values
+// neither rounded nor clamped
+typedef void (*SampleProc) (const UInt16* chan, double* codes);
+
+// Pixels converted per call of the row kernels
+#define		kMatchBlockPixels		256
+
+// Colors the memo of a band remembers, in sets of two, and the colors it
+// judges its hit rate over
+#define		kMemoSetBits			11
+#define		kMemoSlots				(2 << kMemoSetBits)
+#define		kMemoWindow				4096
+
+// Fewest pixels a band must have to be matched through a memo; fewer
+// would not pay for clearing it
+#define		kMemoMinPixels			4096
+
+// Pixels per band handed to a worker thread
+#define		kBandPixels				(64 * 1024)
+
+typedef void (*BandProc) (void* data, UInt32 firstRow, UInt32 rowCount);
+
+// Points per channel of the grids the costly conversions are sampled
+// into, unless the key asks for 17 or 65
+#define		kDefaultGridPoints		33
+
+// Memory the transform cache may hold on to, 0 turns the cache off
+#ifndef TRANSFORM_CACHE_BYTES
+#define		TRANSFORM_CACHE_BYTES	(8 * 1024 * 1024)
+#endif
+#define		kTransformCacheBuckets	64
+
+
+// Float channels in the units of a space, to and from the 16 bit code
+// values the float kernels work in, unrounded and unclamped
+typedef struct
+{
+	OSType				space;
+	float				scale[4];		// code value of 1.0
+	float				offset[4];		// code value of 0.0
+	float				inverse[4];		// 1.0 / scale
+} ScaleRec;
+
+typedef struct EngineTransform	CMMTransformRec, *CMMTransformPtr;
+
+typedef void (*MatchBlockProc) (CMMTransformPtr xform, UInt16* chan, UInt32 count);
+typedef void (*UnpackProc) (UInt8* const* buf, UInt32 colBytes, UInt16* chan, UInt32 count);
+typedef void (*PackProc) (const UInt16* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count);
+typedef void (*MatchBlock8Proc) (UInt8* chan, UInt32 count);
+typedef void (*UnpackByteProc) (UInt8* const* buf, UInt32 colBytes, UInt8* chan, UInt32 count);
+typedef void (*PackByteProc) (const UInt8* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count);
+typedef void (*CheckBlockProc) (UInt16* chan, UInt32 count, UInt8* out);
+typedef void (*GatherProc) (const UInt8* index, UInt8* dst, UInt32 colBytes, const UInt8* palette, UInt32 count);
+typedef void (*MatchFloatProc) (CMMTransformPtr xform, float* chan, UInt32 count);
+typedef void (*UnpackFloatProc) (UInt8* const* buf, UInt32 colBytes, float* chan, UInt32 count, const ScaleRec* scale);
+typedef void (*PackFloatProc) (const float* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count, const ScaleRec* scale);
+typedef void (*UnpackAlphaProc) (const UInt8* buf, UInt32 colBytes, UInt16* alpha, UInt32 count);
+typedef void (*PackAlphaProc) (const UInt16* alpha, UInt8* buf, UInt32 colBytes, UInt32 count);
+
+
+// Compiled transform. Never changed once CompileTransform returns, but
+// for the counters, so any number of threads may match through it at once.
+struct EngineTransform
+{
+	UInt32				refCount;		// changed with atomic ops only
+	UInt64				memoRuns;		// counters of EngineMemoStats, likewise
+	UInt64				memoHits;
+	UInt64				memoMisses;
+	UInt64				memoBypassed;
+	
+	OSType				srcSpace;
+	OSType				srcClass;
+	OSType				dstSpace;
+	OSType				dstClass;
+	UInt32				viaCount;
+	OSType				via[kEngineMaxVia];	// as given in the key
+	UInt32				quality;		// kEngineNormalMode, kEngineDraftMode or kEngineBestMode
+	UInt32				precision;		// as given in the key
+	UInt32				memo;			// as given in the key
+	Boolean				memoize;		// match bitmaps and colors through a memo
+	MatchOneProc		proc;
+	MatchBlockProc		block;			// proc applied to a block of colors
+	MatchBlock8Proc		block8;			// 8 bit version of block, if any
+	
+	// Sampled proc, nil when proc is evaluated directly. The nodes hold
+	// code values from -32768 to 98302 in steps of two, see BuildGrid.
+	UInt16*				grid;
+	UInt32				gridPoints;		// from the key, 0 there is kDefaultGridPoints
+	UInt32				gridOutChans;
+	Boolean				gridShaped;		// channels go through gGridShaper first
+	Boolean				gridCubed;		// nodes hold the shaped XYZ, see gGridUnshaper
+	MatchBlockProc		gridHead;		// CMYK to RGB before the grid, or nil
+	MatchBlockProc		gridTail[2];	// to RGB and to CMYK after it, nil if not
+	
+	// Conversions of the chain, in order, for the gamut check
+	const struct ConversionRec*	steps[kEngineMaxVia + 1];
+	UInt32				stepCount;
+	
+	// Block of each conversion at the precision of the chain, run in turn
+	// by MatchBlock_Chain
+	MatchBlockProc		stepBlocks[kEngineMaxVia + 1];
+};
+
+
+typedef EngineTransformKey		TransformKey;
+
+
+// Conversion table entry
+typedef struct ConversionRec
+{
+	OSType				srcSpace;
+	OSType				dstSpace;
+	MatchOneProc		proc;
+	MatchBlockProc		block;
+	MatchBlock8Proc		block8;			// bit-identical 8 bit version of block
+	MatchBlockProc		fast;			// single precision version of block
+	MatchBlockProc		fixed;			// integer version of block
+	Boolean				sampled;		// costly enough to be worth a grid
+	CheckBlockProc		check;			// flags the colors out of gamut, nil if none can be
+	MatchFloatProc		floating;		// version of block on float codes, for the float layouts
+	SampleProc			sample;			// proc for the nodes of a grid it ends, nil if none
+} ConversionRec;
+
+
+// Match stuff
+typedef struct
+{
+	CMMTransformPtr		transform;
+	
+	UInt32				height;
+	UInt32				width;
+	
+	OSType				srcSpace;
+	UInt8*				srcBuf[4];
+	UInt32				srcChanBits;
+	UInt32				srcRowBytes[4];		// of the plane of each channel
+	UInt32				srcColBytes[4];
+	Boolean				srcSwap;
+	UInt32				srcWord;
+	UInt32				srcSample;
+	
+	OSType				dstSpace;
+	UInt8*				dstBuf[4];
+	UInt32				dstChanBits;
+	UInt32				dstRowBytes[4];
+	UInt32				dstColBytes[4];
+	Boolean				dstSwap;
+	UInt32				dstWord;
+	UInt32				dstSample;
+	
+	// Row kernels, chosen once by SetupMatchKernels
+	UInt32				srcChans;
+	UInt32				dstChans;
+	UnpackProc			unpack;
+	PackProc			pack;
+	MatchBlockProc		block;
+	
+	// An identity between layouts that differ only in byte order, whose
+	// rows are swapped whole by SwapRows
+	Boolean				swapOnly;
+	
+	// Channels not all the same distance apart, unpacked or packed one at
+	// a time by the one channel kernels
+	Boolean				srcSplit;
+	Boolean				dstSplit;
+	
+	// 8 bit kernels, used when native8 is set
+	Boolean				native8;
+	UnpackByteProc		unpackByte;
+	PackByteProc		packByte;
+	MatchBlock8Proc		block8;
+	
+	// Float kernels, used when floating is set. The side whose channels
+	// are integers is unpacked and packed as codes.
+	Boolean				floating;
+	UnpackFloatProc		unpackFloat;
+	PackFloatProc		packFloat;
+	const ScaleRec*		srcScale;
+	const ScaleRec*		dstScale;
+	
+	// Alpha, one 16 bit code per color beside the block buffer, from the
+	// source or opaque, to the destination if it has alpha. Premultiplied
+	// colors are divided by it before the match and multiplied after.
+	UInt32				srcAlpha;		// kAlphaNone, kAlphaStraight or kAlphaPremultiplied
+	UInt8*				srcAlphaBuf;
+	UInt32				srcAlphaRowBytes;
+	UInt32				srcAlphaColBytes;
+	UInt32				dstAlpha;
+	UInt8*				dstAlphaBuf;
+	UInt32				dstAlphaRowBytes;
+	UInt32				dstAlphaColBytes;
+	UnpackAlphaProc		unpackAlpha;
+	PackAlphaProc		packAlpha;
+	Boolean				unpremultiply;
+	Boolean				premultiply;
+	
+	// Gamut check, a bit per color instead of dstBuf
+	UInt8*				chkBuf;
+	UInt32				chkRowBytes;
+	Boolean				chkWords;		// 32 bit words rather than bytes
+	
+} CMMMatchRec, *CMMMatchPtr, **CMMMatchHdl;
+
+
+// Layouts whose channels share one word of each pixel
+enum
+{
+	kWordNone			= 0,
+	kWord555,
+	kWord565,
+	kWord101010,
+	kWordCount
+};
+
+// Number format of the channels
+enum
+{
+	kSampleUInt			= 0,
+	kSampleFloat,
+	kSampleHalf
+};
+
+// Alpha of the layouts with an alpha channel, which is in offset[3]
+// after three color channels
+enum
+{
+	kAlphaNone			= 0,
+	kAlphaStraight,
+	kAlphaPremultiplied
+};
+
+// Bitmap layout table entry
+typedef struct
+{
+	const char*			name;			// the EngineLayout constant less kEngine
+	OSType				space;
+	UInt32				chans;
+	UInt32				chanBits;
+	UInt32				colBytes;
+	UInt32				offset[4];		// byte offset of each channel
+	Boolean				little;			// 16 bit channels or words are little endian
+	UInt32				word;			// channels packed into a word, or kWordNone
+	UInt32				sample;			// kSampleUInt, kSampleFloat or kSampleHalf
+	UInt32				alpha;			// kAlphaNone, kAlphaStraight or kAlphaPremultiplied
+} LayoutRec;
+
+
+// Colors a band has matched, by their source channels
+typedef struct MemoRec
+{
+	struct MemoRec*		next;			// in gMemoPool while not in use
+	UInt64				lastKey;		// the color before, for runs
+	UInt64				lastResult;
+	Boolean				lastValid;
+	Boolean				off;			// too few colors found, match directly
+	UInt32				windowColors;
+	UInt32				windowFound;
+	UInt64				runs;
+	UInt64				hits;
+	UInt64				misses;
+	UInt64				bypassed;
+	Boolean				used[kMemoSlots];
+	
+	// Not cleared between bands, only read where used is set
+	UInt64				key[kMemoSlots];
+	UInt64				result[kMemoSlots];
+} MemoRec;
+
+
+// Indexed bitmap, matched by copying the matched colors of its table
+typedef struct
+{
+	const UInt8*		src;
+	UInt32				srcRowBytes;
+	UInt8*				dst;			// first channel of the first pixel
+	UInt32				dstRowBytes;
+	UInt32				dstColBytes;
+	UInt32				width;
+	GatherProc			gather;
+	UInt8				palette[256 * 16];	// matched colors, 16 bytes apart
+} IndexedRec;
+
+
+// Streaming match, set up once by EngineBeginSession
+struct EngineSession
+{
+	CMMMatchRec			matchInfo;
+	const LayoutRec*	src;
+	const LayoutRec*	dst;
+};
+
+
+
+
+
+// function prototypes
+static EngineError CompileTransform	(CMMTransformPtr xform);
+static EngineError CompileChain		(CMMTransformPtr xform, const OSType* spaces, UInt32 count);
+static EngineError BuildGrid		(CMMTransformPtr xform, const OSType* spaces, UInt32 count);
+static MatchBlockProc StepBlock		(const ConversionRec* conv, UInt32 quality, UInt32 precision);
+static void    InitGridShaper		(void);
+static double  ShapeCode			(double code);
+static double  UnshapeCode			(double shaped);
+static const LayoutRec* FindLayout	(EngineLayout layout);
+static const ScaleRec* FindScale	(OSType space);
+static const LayoutRec* FindPlanarLayout (const EnginePlanarBitmap* map, OSType space);
+static void    SetMatchBuffers		(CMMMatchPtr pMatchInfo, const LayoutRec* src, const void* srcImage, UInt32 srcRowBytes,
+									 const LayoutRec* dst, void* dstImage, UInt32 dstRowBytes);
+static void    GridInterp			(CMMTransformPtr xform, UInt16* chan);
+static void    InitFixedTables		(void);
+static void    SetupMatchKernels	(CMMMatchPtr pMatchInfo);
+static void    MatchAll				(CMMMatchPtr pMatchInfo);
+static void    MatchRows			(CMMMatchPtr pMatchInfo, UInt32 firstRow, UInt32 rowCount);
+static void    MatchRowsFloat		(CMMMatchPtr pMatchInfo, UInt32 firstRow, UInt32 rowCount);
+static void    SwapRows			(CMMMatchPtr pMatchInfo, UInt32 firstRow, UInt32 rowCount);
+static UInt8*  WholePixels			(UInt8* const* buf, const UInt32* rowBytes, const UInt32* colBytes, UInt32 chans,
+									 UInt8* alphaBuf, UInt32 alphaRowBytes, UInt32 alphaColBytes);
+static void    UnpackBlock			(CMMMatchPtr pMatchInfo, UInt8* const* sRow, UInt16* chan, UInt32 count);
+static void    PackBlock			(CMMMatchPtr pMatchInfo, const UInt16* chan, UInt8* const* dRow, UInt32 count);
+static void    CodesToFloats		(const UInt16* codes, float* chan, UInt32 count);
+static void    FloatsToCodes		(const float* chan, UInt16* codes, UInt32 count);
+static void    SwapBytes16			(const UInt8* src, UInt8* dst, UInt32 count);
+static void    Premultiply			(UInt16* chan, const UInt16* alpha, UInt32 count);
+static void    Unpremultiply		(UInt16* chan, const UInt16* alpha, UInt32 count);
+static void    MatchBand			(void* data, UInt32 firstRow, UInt32 rowCount);
+static EngineError MatchIndexed		(CMMTransformPtr xform, const EngineBitmap* srcMap, const EngineBitmap* dstMap,
+									 EngineProgressProc progressProc, void* refCon);
+static void    IndexedBand			(void* data, UInt32 firstRow, UInt32 rowCount);
+static void    MatchBlockPadded		(MatchBlockProc block, CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void    MatchBlockMemo		(CMMTransformPtr xform, UInt16* chan, UInt32 count, UInt64 mask, MemoRec* memo);
+static MemoRec* TakeMemo			(void);
+static void    GiveMemo				(MemoRec* memo);
+static void    CheckRows			(CMMMatchPtr pMatchInfo, UInt32 firstRow, UInt32 rowCount);
+static void    CheckBand			(void* data, UInt32 firstRow, UInt32 rowCount);
+static EngineError RunBands			(BandProc proc, void* data, UInt32 height, UInt32 width,
+									 EngineProgressProc progressProc, void* refCon);
+static void MatchBlock_Grid		(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_Chain	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_RGB_CMYK	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_CMYK_RGB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_RGB_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_XYZ_RGB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_RGB_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_LAB_RGB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_XYZ_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_LAB_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_XYZ_Gray	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_Gray_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_CMYK_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_LAB_CMYK	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_CMYK_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_XYZ_CMYK	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_RGB_Gray	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_Gray_RGB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_LAB_Gray	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_Gray_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_CMYK_Gray	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlock_Gray_CMYK	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_RGB_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_XYZ_RGB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_Gray_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_XYZ_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_LAB_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_RGB_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_LAB_RGB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_RGB_Gray	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_CMYK_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_XYZ_CMYK	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_CMYK_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_LAB_CMYK	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFast_CMYK_Gray	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_RGB_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_XYZ_RGB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_Gray_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_XYZ_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_LAB_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_RGB_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_LAB_RGB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_RGB_Gray	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_CMYK_XYZ	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_XYZ_CMYK	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_CMYK_LAB	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_LAB_CMYK	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchBlockFixed_CMYK_Gray	(CMMTransformPtr xform, UInt16* chan, UInt32 count);
+static void MatchFloat_RGB_CMYK	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_RGB_XYZ	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_RGB_LAB	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_RGB_Gray	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_CMYK_RGB	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_CMYK_LAB	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_CMYK_XYZ	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_CMYK_Gray	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_XYZ_RGB	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_XYZ_LAB	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_XYZ_CMYK	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_XYZ_Gray	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_LAB_RGB	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_LAB_XYZ	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_LAB_CMYK	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_LAB_Gray	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_Gray_RGB	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_Gray_CMYK	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_Gray_XYZ	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void MatchFloat_Gray_LAB	(CMMTransformPtr xform, float* chan, UInt32 count);
+static void CheckBlock_XYZ_RGB	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_XYZ_LAB	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_LAB_XYZ	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_RGB_LAB	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_LAB_RGB	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_CMYK_XYZ	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_XYZ_CMYK	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_CMYK_LAB	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_LAB_CMYK	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_CMYK_Gray	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_CMYK_RGB	(UInt16* chan, UInt32 count, UInt8* out);
+static void CheckBlock_XYZ_Gray	(UInt16* chan, UInt32 count, UInt8* out);
+static void MatchBlock8_RGB_CMYK	(UInt8* chan, UInt32 count);
+static void MatchBlock8_CMYK_RGB	(UInt8* chan, UInt32 count);
+static void MatchBlock8_Gray_RGB	(UInt8* chan, UInt32 count);
+static void MatchBlock8_Gray_CMYK	(UInt8* chan, UInt32 count);
+static void MatchBlock8_LAB_Gray	(UInt8* chan, UInt32 count);
+static void MatchBlock8_Gray_LAB	(UInt8* chan, UInt32 count);
+static void MatchOne_RGB_CMYK	(UInt16* chan);
+static void MatchOne_CMYK_RGB	(UInt16* chan);
+static void MatchOne_RGB_XYZ	(UInt16* chan);
+static void MatchOne_XYZ_RGB	(UInt16* chan);
+static void MatchOne_RGB_LAB	(UInt16* chan);
+static void MatchOne_LAB_RGB	(UInt16* chan);
+static void MatchOne_XYZ_LAB	(UInt16* chan);
+static void MatchOne_LAB_XYZ	(UInt16* chan);
+static void MatchOne_XYZ_Gray	(UInt16* chan);
+static void MatchOne_Gray_XYZ	(UInt16* chan);
+static void MatchOne_CMYK_LAB	(UInt16* chan);
+static void MatchOne_LAB_CMYK	(UInt16* chan);
+static void MatchOne_CMYK_XYZ	(UInt16* chan);
+static void MatchOne_XYZ_CMYK	(UInt16* chan);
+static void MatchOne_RGB_Gray	(UInt16* chan);
+static void MatchOne_Gray_RGB	(UInt16* chan);
+static void MatchOne_LAB_Gray	(UInt16* chan);
+static void MatchOne_Gray_LAB	(UInt16* chan);
+static void MatchOne_CMYK_Gray	(UInt16* chan);
+static void MatchOne_Gray_CMYK	(UInt16* chan);
+static void Sample_RGB_XYZ		(const UInt16* chan, double* codes);
+static void Sample_XYZ_RGB		(const UInt16* chan, double* codes);
+static void Sample_RGB_LAB		(const UInt16* chan, double* codes);
+static void Sample_LAB_RGB		(const UInt16* chan, double* codes);
+static void Sample_XYZ_LAB		(const UInt16* chan, double* codes);
+static void Sample_LAB_XYZ		(const UInt16* chan, double* codes);
+static void Sample_RGB_Gray		(const UInt16* chan, double* codes);
+
+
+
+
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- matching -----
+#endif
+
+
+//--------------------------------------------------------------------- EngineMatchColors
+
+EngineError
+EngineMatchColors (EngineTransformRef xform, void* colors, uint32_t count, uint32_t colorBytes)
+{
+	CMMMatchRec			matchInfo;
+	UInt32				i;
+	
+	// Check params
+	if (xform==nil || colors==nil)
+		return kEngineParamErr;
+	
+	matchInfo.transform		= xform;
+	matchInfo.height		= 1;
+	matchInfo.width			= count;
+	
+	matchInfo.srcSpace		= xform->srcSpace;
+	matchInfo.srcChanBits	= 16;
+	matchInfo.srcSwap		= false;
+	matchInfo.srcWord		= kWordNone;
+	matchInfo.srcSample		= kSampleUInt;
+	matchInfo.srcAlpha		= kAlphaNone;
+	matchInfo.srcAlphaBuf	= nil;
+	
+	matchInfo.dstSpace		= xform->dstSpace;
+	matchInfo.dstChanBits	= 16;
+	matchInfo.dstSwap		= false;
+	matchInfo.dstWord		= kWordNone;
+	matchInfo.dstSample		= kSampleUInt;
+	matchInfo.dstAlpha		= kAlphaNone;
+	matchInfo.dstAlphaBuf	= nil;
+	
+	for (i=0; i < 4; i++)
+	{
+		matchInfo.srcBuf[i] = (UInt8*)colors + i * sizeof(UInt16);
+		matchInfo.dstBuf[i] = (UInt8*)colors + i * sizeof(UInt16);
+		matchInfo.srcRowBytes[i] = matchInfo.dstRowBytes[i] = count * colorBytes;
+		matchInfo.srcColBytes[i] = matchInfo.dstColBytes[i] = colorBytes;
+	}
+	
+	SetupMatchKernels(&matchInfo);
+	MatchAll(&matchInfo);
+	
+	return kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- EngineGetMemoStats
+
+void
+EngineGetMemoStats (EngineTransformRef xform, EngineMemoStats* stats)
+{
+	if (xform==nil || stats==nil)
+		return;
+	
+	stats->runs		= __sync_add_and_fetch(&xform->memoRuns, 0);
+	stats->hits		= __sync_add_and_fetch(&xform->memoHits, 0);
+	stats->misses	= __sync_add_and_fetch(&xform->memoMisses, 0);
+	stats->bypassed	= __sync_add_and_fetch(&xform->memoBypassed, 0);
+}
+
+
+//--------------------------------------------------------------------- EngineMatchBitmap
+
+EngineError
+EngineMatchBitmap (EngineTransformRef xform, const EngineBitmap* srcMap, const EngineBitmap* dstMap,
+				   EngineProgressProc progressProc, void* refCon)
+{
+	CMMMatchRec			matchInfo;
+	const LayoutRec*	src;
+	const LayoutRec*	dst;
+	
+	// Check params
+	if (xform==nil || srcMap==nil || dstMap==nil)
+		return kEngineParamErr;
+	
+	if (srcMap->layout == kEngineIndexed8)
+		return MatchIndexed(xform, srcMap, dstMap, progressProc, refCon);
+	
+	src = FindLayout(srcMap->layout);
+	if (src == nil || src->space != xform->srcSpace)
+		return kEngineInvalidSrcMapErr;
+	
+	dst = FindLayout(dstMap->layout);
+	if (dst == nil || dst->space != xform->dstSpace)
+		return kEngineInvalidDstMapErr;
+	
+	matchInfo.transform		= xform;
+	matchInfo.height		= srcMap->height;
+	matchInfo.width			= srcMap->width;
+	
+	matchInfo.srcSpace		= src->space;
+	matchInfo.srcChanBits	= src->chanBits;
+	matchInfo.srcSwap		= (src->little != TARGET_RT_LITTLE_ENDIAN);
+	matchInfo.srcWord		= src->word;
+	matchInfo.srcSample		= src->sample;
+	matchInfo.srcAlpha		= src->alpha;
+	
+	matchInfo.dstSpace		= dst->space;
+	matchInfo.dstChanBits	= dst->chanBits;
+	matchInfo.dstSwap		= (dst->little != TARGET_RT_LITTLE_ENDIAN);
+	matchInfo.dstWord		= dst->word;
+	matchInfo.dstSample		= dst->sample;
+	matchInfo.dstAlpha		= dst->alpha;
+	
+	SetMatchBuffers(&matchInfo, src, srcMap->image, srcMap->rowBytes, dst, dstMap->image, dstMap->rowBytes);
+	SetupMatchKernels(&matchInfo);
+	
+	return RunBands(&MatchBand, &matchInfo, matchInfo.height, matchInfo.width, progressProc, refCon);
+}
+
+
+//--------------------------------------------------------------------- SetMatchBuffers
+//	Points the channels of pMatchInfo into new images of the same layouts.
+//	The row kernels only depend on the distances between the channels, so
+//	they stay as SetupMatchKernels chose them.
+//---------------------------------------------------------------------
+
+static void
+SetMatchBuffers (CMMMatchPtr pMatchInfo, const LayoutRec* src, const void* srcImage, UInt32 srcRowBytes,
+				 const LayoutRec* dst, void* dstImage, UInt32 dstRowBytes)
+{
+	UInt32				i;
+	
+	for (i=0; i < 4; i++)
+	{
+		pMatchInfo->srcBuf[i] = (i < src->chans) ? (UInt8*)srcImage + src->offset[i] : nil;
+		pMatchInfo->dstBuf[i] = (i < dst->chans) ? (UInt8*)dstImage + dst->offset[i] : nil;
+		pMatchInfo->srcRowBytes[i] = srcRowBytes;
+		pMatchInfo->dstRowBytes[i] = dstRowBytes;
+		pMatchInfo->srcColBytes[i] = src->colBytes;
+		pMatchInfo->dstColBytes[i] = dst->colBytes;
+	}
+	
+	pMatchInfo->srcAlphaBuf = src->alpha ? (UInt8*)srcImage + src->offset[3] : nil;
+	pMatchInfo->dstAlphaBuf = dst->alpha ? (UInt8*)dstImage + dst->offset[3] : nil;
+	pMatchInfo->srcAlphaRowBytes = srcRowBytes;
+	pMatchInfo->dstAlphaRowBytes = dstRowBytes;
+	pMatchInfo->srcAlphaColBytes = src->colBytes;
+	pMatchInfo->dstAlphaColBytes = dst->colBytes;
+}
+
+
+//--------------------------------------------------------------------- EngineMatchPlanar
+
+EngineError
+EngineMatchPlanar (EngineTransformRef xform, const EnginePlanarBitmap* srcMap,
+				   const EnginePlanarBitmap* dstMap, EngineProgressProc progressProc, void* refCon)
+{
+	CMMMatchRec			matchInfo;
+	const LayoutRec*	src;
+	const LayoutRec*	dst;
+	UInt32				i;
+	
+	// Check params
+	if (xform==nil || srcMap==nil || dstMap==nil)
+		return kEngineParamErr;
+	
+	src = FindPlanarLayout(srcMap, xform->srcSpace);
+	if (src == nil)
+		return kEngineInvalidSrcMapErr;
+	
+	dst = FindPlanarLayout(dstMap, xform->dstSpace);
+	if (dst == nil)
+		return kEngineInvalidDstMapErr;
+	
+	memset(&matchInfo, 0, sizeof(matchInfo));
+	matchInfo.transform		= xform;
+	matchInfo.height		= srcMap->height;
+	matchInfo.width			= srcMap->width;
+	
+	matchInfo.srcSpace		= src->space;
+	matchInfo.srcChanBits	= src->chanBits;
+	matchInfo.srcSwap		= (src->little != TARGET_RT_LITTLE_ENDIAN);
+	matchInfo.srcWord		= kWordNone;
+	matchInfo.srcSample		= src->sample;
+	matchInfo.srcAlpha		= src->alpha;
+	
+	matchInfo.dstSpace		= dst->space;
+	matchInfo.dstChanBits	= dst->chanBits;
+	matchInfo.dstSwap		= (dst->little != TARGET_RT_LITTLE_ENDIAN);
+	matchInfo.dstWord		= kWordNone;
+	matchInfo.dstSample		= dst->sample;
+	matchInfo.dstAlpha		= dst->alpha;
+	
+	for (i=0; i < 4; i++)
+	{
+		if (i < src->chans)
+		{
+			matchInfo.srcBuf[i] = (UInt8*)srcMap->planes[i];
+			matchInfo.srcRowBytes[i] = srcMap->rowBytes[i];
+			matchInfo.srcColBytes[i] = srcMap->colBytes[i];
+		}
+		if (i < dst->chans)
+		{
+			matchInfo.dstBuf[i] = (UInt8*)dstMap->planes[i];
+			matchInfo.dstRowBytes[i] = dstMap->rowBytes[i];
+			matchInfo.dstColBytes[i] = dstMap->colBytes[i];
+		}
+	}
+	
+	// Alpha is in the plane after the color channels
+	if (src->alpha)
+	{
+		matchInfo.srcAlphaBuf		= (UInt8*)srcMap->planes[3];
+		matchInfo.srcAlphaRowBytes	= srcMap->rowBytes[3];
+		matchInfo.srcAlphaColBytes	= srcMap->colBytes[3];
+	}
+	if (dst->alpha)
+	{
+		matchInfo.dstAlphaBuf		= (UInt8*)dstMap->planes[3];
+		matchInfo.dstAlphaRowBytes	= dstMap->rowBytes[3];
+		matchInfo.dstAlphaColBytes	= dstMap->colBytes[3];
+	}
+	
+	SetupMatchKernels(&matchInfo);
+	
+	return RunBands(&MatchBand, &matchInfo, matchInfo.height, matchInfo.width, progressProc, refCon);
+}
+
+
+//--------------------------------------------------------------------- FindPlanarLayout
+//	The layout of a planar bitmap of the given space, or nil when it has
+//	no planar form or a channel is missing. The float kernels step every
+//	channel by the same distance.
+//---------------------------------------------------------------------
+
+static const LayoutRec*
+FindPlanarLayout (const EnginePlanarBitmap* map, OSType space)
+{
+	const LayoutRec*	layout = FindLayout(map->layout);
+	UInt32				i;
+	
+	if (layout == nil || layout->space != space || layout->word != kWordNone)
+		return nil;
+	
+	for (i=0; i < layout->chans + (layout->alpha != kAlphaNone); i++)
+	{
+		if (map->planes[i] == nil)
+			return nil;
+		if (layout->sample != kSampleUInt && map->colBytes[i] != map->colBytes[0])
+			return nil;
+	}
+	
+	return layout;
+}
+
+
+//--------------------------------------------------------------------- EngineBeginSession
+
+EngineError
+EngineBeginSession (EngineTransformRef xform, EngineLayout srcLayout, EngineLayout dstLayout,
+					uint32_t width, EngineSessionRef* result)
+{
+	EngineSessionRef	session;
+	const LayoutRec*	src;
+	const LayoutRec*	dst;
+	CMMMatchPtr			pMatchInfo;
+	
+	// Check params
+	if (xform==nil || result==nil)
+		return kEngineParamErr;
+	
+	*result = nil;
+	
+	src = FindLayout(srcLayout);
+	if (src == nil || src->space != xform->srcSpace)
+		return kEngineInvalidSrcMapErr;
+	
+	dst = FindLayout(dstLayout);
+	if (dst == nil || dst->space != xform->dstSpace)
+		return kEngineInvalidDstMapErr;
+	
+	session = (EngineSessionRef)calloc(1, sizeof(struct EngineSession));
+	if (session == nil)
+		return kEngineMemFullErr;
+	
+	EngineRetainTransform(xform);
+	session->src = src;
+	session->dst = dst;
+	
+	pMatchInfo = &session->matchInfo;
+	pMatchInfo->transform	= xform;
+	pMatchInfo->width		= width;
+	
+	pMatchInfo->srcSpace	= src->space;
+	pMatchInfo->srcChanBits	= src->chanBits;
+	pMatchInfo->srcSwap		= (src->little != TARGET_RT_LITTLE_ENDIAN);
+	pMatchInfo->srcWord		= src->word;
+	pMatchInfo->srcSample	= src->sample;
+	pMatchInfo->srcAlpha	= src->alpha;
+	
+	pMatchInfo->dstSpace	= dst->space;
+	pMatchInfo->dstChanBits	= dst->chanBits;
+	pMatchInfo->dstSwap		= (dst->little != TARGET_RT_LITTLE_ENDIAN);
+	pMatchInfo->dstWord		= dst->word;
+	pMatchInfo->dstSample	= dst->sample;
+	pMatchInfo->dstAlpha	= dst->alpha;
+	
+	// Any image will do to pick the kernels, the strips come later
+	SetMatchBuffers(pMatchInfo, src, session, 0, dst, session, 0);
+	SetupMatchKernels(pMatchInfo);
+	
+	*result = session;
+	return kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- EngineMatchStrip
+
+EngineError
+EngineMatchStrip (EngineSessionRef session, const void* src, uint32_t srcRowBytes,
+				  void* dst, uint32_t dstRowBytes, uint32_t rowCount)
+{
+	CMMMatchPtr			pMatchInfo;
+	
+	// Check params
+	if (session==nil || src==nil || dst==nil)
+		return kEngineParamErr;
+	
+	pMatchInfo = &session->matchInfo;
+	pMatchInfo->height		= rowCount;
+	SetMatchBuffers(pMatchInfo, session->src, src, srcRowBytes, session->dst, dst, dstRowBytes);
+	
+	return RunBands(&MatchBand, pMatchInfo, rowCount, pMatchInfo->width, nil, nil);
+}
+
+
+//--------------------------------------------------------------------- EngineEndSession
+
+void
+EngineEndSession (EngineSessionRef session)
+{
+	if (session)
+	{
+		EngineReleaseTransform(session->matchInfo.transform);
+		free(session);
+	}
+}
+
+
+//--------------------------------------------------------------------- EngineCheckColors
+
+EngineError
+EngineCheckColors (EngineTransformRef xform, const void* colors, uint32_t count, uint32_t colorBytes,
+				   uint32_t* result)
+{
+	CMMMatchRec			matchInfo;
+	UInt32				i;
+	
+	// Check params
+	if (xform==nil || colors==nil || result==nil)
+		return kEngineParamErr;
+	
+	memset(&matchInfo, 0, sizeof(matchInfo));
+	matchInfo.transform		= xform;
+	matchInfo.height		= 1;
+	matchInfo.width			= count;
+	
+	matchInfo.srcSpace		= xform->srcSpace;
+	matchInfo.srcChanBits	= 16;
+	matchInfo.srcSwap		= false;
+	
+	for (i=0; i < 4; i++)
+	{
+		matchInfo.srcBuf[i] = (UInt8*)colors + i * sizeof(UInt16);
+		matchInfo.srcRowBytes[i] = count * colorBytes;
+		matchInfo.srcColBytes[i] = colorBytes;
+	}
+	
+	matchInfo.dstChanBits	= 16;
+	matchInfo.chkBuf		= (UInt8*)result;
+	matchInfo.chkRowBytes	= (count + 31) / 32 * sizeof(UInt32);
+	matchInfo.chkWords		= true;
+	
+	SetupMatchKernels(&matchInfo);
+	CheckRows(&matchInfo, 0, 1);
+	
+	return kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- EngineCheckBitmap
+
+EngineError
+EngineCheckBitmap (EngineTransformRef xform, const EngineBitmap* srcMap, const EngineBitmap* chkMap,
+				   EngineProgressProc progressProc, void* refCon)
+{
+	CMMMatchRec			matchInfo;
+	const LayoutRec*	src;
+	UInt32				i;
+	
+	// Check params
+	if (xform==nil || srcMap==nil || chkMap==nil)
+		return kEngineParamErr;
+	
+	src = FindLayout(srcMap->layout);
+	if (src == nil || src->space != xform->srcSpace)
+		return kEngineInvalidSrcMapErr;
+	
+	if (chkMap->layout != kEngineGamut1 || chkMap->image == nil ||
+		chkMap->width < srcMap->width || chkMap->height < srcMap->height)
+		return kEngineInvalidDstMapErr;
+	
+	memset(&matchInfo, 0, sizeof(matchInfo));
+	matchInfo.transform		= xform;
+	matchInfo.height		= srcMap->height;
+	matchInfo.width			= srcMap->width;
+	
+	matchInfo.srcSpace		= src->space;
+	matchInfo.srcChanBits	= src->chanBits;
+	matchInfo.srcSwap		= (src->little != TARGET_RT_LITTLE_ENDIAN);
+	matchInfo.srcWord		= src->word;
+	matchInfo.srcSample		= src->sample;
+	matchInfo.srcAlpha		= src->alpha;
+	
+	for (i=0; i < 4; i++)
+	{
+		matchInfo.srcBuf[i] = (i < src->chans) ? (UInt8*)srcMap->image + src->offset[i] : nil;
+		matchInfo.srcRowBytes[i] = srcMap->rowBytes;
+		matchInfo.srcColBytes[i] = src->colBytes;
+	}
+	
+	matchInfo.srcAlphaBuf		= src->alpha ? (UInt8*)srcMap->image + src->offset[3] : nil;
+	matchInfo.srcAlphaRowBytes	= srcMap->rowBytes;
+	matchInfo.srcAlphaColBytes	= src->colBytes;
+	
+	matchInfo.dstChanBits	= 16;
+	matchInfo.chkBuf		= (UInt8*)chkMap->image;
+	matchInfo.chkRowBytes	= chkMap->rowBytes;
+	matchInfo.chkWords		= false;
+	
+	SetupMatchKernels(&matchInfo);
+	
+	return RunBands(&CheckBand, &matchInfo, matchInfo.height, matchInfo.width, progressProc, refCon);
+}
+
+
+//--------------------------------------------------------------------- FindLayout
+//	Entries are in EngineLayout order, each named as its constant, and are
+//	counted at compile time. Gamut1 has none, it is only ever written by
+//	the gamut check, nor has Indexed8, which is only matched through its
+//	color table. The layouts packed into a word give their
+//	channels 16 bits, which the word kernels widen them to. Float and half
+//	channels are in native byte order. The alpha of a layout is where a
+//	fourth channel would be.
+//---------------------------------------------------------------------
+
+#define kNative				TARGET_RT_LITTLE_ENDIAN
+
+static const LayoutRec	gLayouts[] =
+{
+	{ "Gray8",			kEngineGrayData,	1,	8,	1,	{ 0, 0, 0, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "Gray16",			kEngineGrayData,	1,	16,	2,	{ 0, 0, 0, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "Gray16L",		kEngineGrayData,	1,	16,	2,	{ 0, 0, 0, 0 },		true,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "RGB24",			kEngineRGBData,		3,	8,	3,	{ 0, 1, 2, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "RGB32",			kEngineRGBData,		3,	8,	4,	{ 1, 2, 3, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "RGB48",			kEngineRGBData,		3,	16,	6,	{ 0, 2, 4, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "RGB48L",			kEngineRGBData,		3,	16,	6,	{ 0, 2, 4, 0 },		true,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "RGB555",			kEngineRGBData,		3,	16,	2,	{ 0, 0, 0, 0 },		false,		kWord555,		kSampleUInt,	kAlphaNone },
+	{ "RGB555L",		kEngineRGBData,		3,	16,	2,	{ 0, 0, 0, 0 },		true,		kWord555,		kSampleUInt,	kAlphaNone },
+	{ "RGB565",			kEngineRGBData,		3,	16,	2,	{ 0, 0, 0, 0 },		false,		kWord565,		kSampleUInt,	kAlphaNone },
+	{ "RGB565L",		kEngineRGBData,		3,	16,	2,	{ 0, 0, 0, 0 },		true,		kWord565,		kSampleUInt,	kAlphaNone },
+	{ "RGB101010",		kEngineRGBData,		3,	16,	4,	{ 0, 0, 0, 0 },		false,		kWord101010,	kSampleUInt,	kAlphaNone },
+	{ "CMYK32",			kEngineCMYKData,	4,	8,	4,	{ 0, 1, 2, 3 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "CMYK64",			kEngineCMYKData,	4,	16,	8,	{ 0, 2, 4, 6 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "CMYK64L",		kEngineCMYKData,	4,	16,	8,	{ 0, 2, 4, 6 },		true,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "LAB24",			kEngineLabData,		3,	8,	3,	{ 0, 1, 2, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "LAB48",			kEngineLabData,		3,	16,	6,	{ 0, 2, 4, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "LAB48L",			kEngineLabData,		3,	16,	6,	{ 0, 2, 4, 0 },		true,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "XYZ24",			kEngineXYZData,		3,	8,	3,	{ 0, 1, 2, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "XYZ48",			kEngineXYZData,		3,	16,	6,	{ 0, 2, 4, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "XYZ48L",			kEngineXYZData,		3,	16,	6,	{ 0, 2, 4, 0 },		true,		kWordNone,		kSampleUInt,	kAlphaNone },
+	{ "GrayFloat",		kEngineGrayData,	1,	32,	4,	{ 0, 0, 0, 0 },		kNative,	kWordNone,		kSampleFloat,	kAlphaNone },
+	{ "GrayHalf",		kEngineGrayData,	1,	16,	2,	{ 0, 0, 0, 0 },		kNative,	kWordNone,		kSampleHalf,	kAlphaNone },
+	{ "RGBFloat",		kEngineRGBData,		3,	32,	12,	{ 0, 4, 8, 0 },		kNative,	kWordNone,		kSampleFloat,	kAlphaNone },
+	{ "RGBHalf",		kEngineRGBData,		3,	16,	6,	{ 0, 2, 4, 0 },		kNative,	kWordNone,		kSampleHalf,	kAlphaNone },
+	{ "CMYKFloat",		kEngineCMYKData,	4,	32,	16,	{ 0, 4, 8, 12 },	kNative,	kWordNone,		kSampleFloat,	kAlphaNone },
+	{ "CMYKHalf",		kEngineCMYKData,	4,	16,	8,	{ 0, 2, 4, 6 },		kNative,	kWordNone,		kSampleHalf,	kAlphaNone },
+	{ "LABFloat",		kEngineLabData,		3,	32,	12,	{ 0, 4, 8, 0 },		kNative,	kWordNone,		kSampleFloat,	kAlphaNone },
+	{ "LABHalf",		kEngineLabData,		3,	16,	6,	{ 0, 2, 4, 0 },		kNative,	kWordNone,		kSampleHalf,	kAlphaNone },
+	{ "XYZFloat",		kEngineXYZData,		3,	32,	12,	{ 0, 4, 8, 0 },		kNative,	kWordNone,		kSampleFloat,	kAlphaNone },
+	{ "XYZHalf",		kEngineXYZData,		3,	16,	6,	{ 0, 2, 4, 0 },		kNative,	kWordNone,		kSampleHalf,	kAlphaNone },
+	{ "ARGB32",			kEngineRGBData,		3,	8,	4,	{ 1, 2, 3, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaStraight },
+	{ "RGBA32",			kEngineRGBData,		3,	8,	4,	{ 0, 1, 2, 3 },		false,		kWordNone,		kSampleUInt,	kAlphaStraight },
+	{ "BGRA32",			kEngineRGBData,		3,	8,	4,	{ 2, 1, 0, 3 },		false,		kWordNone,		kSampleUInt,	kAlphaStraight },
+	{ "ARGB64",			kEngineRGBData,		3,	16,	8,	{ 2, 4, 6, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaStraight },
+	{ "ARGB64L",		kEngineRGBData,		3,	16,	8,	{ 2, 4, 6, 0 },		true,		kWordNone,		kSampleUInt,	kAlphaStraight },
+	{ "RGBA64",			kEngineRGBData,		3,	16,	8,	{ 0, 2, 4, 6 },		false,		kWordNone,		kSampleUInt,	kAlphaStraight },
+	{ "RGBA64L",		kEngineRGBData,		3,	16,	8,	{ 0, 2, 4, 6 },		true,		kWordNone,		kSampleUInt,	kAlphaStraight },
+	{ "ARGB32Pmul",		kEngineRGBData,		3,	8,	4,	{ 1, 2, 3, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaPremultiplied },
+	{ "RGBA32Pmul",		kEngineRGBData,		3,	8,	4,	{ 0, 1, 2, 3 },		false,		kWordNone,		kSampleUInt,	kAlphaPremultiplied },
+	{ "BGRA32Pmul",		kEngineRGBData,		3,	8,	4,	{ 2, 1, 0, 3 },		false,		kWordNone,		kSampleUInt,	kAlphaPremultiplied },
+	{ "ARGB64Pmul",		kEngineRGBData,		3,	16,	8,	{ 2, 4, 6, 0 },		false,		kWordNone,		kSampleUInt,	kAlphaPremultiplied },
+	{ "ARGB64LPmul",	kEngineRGBData,		3,	16,	8,	{ 2, 4, 6, 0 },		true,		kWordNone,		kSampleUInt,	kAlphaPremultiplied },
+	{ "RGBA64Pmul",		kEngineRGBData,		3,	16,	8,	{ 0, 2, 4, 6 },		false,		kWordNone,		kSampleUInt,	kAlphaPremultiplied },
+	{ "RGBA64LPmul",	kEngineRGBData,		3,	16,	8,	{ 0, 2, 4, 6 },		true,		kWordNone,		kSampleUInt,	kAlphaPremultiplied },
+};
+
+// Fails to compile unless there is an entry for every layout before Gamut1
+typedef char LayoutCountCheck[(sizeof(gLayouts) / sizeof(gLayouts[0]) == kEngineGamut1) ? 1 : -1];
+
+static const LayoutRec*
+FindLayout (EngineLayout layout)
+{
+	if ((UInt32)layout >= sizeof(gLayouts) / sizeof(gLayouts[0]))
+		return nil;
+	return &gLayouts[layout];
+}
+
+
+//--------------------------------------------------------------------- EngineGetLayoutInfo
+
+EngineError
+EngineGetLayoutInfo (EngineLayout layout, EngineLayoutInfo* info)
+{
+	const LayoutRec*	rec = FindLayout(layout);
+	
+	if (rec == nil)
+		return kEngineParamErr;
+	
+	info->name			= rec->name;
+	info->space			= rec->space;
+	info->channels		= rec->chans;
+	info->channelBits	= rec->chanBits;
+	info->pixelBytes	= rec->colBytes;
+	info->floating		= (rec->sample != kSampleUInt);
+	info->alpha			= (rec->alpha != kAlphaNone);
+	
+	return kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- FindScale
+//	The codes are those of the 16 bit layouts: UInt16 for Gray, RGB and
+//	CMYK, u1.15 Fract for XYZ, and for Lab L* of 100 at 65535 and a* and
+//	b* of 0 half way.
+//---------------------------------------------------------------------
+
+#define kABCode				(65535.0f / 256.0f)
+
+static const ScaleRec	gScales[] =
+{
+	{ kEngineGrayData,	{ 65535.0f, 0, 0, 0 },						{ 0, 0, 0, 0 },					{ 1.0f / 65535.0f, 0, 0, 0 } },
+	{ kEngineRGBData,	{ 65535.0f, 65535.0f, 65535.0f, 0 },		{ 0, 0, 0, 0 },					{ 1.0f / 65535.0f, 1.0f / 65535.0f, 1.0f / 65535.0f, 0 } },
+	{ kEngineCMYKData,	{ 65535.0f, 65535.0f, 65535.0f, 65535.0f },	{ 0, 0, 0, 0 },					{ 1.0f / 65535.0f, 1.0f / 65535.0f, 1.0f / 65535.0f, 1.0f / 65535.0f } },
+	{ kEngineXYZData,	{ 32768.0f, 32768.0f, 32768.0f, 0 },		{ 0, 0, 0, 0 },					{ 1.0f / 32768.0f, 1.0f / 32768.0f, 1.0f / 32768.0f, 0 } },
+	{ kEngineLabData,	{ 655.35f, kABCode, kABCode, 0 },			{ 0, 32767.5f, 32767.5f, 0 },	{ 1.0f / 655.35f, 1.0f / kABCode, 1.0f / kABCode, 0 } },
+};
+
+static const ScaleRec*
+FindScale (OSType space)
+{
+	UInt32				i;
+	
+	for (i=0; i < sizeof(gScales) / sizeof(gScales[0]); i++)
+		if (gScales[i].space == space)
+			return &gScales[i];
+	return nil;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- utilities -----
+#endif
+
+
+//--------------------------------------------------------------------- CompileTransform
+
+static const ConversionRec	gConversions[] =
+{
+	{ kEngineRGBData,	kEngineCMYKData,	&MatchOne_RGB_CMYK,		&MatchBlock_RGB_CMYK,	&MatchBlock8_RGB_CMYK,	nil,						nil,						false,	nil,					&MatchFloat_RGB_CMYK,	nil },
+	{ kEngineRGBData,	kEngineXYZData,		&MatchOne_RGB_XYZ,		&MatchBlock_RGB_XYZ,	nil,					&MatchBlockFast_RGB_XYZ,	&MatchBlockFixed_RGB_XYZ,	false,	nil,					&MatchFloat_RGB_XYZ,	&Sample_RGB_XYZ },
+	{ kEngineRGBData,	kEngineLabData,		&MatchOne_RGB_LAB,		&MatchBlock_RGB_LAB,	nil,					&MatchBlockFast_RGB_LAB,	&MatchBlockFixed_RGB_LAB,	true,	&CheckBlock_RGB_LAB,	&MatchFloat_RGB_LAB,	&Sample_RGB_LAB },
+	{ kEngineRGBData,	kEngineGrayData,	&MatchOne_RGB_Gray,		&MatchBlock_RGB_Gray,	nil,					&MatchBlockFast_RGB_Gray,	&MatchBlockFixed_RGB_Gray,	false,	nil,					&MatchFloat_RGB_Gray,	&Sample_RGB_Gray },
+	{ kEngineCMYKData,	kEngineRGBData,		&MatchOne_CMYK_RGB,		&MatchBlock_CMYK_RGB,	&MatchBlock8_CMYK_RGB,	nil,						nil,						false,	&CheckBlock_CMYK_RGB,	&MatchFloat_CMYK_RGB,	nil },
+	{ kEngineCMYKData,	kEngineLabData,		&MatchOne_CMYK_LAB,		&MatchBlock_CMYK_LAB,	nil,					&MatchBlockFast_CMYK_LAB,	&MatchBlockFixed_CMYK_LAB,	true,	&CheckBlock_CMYK_LAB,	&MatchFloat_CMYK_LAB,	nil },
+	{ kEngineCMYKData,	kEngineXYZData,		&MatchOne_CMYK_XYZ,		&MatchBlock_CMYK_XYZ,	nil,					&MatchBlockFast_CMYK_XYZ,	&MatchBlockFixed_CMYK_XYZ,	true,	&CheckBlock_CMYK_XYZ,	&MatchFloat_CMYK_XYZ,	nil },
+	{ kEngineCMYKData,	kEngineGrayData,	&MatchOne_CMYK_Gray,	&MatchBlock_CMYK_Gray,	nil,					&MatchBlockFast_CMYK_Gray,	&MatchBlockFixed_CMYK_Gray,	true,	&CheckBlock_CMYK_Gray,	&MatchFloat_CMYK_Gray,	nil },
+	{ kEngineXYZData,	kEngineRGBData,		&MatchOne_XYZ_RGB,		&MatchBlock_XYZ_RGB,	nil,					&MatchBlockFast_XYZ_RGB,	&MatchBlockFixed_XYZ_RGB,	false,	&CheckBlock_XYZ_RGB,	&MatchFloat_XYZ_RGB,	&Sample_XYZ_RGB },
+	{ kEngineXYZData,	kEngineLabData,		&MatchOne_XYZ_LAB,		&MatchBlock_XYZ_LAB,	nil,					&MatchBlockFast_XYZ_LAB,	&MatchBlockFixed_XYZ_LAB,	true,	&CheckBlock_XYZ_LAB,	&MatchFloat_XYZ_LAB,	&Sample_XYZ_LAB },
+	{ kEngineXYZData,	kEngineCMYKData,	&MatchOne_XYZ_CMYK,		&MatchBlock_XYZ_CMYK,	nil,					&MatchBlockFast_XYZ_CMYK,	&MatchBlockFixed_XYZ_CMYK,	true,	&CheckBlock_XYZ_CMYK,	&MatchFloat_XYZ_CMYK,	nil },
+	{ kEngineXYZData,	kEngineGrayData,	&MatchOne_XYZ_Gray,		&MatchBlock_XYZ_Gray,	nil,					nil,						nil,						false,	&CheckBlock_XYZ_Gray,	&MatchFloat_XYZ_Gray,	nil },
+	{ kEngineLabData,	kEngineRGBData,		&MatchOne_LAB_RGB,		&MatchBlock_LAB_RGB,	nil,					&MatchBlockFast_LAB_RGB,	&MatchBlockFixed_LAB_RGB,	true,	&CheckBlock_LAB_RGB,	&MatchFloat_LAB_RGB,	&Sample_LAB_RGB },
+	{ kEngineLabData,	kEngineXYZData,		&MatchOne_LAB_XYZ,		&MatchBlock_LAB_XYZ,	nil,					&MatchBlockFast_LAB_XYZ,	&MatchBlockFixed_LAB_XYZ,	true,	&CheckBlock_LAB_XYZ,	&MatchFloat_LAB_XYZ,	&Sample_LAB_XYZ },
+	{ kEngineLabData,	kEngineCMYKData,	&MatchOne_LAB_CMYK,		&MatchBlock_LAB_CMYK,	nil,					&MatchBlockFast_LAB_CMYK,	&MatchBlockFixed_LAB_CMYK,	true,	&CheckBlock_LAB_CMYK,	&MatchFloat_LAB_CMYK,	nil },
+	{ kEngineLabData,	kEngineGrayData,	&MatchOne_LAB_Gray,		&MatchBlock_LAB_Gray,	&MatchBlock8_LAB_Gray,	nil,						nil,						false,	nil,					&MatchFloat_LAB_Gray,	nil },
+	{ kEngineGrayData,	kEngineRGBData,		&MatchOne_Gray_RGB,		&MatchBlock_Gray_RGB,	&MatchBlock8_Gray_RGB,	nil,						nil,						false,	nil,					&MatchFloat_Gray_RGB,	nil },
+	{ kEngineGrayData,	kEngineCMYKData,	&MatchOne_Gray_CMYK,	&MatchBlock_Gray_CMYK,	&MatchBlock8_Gray_CMYK,	nil,						nil,						false,	nil,					&MatchFloat_Gray_CMYK,	nil },
+	{ kEngineGrayData,	kEngineXYZData,		&MatchOne_Gray_XYZ,		&MatchBlock_Gray_XYZ,	nil,					&MatchBlockFast_Gray_XYZ,	&MatchBlockFixed_Gray_XYZ,	false,	nil,					&MatchFloat_Gray_XYZ,	nil },
+	{ kEngineGrayData,	kEngineLabData,		&MatchOne_Gray_LAB,		&MatchBlock_Gray_LAB,	&MatchBlock8_Gray_LAB,	nil,						nil,						false,	nil,					&MatchFloat_Gray_LAB,	nil },
+};
+
+static const ConversionRec*
+FindConversion (OSType srcSpace, OSType dstSpace)
+{
+	UInt32			i;
+	
+	for (i=0; i < sizeof(gConversions) / sizeof(gConversions[0]); i++)
+		if (gConversions[i].srcSpace == srcSpace && gConversions[i].dstSpace == dstSpace)
+			return &gConversions[i];
+	
+	return nil;
+}
+
+static EngineError
+CompileTransform (CMMTransformPtr xform)
+{
+	OSType					srcSpace = xform->srcSpace;
+	OSType					dstSpace = xform->dstSpace;
+	UInt32					precision = xform->precision;
+	const ConversionRec*	conv;
+	OSType					spaces[kEngineMaxVia + 2];
+	UInt32					count, i;
+	
+	if (xform->gridPoints == 0)
+		xform->gridPoints = kDefaultGridPoints;
+	
+	if (precision > kEnginePrecisionFixed || xform->viaCount > kEngineMaxVia || xform->memo > kEngineMemoOff ||
+		(xform->gridPoints != 17 && xform->gridPoints != 33 && xform->gridPoints != 65))
+		return kEngineParamErr;
+	
+	// A space the colors stay in, like a proofing profile used both ways,
+	// is one stop of the chain
+	spaces[0] = srcSpace;
+	count = 1;
+	for (i=0; i < xform->viaCount; i++)
+		if (xform->via[i] != spaces[count-1])
+			spaces[count++] = xform->via[i];
+	if (dstSpace != spaces[count-1])
+		spaces[count++] = dstSpace;
+	
+	if (count > 2)
+		return CompileChain(xform, spaces, count);
+	
+	if (srcSpace == dstSpace)
+		return kEngineNoErr;
+	
+	conv = FindConversion(srcSpace, dstSpace);
+	if (conv == nil)
+		return kEngineUnsupportedErr;
+	
+	xform->proc = conv->proc;
+	xform->block = conv->block;
+	xform->block8 = conv->block8;
+	xform->steps[0] = conv;
+	xform->stepCount = 1;
+	
+	// Draft quality samples the costly conversions into a grid
+	if (precision == kEnginePrecisionDefault && xform->quality == kEngineDraftMode && conv->sampled)
+		return BuildGrid(xform, spaces, count);
+	
+	xform->block = StepBlock(conv, xform->quality, precision);
+	return kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- StepBlock
+//	Block of a conversion at a precision, the default resolved from the
+//	quality as it is for a conversion that is not sampled.
+//---------------------------------------------------------------------
+
+static MatchBlockProc
+StepBlock (const ConversionRec* conv, UInt32 quality, UInt32 precision)
+{
+	if (precision == kEnginePrecisionDefault)
+	{
+		// The matrix conversions are both cheaper and closer in
+		// fixed point, Lab needs float to be fast
+		if (quality == kEngineBestMode)
+			precision = kEnginePrecisionExact;
+		else if (quality == kEngineDraftMode)
+			precision = kEnginePrecisionFixed;
+		else if (conv->srcSpace != kEngineLabData && conv->dstSpace != kEngineLabData)
+			precision = kEnginePrecisionFixed;
+		else
+			precision = kEnginePrecisionFloat;
+	}
+	
+	if (precision == kEnginePrecisionFloat && conv->fast)
+		return conv->fast;
+	
+	if (precision == kEnginePrecisionFixed && conv->fixed)
+	{
+		InitFixedTables();
+		return conv->fixed;
+	}
+	
+	return conv->block;
+}
+
+
+//--------------------------------------------------------------------- CompileChain
+//	Profiles between the source and the destination add a conversion per
+//	space they pass the colors through. The block of each conversion at
+//	the precision asked for, as StepBlock picks it for a single one, is
+//	run in turn. Chains are not sampled into a grid, not even at draft
+//	quality: one through RGB clamps there, and a grid blurs the kink.
+//---------------------------------------------------------------------
+
+static EngineError
+CompileChain (CMMTransformPtr xform, const OSType* spaces, UInt32 count)
+{
+	const ConversionRec*	conv;
+	UInt32					i;
+	
+	for (i=0; i+1 < count; i++)
+	{
+		conv = FindConversion(spaces[i], spaces[i+1]);
+		if (conv == nil)
+			return kEngineUnsupportedErr;
+		xform->steps[i] = conv;
+		xform->stepBlocks[i] = StepBlock(conv, xform->quality, xform->precision);
+	}
+	xform->stepCount = count - 1;
+	xform->block = &MatchBlock_Chain;
+	
+	return kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- ChannelCount
+
+static UInt32
+ChannelCount (OSType space)
+{
+	if (space == kEngineGrayData)
+		return 1;
+	if (space == kEngineCMYKData)
+		return 4;
+	return 3;
+}
+
+
+//--------------------------------------------------------------------- BuildGrid
+//	Samples the costly (pow and matrix heavy) procs of the conversions
+//	from the first of the spaces through the others to the last into a
+//	3D grid, which MatchBlock_Grid then interpolates instead of calling
+//	the procs. Each node is run through the procs in turn.
+//
+//	CMYK goes to RGB before the grid, and RGB to CMYK after it, as the
+//	procs through CMYK do, so no grid is 4D or has to follow the kink
+//	where K takes over. Lab to RGB goes through XYZ the same way; the grid
+//	holds only Lab to XYZ, which is the cube of a linear function of Lab,
+//	so its nodes hold the cube root, and the matrix to RGB, which clamps
+//	the XYZ first, is applied after it.
+//
+//	The last conversion is sampled unclamped when it has a sample proc,
+//	so colors near the edge of the range of the destination interpolate
+//	from nodes on both sides of it; the nodes hold code values from
+//	-32768 to 98302, which costs them one bit. The grids from RGB or XYZ
+//	to Lab are shaped, see gGridShaper.
+//
+//	Leaves the transform as it is when nothing is left to sample between
+//	the CMYK ends, or the colors enter the grid as Gray.
+//---------------------------------------------------------------------
+
+static EngineError
+BuildGrid (CMMTransformPtr xform, const OSType* spaces, UInt32 count)
+{
+	OSType					path[kEngineMaxVia + 4];
+	MatchOneProc			procs[kEngineMaxVia + 3];
+	const ConversionRec*	conv = nil;
+	UInt16					nodeCodes[65];
+	OSType					end;
+	UInt32					pathCount, first, last, stepCount, tails;
+	UInt32					outChans, points, nodes;
+	UInt32					i, j, idx;
+	UInt16					chan[4];
+	UInt16*					grid;
+	double					codes[4];
+	double					v;
+	
+	// The spaces, with RGB put in where the procs of CMYK go through it
+	path[0] = spaces[0];
+	pathCount = 1;
+	if (spaces[0] == kEngineCMYKData && spaces[1] != kEngineRGBData)
+		path[pathCount++] = kEngineRGBData;
+	for (i=1; i < count; i++)
+	{
+		if (i == count - 1 && spaces[i] == kEngineCMYKData &&
+			(spaces[i-1] == kEngineLabData || spaces[i-1] == kEngineXYZData))
+			path[pathCount++] = kEngineRGBData;
+		path[pathCount++] = spaces[i];
+	}
+	
+	first = (path[0] == kEngineCMYKData) ? 1 : 0;
+	last = pathCount - 1;
+	if (path[last] == kEngineCMYKData && path[last-1] == kEngineRGBData)
+		last--;
+	
+	if (first >= last || path[first] == kEngineGrayData)
+		return kEngineNoErr;
+	
+	xform->gridCubed = (path[first] == kEngineLabData && last == first + 1 &&
+						(path[last] == kEngineXYZData || path[last] == kEngineRGBData));
+	end = xform->gridCubed ? kEngineXYZData : path[last];
+	
+	stepCount = last - first;
+	for (i=0; i < stepCount; i++)
+	{
+		conv = FindConversion(path[first+i], (i + 1 < stepCount) ? path[first+i+1] : end);
+		if (conv == nil)
+			return kEngineUnsupportedErr;
+		procs[i] = conv->proc;
+	}
+	
+	outChans = ChannelCount(end);
+	points = xform->gridPoints;
+	nodes = points * points * points;
+	
+	xform->gridShaped = (end == kEngineLabData &&
+						 (path[first] == kEngineRGBData || path[first] == kEngineXYZData));
+	if (xform->gridShaped || xform->gridCubed)
+		InitGridShaper();
+	
+	for (i=0; i < points; i++)
+	{
+		if (xform->gridShaped)
+		{
+			v = UnshapeCode((double)i / (points - 1));
+			nodeCodes[i] = (v >= 65535.0) ? 65535 : (UInt16)(v + 0.5);
+		}
+		else
+			nodeCodes[i] = (i * 65535 + (points - 1) / 2) / (points - 1);
+	}
+	
+	grid = (UInt16*)malloc(nodes * outChans * sizeof(UInt16));
+	if (grid == nil)
+		return kEngineMemFullErr;
+	
+	// Nodes are stored with the first channel varying slowest
+	for (i=0; i < nodes; i++)
+	{
+		idx = i;
+		for (j=3; j-- > 0; )
+		{
+			chan[j] = nodeCodes[idx % points];
+			idx /= points;
+		}
+		chan[3] = 0;
+		
+		for (j=0; j+1 < stepCount; j++)
+			procs[j](chan);
+		
+		if (conv->sample)
+			conv->sample(chan, codes);
+		else
+		{
+			procs[stepCount-1](chan);
+			for (j=0; j < outChans; j++)
+				codes[j] = chan[j];
+		}
+		
+		for (j=0; j < outChans; j++)
+		{
+			if (xform->gridCubed)
+				codes[j] = ShapeCode(codes[j]) * 65535.0;
+			v = (codes[j] + 32768.0) / 2.0;
+			grid[i * outChans + j] = (v <= 0.0) ? 0 : ((v >= 65535.0) ? 65535 : (UInt16)(v + 0.5));
+		}
+	}
+	
+	tails = 0;
+	if (end != path[last])
+		xform->gridTail[tails++] = StepBlock(FindConversion(end, path[last]), xform->quality, xform->precision);
+	if (last < pathCount - 1)
+		xform->gridTail[tails++] = &MatchBlock_RGB_CMYK;
+	
+	xform->block		= &MatchBlock_Grid;
+	xform->grid			= grid;
+	xform->gridOutChans	= outChans;
+	xform->gridHead		= (first > 0) ? &MatchBlock_CMYK_RGB : nil;
+	
+	return kEngineNoErr;
+}
+
+
+//---------------------------------------------------------------------
+//	Lab takes the cube root of XYZ, which bends most near black, where
+//	evenly spaced nodes are too far apart. Grids from RGB or XYZ to Lab
+//	space their nodes evenly in the f(t) of Lab instead: the channels are
+//	looked up in gGridShaper before they are interpolated, and the nodes
+//	are sampled at the codes UnshapeCode gives. RGB codes are taken as
+//	u1.15 like XYZ, which puts more nodes near black still. The grid of
+//	Lab to XYZ holds the shaped XYZ, and looks it up in gGridUnshaper.
+//---------------------------------------------------------------------
+
+static UInt16			gGridShaper[65536];
+static UInt16			gGridUnshaper[65536];
+static pthread_once_t	gGridShaperOnce = PTHREAD_ONCE_INIT;
+
+// The f(t) of Lab, from 0 at code 0 to 1 at code 65535
+static double
+ShapeCode (double code)
+{
+	double			t = code / 32768.0;
+	double			f;
+	
+	f = (t > 0.008856) ? cbrt(t) : 7.787 * t + 16.0 / 116.0;
+	return (f - 16.0 / 116.0) / (cbrt(65535.0 / 32768.0) - 16.0 / 116.0);
+}
+
+static double
+UnshapeCode (double shaped)
+{
+	double			f = shaped * (cbrt(65535.0 / 32768.0) - 16.0 / 116.0) + 16.0 / 116.0;
+	double			t;
+	
+	t = (f > 0.20689) ? f * f * f : (f - 16.0 / 116.0) / 7.787;
+	return t * 32768.0;
+}
+
+static void
+BuildGridShaper (void)
+{
+	double			v;
+	UInt32			i;
+	
+	for (i=0; i < 65536; i++)
+	{
+		gGridShaper[i] = (UInt16)(ShapeCode(i) * 65535.0 + 0.5);
+		v = UnshapeCode(i / 65535.0);
+		gGridUnshaper[i] = (v >= 65535.0) ? 65535 : (UInt16)(v + 0.5);
+	}
+}
+
+static void
+InitGridShaper (void)
+{
+	pthread_once(&gGridShaperOnce, &BuildGridShaper);
+}
+
+
+//--------------------------------------------------------------------- EngineNewTransform
+//	Returns a compiled transform with a reference count of one.
+//---------------------------------------------------------------------
+
+EngineError
+EngineNewTransform (const EngineTransformKey* key, EngineTransformRef* result)
+{
+	CMMTransformPtr		xform;
+	EngineError			err;
+	
+	*result = nil;
+	
+	xform = (CMMTransformPtr)calloc(1, sizeof(CMMTransformRec));
+	if (xform == nil)
+		return kEngineMemFullErr;
+	
+	xform->refCount	= 1;
+	xform->srcSpace	= key->srcSpace;
+	xform->srcClass	= key->srcClass;
+	xform->dstSpace	= key->dstSpace;
+	xform->dstClass	= key->dstClass;
+	xform->viaCount	= key->viaCount;
+	memcpy(xform->via, key->via, sizeof(xform->via));
+	xform->quality	= key->quality;
+	xform->precision = key->precision;
+	xform->memo		= key->memo;
+	xform->gridPoints = key->gridPoints;
+	
+	err = CompileTransform(xform);
+	if (err != kEngineNoErr)
+	{
+		EngineReleaseTransform(xform);
+		return err;
+	}
+	
+	// Only exact costly conversions and chains measured faster through a
+	// memo; the float and fixed kernels are about as fast as a lookup
+	if (xform->memo == kEngineMemoDefault)
+		xform->memoize = (xform->grid == nil && (xform->stepCount > 1 || (xform->stepCount == 1 && xform->steps[0]->sampled)) &&
+						  (xform->precision == kEnginePrecisionExact ||
+						   (xform->precision == kEnginePrecisionDefault && xform->quality == kEngineBestMode)));
+	else
+		xform->memoize = (xform->memo == kEngineMemoOn);
+	
+	*result = xform;
+	return kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- EngineRetainTransform
+
+void
+EngineRetainTransform (EngineTransformRef xform)
+{
+	if (xform)
+		__sync_add_and_fetch(&xform->refCount, 1);
+}
+
+
+//--------------------------------------------------------------------- EngineReleaseTransform
+
+void
+EngineReleaseTransform (EngineTransformRef xform)
+{
+	if (xform && __sync_sub_and_fetch(&xform->refCount, 1) == 0)
+	{
+		if (xform->grid)
+			free(xform->grid);
+		free(xform);
+	}
+}
+
+
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- transform cache -----
+#endif
+
+
+//---------------------------------------------------------------------
+//	Compiled transforms are kept in a process wide cache so that opening
+//	the same profile pair again only costs a hash lookup, and every
+//	component instance shares the one set of tables. Entries are hashed
+//	on their TransformKey and kept in least recently used order. The
+//	least recently used are dropped once the cache holds more than its
+//	budget, TRANSFORM_CACHE_BYTES unless EngineSetCacheBudget changes
+//	it; instances still using them keep their own reference.
+//---------------------------------------------------------------------
+
+typedef struct CacheEntry
+{
+	struct CacheEntry*	hashNext;
+	struct CacheEntry*	older;
+	struct CacheEntry*	newer;
+	UInt32				hash;
+	UInt32				bytes;
+	TransformKey		key;
+	CMMTransformPtr		transform;
+} CacheEntry;
+
+static struct
+{
+	pthread_mutex_t		lock;
+	CacheEntry*			buckets[kTransformCacheBuckets];
+	CacheEntry*			newest;
+	CacheEntry*			oldest;
+	UInt32				bytes;
+	UInt32				budget;
+} gTransformCache = { PTHREAD_MUTEX_INITIALIZER, { nil }, nil, nil, 0, TRANSFORM_CACHE_BYTES };
+
+
+//--------------------------------------------------------------------- HashKey
+//	FNV-1a over the key. Keys are cleared before they are filled in, so
+//	the padding bytes hash the same every time.
+//---------------------------------------------------------------------
+
+static UInt32
+HashKey (const TransformKey* key)
+{
+	const UInt8*		p = (const UInt8*)key;
+	UInt32				hash = 2166136261U;
+	UInt32				i;
+	
+	for (i=0; i < sizeof(TransformKey); i++)
+		hash = (hash ^ p[i]) * 16777619U;
+	
+	return hash;
+}
+
+
+//--------------------------------------------------------------------- TransformBytes
+
+static UInt32
+TransformBytes (CMMTransformPtr xform)
+{
+	UInt32				bytes = sizeof(CMMTransformRec);
+	UInt32				nodes;
+	
+	if (xform->grid)
+	{
+		nodes = xform->gridPoints * xform->gridPoints * xform->gridPoints;
+		bytes += nodes * xform->gridOutChans * sizeof(UInt16);
+	}
+	
+	return bytes + sizeof(CacheEntry);
+}
+
+
+//--------------------------------------------------------------------- UnlinkEntry
+//	Called with gTransformCache.lock held.
+
+static void
+UnlinkEntry (CacheEntry* entry)
+{
+	CacheEntry**		link;
+	
+	for (link = &gTransformCache.buckets[entry->hash % kTransformCacheBuckets]; *link != entry; link = &(*link)->hashNext)
+		;
+	*link = entry->hashNext;
+	
+	if (entry->older)
+		entry->older->newer = entry->newer;
+	else
+		gTransformCache.oldest = entry->newer;
+	
+	if (entry->newer)
+		entry->newer->older = entry->older;
+	else
+		gTransformCache.newest = entry->older;
+	
+	gTransformCache.bytes -= entry->bytes;
+}
+
+
+//--------------------------------------------------------------------- LinkEntry
+//	Called with gTransformCache.lock held. Makes entry the newest.
+
+static void
+LinkEntry (CacheEntry* entry)
+{
+	CacheEntry**		bucket = &gTransformCache.buckets[entry->hash % kTransformCacheBuckets];
+	
+	entry->hashNext = *bucket;
+	*bucket = entry;
+	
+	entry->older = gTransformCache.newest;
+	entry->newer = nil;
+	if (gTransformCache.newest)
+		gTransformCache.newest->newer = entry;
+	else
+		gTransformCache.oldest = entry;
+	gTransformCache.newest = entry;
+	
+	gTransformCache.bytes += entry->bytes;
+}
+
+
+//--------------------------------------------------------------------- FindEntry
+//	Called with gTransformCache.lock held. Makes the entry found the newest.
+
+static CacheEntry*
+FindEntry (const TransformKey* key, UInt32 hash)
+{
+	CacheEntry*			entry;
+	
+	for (entry = gTransformCache.buckets[hash % kTransformCacheBuckets]; entry; entry = entry->hashNext)
+	{
+		if (entry->hash == hash && memcmp(&entry->key, key, sizeof(TransformKey)) == 0)
+		{
+			UnlinkEntry(entry);
+			LinkEntry(entry);
+			return entry;
+		}
+	}
+	
+	return nil;
+}
+
+
+//--------------------------------------------------------------------- TrimCache
+//	Called with gTransformCache.lock held. Unlinks the oldest entries until
+//	the cache fits its budget and returns them, chained through hashNext,
+//	for ReleaseEntries to free once the lock is given up.
+//---------------------------------------------------------------------
+
+static CacheEntry*
+TrimCache (void)
+{
+	CacheEntry*			entry;
+	CacheEntry*			evicted = nil;
+	
+	while (gTransformCache.bytes > gTransformCache.budget)
+	{
+		entry = gTransformCache.oldest;
+		UnlinkEntry(entry);
+		entry->hashNext = evicted;
+		evicted = entry;
+	}
+	
+	return evicted;
+}
+
+
+//--------------------------------------------------------------------- ReleaseEntries
+
+static void
+ReleaseEntries (CacheEntry* evicted)
+{
+	CacheEntry*			entry;
+	
+	while (evicted)
+	{
+		entry = evicted;
+		evicted = entry->hashNext;
+		EngineReleaseTransform(entry->transform);
+		free(entry);
+	}
+}
+
+
+//--------------------------------------------------------------------- EngineFindTransform
+//	Returns a retained transform for key, from the cache when possible.
+//---------------------------------------------------------------------
+
+EngineError
+EngineFindTransform (const EngineTransformKey* key, EngineTransformRef* result)
+{
+	CacheEntry*			entry;
+	CacheEntry*			cached;
+	CacheEntry*			evicted;
+	CMMTransformPtr		xform;
+	UInt32				hash;
+	EngineError			err;
+	
+	hash = HashKey(key);
+	
+	pthread_mutex_lock(&gTransformCache.lock);
+	if (gTransformCache.budget == 0)
+	{
+		pthread_mutex_unlock(&gTransformCache.lock);
+		return EngineNewTransform(key, result);
+	}
+	
+	entry = FindEntry(key, hash);
+	if (entry)
+	{
+		EngineRetainTransform(entry->transform);
+		*result = entry->transform;
+		pthread_mutex_unlock(&gTransformCache.lock);
+		return kEngineNoErr;
+	}
+	pthread_mutex_unlock(&gTransformCache.lock);
+	
+	// Compile outside the lock, grids take a while
+	err = EngineNewTransform(key, &xform);
+	if (err != kEngineNoErr)
+		return err;
+	
+	*result = xform;
+	
+	entry = (CacheEntry*)malloc(sizeof(CacheEntry));
+	if (entry == nil)
+		return kEngineNoErr;
+	
+	entry->hash			= hash;
+	entry->key			= *key;
+	entry->transform	= xform;
+	entry->bytes		= TransformBytes(xform);
+	
+	pthread_mutex_lock(&gTransformCache.lock);
+	if (entry->bytes > gTransformCache.budget)
+	{
+		pthread_mutex_unlock(&gTransformCache.lock);
+		free(entry);
+		return kEngineNoErr;
+	}
+	
+	// Another thread may have compiled the same transform meanwhile; the
+	// first one cached is shared and this one dropped
+	cached = FindEntry(key, hash);
+	if (cached)
+	{
+		EngineRetainTransform(cached->transform);
+		*result = cached->transform;
+		pthread_mutex_unlock(&gTransformCache.lock);
+		EngineReleaseTransform(xform);
+		free(entry);
+		return kEngineNoErr;
+	}
+	
+	EngineRetainTransform(xform);
+	LinkEntry(entry);
+	evicted = TrimCache();
+	pthread_mutex_unlock(&gTransformCache.lock);
+	
+	ReleaseEntries(evicted);
+	
+	return kEngineNoErr;
+}
+
+
+//--------------------------------------------------------------------- EngineSetCacheBudget
+
+void
+EngineSetCacheBudget (uint32_t bytes)
+{
+	CacheEntry*			evicted;
+	
+	pthread_mutex_lock(&gTransformCache.lock);
+	gTransformCache.budget = bytes;
+	evicted = TrimCache();
+	pthread_mutex_unlock(&gTransformCache.lock);
+	
+	ReleaseEntries(evicted);
+}
+
+
+//--------------------------------------------------------------------- GridInterp
+//	Tetrahedral interpolation of the grid. Positions are s15.16 fixed
+//	point, weights are 15 bits so the sums stay within 32 bits. The sums
+//	are rounded to the code values the nodes stand for, see BuildGrid,
+//	which have one bit more than the nodes.
+//---------------------------------------------------------------------
+
+#define ToFixedDomain(x)	((x) + (((x) + 0x7FFF) / 0xFFFF))
+
+static void
+Tetrahedral (const UInt16* grid, UInt32 points, UInt32 outChans, const UInt16* chan, SInt32* out)
+{
+	UInt32			fx, fy, fz;
+	SInt32			rx, ry, rz;
+	UInt32			X0, X1, Y0, Y1, Z0, Z1;
+	SInt32			c0, c1, c2, c3, rest;
+	UInt32			o;
+	
+	fx = ToFixedDomain((UInt32)chan[0] * (points - 1));
+	fy = ToFixedDomain((UInt32)chan[1] * (points - 1));
+	fz = ToFixedDomain((UInt32)chan[2] * (points - 1));
+	
+	rx = (fx & 0xFFFF) >> 1;
+	ry = (fy & 0xFFFF) >> 1;
+	rz = (fz & 0xFFFF) >> 1;
+	
+	Z0 = (fz >> 16) * outChans;
+	Y0 = (fy >> 16) * outChans * points;
+	X0 = (fx >> 16) * outChans * points * points;
+	
+	Z1 = Z0 + ((chan[2] == 0xFFFF) ? 0 : outChans);
+	Y1 = Y0 + ((chan[1] == 0xFFFF) ? 0 : outChans * points);
+	X1 = X0 + ((chan[0] == 0xFFFF) ? 0 : outChans * points * points);
+	
+	for (o=0; o < outChans; o++)
+	{
+		const UInt16*	g = grid + o;
+		
+		c0 = g[X0 + Y0 + Z0];
+		
+		if (rx >= ry && ry >= rz)
+		{
+			c1 = g[X1 + Y0 + Z0] - c0;
+			c2 = g[X1 + Y1 + Z0] - g[X1 + Y0 + Z0];
+			c3 = g[X1 + Y1 + Z1] - g[X1 + Y1 + Z0];
+		}
+		else if (rx >= rz && rz >= ry)
+		{
+			c1 = g[X1 + Y0 + Z0] - c0;
+			c2 = g[X1 + Y1 + Z1] - g[X1 + Y0 + Z1];
+			c3 = g[X1 + Y0 + Z1] - g[X1 + Y0 + Z0];
+		}
+		else if (rz >= rx && rx >= ry)
+		{
+			c1 = g[X1 + Y0 + Z1] - g[X0 + Y0 + Z1];
+			c2 = g[X1 + Y1 + Z1] - g[X1 + Y0 + Z1];
+			c3 = g[X0 + Y0 + Z1] - c0;
+		}
+		else if (ry >= rx && rx >= rz)
+		{
+			c1 = g[X1 + Y1 + Z0] - g[X0 + Y1 + Z0];
+			c2 = g[X0 + Y1 + Z0] - c0;
+			c3 = g[X1 + Y1 + Z1] - g[X1 + Y1 + Z0];
+		}
+		else if (ry >= rz && rz >= rx)
+		{
+			c1 = g[X1 + Y1 + Z1] - g[X0 + Y1 + Z1];
+			c2 = g[X0 + Y1 + Z0] - c0;
+			c3 = g[X0 + Y1 + Z1] - g[X0 + Y1 + Z0];
+		}
+		else
+		{
+			c1 = g[X1 + Y1 + Z1] - g[X0 + Y1 + Z1];
+			c2 = g[X0 + Y1 + Z1] - g[X0 + Y0 + Z1];
+			c3 = g[X0 + Y0 + Z1] - c0;
+		}
+		
+		rest = c1 * rx + c2 * ry + c3 * rz;
+		out[o] = 2 * c0 + ((rest + 0x2000) >> 14) - 32768;
+	}
+}
+
+static void
+GridInterp (CMMTransformPtr xform, UInt16* chan)
+{
+	UInt32			outChans = xform->gridOutChans;
+	UInt16			shaped[3];
+	SInt32			out[4];
+	UInt32			o;
+	
+	if (xform->gridShaped)
+	{
+		shaped[0] = gGridShaper[chan[0]];
+		shaped[1] = gGridShaper[chan[1]];
+		shaped[2] = gGridShaper[chan[2]];
+		Tetrahedral(xform->grid, xform->gridPoints, outChans, shaped, out);
+	}
+	else
+		Tetrahedral(xform->grid, xform->gridPoints, outChans, chan, out);
+	
+	for (o=0; o < outChans; o++)
+		chan[o] = (out[o] < 0) ? 0 : ((out[o] > 65535) ? 65535 : out[o]);
+	
+	if (xform->gridCubed)
+	{
+		chan[0] = gGridUnshaper[chan[0]];
+		chan[1] = gGridUnshaper[chan[1]];
+		chan[2] = gGridUnshaper[chan[2]];
+	}
+}
+
+
+//--------------------------------------------------------------------- DebugColor4
+
+#if DO_DEBUGCOLOR
+static void
+DebugColor4( UInt16* color)
+{
+	char			s[] = " 0xXXXX, 0xXXXX, 0xXXXX, 0xXXXX\n";
+	char*			c = &(s[3]);
+	int				i;
+	int				v;
+	
+	for (i=0; i<4; i++)
+	{
+		v = (((*color)>>12) & 0x000F);	*c++ = (v<10) ? (v+'0') : (v+'A'-10);
+		v = (((*color)>>8) & 0x000F);	*c++ = (v<10) ? (v+'0') : (v+'A'-10);
+		v = (((*color)>>4) & 0x000F);	*c++ = (v<10) ? (v+'0') : (v+'A'-10);
+		v = (((*color)) & 0x000F);		*c++ = (v<10) ? (v+'0') : (v+'A'-10);
+		c += 4;
+		color++;
+	}
+	
+	fprintf(stderr, s);
+}
+#endif
+
+
+//--------------------------------------------------------------------- EngineCheckAccuracy
+//	Matches pseudo-random colors through every conversion at the given
+//	quality and precision and reports the largest difference from the
+//	exact procs, in code values and, for Lab results, in dE*ab. Results
+//	outside the bounds published in DemoCMMEngine.h are flagged and
+//	counted. Where draft quality samples conversions into grids, they are
+//	matched at each size of grid in turn. A few chains are matched too,
+//	against the procs of their steps run in turn.
+//---------------------------------------------------------------------
+
+typedef struct
+{
+	UInt32				matrixDiff;		// code values, neither space Lab
+	double				toLabDE;		// dE*ab, to Lab
+	UInt32				toXYZDiff;		// code values, Lab to XYZ
+	UInt32				fromLabDiff;	// code values, Lab to RGB or CMYK
+	UInt32				chainDiff;		// code values, a chain
+} AccuracyBoundsRec;
+
+// Chains checked after the single conversions, source, via and destination
+static const OSType				gAccuracyChains[][3] =
+{
+	{ kEngineRGBData,	kEngineLabData,		kEngineCMYKData },
+	{ kEngineCMYKData,	kEngineXYZData,		kEngineRGBData },
+	{ kEngineLabData,	kEngineRGBData,		kEngineLabData },
+};
+
+// Indexed by precision
+static const AccuracyBoundsRec	gAccuracyBounds[] =
+{
+	{ 0,	0.0,	0,	0,	0 },	// kEnginePrecisionDefault, not used
+	{ 0,	0.0,	0,	0,	0 },	// kEnginePrecisionExact
+	{ 2,	0.03,	2,	2,	16 },	// kEnginePrecisionFloat
+	{ 1,	0.01,	1,	2,	16 },	// kEnginePrecisionFixed
+};
+
+// Sizes of grid checked, and their bounds; no chain is sampled
+static const UInt32				gAccuracyGridPoints[] = { 17, 33, 65 };
+static const AccuracyBoundsRec	gAccuracyGridBounds[] =
+{
+	{ 8,	1.5,	12,	48,	0 },	// 17 nodes
+	{ 8,	0.5,	8,	40,	0 },	// 33 nodes
+	{ 8,	0.2,	8,	40,	0 },	// 65 nodes
+};
+
+int
+EngineCheckAccuracy (uint32_t quality, uint32_t precision)
+{
+	EngineTransformKey	key;
+	CMMTransformPtr		xform;
+	const AccuracyBoundsRec* bounds;
+	const AccuracyBoundsRec* limits;
+	Boolean				exceeded;
+	int					failures = 0;
+	UInt16				colors[kMatchBlockPixels][4];
+	UInt16				exact[4];
+	UInt16*				chan;
+	UInt32				seed = 1;
+	UInt32				conversions = sizeof(gConversions) / sizeof(gConversions[0]);
+	UInt32				chains = sizeof(gAccuracyChains) / sizeof(gAccuracyChains[0]);
+	UInt32				size = 1, sizes = 2;	// of gAccuracyGridPoints, 33 only
+	UInt32				i, j, k, n, s, outChans;
+	char				gridNote[24];
+	SInt32				diff, maxDiff;
+	double				dL, da, db, dE, maxDE;
+	
+	if (precision > kEnginePrecisionFixed)
+		return 0;
+	
+	// Bounds of the precision the transforms resolve to
+	if (precision != kEnginePrecisionDefault)
+		bounds = &gAccuracyBounds[precision];
+	else if (quality == kEngineBestMode)
+		bounds = &gAccuracyBounds[kEnginePrecisionExact];
+	else if (quality == kEngineDraftMode)
+		bounds = &gAccuracyBounds[kEnginePrecisionFixed];
+	else
+		bounds = &gAccuracyBounds[kEnginePrecisionFloat];	// and fixed, which is within them
+	
+	if (quality == kEngineDraftMode && precision == kEnginePrecisionDefault)
+	{
+		size = 0;
+		sizes = sizeof(gAccuracyGridPoints) / sizeof(gAccuracyGridPoints[0]);
+	}
+	
+	for (s=size; s < sizes; s++)
+	{
+		for (i=0; i < conversions + chains; i++)
+		{
+			memset(&key, 0, sizeof(key));
+			if (i < conversions)
+			{
+				key.srcSpace = gConversions[i].srcSpace;
+				key.dstSpace = gConversions[i].dstSpace;
+			}
+			else
+			{
+				key.srcSpace = gAccuracyChains[i - conversions][0];
+				key.viaCount = 1;
+				key.via[0] = gAccuracyChains[i - conversions][1];
+				key.dstSpace = gAccuracyChains[i - conversions][2];
+			}
+			key.quality = quality;
+			key.precision = precision;
+			key.gridPoints = gAccuracyGridPoints[s];
+			if (EngineNewTransform(&key, &xform) != kEngineNoErr)
+				continue;
+			
+			// Only the grids depend on their size
+			if (s > size && xform->grid == nil)
+			{
+				EngineReleaseTransform(xform);
+				continue;
+			}
+			
+			outChans = ChannelCount(xform->dstSpace);
+			maxDiff = 0;
+			maxDE = 0.0;
+			
+			for (n=0; n < 256; n++)
+			{
+				for (j=0; j < kMatchBlockPixels; j++)
+				{
+					chan = colors[j];
+					for (k=0; k < 4; k++)
+					{
+						seed = seed * 1664525 + 1013904223;
+						chan[k] = seed >> 16;
+					}
+				}
+				
+				memcpy(colors + kMatchBlockPixels / 2, colors, sizeof(colors) / 2);
+				EngineMatchColors(xform, colors, kMatchBlockPixels / 2, sizeof(colors[0]));
+				
+				for (j=0; j < kMatchBlockPixels / 2; j++)
+				{
+					chan = colors[j];
+					memcpy(exact, colors[j + kMatchBlockPixels / 2], sizeof(exact));
+					for (k=0; k < xform->stepCount; k++)
+						xform->steps[k]->proc(exact);
+					
+					for (k=0; k < outChans; k++)
+					{
+						diff = (SInt32)chan[k] - (SInt32)exact[k];
+						if (diff < 0) diff = -diff;
+						if (diff > maxDiff) maxDiff = diff;
+					}
+					
+					if (xform->dstSpace == kEngineLabData)
+					{
+						dL = ((double)chan[0] - exact[0]) * 100.0 / 65535.0;
+						da = ((double)chan[1] - exact[1]) * 256.0 / 65535.0;
+						db = ((double)chan[2] - exact[2]) * 256.0 / 65535.0;
+						dE = sqrt(dL * dL + da * da + db * db);
+						if (dE > maxDE) maxDE = dE;
+					}
+				}
+			}
+			
+			limits = xform->grid ? &gAccuracyGridBounds[s] : bounds;
+			
+			if (xform->stepCount > 1)
+				exceeded = (maxDiff > (SInt32)bounds->chainDiff);
+			else if (xform->dstSpace == kEngineLabData)
+				exceeded = (maxDE > limits->toLabDE);
+			else if (xform->srcSpace != kEngineLabData)
+				exceeded = (maxDiff > (SInt32)limits->matrixDiff);
+			else if (xform->dstSpace == kEngineXYZData)
+				exceeded = (maxDiff > (SInt32)limits->toXYZDiff);
+			else
+				exceeded = (maxDiff > (SInt32)limits->fromLabDiff);
+			
+			if (exceeded)
+				failures++;
+			
+			gridNote[0] = 0;
+			if (xform->grid)
+				snprintf(gridNote, sizeof(gridNote), "  grid %lu", (unsigned long)xform->gridPoints);
+			
+			fprintf(stderr, "%c%c%c%c -> %s%c%c%c%c  max diff %5ld  max dE %.4f%s%s\n",
+					(char)(xform->srcSpace >> 24), (char)(xform->srcSpace >> 16), (char)(xform->srcSpace >> 8), (char)xform->srcSpace,
+					xform->stepCount > 1 ? "... -> " : "",
+					(char)(xform->dstSpace >> 24), (char)(xform->dstSpace >> 16), (char)(xform->dstSpace >> 8), (char)xform->dstSpace,
+					(long)maxDiff, maxDE, gridNote,
+					exceeded ? "  exceeds bound" : "");
+			
+			EngineReleaseTransform(xform);
+		}
+	}
+	
+	return failures;
+}
+
+
+//---------------------------------------------------------------------	MatchAll				
+//	Simple conversion of a bunch or colors. MatchRows converts a band of
+//	rows, so bands may be matched on different threads at once.
+//	Each row is unpacked into blocks of 16 bit colors, matched and packed
+//	again by the kernels chosen in SetupMatchKernels.
+//---------------------------------------------------------------------
+
+static void
+MatchAll (CMMMatchPtr pMatchInfo)
+{
+	MatchRows(pMatchInfo, 0, pMatchInfo->height);
+}
+
+static void
+MatchBand (void* data, UInt32 firstRow, UInt32 rowCount)
+{
+	CMMMatchPtr			pMatchInfo = (CMMMatchPtr)data;
+	
+	if (pMatchInfo->swapOnly)
+		SwapRows(pMatchInfo, firstRow, rowCount);
+	else if (pMatchInfo->floating)
+		MatchRowsFloat(pMatchInfo, firstRow, rowCount);
+	else
+		MatchRows(pMatchInfo, firstRow, rowCount);
+}
+
+static void
+MatchRows (CMMMatchPtr pMatchInfo, UInt32 firstRow, UInt32 rowCount)
+{
+	UInt32				r, c, i, n;
+	UInt16				chan[kMatchBlockPixels * 4];
+	UInt8				chan8[kMatchBlockPixels * 4];
+	UInt16				alpha[kMatchBlockPixels];
+	UInt8*				sRow[4];
+	UInt8*				dRow[4];
+	UInt8*				sAlpha = nil;
+	UInt8*				dAlpha = nil;
+	CMMTransformPtr		xform = pMatchInfo->transform;
+	MemoRec*			memo = nil;
+	UInt16				used[4];
+	UInt64				mask = 0;
+	
+	// Colors without alpha are opaque
+	for (i=0; i < kMatchBlockPixels; i++)
+		alpha[i] = 0xFFFF;
+	
+	// The channels of the source make up the key of a color in the memo
+	if (xform->memoize && pMatchInfo->block && !pMatchInfo->native8 &&
+		rowCount * pMatchInfo->width >= kMemoMinPixels)
+		memo = TakeMemo();
+	if (memo)
+	{
+		for (i=0; i < 4; i++)
+			used[i] = (i < pMatchInfo->srcChans) ? 0xFFFF : 0;
+		memcpy(&mask, used, sizeof(mask));
+	}
+	
+	for (r=firstRow; r < firstRow + rowCount; r++)
+	{
+		for (i=0; i < pMatchInfo->srcChans; i++)
+			sRow[i] = pMatchInfo->srcBuf[i] + (r * pMatchInfo->srcRowBytes[i]);
+		for (i=0; i < pMatchInfo->dstChans; i++)
+			dRow[i] = pMatchInfo->dstBuf[i] + (r * pMatchInfo->dstRowBytes[i]);
+		if (pMatchInfo->unpackAlpha)
+			sAlpha = pMatchInfo->srcAlphaBuf + (r * pMatchInfo->srcAlphaRowBytes);
+		if (pMatchInfo->packAlpha)
+			dAlpha = pMatchInfo->dstAlphaBuf + (r * pMatchInfo->dstAlphaRowBytes);
+		
+		for (c=0; c < pMatchInfo->width; c += n)
+		{
+			n = pMatchInfo->width - c;
+			if (n > kMatchBlockPixels)
+				n = kMatchBlockPixels;
+			
+			if (sAlpha)
+				pMatchInfo->unpackAlpha(sAlpha, pMatchInfo->srcAlphaColBytes, alpha, n);
+			
+			if (pMatchInfo->native8)
+			{
+				pMatchInfo->unpackByte(sRow, pMatchInfo->srcColBytes[0], chan8, n);
+				if (pMatchInfo->block8)
+					pMatchInfo->block8(chan8, n);
+				pMatchInfo->packByte(chan8, dRow, pMatchInfo->dstColBytes[0], n);
+			}
+			else
+			{
+			// read colors in from source buffer
+			UnpackBlock(pMatchInfo, sRow, chan, n);
+			if (pMatchInfo->unpremultiply)
+				Unpremultiply(chan, alpha, n);
+			
+#if DO_DEBUGCOLOR
+			for (i=0; i < n; i++) DebugColor4(chan + i * 4);
+#endif
+			// Match the colors
+			if (memo)
+				MatchBlockMemo(xform, chan, n, mask, memo);
+			else if (pMatchInfo->block)
+				MatchBlockPadded(pMatchInfo->block, xform, chan, n);
+				
+#if DO_DEBUGCOLOR
+			for (i=0; i < n; i++) DebugColor4(chan + i * 4);
+#endif
+			
+			// Write colors to destination buffer
+			if (pMatchInfo->premultiply)
+				Premultiply(chan, alpha, n);
+			PackBlock(pMatchInfo, chan, dRow, n);
+			}
+			
+			if (dAlpha)
+				pMatchInfo->packAlpha(alpha, dAlpha, pMatchInfo->dstAlphaColBytes, n);
+			
+			for (i=0; i < pMatchInfo->srcChans; i++)
+				sRow[i] += n * pMatchInfo->srcColBytes[i];
+			for (i=0; i < pMatchInfo->dstChans; i++)
+				dRow[i] += n * pMatchInfo->dstColBytes[i];
+			if (sAlpha)
+				sAlpha += n * pMatchInfo->srcAlphaColBytes;
+			if (dAlpha)
+				dAlpha += n * pMatchInfo->dstAlphaColBytes;
+		}
+	}
+	
+	if (memo)
+	{
+		__sync_add_and_fetch(&xform->memoRuns, memo->runs);
+		__sync_add_and_fetch(&xform->memoHits, memo->hits);
+		__sync_add_and_fetch(&xform->memoMisses, memo->misses);
+		__sync_add_and_fetch(&xform->memoBypassed, memo->bypassed);
+		GiveMemo(memo);
+	}
+}
+
+
+//--------------------------------------------------------------------- MatchRowsFloat
+//	Rows to or from a float layout, as MatchRows but in float codes. Each
+//	conversion of the transform is applied in turn, so a chain is never
+//	sampled, and nothing is rounded or clamped before the destination.
+//---------------------------------------------------------------------
+
+static void
+MatchRowsFloat (CMMMatchPtr pMatchInfo, UInt32 firstRow, UInt32 rowCount)
+{
+	UInt32				r, c, i, n;
+	float				chan[kMatchBlockPixels * 4];
+	UInt16				codes[kMatchBlockPixels * 4];
+	UInt16				alpha[kMatchBlockPixels];
+	UInt8*				sRow[4];
+	UInt8*				dRow[4];
+	UInt8*				sAlpha = nil;
+	UInt8*				dAlpha = nil;
+	CMMTransformPtr		xform = pMatchInfo->transform;
+	
+	for (i=0; i < kMatchBlockPixels; i++)
+		alpha[i] = 0xFFFF;
+	
+	for (r=firstRow; r < firstRow + rowCount; r++)
+	{
+		for (i=0; i < pMatchInfo->srcChans; i++)
+			sRow[i] = pMatchInfo->srcBuf[i] + (r * pMatchInfo->srcRowBytes[i]);
+		for (i=0; i < pMatchInfo->dstChans; i++)
+			dRow[i] = pMatchInfo->dstBuf[i] + (r * pMatchInfo->dstRowBytes[i]);
+		if (pMatchInfo->unpackAlpha)
+			sAlpha = pMatchInfo->srcAlphaBuf + (r * pMatchInfo->srcAlphaRowBytes);
+		if (pMatchInfo->packAlpha)
+			dAlpha = pMatchInfo->dstAlphaBuf + (r * pMatchInfo->dstAlphaRowBytes);
+		
+		for (c=0; c < pMatchInfo->width; c += n)
+		{
+			n = pMatchInfo->width - c;
+			if (n > kMatchBlockPixels)
+				n = kMatchBlockPixels;
+			
+			// Only the side of integer channels may have alpha
+			if (sAlpha)
+				pMatchInfo->unpackAlpha(sAlpha, pMatchInfo->srcAlphaColBytes, alpha, n);
+			
+			if (pMatchInfo->unpackFloat)
+				pMatchInfo->unpackFloat(sRow, pMatchInfo->srcColBytes[0], chan, n, pMatchInfo->srcScale);
+			else
+			{
+				UnpackBlock(pMatchInfo, sRow, codes, n);
+				if (pMatchInfo->unpremultiply)
+					Unpremultiply(codes, alpha, n);
+				CodesToFloats(codes, chan, n);
+			}
+			
+			for (i=0; i < xform->stepCount; i++)
+				xform->steps[i]->floating(xform, chan, n);
+			
+			if (pMatchInfo->packFloat)
+				pMatchInfo->packFloat(chan, dRow, pMatchInfo->dstColBytes[0], n, pMatchInfo->dstScale);
+			else
+			{
+				FloatsToCodes(chan, codes, n);
+				if (pMatchInfo->premultiply)
+					Premultiply(codes, alpha, n);
+				PackBlock(pMatchInfo, codes, dRow, n);
+			}
+			
+			if (dAlpha)
+				pMatchInfo->packAlpha(alpha, dAlpha, pMatchInfo->dstAlphaColBytes, n);
+			
+			for (i=0; i < pMatchInfo->srcChans; i++)
+				sRow[i] += n * pMatchInfo->srcColBytes[i];
+			for (i=0; i < pMatchInfo->dstChans; i++)
+				dRow[i] += n * pMatchInfo->dstColBytes[i];
+			if (sAlpha)
+				sAlpha += n * pMatchInfo->srcAlphaColBytes;
+			if (dAlpha)
+				dAlpha += n * pMatchInfo->dstAlphaColBytes;
+		}
+	}
+}
+
+// Rows of an identity between layouts that differ only in byte order
+static void
+SwapRows (CMMMatchPtr pMatchInfo, UInt32 firstRow, UInt32 rowCount)
+{
+	UInt32				r;
+	UInt8*				src = WholePixels(pMatchInfo->srcBuf, pMatchInfo->srcRowBytes, pMatchInfo->srcColBytes, pMatchInfo->srcChans,
+										  pMatchInfo->srcAlphaBuf, pMatchInfo->srcAlphaRowBytes, pMatchInfo->srcAlphaColBytes);
+	UInt8*				dst = WholePixels(pMatchInfo->dstBuf, pMatchInfo->dstRowBytes, pMatchInfo->dstColBytes, pMatchInfo->dstChans,
+										  pMatchInfo->dstAlphaBuf, pMatchInfo->dstAlphaRowBytes, pMatchInfo->dstAlphaColBytes);
+	
+	for (r=firstRow; r < firstRow + rowCount; r++)
+		SwapBytes16(src + r * pMatchInfo->srcRowBytes[0], dst + r * pMatchInfo->dstRowBytes[0],
+					pMatchInfo->width * pMatchInfo->srcColBytes[0] / 2);
+}
+
+
+//--------------------------------------------------------------------- UnpackBlock
+//	A split side, whose channels are not all the same distance apart, is
+//	moved one channel at a time by the one channel kernel, which only
+//	touches the first channel of each color in the block buffer.
+//---------------------------------------------------------------------
+
+static void
+UnpackBlock (CMMMatchPtr pMatchInfo, UInt8* const* sRow, UInt16* chan, UInt32 count)
+{
+	UInt32				i;
+	
+	if (!pMatchInfo->srcSplit)
+		pMatchInfo->unpack(sRow, pMatchInfo->srcColBytes[0], chan, count);
+	else
+		for (i=0; i < pMatchInfo->srcChans; i++)
+			pMatchInfo->unpack(&sRow[i], pMatchInfo->srcColBytes[i], chan + i, count);
+}
+
+static void
+PackBlock (CMMMatchPtr pMatchInfo, const UInt16* chan, UInt8* const* dRow, UInt32 count)
+{
+	UInt32				i;
+	
+	if (!pMatchInfo->dstSplit)
+		pMatchInfo->pack(chan, dRow, pMatchInfo->dstColBytes[0], count);
+	else
+		for (i=0; i < pMatchInfo->dstChans; i++)
+			pMatchInfo->pack(chan + i, &dRow[i], pMatchInfo->dstColBytes[i], count);
+}
+
+
+//---------------------------------------------------------------------	MatchBlockPadded
+//	The vector kernels round a little differently from their scalar tail,
+//	so the colors of a row always go through them in whole groups of four,
+//	the last padded with copies of the last color. A color then comes out
+//	the same wherever it is, in a row, a strip or the memo.
+//---------------------------------------------------------------------
+
+static void
+MatchBlockPadded (MatchBlockProc block, CMMTransformPtr xform, UInt16* chan, UInt32 count)
+{
+	UInt16				tail[4 * 4];
+	UInt32				whole = count & ~3;
+	UInt32				i, left = count - whole;
+	
+	if (whole)
+		block(xform, chan, whole);
+	
+	if (left)
+	{
+		memcpy(tail, chan + whole * 4, left * 4 * sizeof(UInt16));
+		for (i=left; i < 4; i++)
+			memcpy(tail + i * 4, tail + (left-1) * 4, 4 * sizeof(UInt16));
+		block(xform, tail, 4);
+		memcpy(chan + whole * 4, tail, left * 4 * sizeof(UInt16));
+	}
+}
+
+
+//---------------------------------------------------------------------	MatchBlockMemo
+//	Matches a block through the memo of the band. A color equal to the
+//	one before is copied from it, one found in the memo is copied from
+//	there, and the rest are gathered and matched by the block kernel of
+//	the transform in one go, then remembered. The memo is two way set
+//	associative on a multiplicative hash of the source channels, the
+//	newer color of a set first.
+//---------------------------------------------------------------------
+
+static void
+MatchBlockMemo (CMMTransformPtr xform, UInt16* chan, UInt32 count, UInt64 mask, MemoRec* memo)
+{
+	UInt64				keys[kMatchBlockPixels];
+	UInt16				miss[kMatchBlockPixels * 4];
+	UInt16				missIndex[kMatchBlockPixels];
+	Boolean				run[kMatchBlockPixels];
+	UInt64				key;
+	UInt32				i, slot, misses = 0;
+	
+	if (memo->off)
+	{
+		MatchBlockPadded(xform->block, xform, chan, count);
+		memo->bypassed += count;
+		return;
+	}
+	
+	for (i=0; i < count; i++)
+	{
+		memcpy(&key, chan + i * 4, sizeof(key));
+		key &= mask;
+		keys[i] = key;
+		
+		// Flat areas repeat the color before
+		run[i] = (i > 0) ? (key == keys[i-1]) : (memo->lastValid && key == memo->lastKey);
+		if (run[i])
+			continue;
+		
+		slot = (UInt32)((key * 0x9E3779B97F4A7C15ULL) >> (64 - kMemoSetBits)) * 2;
+		if (memo->used[slot] && memo->key[slot] == key)
+		{
+			memcpy(chan + i * 4, &memo->result[slot], sizeof(UInt64));
+			memo->hits++;
+			continue;
+		}
+		if (memo->used[slot+1] && memo->key[slot+1] == key)
+		{
+			memcpy(chan + i * 4, &memo->result[slot+1], sizeof(UInt64));
+			memo->hits++;
+			continue;
+		}
+		
+		memcpy(miss + misses * 4, chan + i * 4, sizeof(UInt64));
+		missIndex[misses++] = (UInt16)i;
+	}
+	
+	if (misses)
+		MatchBlockPadded(xform->block, xform, miss, misses);
+	
+	for (i=0; i < misses; i++)
+	{
+		key = keys[missIndex[i]];
+		slot = (UInt32)((key * 0x9E3779B97F4A7C15ULL) >> (64 - kMemoSetBits)) * 2;
+		memo->key[slot+1] = memo->key[slot];
+		memo->result[slot+1] = memo->result[slot];
+		memo->used[slot+1] = memo->used[slot];
+		memo->key[slot] = key;
+		memcpy(&memo->result[slot], miss + i * 4, sizeof(UInt64));
+		memo->used[slot] = true;
+		memcpy(chan + missIndex[i] * 4, miss + i * 4, sizeof(UInt64));
+	}
+	
+	// Runs last, in order, once the colors they copy are matched
+	for (i=0; i < count; i++)
+	{
+		if (run[i])
+		{
+			memcpy(chan + i * 4, (i > 0) ? (void*)(chan + (i-1) * 4) : (void*)&memo->lastResult, sizeof(UInt64));
+			memo->runs++;
+		}
+	}
+	
+	memo->misses += misses;
+	memo->lastKey = keys[count-1];
+	memcpy(&memo->lastResult, chan + (count-1) * 4, sizeof(UInt64));
+	memo->lastValid = true;
+	
+	// Give up on a band of too many colors
+	memo->windowColors += count;
+	memo->windowFound += count - misses;
+	if (memo->windowColors >= kMemoWindow)
+	{
+		if (memo->windowFound * 2 < memo->windowColors)
+			memo->off = true;
+		memo->windowColors = memo->windowFound = 0;
+	}
+}
+
+
+//---------------------------------------------------------------------	TakeMemo
+//	Memos are kept for the next band once one is done, so a band only
+//	clears the used flags of a memo, not the whole of it. There are never
+//	more than the bands matched at once.
+//---------------------------------------------------------------------
+
+static struct
+{
+	pthread_mutex_t		lock;
+	MemoRec*			free;
+} gMemoPool = { PTHREAD_MUTEX_INITIALIZER, nil };
+
+static MemoRec*
+TakeMemo (void)
+{
+	MemoRec*			memo;
+	
+	pthread_mutex_lock(&gMemoPool.lock);
+	memo = gMemoPool.free;
+	if (memo)
+		gMemoPool.free = memo->next;
+	pthread_mutex_unlock(&gMemoPool.lock);
+	
+	if (memo == nil)
+		memo = (MemoRec*)malloc(sizeof(MemoRec));
+	if (memo)
+		memset(memo, 0, offsetof(MemoRec, key));
+	
+	return memo;
+}
+
+static void
+GiveMemo (MemoRec* memo)
+{
+	pthread_mutex_lock(&gMemoPool.lock);
+	memo->next = gMemoPool.free;
+	gMemoPool.free = memo;
+	pthread_mutex_unlock(&gMemoPool.lock);
+}
+
+
+//---------------------------------------------------------------------	CheckRows
+//	Gamut check of a band of rows. Each block of colors goes through the
+//	check of every conversion of the chain, and is matched on to the next
+//	one in between, then its flags are packed into bits, the first color
+//	in the high bit of a byte of the bitmap or of a word of the list.
+//---------------------------------------------------------------------
+
+static void
+CheckBand (void* data, UInt32 firstRow, UInt32 rowCount)
+{
+	CheckRows((CMMMatchPtr)data, firstRow, rowCount);
+}
+
+static void
+CheckBlock (CMMTransformPtr xform, UInt16* chan, UInt32 count, UInt8* out)
+{
+	const ConversionRec*	step;
+	UInt32					i;
+	
+	// Between the steps the colors are matched as MatchBlock_Chain does
+	memset(out, 0, count);
+	for (i=0; i < xform->stepCount; i++)
+	{
+		step = xform->steps[i];
+		if (step->check)
+			step->check(chan, count, out);
+		if (i + 1 < xform->stepCount)
+			xform->stepBlocks[i](xform, chan, count);
+	}
+}
+
+static void
+PackGamutBytes (const UInt8* out, UInt32 count, UInt8* bits)
+{
+	UInt32				i, byte;
+	UInt8				mask;
+	
+	for ( ; count >= 8; count -= 8, out += 8)
+		*bits++ = (UInt8)((out[0] << 7) | (out[1] << 6) | (out[2] << 5) | (out[3] << 4) |
+						  (out[4] << 3) | (out[5] << 2) | (out[6] << 1) | out[7]);
+	
+	// The bits past the last pixel are left alone
+	if (count)
+	{
+		for (i=0, byte=0; i < count; i++)
+			byte |= out[i] << (7 - i);
+		mask = (UInt8)(0xFF00 >> count);
+		*bits = (UInt8)((*bits & ~mask) | byte);
+	}
+}
+
+static void
+PackGamutWords (const UInt8* out, UInt32 count, UInt32* bits)
+{
+	UInt32				i, n, word;
+	
+	for ( ; count > 0; count -= n, out += n)
+	{
+		n = (count < 32) ? count : 32;
+		for (i=0, word=0; i < n; i++)
+			word |= (UInt32)out[i] << (31 - i);
+		*bits++ = word;
+	}
+}
+
+static void
+CheckRows (CMMMatchPtr pMatchInfo, UInt32 firstRow, UInt32 rowCount)
+{
+	UInt32				r, c, i, n;
+	UInt16				chan[kMatchBlockPixels * 4];
+	float				floats[kMatchBlockPixels * 4];
+	UInt16				alpha[kMatchBlockPixels];
+	UInt8				out[kMatchBlockPixels];
+	UInt8*				sRow[4];
+	UInt8*				sAlpha = nil;
+	UInt8*				cRow;
+	CMMTransformPtr		xform = pMatchInfo->transform;
+	Boolean				any = false;
+	
+	// Conversions that never clamp need not look at the colors
+	for (i=0; i < xform->stepCount; i++)
+		any = any || (xform->steps[i]->check != nil);
+	if (!any)
+		memset(out, 0, sizeof(out));
+	
+	for (r=firstRow; r < firstRow + rowCount; r++)
+	{
+		for (i=0; i < pMatchInfo->srcChans; i++)
+			sRow[i] = pMatchInfo->srcBuf[i] + (r * pMatchInfo->srcRowBytes[i]);
+		if (pMatchInfo->unpackAlpha)
+			sAlpha = pMatchInfo->srcAlphaBuf + (r * pMatchInfo->srcAlphaRowBytes);
+		cRow = pMatchInfo->chkBuf + (r * pMatchInfo->chkRowBytes);
+		
+		// kMatchBlockPixels is a multiple of 32, so every block starts a word
+		for (c=0; c < pMatchInfo->width; c += n)
+		{
+			n = pMatchInfo->width - c;
+			if (n > kMatchBlockPixels)
+				n = kMatchBlockPixels;
+			
+			// Float channels are checked as the codes they round to
+			if (any)
+			{
+				if (pMatchInfo->unpackFloat)
+				{
+					pMatchInfo->unpackFloat(sRow, pMatchInfo->srcColBytes[0], floats, n, pMatchInfo->srcScale);
+					FloatsToCodes(floats, chan, n);
+				}
+				else
+					UnpackBlock(pMatchInfo, sRow, chan, n);
+				
+				// Premultiplied colors are checked as they are matched
+				if (sAlpha)
+				{
+					pMatchInfo->unpackAlpha(sAlpha, pMatchInfo->srcAlphaColBytes, alpha, n);
+					Unpremultiply(chan, alpha, n);
+				}
+				CheckBlock(xform, chan, n, out);
+			}
+			
+			if (pMatchInfo->chkWords)
+				PackGamutWords(out, n, (UInt32*)cRow + c / 32);
+			else
+				PackGamutBytes(out, n, cRow + c / 8);
+			
+			for (i=0; i < pMatchInfo->srcChans; i++)
+				sRow[i] += n * pMatchInfo->srcColBytes[i];
+			if (sAlpha)
+				sAlpha += n * pMatchInfo->srcAlphaColBytes;
+		}
+	}
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- band scheduling -----
+#endif
+
+
+//---------------------------------------------------------------------
+//	Large bitmaps are split into horizontal bands which a pool of worker
+//	threads, one per extra processor, takes from a shared job list. The
+//	calling thread matches bands as well and is the only one that calls
+//	the progress proc, between its own bands and whenever a worker
+//	finishes one. If the progress proc asks to stop, no further bands
+//	are started and the call returns once the running ones are done.
+//---------------------------------------------------------------------
+
+typedef struct BandJob
+{
+	struct BandJob*		next;
+	BandProc			proc;
+	void*				data;
+	UInt32				height;
+	UInt32				bandRows;
+	UInt32				nextRow;		// first row not yet handed out
+	UInt32				rowsDone;
+	UInt32				busy;			// bands being matched right now
+	Boolean				abort;
+	pthread_cond_t		changed;		// rowsDone or busy changed
+} BandJob;
+
+static struct
+{
+	pthread_once_t		once;
+	pthread_mutex_t		lock;
+	pthread_cond_t		work;
+	BandJob*			jobs;
+	UInt32				workers;
+} gBandPool = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, nil, 0 };
+
+
+//--------------------------------------------------------------------- TakeBand
+//	Called with gBandPool.lock held.
+
+static Boolean
+TakeBand (BandJob* job, UInt32* firstRow, UInt32* rowCount)
+{
+	if (job->abort || job->nextRow >= job->height)
+		return false;
+	
+	*firstRow = job->nextRow;
+	*rowCount = job->height - job->nextRow;
+	if (*rowCount > job->bandRows)
+		*rowCount = job->bandRows;
+	
+	job->nextRow += *rowCount;
+	job->busy++;
+	return true;
+}
+
+
+//--------------------------------------------------------------------- BandWorker
+
+static void*
+BandWorker (void* arg)
+{
+	BandJob*			job;
+	UInt32				firstRow, rowCount;
+	
+	(void)arg;
+	pthread_mutex_lock(&gBandPool.lock);
+	for (;;)
+	{
+		for (job = gBandPool.jobs; job; job = job->next)
+			if (TakeBand(job, &firstRow, &rowCount))
+				break;
+		
+		if (job == nil)
+		{
+			pthread_cond_wait(&gBandPool.work, &gBandPool.lock);
+			continue;
+		}
+		
+		pthread_mutex_unlock(&gBandPool.lock);
+		job->proc(job->data, firstRow, rowCount);
+		pthread_mutex_lock(&gBandPool.lock);
+		
+		job->busy--;
+		job->rowsDone += rowCount;
+		pthread_cond_signal(&job->changed);
+	}
+	
+	return nil;
+}
+
+
+//--------------------------------------------------------------------- StartBandWorkers
+
+static void
+StartBandWorkers (void)
+{
+	pthread_attr_t		attr;
+	pthread_t			thread;
+	long				cpus;
+	
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus <= 1)
+		return;
+	
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	
+	while (gBandPool.workers < (UInt32)(cpus - 1))
+	{
+		if (pthread_create(&thread, &attr, &BandWorker, nil) != 0)
+			break;
+		gBandPool.workers++;
+	}
+	
+	pthread_attr_destroy(&attr);
+}
+
+
+//--------------------------------------------------------------------- RunBands
+
+static EngineError
+RunBands (BandProc proc, void* data, UInt32 height, UInt32 width,
+		  EngineProgressProc progressProc, void* refCon)
+{
+	BandJob				job;
+	BandJob**			link;
+	UInt32				firstRow, rowCount;
+	UInt32				reported;
+	Boolean				working, canceled;
+	
+	job.next		= nil;
+	job.proc		= proc;
+	job.data		= data;
+	job.height		= height;
+	job.bandRows	= (width > 0 && width < kBandPixels) ? (kBandPixels / width) : 1;
+	job.nextRow		= 0;
+	job.rowsDone	= 0;
+	job.busy		= 0;
+	job.abort		= false;
+	
+	// Small bitmaps without a progress proc are not worth a hand-off
+	if (height <= job.bandRows && progressProc == nil)
+	{
+		proc(data, 0, height);
+		return kEngineNoErr;
+	}
+	
+	pthread_once(&gBandPool.once, &StartBandWorkers);
+	pthread_cond_init(&job.changed, nil);
+	
+	pthread_mutex_lock(&gBandPool.lock);
+	job.next = gBandPool.jobs;
+	gBandPool.jobs = &job;
+	pthread_cond_broadcast(&gBandPool.work);
+	
+	reported = height + 1;
+	for (;;)
+	{
+		working = TakeBand(&job, &firstRow, &rowCount);
+		if (working)
+		{
+			pthread_mutex_unlock(&gBandPool.lock);
+			proc(data, firstRow, rowCount);
+			pthread_mutex_lock(&gBandPool.lock);
+			job.busy--;
+			job.rowsDone += rowCount;
+		}
+		
+		if (progressProc && !job.abort && job.rowsDone != reported)
+		{
+			reported = job.rowsDone;
+			pthread_mutex_unlock(&gBandPool.lock);
+			canceled = (progressProc(height - reported, refCon) != 0);
+			pthread_mutex_lock(&gBandPool.lock);
+			
+			// Once the last row is in there is nothing left to cancel
+			if (canceled && reported < height)
+				job.abort = true;
+		}
+		
+		if (!working)
+		{
+			if (job.busy == 0)
+				break;
+			pthread_cond_wait(&job.changed, &gBandPool.lock);
+		}
+	}
+	
+	for (link = &gBandPool.jobs; *link != &job; link = &(*link)->next)
+		;
+	*link = job.next;
+	pthread_mutex_unlock(&gBandPool.lock);
+	
+	pthread_cond_destroy(&job.changed);
+	
+	return (job.abort && job.rowsDone < height) ? kEngineCanceledErr : kEngineNoErr;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark ----- row kernels -----
+#endif
+
+
+//---------------------------------------------------------------------
+//	Unpack and pack kernels for each channel count and channel format.
+//	Colors are held four 16 bit channels apart in the block buffer.
+//---------------------------------------------------------------------
+
+#define Load8(p)			((UInt16)((*(UInt8*)(p) << 8) | *(UInt8*)(p)))
+#define Store8(p,v)			(*(UInt8*)(p) = (UInt8)((v) >> 8))
+
+// Wider channels need not be aligned, a PNM header of odd length puts them
+// at odd addresses, so they are copied rather than dereferenced. The copy
+// compiles to a single load or store.
+static inline UInt16
+Load16 (const void* p)
+{
+	UInt16				v;
+	
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline UInt16
+Load16Swap (const void* p)
+{
+	UInt16				v = Load16(p);
+	
+	return Endian16_Swap(v);
+}
+
+static inline void
+Store16 (void* p, UInt16 v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline void
+Store16Swap (void* p, UInt16 v)
+{
+	v = Endian16_Swap(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+#define DEFINE_UNPACK(name, chans, load)										\
+static void																		\
+name (UInt8* const* buf, UInt32 colBytes, UInt16* chan, UInt32 count)			\
+{																				\
+	UInt32			i, k;														\
+	for (i=0; i < count; i++, chan += 4)										\
+		for (k=0; k < chans; k++)												\
+			chan[k] = load(buf[k] + i * colBytes);								\
+}
+
+#define DEFINE_PACK(name, chans, store)											\
+static void																		\
+name (const UInt16* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)		\
+{																				\
+	UInt32			i, k;														\
+	for (i=0; i < count; i++, chan += 4)										\
+		for (k=0; k < chans; k++)												\
+			store(buf[k] + i * colBytes, chan[k]);								\
+}
+
+DEFINE_UNPACK	(Unpack8_1,			1,	Load8)
+DEFINE_UNPACK	(Unpack8_3,			3,	Load8)
+DEFINE_UNPACK	(Unpack8_4,			4,	Load8)
+DEFINE_UNPACK	(Unpack16_1,		1,	Load16)
+DEFINE_UNPACK	(Unpack16_3,		3,	Load16)
+DEFINE_UNPACK	(Unpack16_4,		4,	Load16)
+DEFINE_UNPACK	(Unpack16Swap_1,	1,	Load16Swap)
+DEFINE_UNPACK	(Unpack16Swap_3,	3,	Load16Swap)
+DEFINE_UNPACK	(Unpack16Swap_4,	4,	Load16Swap)
+
+DEFINE_PACK		(Pack8_1,			1,	Store8)
+DEFINE_PACK		(Pack8_3,			3,	Store8)
+DEFINE_PACK		(Pack8_4,			4,	Store8)
+DEFINE_PACK		(Pack16_1,			1,	Store16)
+DEFINE_PACK		(Pack16_3,			3,	Store16)
+DEFINE_PACK		(Pack16_4,			4,	Store16)
+DEFINE_PACK		(Pack16Swap_1,		1,	Store16Swap)
+DEFINE_PACK		(Pack16Swap_3,		3,	Store16Swap)
+DEFINE_PACK		(Pack16Swap_4,		4,	Store16Swap)
+
+
+//---------------------------------------------------------------------
+//	Byte kernels for 8 bit to 8 bit matching. Colors are held four
+//	8 bit channels apart in the block buffer.
+//---------------------------------------------------------------------
+
+#define DEFINE_UNPACKBYTE(name, chans)											\
+static void																		\
+name (UInt8* const* buf, UInt32 colBytes, UInt8* chan, UInt32 count)			\
+{																				\
+	UInt32			i, k;														\
+	for (i=0; i < count; i++, chan += 4)										\
+		for (k=0; k < chans; k++)												\
+			chan[k] = buf[k][i * colBytes];										\
+}
+
+#define DEFINE_PACKBYTE(name, chans)											\
+static void																		\
+name (const UInt8* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)		\
+{																				\
+	UInt32			i, k;														\
+	for (i=0; i < count; i++, chan += 4)										\
+		for (k=0; k < chans; k++)												\
+			buf[k][i * colBytes] = chan[k];										\
+}
+
+DEFINE_UNPACKBYTE	(UnpackByte_1,	1)
+DEFINE_UNPACKBYTE	(UnpackByte_3,	3)
+DEFINE_UNPACKBYTE	(UnpackByte_4,	4)
+
+DEFINE_PACKBYTE		(PackByte_1,	1)
+DEFINE_PACKBYTE		(PackByte_3,	3)
+DEFINE_PACKBYTE		(PackByte_4,	4)
+
+
+//---------------------------------------------------------------------
+//	Layouts whose four channels are adjacent and in order, like CMYK32
+//	and native endian CMYK64, are already in block buffer order.
+//---------------------------------------------------------------------
+
+static void
+Unpack16_Packed (UInt8* const* buf, UInt32 colBytes, UInt16* chan, UInt32 count)
+{
+	(void)colBytes;
+	memcpy(chan, buf[0], count * 4 * sizeof(UInt16));
+}
+
+static void
+Pack16_Packed (const UInt16* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)
+{
+	(void)colBytes;
+	memcpy(buf[0], chan, count * 4 * sizeof(UInt16));
+}
+
+static void
+UnpackByte_Packed (UInt8* const* buf, UInt32 colBytes, UInt8* chan, UInt32 count)
+{
+	(void)colBytes;
+	memcpy(chan, buf[0], count * 4);
+}
+
+static void
+PackByte_Packed (const UInt8* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)
+{
+	(void)colBytes;
+	memcpy(buf[0], chan, count * 4);
+}
+
+static Boolean
+IsPacked (UInt8* const* buf, UInt32 chans, UInt32 colBytes, UInt32 chanBytes)
+{
+	return (chans == 4) && (colBytes == 4 * chanBytes) &&
+		   (buf[1] == buf[0] + chanBytes) &&
+		   (buf[2] == buf[0] + 2 * chanBytes) &&
+		   (buf[3] == buf[0] + 3 * chanBytes);
+}
+
+
+//---------------------------------------------------------------------
+//	Word kernels for the layouts that pack the three channels of a pixel
+//	into one 16 or 32 bit word. A channel is moved to the high bits and
+//	widened by repeating its bits below, so that its largest code gives
+//	65535, and is narrowed by dropping the low bits. Unused high bits are
+//	written as zero.
+//
+//	With SSE2 the words are taken eight at a time, byte swapped and split
+//	into channel planes of eight 16 bit codes, which are interleaved into
+//	the block buffer, and back, without a pass through memory between the
+//	word and the block.
+//---------------------------------------------------------------------
+
+static inline UInt32
+Load32 (const void* p)
+{
+	UInt32				v;
+	
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline UInt32
+Load32Swap (const void* p)
+{
+	UInt32				v = Load32(p);
+	
+	return Endian32_Swap(v);
+}
+
+static inline void
+Store32 (void* p, UInt32 v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline void
+Store32Swap (void* p, UInt32 v)
+{
+	v = Endian32_Swap(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+// A channel of bits bits in the high bits of v, widened to 16 bits
+#define Widen(v, bits)		((UInt16)((v) | ((v) >> (bits)) | ((v) >> 2 * (bits)) | ((v) >> 3 * (bits))))
+
+#define Widen555(w, chan)	((chan)[0] = Widen(((w) << 1) & 0xF800, 5),				\
+							 (chan)[1] = Widen(((w) << 6) & 0xF800, 5),				\
+							 (chan)[2] = Widen(((w) << 11) & 0xF800, 5))
+#define Widen565(w, chan)	((chan)[0] = Widen((w) & 0xF800, 5),					\
+							 (chan)[1] = Widen(((w) << 5) & 0xFC00, 6),				\
+							 (chan)[2] = Widen(((w) << 11) & 0xF800, 5))
+#define Widen101010(w, chan) ((chan)[0] = Widen(((w) >> 14) & 0xFFC0, 10),			\
+							 (chan)[1] = Widen(((w) >> 4) & 0xFFC0, 10),			\
+							 (chan)[2] = Widen(((w) << 6) & 0xFFC0, 10))
+
+#define Narrow555(chan)		((UInt16)((((chan)[0] >> 1) & 0x7C00) | (((chan)[1] >> 6) & 0x03E0) | ((chan)[2] >> 11)))
+#define Narrow565(chan)		((UInt16)(((chan)[0] & 0xF800) | (((chan)[1] >> 5) & 0x07E0) | ((chan)[2] >> 11)))
+#define Narrow101010(chan)	((((UInt32)(chan)[0] & 0xFFC0) << 14) | (((UInt32)(chan)[1] & 0xFFC0) << 4) | ((chan)[2] >> 6))
+
+#if USE_SSE2
+
+#define Widen5x8(v)			_mm_or_si128(_mm_or_si128(v, _mm_srli_epi16(v, 5)),		\
+										 _mm_or_si128(_mm_srli_epi16(v, 10), _mm_srli_epi16(v, 15)))
+#define Widen6x8(v)			_mm_or_si128(_mm_or_si128(v, _mm_srli_epi16(v, 6)), _mm_srli_epi16(v, 12))
+#define Widen10x8(v)		_mm_or_si128(v, _mm_srli_epi16(v, 10))
+
+static inline __m128i
+Swap16x8 (__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static inline __m128i
+Swap32x4 (__m128i v)
+{
+	return Swap16x8(_mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1));
+}
+
+// Eight colors of the block buffer from and to planes of each channel.
+// The three channel forms write the fourth channel as zero.
+static inline void
+StoreChannels8x4 (UInt16* chan, __m128i r, __m128i g, __m128i b, __m128i k)
+{
+	__m128i			rg, bk;
+	
+	rg = _mm_unpacklo_epi16(r, g);
+	bk = _mm_unpacklo_epi16(b, k);
+	_mm_storeu_si128((__m128i*)chan, _mm_unpacklo_epi32(rg, bk));
+	_mm_storeu_si128((__m128i*)(chan + 8), _mm_unpackhi_epi32(rg, bk));
+	rg = _mm_unpackhi_epi16(r, g);
+	bk = _mm_unpackhi_epi16(b, k);
+	_mm_storeu_si128((__m128i*)(chan + 16), _mm_unpacklo_epi32(rg, bk));
+	_mm_storeu_si128((__m128i*)(chan + 24), _mm_unpackhi_epi32(rg, bk));
+}
+
+static inline void
+StoreChannels8 (UInt16* chan, __m128i r, __m128i g, __m128i b)
+{
+	StoreChannels8x4(chan, r, g, b, _mm_setzero_si128());
+}
+
+static inline void
+LoadChannels8x4 (const UInt16* chan, __m128i* r, __m128i* g, __m128i* b, __m128i* k)
+{
+	__m128i			a, c, lo, hi, rg03, bk03;
+	
+	a = _mm_loadu_si128((const __m128i*)chan);
+	c = _mm_loadu_si128((const __m128i*)(chan + 8));
+	lo = _mm_unpacklo_epi16(a, c);
+	hi = _mm_unpackhi_epi16(a, c);
+	rg03 = _mm_unpacklo_epi16(lo, hi);
+	bk03 = _mm_unpackhi_epi16(lo, hi);
+	
+	a = _mm_loadu_si128((const __m128i*)(chan + 16));
+	c = _mm_loadu_si128((const __m128i*)(chan + 24));
+	lo = _mm_unpacklo_epi16(a, c);
+	hi = _mm_unpackhi_epi16(a, c);
+	a = _mm_unpacklo_epi16(lo, hi);
+	c = _mm_unpackhi_epi16(lo, hi);
+	
+	*r = _mm_unpacklo_epi64(rg03, a);
+	*g = _mm_unpackhi_epi64(rg03, a);
+	*b = _mm_unpacklo_epi64(bk03, c);
+	*k = _mm_unpackhi_epi64(bk03, c);
+}
+
+static inline void
+LoadChannels8 (const UInt16* chan, __m128i* r, __m128i* g, __m128i* b)
+{
+	__m128i			k;
+	
+	LoadChannels8x4(chan, r, g, b, &k);
+}
+
+static inline void
+Widen555x8 (const UInt8* p, UInt16* chan, Boolean swap)
+{
+	const __m128i	top5 = _mm_set1_epi16((short)0xF800);
+	__m128i			w;
+	
+	w = _mm_loadu_si128((const __m128i*)p);
+	if (swap)
+		w = Swap16x8(w);
+	StoreChannels8(chan,
+				   Widen5x8(_mm_and_si128(_mm_slli_epi16(w, 1), top5)),
+				   Widen5x8(_mm_and_si128(_mm_slli_epi16(w, 6), top5)),
+				   Widen5x8(_mm_slli_epi16(w, 11)));
+}
+
+static inline void
+Widen565x8 (const UInt8* p, UInt16* chan, Boolean swap)
+{
+	__m128i			w;
+	
+	w = _mm_loadu_si128((const __m128i*)p);
+	if (swap)
+		w = Swap16x8(w);
+	StoreChannels8(chan,
+				   Widen5x8(_mm_and_si128(w, _mm_set1_epi16((short)0xF800))),
+				   Widen6x8(_mm_and_si128(_mm_slli_epi16(w, 5), _mm_set1_epi16((short)0xFC00))),
+				   Widen5x8(_mm_slli_epi16(w, 11)));
+}
+
+// The fields are 10 bits, so the signed packs is exact
+static inline void
+Widen101010x8 (const UInt8* p, UInt16* chan, Boolean swap)
+{
+	const __m128i	mask = _mm_set1_epi32(0x3FF);
+	__m128i			a, b, r, g;
+	
+	a = _mm_loadu_si128((const __m128i*)p);
+	b = _mm_loadu_si128((const __m128i*)(p + 16));
+	if (swap)
+	{
+		a = Swap32x4(a);
+		b = Swap32x4(b);
+	}
+	r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 20), mask), _mm_and_si128(_mm_srli_epi32(b, 20), mask));
+	g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 10), mask), _mm_and_si128(_mm_srli_epi32(b, 10), mask));
+	a = _mm_packs_epi32(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	StoreChannels8(chan,
+				   Widen10x8(_mm_slli_epi16(r, 6)),
+				   Widen10x8(_mm_slli_epi16(g, 6)),
+				   Widen10x8(_mm_slli_epi16(a, 6)));
+}
+
+static inline void
+Narrow555x8 (UInt8* p, const UInt16* chan, Boolean swap)
+{
+	__m128i			r, g, b, w;
+	
+	LoadChannels8(chan, &r, &g, &b);
+	w = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi16(r, 1), _mm_set1_epi16(0x7C00)),
+								  _mm_and_si128(_mm_srli_epi16(g, 6), _mm_set1_epi16(0x03E0))),
+					 _mm_srli_epi16(b, 11));
+	if (swap)
+		w = Swap16x8(w);
+	_mm_storeu_si128((__m128i*)p, w);
+}
+
+static inline void
+Narrow565x8 (UInt8* p, const UInt16* chan, Boolean swap)
+{
+	__m128i			r, g, b, w;
+	
+	LoadChannels8(chan, &r, &g, &b);
+	w = _mm_or_si128(_mm_or_si128(_mm_and_si128(r, _mm_set1_epi16((short)0xF800)),
+								  _mm_and_si128(_mm_srli_epi16(g, 5), _mm_set1_epi16(0x07E0))),
+					 _mm_srli_epi16(b, 11));
+	if (swap)
+		w = Swap16x8(w);
+	_mm_storeu_si128((__m128i*)p, w);
+}
+
+static inline void
+Narrow101010x8 (UInt8* p, const UInt16* chan, Boolean swap)
+{
+	const __m128i	zero = _mm_setzero_si128();
+	__m128i			r, g, b, a;
+	
+	LoadChannels8(chan, &r, &g, &b);
+	r = _mm_srli_epi16(r, 6);
+	g = _mm_srli_epi16(g, 6);
+	b = _mm_srli_epi16(b, 6);
+	
+	a = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_unpacklo_epi16(r, zero), 20),
+								  _mm_slli_epi32(_mm_unpacklo_epi16(g, zero), 10)),
+					 _mm_unpacklo_epi16(b, zero));
+	if (swap)
+		a = Swap32x4(a);
+	_mm_storeu_si128((__m128i*)p, a);
+	
+	a = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_unpackhi_epi16(r, zero), 20),
+								  _mm_slli_epi32(_mm_unpackhi_epi16(g, zero), 10)),
+					 _mm_unpackhi_epi16(b, zero));
+	if (swap)
+		a = Swap32x4(a);
+	_mm_storeu_si128((__m128i*)(p + 16), a);
+}
+
+// Eight words at a time when they are adjacent, leaving the rest to the
+// scalar loop
+#define WORDS8(op, format, bytes, swap)											\
+	if (colBytes == bytes)														\
+		for ( ; count >= 8; count -= 8, p += 8 * bytes, chan += 32)				\
+			op##format##x8(p, chan, swap);
+
+#else
+
+#define WORDS8(op, format, bytes, swap)
+
+#endif // USE_SSE2
+
+#define DEFINE_UNPACKWORD(name, format, bytes, load, swap)						\
+static void																		\
+name (UInt8* const* buf, UInt32 colBytes, UInt16* chan, UInt32 count)			\
+{																				\
+	const UInt8*	p = buf[0];													\
+	UInt32			w;															\
+																				\
+	WORDS8(Widen, format, bytes, swap)											\
+	for ( ; count > 0; count--, p += colBytes, chan += 4)						\
+	{																			\
+		w = load(p);															\
+		Widen##format(w, chan);													\
+	}																			\
+}
+
+#define DEFINE_PACKWORD(name, format, bytes, store, swap)						\
+static void																		\
+name (const UInt16* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)		\
+{																				\
+	UInt8*			p = buf[0];													\
+																				\
+	WORDS8(Narrow, format, bytes, swap)											\
+	for ( ; count > 0; count--, p += colBytes, chan += 4)						\
+		store(p, Narrow##format(chan));											\
+}
+
+DEFINE_UNPACKWORD	(UnpackWord555,			555,	2,	Load16,		false)
+DEFINE_UNPACKWORD	(UnpackWord555Swap,		555,	2,	Load16Swap,	true)
+DEFINE_UNPACKWORD	(UnpackWord565,			565,	2,	Load16,		false)
+DEFINE_UNPACKWORD	(UnpackWord565Swap,		565,	2,	Load16Swap,	true)
+DEFINE_UNPACKWORD	(UnpackWord101010,		101010,	4,	Load32,		false)
+DEFINE_UNPACKWORD	(UnpackWord101010Swap,	101010,	4,	Load32Swap,	true)
+
+DEFINE_PACKWORD		(PackWord555,			555,	2,	Store16,		false)
+DEFINE_PACKWORD		(PackWord555Swap,		555,	2,	Store16Swap,	true)
+DEFINE_PACKWORD		(PackWord565,			565,	2,	Store16,		false)
+DEFINE_PACKWORD		(PackWord565Swap,		565,	2,	Store16Swap,	true)
+DEFINE_PACKWORD		(PackWord101010,		101010,	4,	Store32,		false)
+DEFINE_PACKWORD		(PackWord101010Swap,	101010,	4,	Store32Swap,	true)
+
+
+//---------------------------------------------------------------------
+//	Planar kernels for layouts whose channels each lie in a plane of
+//	their own, one sample after another. The generic kernels handle them
+//	too, since they follow each channel from its own start; with SSE2
+//	these take eight pixels of every plane at once and interleave them
+//	into the block buffer, and back, so a planar image is never copied
+//	into an interleaved one. The byte kernels take sixteen.
+//---------------------------------------------------------------------
+
+#if USE_SSE2
+
+#define Load8x8(p)			_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p)), _mm_loadl_epi64((const __m128i*)(p)))
+#define Load16x8(p)			_mm_loadu_si128((const __m128i*)(p))
+#define Load16Swapx8(p)		Swap16x8(Load16x8(p))
+#define Store8x8(p,v)		_mm_storel_epi64((__m128i*)(p), _mm_packus_epi16(_mm_srli_epi16(v, 8), _mm_setzero_si128()))
+#define Store16x8(p,v)		_mm_storeu_si128((__m128i*)(p), (v))
+#define Store16Swapx8(p,v)	Store16x8(p, Swap16x8(v))
+
+#define DEFINE_UNPACKPLANAR(name, chans, bytes, load)							\
+static void																		\
+name (UInt8* const* buf, UInt32 colBytes, UInt16* chan, UInt32 count)			\
+{																				\
+	UInt32			i, k;														\
+																				\
+	for (i=0; i + 8 <= count; i += 8, chan += 32)								\
+		StoreChannels8x4(chan, load##x8(buf[0] + i * bytes), load##x8(buf[1] + i * bytes),	\
+						 load##x8(buf[2] + i * bytes),							\
+						 (chans > 3) ? load##x8(buf[3] + i * bytes) : _mm_setzero_si128());	\
+	for ( ; i < count; i++, chan += 4)											\
+		for (k=0; k < chans; k++)												\
+			chan[k] = load(buf[k] + i * colBytes);								\
+}
+
+#define DEFINE_PACKPLANAR(name, chans, bytes, store)							\
+static void																		\
+name (const UInt16* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)		\
+{																				\
+	__m128i			r, g, b, x;													\
+	UInt32			i, k;														\
+																				\
+	for (i=0; i + 8 <= count; i += 8, chan += 32)								\
+	{																			\
+		LoadChannels8x4(chan, &r, &g, &b, &x);									\
+		store##x8(buf[0] + i * bytes, r);										\
+		store##x8(buf[1] + i * bytes, g);										\
+		store##x8(buf[2] + i * bytes, b);										\
+		if (chans > 3)															\
+			store##x8(buf[3] + i * bytes, x);									\
+	}																			\
+	for ( ; i < count; i++, chan += 4)											\
+		for (k=0; k < chans; k++)												\
+			store(buf[k] + i * colBytes, chan[k]);								\
+}
+
+DEFINE_UNPACKPLANAR	(UnpackPlanar8_3,		3,	1,	Load8)
+DEFINE_UNPACKPLANAR	(UnpackPlanar8_4,		4,	1,	Load8)
+DEFINE_UNPACKPLANAR	(UnpackPlanar16_3,		3,	2,	Load16)
+DEFINE_UNPACKPLANAR	(UnpackPlanar16_4,		4,	2,	Load16)
+DEFINE_UNPACKPLANAR	(UnpackPlanar16Swap_3,	3,	2,	Load16Swap)
+DEFINE_UNPACKPLANAR	(UnpackPlanar16Swap_4,	4,	2,	Load16Swap)
+
+DEFINE_PACKPLANAR	(PackPlanar8_3,			3,	1,	Store8)
+DEFINE_PACKPLANAR	(PackPlanar8_4,			4,	1,	Store8)
+DEFINE_PACKPLANAR	(PackPlanar16_3,		3,	2,	Store16)
+DEFINE_PACKPLANAR	(PackPlanar16_4,		4,	2,	Store16)
+DEFINE_PACKPLANAR	(PackPlanar16Swap_3,	3,	2,	Store16Swap)
+DEFINE_PACKPLANAR	(PackPlanar16Swap_4,	4,	2,	Store16Swap)
+
+// Sixteen bytes of each plane interleave into sixteen colors of the byte
+// block buffer, and back, a channel being a byte of each 32 bit color
+#define DEFINE_UNPACKBYTEPLANAR(name, chans)									\
+static void																		\
+name (UInt8* const* buf, UInt32 colBytes, UInt8* chan, UInt32 count)			\
+{																				\
+	__m128i			r, g, b, x, rg, bx;											\
+	UInt32			i, k;														\
+																				\
+	for (i=0; i + 16 <= count; i += 16, chan += 64)								\
+	{																			\
+		r = _mm_loadu_si128((const __m128i*)(buf[0] + i));						\
+		g = _mm_loadu_si128((const __m128i*)(buf[1] + i));						\
+		b = _mm_loadu_si128((const __m128i*)(buf[2] + i));						\
+		x = (chans > 3) ? _mm_loadu_si128((const __m128i*)(buf[3] + i)) : _mm_setzero_si128();	\
+		rg = _mm_unpacklo_epi8(r, g);											\
+		bx = _mm_unpacklo_epi8(b, x);											\
+		_mm_storeu_si128((__m128i*)chan, _mm_unpacklo_epi16(rg, bx));			\
+		_mm_storeu_si128((__m128i*)(chan + 16), _mm_unpackhi_epi16(rg, bx));	\
+		rg = _mm_unpackhi_epi8(r, g);											\
+		bx = _mm_unpackhi_epi8(b, x);											\
+		_mm_storeu_si128((__m128i*)(chan + 32), _mm_unpacklo_epi16(rg, bx));	\
+		_mm_storeu_si128((__m128i*)(chan + 48), _mm_unpackhi_epi16(rg, bx));	\
+	}																			\
+	for ( ; i < count; i++, chan += 4)											\
+		for (k=0; k < chans; k++)												\
+			chan[k] = buf[k][i * colBytes];										\
+}
+
+// One channel of sixteen colors, loaded sixteen bytes at a time
+static inline __m128i
+ByteChannel16 (const UInt8* chan, int shift)
+{
+	const __m128i	low = _mm_set1_epi32(0xFF);
+	__m128i			a, b, c, d;
+	
+	a = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)chan), shift), low);
+	b = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(chan + 16)), shift), low);
+	c = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(chan + 32)), shift), low);
+	d = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(chan + 48)), shift), low);
+	return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+#define DEFINE_PACKBYTEPLANAR(name, chans)										\
+static void																		\
+name (const UInt8* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)		\
+{																				\
+	UInt32			i, k;														\
+																				\
+	for (i=0; i + 16 <= count; i += 16, chan += 64)								\
+		for (k=0; k < chans; k++)												\
+			_mm_storeu_si128((__m128i*)(buf[k] + i), ByteChannel16(chan, 8 * k));	\
+	for ( ; i < count; i++, chan += 4)											\
+		for (k=0; k < chans; k++)												\
+			buf[k][i * colBytes] = chan[k];										\
+}
+
+DEFINE_UNPACKBYTEPLANAR	(UnpackBytePlanar_3,	3)
+DEFINE_UNPACKBYTEPLANAR	(UnpackBytePlanar_4,	4)
+
+DEFINE_PACKBYTEPLANAR	(PackBytePlanar_3,		3)
+DEFINE_PACKBYTEPLANAR	(PackBytePlanar_4,		4)
+
+// Whether each of the channels lies in a plane of its own, its samples
+// next to one another
+static Boolean
+IsPlanar (const UInt32* colBytes, UInt32 chans, UInt32 chanBits)
+{
+	UInt32				k;
+	
+	if (chans < 3)
+		return false;
+	for (k=0; k < chans; k++)
+		if (colBytes[k] != chanBits / 8)
+			return false;
+	return true;
+}
+
+#endif // USE_SSE2
+
+
+//---------------------------------------------------------------------
+//	Byte swapped kernels for 16 bit layouts whose channels lie next to
+//	one another in order, as those of big endian RGB48, Lab48, XYZ48 and
+//	CMYK64 do on a little endian host. With SSE2 the swap is folded into
+//	the loads and stores that move pixels between the layout and the
+//	block buffer: four pixels of six bytes are a load and a half, spread
+//	out to the lanes of four colors, and two pixels of eight bytes are
+//	one load. The three channel kernels write the fourth channel as zero,
+//	and the pack into a pixel of eight bytes leaves its fourth code, alpha
+//	or unused, as it was, so its last pixel is left to the scalar loop.
+//	SSE2 has no byte shuffle, so the swap is the shifts of Swap16x8.
+//---------------------------------------------------------------------
+
+#if USE_SSE2
+
+// Two colors of three channels, as in a pixel of six bytes each
+static inline __m128i
+Squeeze3x2 (__m128i v)
+{
+	const __m128i	first = _mm_setr_epi16(-1, -1, -1, 0, 0, 0, 0, 0);
+	const __m128i	second = _mm_setr_epi16(0, 0, 0, -1, -1, -1, 0, 0);
+	
+	return _mm_or_si128(_mm_and_si128(v, first), _mm_and_si128(_mm_srli_si128(v, 2), second));
+}
+
+// Two pixels of six bytes, spread out to two colors
+static inline __m128i
+Spread3x2 (__m128i v)
+{
+	const __m128i	three = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+	
+	return _mm_and_si128(_mm_unpacklo_epi64(v, _mm_srli_si128(v, 6)), three);
+}
+
+static void
+Unpack16Swap_3x6 (UInt8* const* buf, UInt32 colBytes, UInt16* chan, UInt32 count)
+{
+	const UInt8*	p = buf[0];
+	__m128i			a, b;
+	UInt32			i, k;
+	
+	for (i=0; i + 4 <= count; i += 4, p += 24, chan += 16)
+	{
+		a = Swap16x8(_mm_loadu_si128((const __m128i*)p));
+		b = Swap16x8(_mm_loadl_epi64((const __m128i*)(p + 16)));
+		_mm_storeu_si128((__m128i*)chan, Spread3x2(a));
+		_mm_storeu_si128((__m128i*)(chan + 8), Spread3x2(_mm_or_si128(_mm_srli_si128(a, 12), _mm_slli_si128(b, 4))));
+	}
+	for ( ; i < count; i++, chan += 4)
+		for (k=0; k < 3; k++)
+			chan[k] = Load16Swap(buf[k] + i * colBytes);
+}
+
+static void
+Pack16Swap_3x6 (const UInt16* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)
+{
+	UInt8*			p = buf[0];
+	__m128i			a, b;
+	UInt32			i, k;
+	
+	for (i=0; i + 4 <= count; i += 4, p += 24, chan += 16)
+	{
+		a = Squeeze3x2(_mm_loadu_si128((const __m128i*)chan));
+		b = Squeeze3x2(_mm_loadu_si128((const __m128i*)(chan + 8)));
+		_mm_storeu_si128((__m128i*)p, Swap16x8(_mm_or_si128(a, _mm_slli_si128(b, 12))));
+		_mm_storel_epi64((__m128i*)(p + 16), Swap16x8(_mm_srli_si128(b, 4)));
+	}
+	for ( ; i < count; i++, chan += 4)
+		for (k=0; k < 3; k++)
+			Store16Swap(buf[k] + i * colBytes, chan[k]);
+}
+
+static void
+Unpack16Swap_3x8 (UInt8* const* buf, UInt32 colBytes, UInt16* chan, UInt32 count)
+{
+	const __m128i	three = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+	UInt32			i, k;
+	
+	for (i=0; i + 2 < count; i += 2, chan += 8)
+		_mm_storeu_si128((__m128i*)chan, _mm_and_si128(Load16Swapx8(buf[0] + i * 8), three));
+	for ( ; i < count; i++, chan += 4)
+		for (k=0; k < 3; k++)
+			chan[k] = Load16Swap(buf[k] + i * colBytes);
+}
+
+static void
+Pack16Swap_3x8 (const UInt16* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)
+{
+	const __m128i	three = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+	UInt32			i, k;
+	
+	for (i=0; i + 2 < count; i += 2, chan += 8)
+		Store16x8(buf[0] + i * 8, _mm_or_si128(_mm_andnot_si128(three, Load16x8(buf[0] + i * 8)),
+											   _mm_and_si128(Load16Swapx8(chan), three)));
+	for ( ; i < count; i++, chan += 4)
+		for (k=0; k < 3; k++)
+			Store16Swap(buf[k] + i * colBytes, chan[k]);
+}
+
+static void
+Unpack16Swap_Packed (UInt8* const* buf, UInt32 colBytes, UInt16* chan, UInt32 count)
+{
+	UInt32			i, k;
+	
+	for (i=0; i + 2 <= count; i += 2, chan += 8)
+		Store16x8(chan, Load16Swapx8(buf[0] + i * 8));
+	for ( ; i < count; i++, chan += 4)
+		for (k=0; k < 4; k++)
+			chan[k] = Load16Swap(buf[k] + i * colBytes);
+}
+
+static void
+Pack16Swap_Packed (const UInt16* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count)
+{
+	UInt32			i, k;
+	
+	for (i=0; i + 2 <= count; i += 2, chan += 8)
+		Store16Swapx8(buf[0] + i * 8, Load16x8(chan));
+	for ( ; i < count; i++, chan += 4)
+		for (k=0; k < 4; k++)
+			Store16Swap(buf[k] + i * colBytes, chan[k]);
+}
+
+#endif // USE_SSE2
+
+// An identity between layouts that differ only in byte order swaps the
+// bytes of whole rows, eight codes at a time with SSE2. It may be done
+// in place.
+static void
+SwapBytes16 (const UInt8* src, UInt8* dst, UInt32 count)
+{
+	UInt32			i = 0;
+	
+#if USE_SSE2
+	for ( ; i + 8 <= count; i += 8)
+		Store16Swapx8(dst + i * 2, Load16x8(src + i * 2));
+#endif
+	for ( ; i < count; i++)
+		Store16Swap(dst + i * 2, Load16(src + i * 2));
+}
+
+
+//---------------------------------------------------------------------
+//	Alpha kernels. Alpha goes around the match, unpacked into one 16 bit
+//	code per color beside the block buffer and packed again unchanged,
+//	widened and narrowed as the other channels are. With SSE2 the alpha
+//	of sixteen 8 bit pixels of four bytes is taken from four loads, each
+//	of four pixels, and put back into them with the other bytes left as
+//	they were; the last pixel is left to the scalar loop, since the load
+//	from its alpha may reach past the end of the row.
+//---------------------------------------------------------------------
+
+#if USE_SSE2
+
+#define ALPHA8x16(op)															\
+	if (colBytes == 4)															\
+		for ( ; i + 16 < count; i += 16)										\
+			op##Alpha8x16(buf + i * 4, alpha + i);
+
+static inline void
+UnpackAlpha8x16 (const UInt8* p, UInt16* alpha)
+{
+	const __m128i	low = _mm_set1_epi32(0xFF);
+	__m128i			a, b;
+	
+	a = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i*)p), low),
+						_mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 16)), low));
+	b = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 32)), low),
+						_mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 48)), low));
+	a = _mm_packus_epi16(a, b);
+	_mm_storeu_si128((__m128i*)alpha, _mm_unpacklo_epi8(a, a));
+	_mm_storeu_si128((__m128i*)(alpha + 8), _mm_unpackhi_epi8(a, a));
+}
+
+static inline void
+PackAlpha8x16 (UInt8* p, const UInt16* alpha)
+{
+	const __m128i	low = _mm_set1_epi32(0xFF);
+	const __m128i	zero = _mm_setzero_si128();
+	__m128i			a, w;
+	UInt32			k;
+	
+	a = _mm_packus_epi16(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)alpha), 8),
+						 _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(alpha + 8)), 8));
+	for (k=0; k < 4; k++, p += 16, a = _mm_srli_si128(a, 4))
+	{
+		w = _mm_unpacklo_epi16(_mm_unpacklo_epi8(a, zero), zero);
+		_mm_storeu_si128((__m128i*)p, _mm_or_si128(_mm_andnot_si128(low, _mm_loadu_si128((const __m128i*)p)), w));
+	}
+}
+
+#else
+
+#define ALPHA8x16(op)
+
+#endif // USE_SSE2
+
+#define DEFINE_UNPACKALPHA(name, load, vector)									\
+static void																		\
+name (const UInt8* buf, UInt32 colBytes, UInt16* alpha, UInt32 count)			\
+{																				\
+	UInt32			i = 0;														\
+																				\
+	vector																		\
+	for ( ; i < count; i++)														\
+		alpha[i] = load(buf + i * colBytes);									\
+}
+
+#define DEFINE_PACKALPHA(name, store, vector)									\
+static void																		\
+name (const UInt16* alpha, UInt8* buf, UInt32 colBytes, UInt32 count)			\
+{																				\
+	UInt32			i = 0;														\
+																				\
+	vector																		\
+	for ( ; i < count; i++)														\
+		store(buf + i * colBytes, alpha[i]);									\
+}
+
+DEFINE_UNPACKALPHA	(UnpackAlpha8,		Load8,			ALPHA8x16(Unpack))
+DEFINE_UNPACKALPHA	(UnpackAlpha16,		Load16,			)
+DEFINE_UNPACKALPHA	(UnpackAlpha16Swap,	Load16Swap,		)
+
+DEFINE_PACKALPHA	(PackAlpha8,		Store8,			ALPHA8x16(Pack))
+DEFINE_PACKALPHA	(PackAlpha16,		Store16,		)
+DEFINE_PACKALPHA	(PackAlpha16Swap,	Store16Swap,	)
+
+
+//---------------------------------------------------------------------
+//	Premultiplied colors of the block buffer, divided by their alpha after
+//	they are unpacked and multiplied by it before they are packed. The
+//	product is rounded to the nearest code, exactly; the quotient is taken
+//	in single precision, the same with SSE2 and without, and clamped, and
+//	is zero for a color of zero alpha. The fourth channel goes along with
+//	SSE2 and is left alone without; the layouts with alpha never use it.
+//---------------------------------------------------------------------
+
+static inline UInt16
+MulAlpha (UInt32 c, UInt32 a)
+{
+	UInt32			t = c * a + 32768;
+	
+	return (UInt16)((t + (t >> 16)) >> 16);
+}
+
+static inline UInt16
+DivAlpha (UInt32 c, float inverse)
+{
+	float			f = (float)c * inverse + 0.5f;
+	
+	return (UInt16)((f < 65535.0f) ? f : 65535.0f);
+}
+
+#if USE_SSE2
+
+// The alpha of four colors, each spread over the four lanes of its color
+static inline void
+SpreadAlpha4 (const UInt16* alpha, __m128i* a01, __m128i* a23)
+{
+	__m128i			a = _mm_loadl_epi64((const __m128i*)alpha);
+	
+	a = _mm_unpacklo_epi16(a, a);
+	*a01 = _mm_unpacklo_epi32(a, a);
+	*a23 = _mm_unpackhi_epi32(a, a);
+}
+
+// Four 32 bit products c * a, rounded to the nearest multiple of 65535
+// and divided by it, packed into four codes of the low half
+static inline __m128i
+RoundProducts4 (__m128i p)
+{
+	const __m128i	half = _mm_set1_epi32(32768);
+	
+	p = _mm_add_epi32(p, half);
+	p = _mm_srli_epi32(_mm_add_epi32(p, _mm_srli_epi32(p, 16)), 16);
+	return _mm_srai_epi32(_mm_slli_epi32(p, 16), 16);
+}
+
+static inline __m128i
+MulAlpha8 (__m128i c, __m128i a)
+{
+	__m128i			lo = _mm_mullo_epi16(c, a);
+	__m128i			hi = _mm_mulhi_epu16(c, a);
+	
+	return _mm_packs_epi32(RoundProducts4(_mm_unpacklo_epi16(lo, hi)),
+						   RoundProducts4(_mm_unpackhi_epi16(lo, hi)));
+}
+
+// Two colors divided by the inverses of their alphas
+static inline __m128i
+DivAlpha8 (__m128i c, __m128 inv01, __m128 inv23)
+{
+	const __m128i	zero = _mm_setzero_si128();
+	const __m128	half = _mm_set1_ps(0.5f);
+	const __m128	top = _mm_set1_ps(65535.0f);
+	__m128i			lo, hi;
+	
+	lo = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(c, zero)), inv01), half), top));
+	hi = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(c, zero)), inv23), half), top));
+	return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(lo, 16), 16), _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16));
+}
+
+#endif // USE_SSE2
+
+static void
+Premultiply (UInt16* chan, const UInt16* alpha, UInt32 count)
+{
+	UInt32			i = 0, k;
+	
+#if USE_SSE2
+	__m128i			a01, a23;
+	
+	for ( ; i + 4 <= count; i += 4, chan += 16)
+	{
+		SpreadAlpha4(alpha + i, &a01, &a23);
+		_mm_storeu_si128((__m128i*)chan, MulAlpha8(_mm_loadu_si128((const __m128i*)chan), a01));
+		_mm_storeu_si128((__m128i*)(chan + 8), MulAlpha8(_mm_loadu_si128((const __m128i*)(chan + 8)), a23));
+	}
+#endif
+	
+	for ( ; i < count; i++, chan += 4)
+		for (k=0; k < 3; k++)
+			chan[k] = MulAlpha(chan[k], alpha[i]);
+}
+
+static void
+Unpremultiply (UInt16* chan, const UInt16* alpha, UInt32 count)
+{
+	UInt32			i = 0, k;
+	float			inverse;
+	
+#if USE_SSE2
+	const __m128i	zero = _mm_setzero_si128();
+	const __m128	top = _mm_set1_ps(65535.0f);
+	__m128i			a01, a23, some;
+	__m128			a, inv;
+	
+	for ( ; i + 4 <= count; i += 4, chan += 16)
+	{
+		SpreadAlpha4(alpha + i, &a01, &a23);
+		some = _mm_xor_si128(_mm_cmpeq_epi16(a01, zero), _mm_set1_epi16(-1));
+		a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(a01, zero));
+		inv = _mm_div_ps(top, a);
+		a = _mm_cvtepi32_ps(_mm_unpackhi_epi16(a01, zero));
+		_mm_storeu_si128((__m128i*)chan, _mm_and_si128(DivAlpha8(_mm_loadu_si128((const __m128i*)chan), inv, _mm_div_ps(top, a)), some));
+		
+		some = _mm_xor_si128(_mm_cmpeq_epi16(a23, zero), _mm_set1_epi16(-1));
+		a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(a23, zero));
+		inv = _mm_div_ps(top, a);
+		a = _mm_cvtepi32_ps(_mm_unpackhi_epi16(a23, zero));
+		_mm_storeu_si128((__m128i*)(chan + 8), _mm_and_si128(DivAlpha8(_mm_loadu_si128((const __m128i*)(chan + 8)), inv, _mm_div_ps(top, a)), some));
+	}
+#endif
+	
+	for ( ; i < count; i++, chan += 4)
+	{
+		inverse = alpha[i] ? 65535.0f / alpha[i] : 0.0f;
+		for (k=0; k < 3; k++)
+			chan[k] = alpha[i] ? DivAlpha(chan[k], inverse) : 0;
+	}
+}
+
+
+//---------------------------------------------------------------------
+//	Float kernels scale the channels of the float and half layouts to
+//	and from float code values, held four floats apart in the block
+//	buffer. The vector loops take a pixel at a time, its channels loaded
+//	and stored four at once: the spare lanes of a load are masked off,
+//	and those of a store are overwritten by the next pixel, so the last
+//	pixels whose spare lanes would reach past the row are left to the
+//	scalar loop. Half floats are converted by F16C when it is there and
+//	bit by bit, rounding to nearest even, when it is not.
+//---------------------------------------------------------------------
+
+static inline float
+HalfToFloat (UInt16 h)
+{
+#if USE_F16C
+	return _cvtsh_ss(h);
+#else
+	union { float f; UInt32 i; } u;
+	UInt32			exp = (h >> 10) & 0x1F;
+	
+	if (exp == 0x1F)
+		u.i = 0x7F800000 | ((UInt32)(h & 0x3FF) << 13);			// Inf and NaN
+	else if (exp != 0)
+		u.i = ((exp + 112) << 23) | ((UInt32)(h & 0x3FF) << 13);
+	else
+		u.f = (h & 0x3FF) * (1.0f / 16777216.0f);				// subnormal, of 2^-24
+	u.i |= (UInt32)(h & 0x8000) << 16;
+	return u.f;
+#endif
+}
+
+static inline UInt16
+FloatToHalf (float f)
+{
+#if USE_F16C
+	return _cvtss_sh(f, 0);
+#else
+	union { float f; UInt32 i; } u;
+	UInt32			sign;
+	
+	u.f = f;
+	sign = (u.i >> 16) & 0x8000;
+	u.i &= 0x7FFFFFFF;
+	
+	// Past the largest half, Inf and NaN
+	if (u.i >= 0x47800000)
+		return (UInt16)(sign | ((u.i > 0x7F800000) ? 0x7E00 : 0x7C00));
+	
+	// Below the smallest normal half the add of 0.5 rounds the mantissa
+	// into place
+	if (u.i < 0x38800000)
+	{
+		u.f += 0.5f;
+		return (UInt16)(sign | (u.i - 0x3F000000));
+	}
+	
+	// Rebias the exponent and round to nearest even; the carry out of a
+	// mantissa of all ones goes into the exponent, up to Inf
+	u.i += 0xC8000FFF + ((u.i >> 13) & 1);
+	return (UInt16)(sign | (u.i >> 13));
+#endif
+}
+
+static inline float
+LoadFloat (const void* p)
+{
+	float				v;
+	
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void
+StoreFloat (void* p, float v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+#define LoadHalf(p)			HalfToFloat(Load16(p))
+#define StoreHalf(p,v)		Store16(p, FloatToHalf(v))
+
+#if USE_SSE2
+
+#define Load4Float(p)		_mm_loadu_ps((float*)(p))
+#define Store4Float(p,v)	_mm_storeu_ps((float*)(p), (v))
+
+// Pixels at the end of a row the spare lanes of a pixel would reach past
+#define SPILL(chans, bytes)	(((4 - (chans)) * (bytes) + colBytes - 1) / colBytes)
+
+// Whether the channels of a pixel follow one another in order, so that
+// one load takes them all
+static inline Boolean
+IsAdjacent (UInt8* const* buf, UInt32 chans, UInt32 bytes)
+{
+	UInt32				k;
+	
+	for (k=1; k < chans; k++)
+		if (buf[k] != buf[0] + k * bytes)
+			return false;
+	return true;
+}
+
+// Channels in planes of their own are instead taken four pixels at a
+// time, a load from each plane, and transposed into four colors
+#define UNPACKPIXEL4(chans, type, bytes)										\
+	{																			\
+		const __m128	lanes = _mm_castsi128_ps(_mm_setr_epi32(-1, -((chans) > 1), -((chans) > 2), -((chans) > 3)));	\
+		const __m128	mul = _mm_loadu_ps(scale->scale);						\
+		const __m128	add = _mm_loadu_ps(scale->offset);						\
+		UInt32			spill = SPILL(chans, bytes);							\
+		__m128			c0, c1, c2, c3;											\
+																				\
+		if (IsAdjacent(buf, chans, bytes))										\
+			for ( ; i + spill < count; i++, chan += 4)							\
+				_mm_storeu_ps(chan, _mm_add_ps(_mm_mul_ps(_mm_and_ps(Load4##type(buf[0] + i * colBytes), lanes), mul), add));	\
+		else if ((chans) > 2 && colBytes == (bytes))							\
+			for ( ; i + 4 <= count; i += 4, chan += 16)							\
+			{																	\
+				c0 = Load4##type(buf[0] + i * (bytes));							\
+				c1 = Load4##type(buf[1] + i * (bytes));							\
+				c2 = Load4##type(buf[2] + i * (bytes));							\
+				c3 = ((chans) > 3) ? Load4##type(buf[3] + i * (bytes)) : _mm_setzero_ps();	\
+				_MM_TRANSPOSE4_PS(c0, c1, c2, c3);								\
+				_mm_storeu_ps(chan, _mm_add_ps(_mm_mul_ps(c0, mul), add));		\
+				_mm_storeu_ps(chan + 4, _mm_add_ps(_mm_mul_ps(c1, mul), add));	\
+				_mm_storeu_ps(chan + 8, _mm_add_ps(_mm_mul_ps(c2, mul), add));	\
+				_mm_storeu_ps(chan + 12, _mm_add_ps(_mm_mul_ps(c3, mul), add));	\
+			}																	\
+	}
+
+#define PACKPIXEL4(chans, type, bytes)											\
+	{																			\
+		const __m128	sub = _mm_loadu_ps(scale->offset);						\
+		const __m128	mul = _mm_loadu_ps(scale->inverse);						\
+		UInt32			spill = SPILL(chans, bytes);							\
+		__m128			c0, c1, c2, c3;											\
+																				\
+		if (IsAdjacent(buf, chans, bytes))										\
+			for ( ; i + spill < count; i++, chan += 4)							\
+				Store4##type(buf[0] + i * colBytes, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(chan), sub), mul));	\
+		else if ((chans) > 2 && colBytes == (bytes))							\
+			for ( ; i + 4 <= count; i += 4, chan += 16)							\
+			{																	\
+				c0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(chan), sub), mul);		\
+				c1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(chan + 4), sub), mul);	\
+				c2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(chan + 8), sub), mul);	\
+				c3 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(chan + 12), sub), mul);	\
+				_MM_TRANSPOSE4_PS(c0, c1, c2, c3);								\
+				Store4##type(buf[0] + i * (bytes), c0);							\
+				Store4##type(buf[1] + i * (bytes), c1);							\
+				Store4##type(buf[2] + i * (bytes), c2);							\
+				if ((chans) > 3)												\
+					Store4##type(buf[3] + i * (bytes), c3);						\
+			}																	\
+	}
+
+#define UNPACK4_Float		UNPACKPIXEL4
+#define PACK4_Float			PACKPIXEL4
+
+#else
+
+#define UNPACK4_Float(chans, type, bytes)
+#define PACK4_Float(chans, type, bytes)
+
+#endif // USE_SSE2
+
+#if USE_F16C
+
+#define Load4Half(p)		_mm_cvtph_ps(_mm_loadl_epi64((__m128i*)(p)))
+#define Store4Half(p,v)		_mm_storel_epi64((__m128i*)(p), _mm_cvtps_ph((v), 0))
+
+#define UNPACK4_Half		UNPACKPIXEL4
+#define PACK4_Half			PACKPIXEL4
+
+#else
+
+#define UNPACK4_Half(chans, type, bytes)
+#define PACK4_Half(chans, type, bytes)
+
+#endif // USE_F16C
+
+#define DEFINE_UNPACKFLOAT(name, chans, type, bytes)							\
+static void																		\
+name (UInt8* const* buf, UInt32 colBytes, float* chan, UInt32 count, const ScaleRec* scale)	\
+{																				\
+	UInt32			i = 0, k;													\
+																				\
+	UNPACK4_##type(chans, type, bytes)											\
+	for ( ; i < count; i++, chan += 4)											\
+		for (k=0; k < 4; k++)													\
+			chan[k] = (k < chans) ? Load##type(buf[k] + i * colBytes) * scale->scale[k] + scale->offset[k] : 0.0f;	\
+}
+
+#define DEFINE_PACKFLOAT(name, chans, type, bytes)								\
+static void																		\
+name (const float* chan, UInt8* const* buf, UInt32 colBytes, UInt32 count, const ScaleRec* scale)	\
+{																				\
+	UInt32			i = 0, k;													\
+																				\
+	PACK4_##type(chans, type, bytes)											\
+	for ( ; i < count; i++, chan += 4)											\
+		for (k=0; k < chans; k++)												\
+			Store##type(buf[k] + i * colBytes, (chan[k] - scale->offset[k]) * scale->inverse[k]);	\
+}
+
+DEFINE_UNPACKFLOAT	(UnpackFloat_1,		1,	Float,	4)
+DEFINE_UNPACKFLOAT	(UnpackFloat_3,		3,	Float,	4)
+DEFINE_UNPACKFLOAT	(UnpackFloat_4,		4,	Float,	4)
+DEFINE_UNPACKFLOAT	(UnpackHalf_1,		1,	Half,	2)
+DEFINE_UNPACKFLOAT	(UnpackHalf_3,		3,	Half,	2)
+DEFINE_UNPACKFLOAT	(UnpackHalf_4,		4,	Half,	2)
+
+DEFINE_PACKFLOAT	(PackFloat_1,		1,	Float,	4)
+DEFINE_PACKFLOAT	(PackFloat_3,		3,	Float,	4)
+DEFINE_PACKFLOAT	(PackFloat_4,		4,	Float,	4)
+DEFINE_PACKFLOAT	(PackHalf_1,		1,	Half,	2)
+DEFINE_PACKFLOAT	(PackHalf_3,		3,	Half,	2)
+DEFINE_PACKFLOAT	(PackHalf_4,		4,	Half,	2)
+
+
+//---------------------------------------------------------------------
+//	Gather kernels copy the matched color of each index of a row from a
+//	palette of 16 byte entries. Colors of 3, 6 and 12 bytes are stored 4,
+//	8 and 16 bytes at a time, left to right, the spare bytes of each
+//	overwritten by the next, and the last color of the row exactly. SSE2 has no
+//	gather, so this is one load and one store a pixel, from a palette
+//	that stays in the first level cache.
+//---------------------------------------------------------------------
+
+#define DEFINE_GATHER(name, bytes, wide)												\
+static void																				\
+name (const UInt8* index, UInt8* dst, UInt32 colBytes, const UInt8* palette, UInt32 count)	\
+{																						\
+	for ( ; count > 1; count--, dst += colBytes)										\
+		memcpy(dst, palette + *index++ * 16, wide);										\
+	if (count)																			\
+		memcpy(dst, palette + *index * 16, bytes);										\
+}
+
+DEFINE_GATHER	(Gather1,			1,	1)
+DEFINE_GATHER	(Gather2,			2,	2)
+DEFINE_GATHER	(Gather3,			3,	4)
+DEFINE_GATHER	(Gather3Spaced,		3,	3)		// RGB32, whose unused byte is left alone
+DEFINE_GATHER	(Gather4,			4,	4)
+DEFINE_GATHER	(Gather6,			6,	8)
+DEFINE_GATHER	(Gather8,			8,	8)
+DEFINE_GATHER	(Gather12,			12,	16)
+DEFINE_GATHER	(Gather16,			16,	16)
+
+
+//--------------------------------------------------------------------- SetupMatchKernels
+//	Picks the row kernels for the layouts in pMatchInfo so that MatchAll
+//	does no per-pixel tests. Only 16 bit channels are ever byte swapped.
+//---------------------------------------------------------------------
+
+static const UnpackProc		gUnpack8[5]			= { nil, &Unpack8_1, nil, &Unpack8_3, &Unpack8_4 };
+static const UnpackProc		gUnpack16[5]		= { nil, &Unpack16_1, nil, &Unpack16_3, &Unpack16_4 };
+static const UnpackProc		gUnpack16Swap[5]	= { nil, &Unpack16Swap_1, nil, &Unpack16Swap_3, &Unpack16Swap_4 };
+static const PackProc		gPack8[5]			= { nil, &Pack8_1, nil, &Pack8_3, &Pack8_4 };
+static const PackProc		gPack16[5]			= { nil, &Pack16_1, nil, &Pack16_3, &Pack16_4 };
+static const PackProc		gPack16Swap[5]		= { nil, &Pack16Swap_1, nil, &Pack16Swap_3, &Pack16Swap_4 };
+static const UnpackByteProc	gUnpackByte[5]		= { nil, &UnpackByte_1, nil, &UnpackByte_3, &UnpackByte_4 };
+static const PackByteProc	gPackByte[5]		= { nil, &PackByte_1, nil, &PackByte_3, &PackByte_4 };
+static const UnpackFloatProc	gUnpackFloat[5]	= { nil, &UnpackFloat_1, nil, &UnpackFloat_3, &UnpackFloat_4 };
+static const UnpackFloatProc	gUnpackHalf[5]	= { nil, &UnpackHalf_1, nil, &UnpackHalf_3, &UnpackHalf_4 };
+static const PackFloatProc	gPackFloat[5]		= { nil, &PackFloat_1, nil, &PackFloat_3, &PackFloat_4 };
+static const PackFloatProc	gPackHalf[5]		= { nil, &PackHalf_1, nil, &PackHalf_3, &PackHalf_4 };
+#if USE_SSE2
+static const UnpackProc		gUnpackPlanar8[5]		= { nil, nil, nil, &UnpackPlanar8_3, &UnpackPlanar8_4 };
+static const UnpackProc		gUnpackPlanar16[5]		= { nil, nil, nil, &UnpackPlanar16_3, &UnpackPlanar16_4 };
+static const UnpackProc		gUnpackPlanar16Swap[5]	= { nil, nil, nil, &UnpackPlanar16Swap_3, &UnpackPlanar16Swap_4 };
+static const PackProc		gPackPlanar8[5]			= { nil, nil, nil, &PackPlanar8_3, &PackPlanar8_4 };
+static const PackProc		gPackPlanar16[5]		= { nil, nil, nil, &PackPlanar16_3, &PackPlanar16_4 };
+static const PackProc		gPackPlanar16Swap[5]	= { nil, nil, nil, &PackPlanar16Swap_3, &PackPlanar16Swap_4 };
+static const UnpackByteProc	gUnpackBytePlanar[5]	= { nil, nil, nil, &UnpackBytePlanar_3, &UnpackBytePlanar_4 };
+static const PackByteProc	gPackBytePlanar[5]		= { nil, nil, nil, &PackBytePlanar_3, &PackBytePlanar_4 };
+#endif
+
+// By word format, then whether the words are byte swapped
+static const UnpackProc		gUnpackWord[kWordCount][2] =
+{
+	{ nil,					nil },
+	{ &UnpackWord555,		&UnpackWord555Swap },
+	{ &UnpackWord565,		&UnpackWord565Swap },
+	{ &UnpackWord101010,	&UnpackWord101010Swap }
+};
+
+static const PackProc		gPackWord[kWordCount][2] =
+{
+	{ nil,					nil },
+	{ &PackWord555,			&PackWord555Swap },
+	{ &PackWord565,			&PackWord565Swap },
+	{ &PackWord101010,		&PackWord101010Swap }
+};
+
+static void
+SetupMatchKernels (CMMMatchPtr pMatchInfo)
+{
+	UInt32				i;
+	UInt8*				src;
+	UInt8*				dst;
+	
+	pMatchInfo->srcChans = 0;
+	pMatchInfo->dstChans = 0;
+	for (i=0; i < 4; i++)
+	{
+		if (pMatchInfo->srcBuf[i]) pMatchInfo->srcChans = i + 1;
+		if (pMatchInfo->dstBuf[i]) pMatchInfo->dstChans = i + 1;
+	}
+	
+	pMatchInfo->srcSplit = false;
+	pMatchInfo->dstSplit = false;
+	for (i=1; i < pMatchInfo->srcChans; i++)
+		pMatchInfo->srcSplit = pMatchInfo->srcSplit || (pMatchInfo->srcColBytes[i] != pMatchInfo->srcColBytes[0]);
+	for (i=1; i < pMatchInfo->dstChans; i++)
+		pMatchInfo->dstSplit = pMatchInfo->dstSplit || (pMatchInfo->dstColBytes[i] != pMatchInfo->dstColBytes[0]);
+	
+	if (pMatchInfo->srcChanBits == 8)
+		pMatchInfo->unpack = gUnpack8[pMatchInfo->srcChans];
+	else if (pMatchInfo->srcSwap)
+		pMatchInfo->unpack = gUnpack16Swap[pMatchInfo->srcChans];
+	else
+		pMatchInfo->unpack = gUnpack16[pMatchInfo->srcChans];
+	
+	if (pMatchInfo->dstChanBits == 8)
+		pMatchInfo->pack = gPack8[pMatchInfo->dstChans];
+	else if (pMatchInfo->dstSwap)
+		pMatchInfo->pack = gPack16Swap[pMatchInfo->dstChans];
+	else
+		pMatchInfo->pack = gPack16[pMatchInfo->dstChans];
+	
+	pMatchInfo->block = pMatchInfo->transform->block;
+	
+	// 8 bit in and out skips the widen and narrow when the conversion
+	// has a byte kernel, or when there is no conversion at all
+	pMatchInfo->block8 = pMatchInfo->transform->block8;
+	pMatchInfo->native8 = (pMatchInfo->srcChanBits == 8) && (pMatchInfo->dstChanBits == 8) &&
+						  (pMatchInfo->block8 || !pMatchInfo->block);
+	pMatchInfo->unpackByte = gUnpackByte[pMatchInfo->srcChans];
+	pMatchInfo->packByte = gPackByte[pMatchInfo->dstChans];
+	
+	if (IsPacked(pMatchInfo->srcBuf, pMatchInfo->srcChans, pMatchInfo->srcColBytes[0], pMatchInfo->srcChanBits / 8))
+	{
+		if (pMatchInfo->srcChanBits == 8)
+			pMatchInfo->unpackByte = &UnpackByte_Packed;
+		else if (!pMatchInfo->srcSwap)
+			pMatchInfo->unpack = &Unpack16_Packed;
+	}
+	
+	if (IsPacked(pMatchInfo->dstBuf, pMatchInfo->dstChans, pMatchInfo->dstColBytes[0], pMatchInfo->dstChanBits / 8))
+	{
+		if (pMatchInfo->dstChanBits == 8)
+			pMatchInfo->packByte = &PackByte_Packed;
+		else if (!pMatchInfo->dstSwap)
+			pMatchInfo->pack = &Pack16_Packed;
+	}
+	
+#if USE_SSE2
+	// Byte swapped channels next to one another are swapped a vector at
+	// a time on their way into the block buffer and out of it
+	if (pMatchInfo->srcChanBits == 16 && pMatchInfo->srcSwap && pMatchInfo->srcWord == kWordNone &&
+		pMatchInfo->srcSample == kSampleUInt && IsAdjacent(pMatchInfo->srcBuf, pMatchInfo->srcChans, 2))
+	{
+		if (pMatchInfo->srcChans == 4 && pMatchInfo->srcColBytes[0] == 8)
+			pMatchInfo->unpack = &Unpack16Swap_Packed;
+		else if (pMatchInfo->srcChans == 3 && pMatchInfo->srcColBytes[0] == 6)
+			pMatchInfo->unpack = &Unpack16Swap_3x6;
+		else if (pMatchInfo->srcChans == 3 && pMatchInfo->srcColBytes[0] == 8)
+			pMatchInfo->unpack = &Unpack16Swap_3x8;
+	}
+	
+	if (pMatchInfo->dstChanBits == 16 && pMatchInfo->dstSwap && pMatchInfo->dstWord == kWordNone &&
+		pMatchInfo->dstSample == kSampleUInt && IsAdjacent(pMatchInfo->dstBuf, pMatchInfo->dstChans, 2))
+	{
+		if (pMatchInfo->dstChans == 4 && pMatchInfo->dstColBytes[0] == 8)
+			pMatchInfo->pack = &Pack16Swap_Packed;
+		else if (pMatchInfo->dstChans == 3 && pMatchInfo->dstColBytes[0] == 6)
+			pMatchInfo->pack = &Pack16Swap_3x6;
+		else if (pMatchInfo->dstChans == 3 && pMatchInfo->dstColBytes[0] == 8)
+			pMatchInfo->pack = &Pack16Swap_3x8;
+	}
+	
+	// Channels in planes of their own interleave into the block buffer
+	// and out of it a vector at a time
+	if (pMatchInfo->srcWord == kWordNone && pMatchInfo->srcSample == kSampleUInt &&
+		IsPlanar(pMatchInfo->srcColBytes, pMatchInfo->srcChans, pMatchInfo->srcChanBits))
+	{
+		if (pMatchInfo->srcChanBits == 8)
+		{
+			pMatchInfo->unpack = gUnpackPlanar8[pMatchInfo->srcChans];
+			pMatchInfo->unpackByte = gUnpackBytePlanar[pMatchInfo->srcChans];
+		}
+		else if (pMatchInfo->srcSwap)
+			pMatchInfo->unpack = gUnpackPlanar16Swap[pMatchInfo->srcChans];
+		else
+			pMatchInfo->unpack = gUnpackPlanar16[pMatchInfo->srcChans];
+	}
+	
+	if (pMatchInfo->dstWord == kWordNone && pMatchInfo->dstSample == kSampleUInt &&
+		IsPlanar(pMatchInfo->dstColBytes, pMatchInfo->dstChans, pMatchInfo->dstChanBits))
+	{
+		if (pMatchInfo->dstChanBits == 8)
+		{
+			pMatchInfo->pack = gPackPlanar8[pMatchInfo->dstChans];
+			pMatchInfo->packByte = gPackBytePlanar[pMatchInfo->dstChans];
+		}
+		else if (pMatchInfo->dstSwap)
+			pMatchInfo->pack = gPackPlanar16Swap[pMatchInfo->dstChans];
+		else
+			pMatchInfo->pack = gPackPlanar16[pMatchInfo->dstChans];
+	}
+#endif
+	
+	// A split side goes a channel at a time through the one channel
+	// kernel, and so never takes the byte path
+	if (pMatchInfo->srcSplit)
+	{
+		if (pMatchInfo->srcChanBits == 8)
+			pMatchInfo->unpack = gUnpack8[1];
+		else if (pMatchInfo->srcSwap)
+			pMatchInfo->unpack = gUnpack16Swap[1];
+		else
+			pMatchInfo->unpack = gUnpack16[1];
+		pMatchInfo->native8 = false;
+	}
+	
+	if (pMatchInfo->dstSplit)
+	{
+		if (pMatchInfo->dstChanBits == 8)
+			pMatchInfo->pack = gPack8[1];
+		else if (pMatchInfo->dstSwap)
+			pMatchInfo->pack = gPack16Swap[1];
+		else
+			pMatchInfo->pack = gPack16[1];
+		pMatchInfo->native8 = false;
+	}
+	
+	// Channels packed into a word go straight between the word and the
+	// block buffer
+	if (pMatchInfo->srcWord != kWordNone)
+		pMatchInfo->unpack = gUnpackWord[pMatchInfo->srcWord][pMatchInfo->srcSwap];
+	if (pMatchInfo->dstWord != kWordNone)
+		pMatchInfo->pack = gPackWord[pMatchInfo->dstWord][pMatchInfo->dstSwap];
+	
+	// Float and half channels are scaled to float codes and matched by
+	// MatchRowsFloat instead, the other side unpacked or packed as codes
+	pMatchInfo->unpackFloat = nil;
+	pMatchInfo->packFloat = nil;
+	if (pMatchInfo->srcSample == kSampleFloat)
+		pMatchInfo->unpackFloat = gUnpackFloat[pMatchInfo->srcChans];
+	else if (pMatchInfo->srcSample == kSampleHalf)
+		pMatchInfo->unpackFloat = gUnpackHalf[pMatchInfo->srcChans];
+	if (pMatchInfo->dstSample == kSampleFloat)
+		pMatchInfo->packFloat = gPackFloat[pMatchInfo->dstChans];
+	else if (pMatchInfo->dstSample == kSampleHalf)
+		pMatchInfo->packFloat = gPackHalf[pMatchInfo->dstChans];
+	pMatchInfo->srcScale = FindScale(pMatchInfo->srcSpace);
+	pMatchInfo->dstScale = FindScale(pMatchInfo->dstSpace);
+	pMatchInfo->floating = (pMatchInfo->unpackFloat != nil) || (pMatchInfo->packFloat != nil);
+	
+	// Alpha is only unpacked when it is needed, and colors are only
+	// premultiplied by an alpha other than opaque. Premultiplied colors
+	// that are not converted are left as they are.
+	pMatchInfo->unpremultiply = (pMatchInfo->srcAlpha == kAlphaPremultiplied);
+	pMatchInfo->premultiply = (pMatchInfo->dstAlpha == kAlphaPremultiplied) && (pMatchInfo->srcAlpha != kAlphaNone);
+	if (pMatchInfo->unpremultiply && pMatchInfo->premultiply && pMatchInfo->block == nil)
+		pMatchInfo->unpremultiply = pMatchInfo->premultiply = false;
+	if (pMatchInfo->unpremultiply || pMatchInfo->premultiply)
+		pMatchInfo->native8 = false;
+	
+	pMatchInfo->unpackAlpha = nil;
+	if (pMatchInfo->srcAlpha != kAlphaNone && (pMatchInfo->dstAlpha != kAlphaNone || pMatchInfo->unpremultiply))
+	{
+		if (pMatchInfo->srcChanBits == 8)
+			pMatchInfo->unpackAlpha = &UnpackAlpha8;
+		else if (pMatchInfo->srcSwap)
+			pMatchInfo->unpackAlpha = &UnpackAlpha16Swap;
+		else
+			pMatchInfo->unpackAlpha = &UnpackAlpha16;
+	}
+	
+	pMatchInfo->packAlpha = nil;
+	if (pMatchInfo->dstAlpha != kAlphaNone)
+	{
+		if (pMatchInfo->dstChanBits == 8)
+			pMatchInfo->packAlpha = &PackAlpha8;
+		else if (pMatchInfo->dstSwap)
+			pMatchInfo->packAlpha = &PackAlpha16Swap;
+		else
+			pMatchInfo->packAlpha = &PackAlpha16;
+	}
+	
+	// An identity between layouts that differ only in byte order swaps
+	// whole rows, when every byte of a pixel is a channel or alpha and
+	// each lies at the same place in both
+	pMatchInfo->swapOnly = false;
+	if (pMatchInfo->block == nil && !pMatchInfo->floating && !pMatchInfo->unpremultiply && !pMatchInfo->premultiply &&
+		pMatchInfo->srcChanBits == 16 && pMatchInfo->dstChanBits == 16 && pMatchInfo->srcSwap != pMatchInfo->dstSwap &&
+		pMatchInfo->srcWord == kWordNone && pMatchInfo->dstWord == kWordNone && pMatchInfo->srcChans == pMatchInfo->dstChans &&
+		(pMatchInfo->srcAlphaBuf == nil) == (pMatchInfo->dstAlphaBuf == nil) && pMatchInfo->srcColBytes[0] == pMatchInfo->dstColBytes[0])
+	{
+		src = WholePixels(pMatchInfo->srcBuf, pMatchInfo->srcRowBytes, pMatchInfo->srcColBytes, pMatchInfo->srcChans,
+						  pMatchInfo->srcAlphaBuf, pMatchInfo->srcAlphaRowBytes, pMatchInfo->srcAlphaColBytes);
+		dst = WholePixels(pMatchInfo->dstBuf, pMatchInfo->dstRowBytes, pMatchInfo->dstColBytes, pMatchInfo->dstChans,
+						  pMatchInfo->dstAlphaBuf, pMatchInfo->dstAlphaRowBytes, pMatchInfo->dstAlphaColBytes);
+		pMatchInfo->swapOnly = (src != nil) && (dst != nil);
+		for (i=0; pMatchInfo->swapOnly && i < pMatchInfo->srcChans; i++)
+			pMatchInfo->swapOnly = (pMatchInfo->srcBuf[i] - src == pMatchInfo->dstBuf[i] - dst);
+		if (pMatchInfo->swapOnly && pMatchInfo->srcAlphaBuf)
+			pMatchInfo->swapOnly = (pMatchInfo->srcAlphaBuf - src == pMatchInfo->dstAlphaBuf - dst);
+	}
+}
+
+// The first byte of the pixels of a side whose channels and alpha, two
+// bytes each, fill its pixels between them, or nil if they do not
+static UInt8*
+WholePixels (UInt8* const* buf, const UInt32* rowBytes, const UInt32* colBytes, UInt32 chans,
+			 UInt8* alphaBuf, UInt32 alphaRowBytes, UInt32 alphaColBytes)
+{
+	UInt8*				codes[5];
+	UInt8*				first;
+	UInt32				count = chans, used = 0, k, at;
+	
+	for (k=0; k < chans; k++)
+	{
+		if (rowBytes[k] != rowBytes[0] || colBytes[k] != colBytes[0])
+			return nil;
+		codes[k] = buf[k];
+	}
+	if (alphaBuf)
+	{
+		if (alphaRowBytes != rowBytes[0] || alphaColBytes != colBytes[0])
+			return nil;
+		codes[count++] = alphaBuf;
+	}
+	if (count == 0 || colBytes[0] != 2 * count)
+		return nil;
+	
+	first = codes[0];
+	for (k=1; k < count; k++)
+		if (codes[k] < first)
+			first = codes[k];
+	
+	// Each at an even offset of its own within the pixel
+	for (k=0; k < count; k++)
+	{
+		at = (UInt32)(codes[k] - first);
+		if (at >= colBytes[0] || (at & 1) || (used & (1 << at)))
+			return nil;
+		used |= 1 << at;
+	}
+	return first;
+}
+
+
+//--------------------------------------------------------------------- MatchIndexed
+//	An indexed bitmap has at most 256 colors, so the color table is matched
+//	once and packed into the destination layout, and the pixels are then
+//	only copied from it, in bands like any other bitmap.
+//---------------------------------------------------------------------
+
+static const GatherProc		gGather[17] = { nil, &Gather1, &Gather2, &Gather3, &Gather4, nil, &Gather6, nil, &Gather8,
+											nil, nil, nil, &Gather12, nil, nil, nil, &Gather16 };
+
+static EngineError
+MatchIndexed (CMMTransformPtr xform, const EngineBitmap* srcMap, const EngineBitmap* dstMap,
+			  EngineProgressProc progressProc, void* refCon)
+{
+	IndexedRec			rec;
+	const LayoutRec*	dst;
+	UInt16				colors[256][4];
+	UInt16				alpha[256];
+	float				floats[256 * 4];
+	UInt8*				buf[4];
+	UInt32				i, chanBytes, first, span;
+	PackProc			pack;
+	PackFloatProc		packFloat;
+	
+	if (srcMap->colors == nil || srcMap->colorCount == 0 || srcMap->colorCount > 256)
+		return kEngineInvalidSrcMapErr;
+	
+	dst = FindLayout(dstMap->layout);
+	if (dst == nil || dst->space != xform->dstSpace)
+		return kEngineInvalidDstMapErr;
+	
+	// Only a byte per pixel can be written over its index
+	if (dstMap->image == srcMap->image && dst->colBytes != 1)
+		return kEngineInvalidDstMapErr;
+	
+	memset(colors, 0, sizeof(colors));
+	memcpy(colors, srcMap->colors, srcMap->colorCount * sizeof(colors[0]));
+	
+	// Each entry holds the channels from the first on, as they are laid
+	// out in a pixel, and its alpha, which is opaque
+	chanBytes = dst->chanBits / 8;
+	first = dst->offset[0];
+	if (dst->alpha)
+		for (i=0; i < 4; i++)
+			first = (dst->offset[i] < first) ? dst->offset[i] : first;
+	for (i=0; i < 4; i++)
+		buf[i] = (i < dst->chans) ? rec.palette + dst->offset[i] - first : nil;
+	
+	if (dst->alpha)
+	{
+		for (i=0; i < 256; i++)
+			alpha[i] = 0xFFFF;
+		if (chanBytes == 1)
+			PackAlpha8(alpha, rec.palette + dst->offset[3] - first, 16, 256);
+		else if (dst->little != TARGET_RT_LITTLE_ENDIAN)
+			PackAlpha16Swap(alpha, rec.palette + dst->offset[3] - first, 16, 256);
+		else
+			PackAlpha16(alpha, rec.palette + dst->offset[3] - first, 16, 256);
+	}
+	
+	// A float destination gets the table matched in float codes, as
+	// MatchRowsFloat would
+	if (dst->sample != kSampleUInt)
+	{
+		CodesToFloats(&colors[0][0], floats, 256);
+		for (i=0; i < xform->stepCount; i++)
+			xform->steps[i]->floating(xform, floats, 256);
+		packFloat = (dst->sample == kSampleFloat) ? gPackFloat[dst->chans] : gPackHalf[dst->chans];
+		packFloat(floats, buf, 16, 256, FindScale(dst->space));
+	}
+	else
+	{
+		EngineMatchColors(xform, colors, 256, sizeof(colors[0]));
+		if (dst->word != kWordNone)
+			pack = gPackWord[dst->word][dst->little != TARGET_RT_LITTLE_ENDIAN];
+		else if (chanBytes == 1)
+			pack = gPack8[dst->chans];
+		else if (dst->little != TARGET_RT_LITTLE_ENDIAN)
+			pack = gPack16Swap[dst->chans];
+		else
+			pack = gPack16[dst->chans];
+		pack(&colors[0][0], buf, 16, 256);
+	}
+	
+	span = (dst->word != kWordNone || dst->alpha) ? dst->colBytes : dst->chans * chanBytes;
+	rec.src			= (const UInt8*)srcMap->image;
+	rec.srcRowBytes	= srcMap->rowBytes;
+	rec.dst			= (UInt8*)dstMap->image + first;
+	rec.dstRowBytes	= dstMap->rowBytes;
+	rec.dstColBytes	= dst->colBytes;
+	rec.width		= srcMap->width;
+	rec.gather		= (span == dst->colBytes) ? gGather[span] : &Gather3Spaced;
+	
+	return RunBands(&IndexedBand, &rec, srcMap->height, srcMap->width, progressProc, refCon);
+}
+
+static void
+IndexedBand (void* data, UInt32 firstRow, UInt32 rowCount)
+{
+	IndexedRec*			rec = (IndexedRec*)data;
+	UInt32				r;
+	
+	for (r=firstRow; r < firstRow + rowCount; r++)
+		rec->gather(rec->src + r * rec->srcRowBytes, rec->dst + r * rec->dstRowBytes,
+					rec->dstColBytes, rec->palette, rec->width);
+}
+
+
+//---------------------------------------------------------------------
+//	RGB <-> CMYK one-minus conversions of a block. With SSE2 the channels
+//	of each color stay together in one 32 bit (8 bit colors) or 64 bit
+//	(16 bit colors) lane: K is the unsigned min of the lane shifted by
+//	one and two channels, and is then spread back over C, M and Y for
+//	the saturating subtract. The scalar loop handles the remainder.
+//---------------------------------------------------------------------
+
+#if USE_SSE2
+
+#define MinU16(a,b)		_mm_xor_si128(_mm_min_epi16(_mm_xor_si128((a), sign), _mm_xor_si128((b), sign)), sign)
+
+// Two colors, the fourth channel cleared
+static inline __m128i
+CMYKToRGB2 (__m128i v)
+{
+	const __m128i	cmy = _mm_set_epi32(0xFFFF, 0xFFFFFFFF, 0xFFFF, 0xFFFFFFFF);
+	__m128i			k;
+	
+	k = _mm_srli_epi64(v, 48);
+	k = _mm_or_si128(k, _mm_or_si128(_mm_slli_epi64(k, 16), _mm_slli_epi64(k, 32)));
+	return _mm_subs_epu16(_mm_andnot_si128(v, cmy), k);
+}
+
+#endif // USE_SSE2
+
+static void
+MatchBlock_RGB_CMYK (CMMTransformPtr xform, UInt16* chan, UInt32 count)
+{
+#if USE_SSE2
+	const __m128i	ones = _mm_set1_epi32(-1);
+	const __m128i	sign = _mm_set1_epi16((short)0x8000);
+	const __m128i	low = _mm_set_epi32(0, 0xFFFF, 0, 0xFFFF);
+	const __m128i	cmy = _mm_set_epi32(0xFFFF, 0xFFFFFFFF, 0xFFFF, 0xFFFFFFFF);
+	__m128i			v, k;
+	
+	for ( ; count >= 2; count -= 2, chan += 8)
+	{
+		v = _mm_xor_si128(_mm_loadu_si128((__m128i*)chan), ones);
+		k = MinU16(v, MinU16(_mm_srli_epi64(v, 16), _mm_srli_epi64(v, 32)));
+		k = _mm_and_si128(k, low);
+		v = _mm_subs_epu16(v, _mm_or_si128(k, _mm_or_si128(_mm_slli_epi64(k, 16), _mm_slli_epi64(k, 32))));
+		v = _mm_or_si128(_mm_and_si128(v, cmy), _mm_slli_epi64(k, 48));
+		_mm_storeu_si128((__m128i*)chan, v);
+	}
+#endif
+	(void)xform;
+	for ( ; count > 0; count--, chan += 4)
+		MatchOne_RGB_CMYK(chan);
+}
+
+static void
+MatchBlock_CMYK_RGB (CMMTransformPtr xform, UInt16* chan, UInt32 count)
+{
+	(void)xform;
+#if USE_SSE2
+	for ( ; count >= 2; count -= 2, chan += 8)
+		_mm_storeu_si128((__m128i*)chan, CMYKToRGB2(_mm_loadu_si128((__m128i*)chan)));
+#endif
+	for ( ; count > 0; count--, chan += 4)
+		MatchOne_CMYK_RGB(chan);
+}
+
+
+//---------------------------------------------------------------------
+//	Block versions of the MatchOne procs. Each loop calls its proc
+//	directly so the compiler can inline the conversion.
+//---------------------------------------------------------------------
+
+#define DEFINE_MATCHBLOCK(name)													\
+static void																		\
+MatchBlock_##name (CMMTransformPtr xform, UInt16* chan, UInt32 count)			\
+{																				\
+	(void)xform;  																\
+	for ( ; count > 0; count--, chan += 4)										\
+		MatchOne_##name(chan);													\
+}
+
+DEFINE_MATCHBLOCK(RGB_XYZ)
+DEFINE_MATCHBLOCK(XYZ_RGB)
+DEFINE_MATCHBLOCK(RGB_LAB)
+DEFINE_MATCHBLOCK(LAB_RGB)
+DEFINE_MATCHBLOCK(XYZ_LAB)
+DEFINE_MATCHBLOCK(LAB_XYZ)
+DEFINE_MATCHBLOCK(XYZ_Gray)
+DEFINE_MATCHBLOCK(Gray_XYZ)
+DEFINE_MATCHBLOCK(CMYK_LAB)
+DEFINE_MATCHBLOCK(LAB_CMYK)
+DEFINE_MATCHBLOCK(CMYK_XYZ)
+DEFINE_MATCHBLOCK(XYZ_CMYK)
+DEFINE_MATCHBLOCK(RGB_Gray)
+DEFINE_MATCHBLOCK(Gray_RGB)
+DEFINE_MATCHBLOCK(LAB_Gray)
+DEFINE_MATCHBLOCK(Gray_LAB)
+DEFINE_MATCHBLOCK(CMYK_Gray)
+DEFINE_MATCHBLOCK(Gray_CMYK)
+
+static void
+MatchBlock_Grid (CMMTransformPtr xform, UInt16* chan, UInt32 count)
+{
+	UInt16*				p;
+	UInt32				n;
+	
+	if (xform->gridHead)
+		xform->gridHead(xform, chan, count);
+	
+	for (p=chan, n=count; n > 0; n--, p += 4)
+		GridInterp(xform, p);
+	
+	for (n=0; n < 2 && xform->gridTail[n]; n++)
+		xform->gridTail[n](xform, chan, count);
+}
+
+static void
+MatchBlock_Chain (CMMTransformPtr xform, UInt16* chan, UInt32 count)
+{
+	UInt32				i;
+	
+	for (i=0; i < xform->stepCount; i++)
+		xform->stepBlocks[i](xform, chan, count);
+}
+
+
+//---------------------------------------------------------------------
+//	Single precision conversions of a block, used for
+//	kEnginePrecisionFloat and for the Lab conversions at normal quality.
+//	The coefficients are scaled to go straight from input code values to
+//	output code values, so the u1.15 Fract and UInt16 encodings cost one
+//	multiply-add each.
+//
+//	With SSE2 the block is taken four colors at a time and transposed
+//	into channel planes of four floats, matched, clamped and rounded,
+//	then transposed back. The fourth channel is passed through.
+//---------------------------------------------------------------------
+
+#define FloatToUInt16(x)	(((x) <= 0.0f) ? 0 : (((x) >= 65535.0f) ? 65535 : (UInt16)(x)))
+
+#if USE_SSE2
+
+static inline void
+LoadPlanes (const UInt16* chan, __m128* x, __m128* y, __m128* z, __m128i* w)
+{
+	const __m128i	zero = _mm_setzero_si128();
+	__m128i			a, b, c01, c23;
+	
+	a = _mm_loadu_si128((const __m128i*)chan);
+	b = _mm_loadu_si128((const __m128i*)(chan + 8));
+	c01 = _mm_unpacklo_epi16(a, b);
+	c23 = _mm_unpackhi_epi16(a, b);
+	a = _mm_unpacklo_epi16(c01, c23);
+	b = _mm_unpackhi_epi16(c01, c23);
+	*x = _mm_cvtepi32_ps(_mm_unpacklo_epi16(a, zero));
+	*y = _mm_cvtepi32_ps(_mm_unpackhi_epi16(a, zero));
+	*z = _mm_cvtepi32_ps(_mm_unpacklo_epi16(b, zero));
+	*w = _mm_unpackhi_epi16(b, zero);
+}
+
+// x, y and z already include the 0.5 for rounding
+static inline void
+StorePlanes (UInt16* chan, __m128 x, __m128 y, __m128 z, __m128i w)
+{
+	const __m128i	bias = _mm_set1_epi32(0x8000);
+	const __m128i	sign = _mm_set1_epi16((short)0x8000);
+	const __m128	fmax = _mm_set1_ps(65535.0f);
+	const __m128	fmin = _mm_setzero_ps();
+	__m128i			a, b, c01, c23;
+	
+	// packs is signed, so pack around 0x8000
+	a = _mm_sub_epi32(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(x, fmin), fmax)), bias);
+	b = _mm_sub_epi32(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(y, fmin), fmax)), bias);
+	c01 = _mm_xor_si128(_mm_packs_epi32(a, b), sign);
+	a = _mm_sub_epi32(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(z, fmin), fmax)), bias);
+	c23 = _mm_xor_si128(_mm_packs_epi32(a, _mm_sub_epi32(w, bias)), sign);
+	a = _mm_unpacklo_epi16(c01, c23);
+	b = _mm_unpackhi_epi16(c01, c23);
+	_mm_storeu_si128((__m128i*)chan, _mm_unpacklo_epi16(a, b));
+	_mm_storeu_si128((__m128i*)(chan + 8), _mm_unpackhi_epi16(a, b));
+}
+
+#endif // USE_SSE2
+
+
+//---------------------------------------------------------------------
+//	Lab helpers. The cube root starts from an exponent-thirding bit
+//	estimate (within 4%) and takes two Newton steps, which leaves a
+//	relative error below 2e-6 over the XYZ range. The linear segment
+//	near black is blended in with a compare mask instead of a branch.
+//---------------------------------------------------------------------
+
+#define kCbrtMagic			0x2A5137A0
+#define kLabEpsilon			0.008856f
+#define kLabFEpsilon		0.20696f
+#define kLabKappa			7.787f
+#define kLabOffset			(16.0f / 116.0f)
+
+static inline float
+FastCbrt (float x)
+{
+	union { float f; SInt32 i; } u;
+	float			y;
+	
+	u.f = x;
+	u.i = (SInt32)((float)u.i * (1.0f / 3.0f) + 0.5f) + kCbrtMagic;
+	y = u.f;
+	y = (2.0f / 3.0f) * y + (1.0f / 3.0f) * x / (y * y);
+	y = (2.0f / 3.0f) * y + (1.0f / 3.0f) * x / (y * y);
+	return y;
+}
+
+static inline float
+LabF (float t)
+{
+	return (t > kLabEpsilon) ? FastCbrt(t) : (kLabKappa * t + kLabOffset);
+}
+
+static inline float
+LabFInv (float f)
+{
+	return (f > kLabFEpsilon) ? (f * f * f) : ((f - kLabOffset) * (1.0f / kLabKappa));
+}
+
+#if USE_SSE2
+
+static inline __m128
+FastCbrt4 (__m128 x)
+{
+	const __m128	third = _mm_set1_ps(1.0f / 3.0f);
+	const __m128	twoThirds = _mm_set1_ps(2.0f / 3.0f);
+	__m128			y;
+	
+	y = _mm_castsi128_ps(_mm_add_epi32(_mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(x)), third)),
+									   _mm_set1_epi32(kCbrtMagic)));
+	y = _mm_add_ps(_mm_mul_ps(twoThirds, y), _mm_mul_ps(third, _mm_div_ps(x, _mm_mul_ps(y, y))));
+	y = _mm_add_ps(_mm_mul_ps(twoThirds, y), _mm_mul_ps(third, _mm_div_ps(x, _mm_mul_ps(y, y))));
+	return y;
+}
+
+// mask ? a : b
+#define Select4(mask, a, b)		_mm_or_ps(_mm_and_ps((mask), (a)), _mm_andnot_ps((mask), (b)))
+
+static inline __m128
+LabF4 (__m128 t)
+{
+	__m128			lin = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(kLabKappa)), _mm_set1_ps(kLabOffset));
+	return Select4(_mm_cmpgt_ps(t, _mm_set1_ps(kLabEpsilon)), FastCbrt4(t), lin);
+}
+
+static inline __m128
+LabFInv4 (__m128 f)
+{
+	__m128			lin = _mm_mul_ps(_mm_sub_ps(f, _mm_set1_ps(kLabOffset)), _mm_set1_ps(1.0f / kLabKappa));
+	return Select4(_mm_cmpgt_ps(f, _mm_set1_ps(kLabFEpsilon)), _mm_mul_ps(f, _mm_mul_ps(f, f)), lin);
+}
+
+#endif // USE_SSE2
+
+// Lab to UInt16 codes
+#define kLCode				(65535.0f * 116.0f / 100.0f)
+#define kACode				(65535.0f * 500.0f / 256.0f)
+#define kBCode				(65535.0f * 200.0f / 256.0f)
+
+// Largest D50 relative XYZ an XYZ Fract code holds
+#define kXMax				((float)(65535.0 / 32768.0 / 0.9642))
+#define kYMax				((float)(65535.0 / 32768.0))
+#define kZMax				((float)(65535.0 / 32768.0 / 0.8249))
+
+
+//---------------------------------------------------------------------
+//	Matrices of the single precision conversions. Each is scaled to go
+//	straight from the encoding of its input to that of its output: RGB
+//	and Gray are UInt16 codes, XYZ u1.15 Fract codes, and the XYZ going
+//	into or coming out of Lab is relative to the D50 white. Adjacent
+//	linear steps of a chain are multiplied into one matrix.
+//---------------------------------------------------------------------
+
+typedef struct
+{
+	float				m[3][3];
+} MatrixRec;
+
+#define RGBToXYZCoef(c)			((float)((c) * 32768.0 / 65535.0))
+#define XYZToRGBCoef(c)			((float)((c) * 65535.0 / 32768.0))
+#define GrayToXYZCoef(c)		((float)((c) * 32768.0 / 65535.0))
+#define RGBToLabCoef(c, white)	((float)((c) / 65535.0 / (white)))
+#define LabToRGBCoef(c, white)	((float)((c) * (white) * 65535.0))
+
+static const MatrixRec	gRGBToXYZ =
+{{
+	{ RGBToXYZCoef(0.418), RGBToXYZCoef(0.363), RGBToXYZCoef(0.183) },
+	{ RGBToXYZCoef(0.213), RGBToXYZCoef(0.715), RGBToXYZCoef(0.072) },
+	{ RGBToXYZCoef(0.015), RGBToXYZCoef(0.090), RGBToXYZCoef(0.720) },
+}};
+
+static const MatrixRec	gXYZToRGB =
+{{
+	{ XYZToRGBCoef( 3.202), XYZToRGBCoef(-1.543), XYZToRGBCoef(-0.660) },
+	{ XYZToRGBCoef(-0.959), XYZToRGBCoef( 1.879), XYZToRGBCoef( 0.056) },
+	{ XYZToRGBCoef( 0.053), XYZToRGBCoef(-0.203), XYZToRGBCoef( 1.396) },
+}};
+
+static const MatrixRec	gGrayToXYZ =
+{{
+	{ GrayToXYZCoef(0.96417), 0, 0 },
+	{ GrayToXYZCoef(1.0), 0, 0 },
+	{ GrayToXYZCoef(0.82489), 0, 0 },
+}};
+
+// RGB to XYZ to Gray, which is Y, in every channel
+static const MatrixRec	gRGBToGray =
+{{
+	{ 0.213f, 0.715f, 0.072f },
+	{ 0.213f, 0.715f, 0.072f },
+	{ 0.213f, 0.715f, 0.072f },
+}};
+
+static const MatrixRec	gRGBToLab =
+{{
+	{ RGBToLabCoef(0.418, 0.9642), RGBToLabCoef(0.363, 0.9642), RGBToLabCoef(0.183, 0.9642) },
+	{ RGBToLabCoef(0.213, 1.0), RGBToLabCoef(0.715, 1.0), RGBToLabCoef(0.072, 1.0) },
+	{ RGBToLabCoef(0.015, 0.8249), RGBToLabCoef(0.090, 0.8249), RGBToLabCoef(0.720, 0.8249) },
+}};
+
+static const MatrixRec	gLabToRGB =
+{{
+	{ LabToRGBCoef( 3.202, 0.9642), LabToRGBCoef(-1.543, 1.0), LabToRGBCoef(-0.660, 0.8249) },
+	{ LabToRGBCoef(-0.959, 0.9642), LabToRGBCoef( 1.879, 1.0), LabToRGBCoef( 0.056, 0.8249) },
+	{ LabToRGBCoef( 0.053, 0.9642), LabToRGBCoef(-0.203, 1.0), LabToRGBCoef( 1.396, 0.8249) },
+}};
+
+static const MatrixRec	gXYZToLab =
+{{
+	{ (float)(1.0 / (32768.0 * 0.9642)), 0, 0 },
+	{ 0, (float)(1.0 / 32768.0), 0 },
+	{ 0, 0, (float)(1.0 / (32768.0 * 0.8249)) },
+}};
+
+static const MatrixRec	gLabToXYZ =
+{{
+	{ (float)(32768.0 * 0.9642), 0, 0 },
+	{ 0, 32768.0f, 0 },
+	{ 0, 0, (float)(32768.0 * 0.8249) },
+}};
+
+
+//---------------------------------------------------------------------
+//	Every single precision conversion is one pass over the block: a
+//	color is loaded, goes through one matrix and is stored, and stays in
+//	registers at full single precision in between. Compound conversions
+//	are not rounded to 16 bits between their steps; nor are the exact
+//	procs they are checked against. Colors are loaded as RGB or XYZ
+//	codes, as RGB codes from CMYK, or as relative XYZ from Lab, clamped
+//	to what an XYZ Fract holds; and stored as codes, as CMYK from RGB
+//	codes rounded first, or as Lab from relative XYZ.
+//
+//	Against the double procs XYZ to Lab differs by less than 0.03 dE*ab,
+//	as measured by EngineCheckAccuracy.
+//---------------------------------------------------------------------
+
+static inline void
+FloatLoadCodes (UInt16* chan, float* v)
+{
+	v[0] = chan[0];
+	v[1] = chan[1];
+	v[2] = chan[2];
+}
+
+static inline void
+FloatLoadCMYK (UInt16* chan, float* v)
+{
+	MatchOne_CMYK_RGB(chan);
+	FloatLoadCodes(chan, v);
+}
+
+static inline void
+FloatLoadLab (UInt16* chan, float* v)
+{
+	float			fx, fy, fz;
+	
+	fy = chan[0] * (1.0f / kLCode) + kLabOffset;
+	fx = fy + (chan[1] - 32767.5f) * (1.0f / kACode);
+	fz = fy - (chan[2] - 32767.5f) * (1.0f / kBCode);
+	
+	fx = LabFInv(fx);
+	fy = LabFInv(fy);
+	fz = LabFInv(fz);
+	v[0] = (fx <= 0.0f) ? 0.0f : ((fx >= kXMax) ? kXMax : fx);
+	v[1] = (fy <= 0.0f) ? 0.0f : ((fy >= kYMax) ? kYMax : fy);
+	v[2] = (fz <= 0.0f) ? 0.0f : ((fz >= kZMax) ? kZMax : fz);
+}
+
+static inline void
+FloatMatrix (const MatrixRec* mat, float* v)
+{
+	float			x = v[0], y = v[1], z = v[2];
+	
+	v[0] = mat->m[0][0] * x + mat->m[0][1] * y + mat->m[0][2] * z;
+	v[1] = mat->m[1][0] * x + mat->m[1][1] * y + mat->m[1][2] * z;
+	v[2] = mat->m[2][0] * x + mat->m[2][1] * y + mat->m[2][2] * z;
+}
+
+static inline void
+FloatStoreCodes (UInt16* chan, const float* v)
+{
+	chan[0] = FloatToUInt16(v[0] + 0.5f);
+	chan[1] = FloatToUInt16(v[1] + 0.5f);
+	chan[2] = FloatToUInt16(v[2] + 0.5f);
+}
+
+static inline void
+FloatStoreCMYK (UInt16* chan, const float* v)
+{
+	FloatStoreCodes(chan, v);
+	MatchOne_RGB_CMYK(chan);
+}
+
+static inline void
+FloatStoreLab (UInt16* chan, const float* v)
+{
+	float			fx, fy, fz;
+	
+	fx = LabF(v[0]);
+	fy = LabF(v[1]);
+	fz = LabF(v[2]);
+	
+	chan[0] = FloatToUInt16(fy * kLCode - kLCode * kLabOffset + 0.5f);
+	chan[1] = FloatToUInt16((fx - fy) * kACode + (65535.0f * 128.0f / 256.0f + 0.5f));
+	chan[2] = FloatToUInt16((fy - fz) * kBCode + (65535.0f * 128.0f / 256.0f + 0.5f));
+}
+
+#if USE_SSE2
+
+#define FloatLoadCodes4		LoadPlanes
+
+static inline void
+FloatLoadCMYK4 (UInt16* chan, __m128* x, __m128* y, __m128* z, __m128i* w)
+{
+	const __m128	max = _mm_set1_ps(65535.0f);
+	const __m128	zero = _mm_setzero_ps();
+	__m128			k;
+	
+	LoadPlanes(chan, x, y, z, w);
+	k = _mm_cvtepi32_ps(*w);
+	*x = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(max, *x), k), zero);
+	*y = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(max, *y), k), zero);
+	*z = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(max, *z), k), zero);
+	*w = _mm_setzero_si128();
+}
+
+static inline void
+FloatLoadLab4 (UInt16* chan, __m128* x, __m128* y, __m128* z, __m128i* w)
+{
+	const __m128	mid = _mm_set1_ps(32767.5f);
+	const __m128	zero = _mm_setzero_ps();
+	__m128			fx, fy, fz;
+	
+	LoadPlanes(chan, &fy, &fx, &fz, w);
+	fy = _mm_add_ps(_mm_mul_ps(fy, _mm_set1_ps(1.0f / kLCode)), _mm_set1_ps(kLabOffset));
+	fx = _mm_add_ps(fy, _mm_mul_ps(_mm_sub_ps(fx, mid), _mm_set1_ps(1.0f / kACode)));
+	fz = _mm_sub_ps(fy, _mm_mul_ps(_mm_sub_ps(fz, mid), _mm_set1_ps(1.0f / kBCode)));
+	*x = _mm_min_ps(_mm_max_ps(LabFInv4(fx), zero), _mm_set1_ps(kXMax));
+	*y = _mm_min_ps(_mm_max_ps(LabFInv4(fy), zero), _mm_set1_ps(kYMax));
+	*z = _mm_min_ps(_mm_max_ps(LabFInv4(fz), zero), _mm_set1_ps(kZMax));
+}
+
+static inline void
+FloatMatrix4 (const __m128 m[3][3], __m128* x, __m128* y, __m128* z)
+{
+	__m128			fx = *x, fy = *y, fz = *z;
+	
+	*x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][0], fx), _mm_mul_ps(m[0][1], fy)), _mm_mul_ps(m[0][2], fz));
+	*y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1][0], fx), _mm_mul_ps(m[1][1], fy)), _mm_mul_ps(m[1][2], fz));
+	*z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2][0], fx), _mm_mul_ps(m[2][1], fy)), _mm_mul_ps(m[2][2], fz));
+}
+
+static inline void
+FloatStoreCodes4 (UInt16* chan, __m128 x, __m128 y, __m128 z, __m128i w)
+{
+	const __m128	half = _mm_set1_ps(0.5f);
+	
+	StorePlanes(chan, _mm_add_ps(x, half), _mm_add_ps(y, half), _mm_add_ps(z, half), w);
+}
+
+// RGB is rounded to codes first, so CMYK is as from MatchOne_RGB_CMYK
+static inline void
+FloatStoreCMYK4 (UInt16* chan, __m128 x, __m128 y, __m128 z, __m128i w)
+{
+	const __m128	half = _mm_set1_ps(0.5f);
+	const __m128	max = _mm_set1_ps(65535.0f);
+	const __m128	zero = _mm_setzero_ps();
+	__m128			k;
+	
+	(void)w;
+	x = _mm_sub_ps(max, _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(x, half), zero), max))));
+	y = _mm_sub_ps(max, _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(y, half), zero), max))));
+	z = _mm_sub_ps(max, _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(z, half), zero), max))));
+	k = _mm_min_ps(x, _mm_min_ps(y, z));
+	StorePlanes(chan, _mm_sub_ps(x, k), _mm_sub_ps(y, k), _mm_sub_ps(z, k), _mm_cvttps_epi32(k));
+}
+
+static inline void
+FloatStoreLab4 (UInt16* chan, __m128 x, __m128 y, __m128 z, __m128i w)
+{
+	const __m128	half = _mm_set1_ps(0.5f);
+	const __m128	ab = _mm_set1_ps(65535.0f * 128.0f / 256.0f + 0.5f);
+	
+	x = LabF4(x);
+	y = LabF4(y);
+	z = LabF4(z);
+	StorePlanes(chan,
+				_mm_add_ps(_mm_sub_ps(_mm_mul_ps(y, _mm_set1_ps(kLCode)), _mm_set1_ps(kLCode * kLabOffset)), half),
+				_mm_add_ps(_mm_mul_ps(_mm_sub_ps(x, y), _mm_set1_ps(kACode)), ab),
+				_mm_add_ps(_mm_mul_ps(_mm_sub_ps(y, z), _mm_set1_ps(kBCode)), ab),
+				w);
+}
+
+// Four colors at a time, leaving the rest of the block to the scalar loop
+#define FLOATBLOCK4(mat, load, store)											\
+	{																			\
+		__m128			m[3][3], x, y, z;										\
+		__m128i			w;														\
+		UInt32			i, j;													\
+																				\
+		for (i=0; i < 3; i++)													\
+			for (j=0; j < 3; j++)												\
+				m[i][j] = _mm_set1_ps(mat.m[i][j]);								\
+																				\
+		for ( ; count >= 4; count -= 4, chan += 16)								\
+		{																		\
+			FloatLoad##load##4(chan, &x, &y, &z, &w);							\
+			FloatMatrix4(m, &x, &y, &z);										\
+			FloatStore##store##4(chan, x, y, z, w);								\
+		}																		\
+	}
+
+#else
+
+#define FLOATBLOCK4(mat, load, store)
+
+#endif // USE_SSE2
+
+#define DEFINE_FLOATBLOCK(name,		mat,			load,		store)					\
+static void																		\
+MatchBlockFast_##name (CMMTransformPtr xform, UInt16* chan, UInt32 count)		\
+{																				\
+	float			v[3];														\
+																				\
+	(void)xform;  																\
+	FLOATBLOCK4(mat, load, store)												\
+	for ( ; count > 0; count--, chan += 4)										\
+	{																			\
+		FloatLoad##load(chan, v);												\
+		FloatMatrix(&mat, v);													\
+		FloatStore##store(chan, v);												\
+	}																			\
+}
+
+DEFINE_FLOATBLOCK(RGB_XYZ,		gRGBToXYZ,		Codes,		Codes)
+DEFINE_FLOATBLOCK(XYZ_RGB,		gXYZToRGB,		Codes,		Codes)
+DEFINE_FLOATBLOCK(Gray_XYZ,		gGrayToXYZ,		Codes,		Codes)
+DEFINE_FLOATBLOCK(XYZ_LAB,		gXYZToLab,		Codes,		Lab)
+DEFINE_FLOATBLOCK(LAB_XYZ,		gLabToXYZ,		Lab,		Codes)
+DEFINE_FLOATBLOCK(RGB_LAB,		gRGBToLab,		Codes,		Lab)
+DEFINE_FLOATBLOCK(LAB_RGB,		gLabToRGB,		Lab,		Codes)
+DEFINE_FLOATBLOCK(RGB_Gray,		gRGBToGray,		Codes,		Codes)
+DEFINE_FLOATBLOCK(CMYK_XYZ,		gRGBToXYZ,		CMYK,		Codes)
+DEFINE_FLOATBLOCK(XYZ_CMYK,		gXYZToRGB,		Codes,		CMYK)
+DEFINE_FLOATBLOCK(CMYK_LAB,		gRGBToLab,		CMYK,		Lab)
+DEFINE_FLOATBLOCK(LAB_CMYK,		gLabToRGB,		Lab,		CMYK)
+DEFINE_FLOATBLOCK(CMYK_Gray,	gRGBToGray,		CMYK,		Codes)
+
+
+//---------------------------------------------------------------------
+//	Gamut checks. A color is out of gamut when its conversion has to
+//	clamp: an RGB or XYZ channel falls below zero or past the largest
+//	code, CMYK ink goes past white, or Lab to XYZ past what a Fract holds.
+//	Each check is the single precision conversion without the clamps and
+//	stores, taken four colors at a time with SSE2, and sets out to 1 for
+//	the colors out of gamut.
+//
+//	The matrices between RGB and XYZ, to three places, are not quite each
+//	other's inverse: D50 white comes out 35 codes past the largest green,
+//	and an RGB color through XYZ and back up to 48 codes off, a few more
+//	with the rounding in between. kGamutSlack lets that pass, so a color
+//	is out of gamut only where it is clamped by more than the matrices
+//	miss by.
+//---------------------------------------------------------------------
+
+#define kGamutSlack			64.0f			// in output codes
+#define kGamutSlackXYZ		(kGamutSlack / 32768.0f)
+
+// XYZ to Gray, which is Y, only ever checked
+static const MatrixRec	gXYZToGray =
+{{
+	{ 0, (float)(65535.0 / 32768.0), 0 },
+	{ 0, (float)(65535.0 / 32768.0), 0 },
+	{ 0, (float)(65535.0 / 32768.0), 0 },
+}};
+
+// CMYK to RGB is all in the load
+static const MatrixRec	gIdentity =
+{{
+	{ 1.0f, 0, 0 },
+	{ 0, 1.0f, 0 },
+	{ 0, 0, 1.0f },
+}};
+
+#define OutOfRange(x, max, slack)	(((x) < -(slack)) | ((x) > (max) + (slack)))
+
+static inline UInt8
+GamutLoadCodes (UInt16* chan, float* v)
+{
+	FloatLoadCodes(chan, v);
+	return 0;
+}
+
+static inline UInt8
+GamutLoadCMYK (UInt16* chan, float* v)
+{
+	float			k = chan[3];
+	UInt8			out;
+	
+	v[0] = 65535.0f - chan[0] - k;
+	v[1] = 65535.0f - chan[1] - k;
+	v[2] = 65535.0f - chan[2] - k;
+	out = (v[0] < -kGamutSlack) | (v[1] < -kGamutSlack) | (v[2] < -kGamutSlack);
+	
+	v[0] = (v[0] <= 0.0f) ? 0.0f : v[0];
+	v[1] = (v[1] <= 0.0f) ? 0.0f : v[1];
+	v[2] = (v[2] <= 0.0f) ? 0.0f : v[2];
+	return out;
+}
+
+static inline UInt8
+GamutLoadLab (UInt16* chan, float* v)
+{
+	float			fx, fy, fz;
+	UInt8			out;
+	
+	fy = chan[0] * (1.0f / kLCode) + kLabOffset;
+	fx = fy + (chan[1] - 32767.5f) * (1.0f / kACode);
+	fz = fy - (chan[2] - 32767.5f) * (1.0f / kBCode);
+	
+	fx = LabFInv(fx);
+	fy = LabFInv(fy);
+	fz = LabFInv(fz);
+	out = OutOfRange(fx, kXMax, kGamutSlackXYZ) | OutOfRange(fy, kYMax, kGamutSlackXYZ) |
+		  OutOfRange(fz, kZMax, kGamutSlackXYZ);
+	
+	v[0] = (fx <= 0.0f) ? 0.0f : ((fx >= kXMax) ? kXMax : fx);
+	v[1] = (fy <= 0.0f) ? 0.0f : ((fy >= kYMax) ? kYMax : fy);
+	v[2] = (fz <= 0.0f) ? 0.0f : ((fz >= kZMax) ? kZMax : fz);
+	return out;
+}
+
+static inline UInt8
+GamutStoreCodes (const float* v)
+{
+	return OutOfRange(v[0], 65535.0f, kGamutSlack) | OutOfRange(v[1], 65535.0f, kGamutSlack) |
+		   OutOfRange(v[2], 65535.0f, kGamutSlack);
+}
+
+// RGB to CMYK never clamps, only the RGB may
+#define GamutStoreCMYK		GamutStoreCodes
+
+static inline UInt8
+GamutStoreLab (const float* v)
+{
+	float			fx, fy, fz, lab[3];
+	
+	fx = LabF(v[0]);
+	fy = LabF(v[1]);
+	fz = LabF(v[2]);
+	
+	lab[0] = fy * kLCode - kLCode * kLabOffset;
+	lab[1] = (fx - fy) * kACode + 65535.0f * 128.0f / 256.0f;
+	lab[2] = (fy - fz) * kBCode + 65535.0f * 128.0f / 256.0f;
+	return GamutStoreCodes(lab);
+}
+
+#if USE_SSE2
+
+#define OutOfRange4(x, max, slack)	_mm_or_ps(_mm_cmplt_ps((x), _mm_set1_ps(-(slack))),					\
+											  _mm_cmpgt_ps((x), _mm_set1_ps((max) + (slack))))
+
+static inline __m128
+GamutLoadCodes4 (UInt16* chan, __m128* x, __m128* y, __m128* z)
+{
+	__m128i			w;
+	
+	LoadPlanes(chan, x, y, z, &w);
+	return _mm_setzero_ps();
+}
+
+static inline __m128
+GamutLoadCMYK4 (UInt16* chan, __m128* x, __m128* y, __m128* z)
+{
+	const __m128	max = _mm_set1_ps(65535.0f);
+	const __m128	zero = _mm_setzero_ps();
+	const __m128	slack = _mm_set1_ps(-kGamutSlack);
+	__m128			k, out;
+	__m128i			w;
+	
+	LoadPlanes(chan, x, y, z, &w);
+	k = _mm_cvtepi32_ps(w);
+	*x = _mm_sub_ps(_mm_sub_ps(max, *x), k);
+	*y = _mm_sub_ps(_mm_sub_ps(max, *y), k);
+	*z = _mm_sub_ps(_mm_sub_ps(max, *z), k);
+	out = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(*x, slack), _mm_cmplt_ps(*y, slack)), _mm_cmplt_ps(*z, slack));
+	
+	*x = _mm_max_ps(*x, zero);
+	*y = _mm_max_ps(*y, zero);
+	*z = _mm_max_ps(*z, zero);
+	return out;
+}
+
+static inline __m128
+GamutLoadLab4 (UInt16* chan, __m128* x, __m128* y, __m128* z)
+{
+	const __m128	mid = _mm_set1_ps(32767.5f);
+	const __m128	zero = _mm_setzero_ps();
+	__m128			fx, fy, fz, out;
+	__m128i			w;
+	
+	LoadPlanes(chan, &fy, &fx, &fz, &w);
+	fy = _mm_add_ps(_mm_mul_ps(fy, _mm_set1_ps(1.0f / kLCode)), _mm_set1_ps(kLabOffset));
+	fx = _mm_add_ps(fy, _mm_mul_ps(_mm_sub_ps(fx, mid), _mm_set1_ps(1.0f / kACode)));
+	fz = _mm_sub_ps(fy, _mm_mul_ps(_mm_sub_ps(fz, mid), _mm_set1_ps(1.0f / kBCode)));
+	
+	fx = LabFInv4(fx);
+	fy = LabFInv4(fy);
+	fz = LabFInv4(fz);
+	out = _mm_or_ps(_mm_or_ps(OutOfRange4(fx, kXMax, kGamutSlackXYZ), OutOfRange4(fy, kYMax, kGamutSlackXYZ)),
+					OutOfRange4(fz, kZMax, kGamutSlackXYZ));
+	
+	*x = _mm_min_ps(_mm_max_ps(fx, zero), _mm_set1_ps(kXMax));
+	*y = _mm_min_ps(_mm_max_ps(fy, zero), _mm_set1_ps(kYMax));
+	*z = _mm_min_ps(_mm_max_ps(fz, zero), _mm_set1_ps(kZMax));
+	return out;
+}
+
+static inline __m128
+GamutStoreCodes4 (__m128 x, __m128 y, __m128 z)
+{
+	return _mm_or_ps(_mm_or_ps(OutOfRange4(x, 65535.0f, kGamutSlack), OutOfRange4(y, 65535.0f, kGamutSlack)),
+					 OutOfRange4(z, 65535.0f, kGamutSlack));
+}
+
+#define GamutStoreCMYK4		GamutStoreCodes4
+
+static inline __m128
+GamutStoreLab4 (__m128 x, __m128 y, __m128 z)
+{
+	const __m128	ab = _mm_set1_ps(65535.0f * 128.0f / 256.0f);
+	
+	x = LabF4(x);
+	y = LabF4(y);
+	z = LabF4(z);
+	return GamutStoreCodes4(_mm_sub_ps(_mm_mul_ps(y, _mm_set1_ps(kLCode)), _mm_set1_ps(kLCode * kLabOffset)),
+							_mm_add_ps(_mm_mul_ps(_mm_sub_ps(x, y), _mm_set1_ps(kACode)), ab),
+							_mm_add_ps(_mm_mul_ps(_mm_sub_ps(y, z), _mm_set1_ps(kBCode)), ab));
+}
+
+#define GAMUTBLOCK4(mat, load, store)											\
+	{																			\
+		__m128			m[3][3], x, y, z, mask;									\
+		UInt32			i, j, bits;												\
+																				\
+		for (i=0; i < 3; i++)													\
+			for (j=0; j < 3; j++)												\
+				m[i][j] = _mm_set1_ps(mat.m[i][j]);								\
+																				\
+		for ( ; count >= 4; count -= 4, chan += 16, out += 4)					\
+		{																		\
+			mask = GamutLoad##load##4(chan, &x, &y, &z);						\
+			FloatMatrix4(m, &x, &y, &z);										\
+			mask = _mm_or_ps(mask, GamutStore##store##4(x, y, z));				\
+			bits = (UInt32)_mm_movemask_ps(mask);								\
+			out[0] |= bits & 1;													\
+			out[1] |= (bits >> 1) & 1;											\
+			out[2] |= (bits >> 2) & 1;											\
+			out[3] |= bits >> 3;												\
+		}																		\
+	}
+
+#else
+
+#define GAMUTBLOCK4(mat, load, store)
+
+#endif // USE_SSE2
+
+#define DEFINE_GAMUTBLOCK(name,		mat,			load,		store)					\
+static void																		\
+CheckBlock_##name (UInt16* chan, UInt32 count, UInt8* out)						\
+{																				\
+	float			v[3];														\
+	UInt8			bad;														\
+																				\
+	GAMUTBLOCK4(mat, load, store)												\
+	for ( ; count > 0; count--, chan += 4, out++)								\
+	{																			\
+		bad = GamutLoad##load(chan, v);											\
+		FloatMatrix(&mat, v);													\
+		*out |= bad | GamutStore##store(v);										\
+	}																			\
+}
+
+DEFINE_GAMUTBLOCK(XYZ_RGB,		gXYZToRGB,		Codes,		Codes)
+DEFINE_GAMUTBLOCK(XYZ_LAB,		gXYZToLab,		Codes,		Lab)
+DEFINE_GAMUTBLOCK(LAB_XYZ,		gLabToXYZ,		Lab,		Codes)
+DEFINE_GAMUTBLOCK(RGB_LAB,		gRGBToLab,		Codes,		Lab)
+DEFINE_GAMUTBLOCK(LAB_RGB,		gLabToRGB,		Lab,		Codes)
+DEFINE_GAMUTBLOCK(CMYK_XYZ,		gRGBToXYZ,		CMYK,		Codes)
+DEFINE_GAMUTBLOCK(XYZ_CMYK,		gXYZToRGB,		Codes,		CMYK)
+DEFINE_GAMUTBLOCK(CMYK_LAB,		gRGBToLab,		CMYK,		Lab)
+DEFINE_GAMUTBLOCK(LAB_CMYK,		gLabToRGB,		Lab,		CMYK)
+DEFINE_GAMUTBLOCK(CMYK_Gray,	gRGBToGray,		CMYK,		Codes)
+DEFINE_GAMUTBLOCK(CMYK_RGB,		gIdentity,		CMYK,		Codes)
+DEFINE_GAMUTBLOCK(XYZ_Gray,		gXYZToGray,		Codes,		Codes)
+
+
+//---------------------------------------------------------------------
+//	Float conversions of a block, for the float and half layouts. Colors
+//	are float code values, scaled as the 16 bit codes but neither rounded
+//	nor clamped, and go through the matrices of the single precision
+//	conversions as they are, but that CMYK ink is still taken off white
+//	no further than black. With SSE2 four colors are transposed into
+//	channel planes and back, the fourth channel passed through.
+//---------------------------------------------------------------------
+
+// Gray into every channel
+static const MatrixRec	gGrayToRGB =
+{{
+	{ 1.0f, 0, 0 },
+	{ 1.0f, 0, 0 },
+	{ 1.0f, 0, 0 },
+}};
+
+static void
+CodesToFloats (const UInt16* codes, float* chan, UInt32 count)
+{
+	UInt32			i = 0;
+#if USE_SSE2
+	const __m128i	zero = _mm_setzero_si128();
+	__m128i			v;
+	
+	for ( ; i + 2 <= count; i += 2)
+	{
+		v = _mm_loadu_si128((const __m128i*)(codes + i * 4));
+		_mm_storeu_ps(chan + i * 4, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+		_mm_storeu_ps(chan + i * 4 + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+	}
+#endif
+	for (i *= 4; i < count * 4; i++)
+		chan[i] = codes[i];
+}
+
+// Rounds and clamps to the 16 bit codes
+static void
+FloatsToCodes (const float* chan, UInt16* codes, UInt32 count)
+{
+	UInt32			i = 0;
+#if USE_SSE2
+	const __m128i	bias = _mm_set1_epi32(0x8000);
+	const __m128i	sign = _mm_set1_epi16((short)0x8000);
+	const __m128	half = _mm_set1_ps(0.5f);
+	const __m128	fmax = _mm_set1_ps(65535.0f);
+	const __m128	fmin = _mm_setzero_ps();
+	__m128i			a, b;
+	
+	// packs is signed, so pack around 0x8000
+	for ( ; i + 2 <= count; i += 2)
+	{
+		a = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_loadu_ps(chan + i * 4), half), fmin), fmax));
+		b = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_loadu_ps(chan + i * 4 + 4), half), fmin), fmax));
+		a = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+		_mm_storeu_si128((__m128i*)(codes + i * 4), _mm_xor_si128(a, sign));
+	}
+#endif
+	for (i *= 4; i < count * 4; i++)
+		codes[i] = FloatToUInt16(chan[i] + 0.5f);
+}
+
+static inline void
+FloatGetCodes (float* chan, float* v)
+{
+	v[0] = chan[0];
+	v[1] = chan[1];
+	v[2] = chan[2];
+}
+
+static inline void
+FloatGetCMYK (float* chan, float* v)
+{
+	float			k = chan[3];
+	
+	v[0] = 65535.0f - chan[0] - k;
+	v[1] = 65535.0f - chan[1] - k;
+	v[2] = 65535.0f - chan[2] - k;
+	v[0] = (v[0] <= 0.0f) ? 0.0f : v[0];
+	v[1] = (v[1] <= 0.0f) ? 0.0f : v[1];
+	v[2] = (v[2] <= 0.0f) ? 0.0f : v[2];
+	chan[3] = 0.0f;
+}
+
+static inline void
+FloatGetLab (float* chan, float* v)
+{
+	float			fy;
+	
+	fy = chan[0] * (1.0f / kLCode) + kLabOffset;
+	v[0] = LabFInv(fy + (chan[1] - 32767.5f) * (1.0f / kACode));
+	v[1] = LabFInv(fy);
+	v[2] = LabFInv(fy - (chan[2] - 32767.5f) * (1.0f / kBCode));
+}
+
+static inline void
+FloatPutCodes (float* chan, const float* v)
+{
+	chan[0] = v[0];
+	chan[1] = v[1];
+	chan[2] = v[2];
+}
+
+static inline void
+FloatPutCMYK (float* chan, const float* v)
+{
+	float			c = 65535.0f - v[0];
+	float			m = 65535.0f - v[1];
+	float			y = 65535.0f - v[2];
+	float			k = (c < m) ? ((c < y) ? c : y) : ((m < y) ? m : y);
+	
+	chan[0] = c - k;
+	chan[1] = m - k;
+	chan[2] = y - k;
+	chan[3] = k;
+}
+
+static inline void
+FloatPutLab (float* chan, const float* v)
+{
+	float			fx, fy, fz;
+	
+	fx = LabF(v[0]);
+	fy = LabF(v[1]);
+	fz = LabF(v[2]);
+	
+	chan[0] = fy * kLCode - kLCode * kLabOffset;
+	chan[1] = (fx - fy) * kACode + 32767.5f;
+	chan[2] = (fy - fz) * kBCode + 32767.5f;
+}
+
+#if USE_SSE2
+
+#define FloatGetCodes4(x, y, z, w)
+#define FloatPutCodes4(x, y, z, w)
+
+static inline void
+FloatGetCMYK4 (__m128* x, __m128* y, __m128* z, __m128* w)
+{
+	const __m128	max = _mm_set1_ps(65535.0f);
+	const __m128	zero = _mm_setzero_ps();
+	
+	*x = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(max, *x), *w), zero);
+	*y = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(max, *y), *w), zero);
+	*z = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(max, *z), *w), zero);
+	*w = zero;
+}
+
+static inline void
+FloatGetLab4 (__m128* x, __m128* y, __m128* z, __m128* w)
+{
+	const __m128	mid = _mm_set1_ps(32767.5f);
+	__m128			fy;
+	
+	(void)w;
+	fy = _mm_add_ps(_mm_mul_ps(*x, _mm_set1_ps(1.0f / kLCode)), _mm_set1_ps(kLabOffset));
+	*x = LabFInv4(_mm_add_ps(fy, _mm_mul_ps(_mm_sub_ps(*y, mid), _mm_set1_ps(1.0f / kACode))));
+	*z = LabFInv4(_mm_sub_ps(fy, _mm_mul_ps(_mm_sub_ps(*z, mid), _mm_set1_ps(1.0f / kBCode))));
+	*y = LabFInv4(fy);
+}
+
+static inline void
+FloatPutCMYK4 (__m128* x, __m128* y, __m128* z, __m128* w)
+{
+	const __m128	max = _mm_set1_ps(65535.0f);
+	
+	*x = _mm_sub_ps(max, *x);
+	*y = _mm_sub_ps(max, *y);
+	*z = _mm_sub_ps(max, *z);
+	*w = _mm_min_ps(*x, _mm_min_ps(*y, *z));
+	*x = _mm_sub_ps(*x, *w);
+	*y = _mm_sub_ps(*y, *w);
+	*z = _mm_sub_ps(*z, *w);
+}
+
+static inline void
+FloatPutLab4 (__m128* x, __m128* y, __m128* z, __m128* w)
+{
+	const __m128	mid = _mm_set1_ps(32767.5f);
+	__m128			fx, fy, fz;
+	
+	(void)w;
+	fx = LabF4(*x);
+	fy = LabF4(*y);
+	fz = LabF4(*z);
+	*x = _mm_sub_ps(_mm_mul_ps(fy, _mm_set1_ps(kLCode)), _mm_set1_ps(kLCode * kLabOffset));
+	*y = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(fx, fy), _mm_set1_ps(kACode)), mid);
+	*z = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(fy, fz), _mm_set1_ps(kBCode)), mid);
+}
+
+#define FLOATCODES4(mat, get, put)												\
+	{																			\
+		__m128			m[3][3], x, y, z, w;									\
+		UInt32			i, j;													\
+																				\
+		for (i=0; i < 3; i++)													\
+			for (j=0; j < 3; j++)												\
+				m[i][j] = _mm_set1_ps(mat.m[i][j]);								\
+																				\
+		for ( ; count >= 4; count -= 4, chan += 16)								\
+		{																		\
+			x = _mm_loadu_ps(chan);												\
+			y = _mm_loadu_ps(chan + 4);											\
+			z = _mm_loadu_ps(chan + 8);											\
+			w = _mm_loadu_ps(chan + 12);										\
+			_MM_TRANSPOSE4_PS(x, y, z, w);										\
+			FloatGet##get##4(&x, &y, &z, &w);									\
+			FloatMatrix4(m, &x, &y, &z);										\
+			FloatPut##put##4(&x, &y, &z, &w);									\
+			_MM_TRANSPOSE4_PS(x, y, z, w);										\
+			_mm_storeu_ps(chan, x);												\
+			_mm_storeu_ps(chan + 4, y);											\
+			_mm_storeu_ps(chan + 8, z);											\
+			_mm_storeu_ps(chan + 12, w);										\
+		}																		\
+	}
+
+#else
+
+#define FLOATCODES4(mat, get, put)
+
+#endif // USE_SSE2
+
+#define DEFINE_FLOATCODES(name,		mat,			get,		put)					\
+static void																		\
+MatchFloat_##name (CMMTransformPtr xform, float* chan, UInt32 count)			\
+{																				\
+	float			v[3];														\
+																				\
+	(void)xform;  																\
+	FLOATCODES4(mat, get, put)													\
+	for ( ; count > 0; count--, chan += 4)										\
+	{																			\
+		FloatGet##get(chan, v);													\
+		FloatMatrix(&mat, v);													\
+		FloatPut##put(chan, v);													\
+	}																			\
+}
+
+DEFINE_FLOATCODES(RGB_XYZ,		gRGBToXYZ,		Codes,		Codes)
+DEFINE_FLOATCODES(XYZ_RGB,		gXYZToRGB,		Codes,		Codes)
+DEFINE_FLOATCODES(Gray_XYZ,		gGrayToXYZ,		Codes,		Codes)
+DEFINE_FLOATCODES(XYZ_LAB,		gXYZToLab,		Codes,		Lab)
+DEFINE_FLOATCODES(LAB_XYZ,		gLabToXYZ,		Lab,		Codes)
+DEFINE_FLOATCODES(RGB_LAB,		gRGBToLab,		Codes,		Lab)
+DEFINE_FLOATCODES(LAB_RGB,		gLabToRGB,		Lab,		Codes)
+DEFINE_FLOATCODES(RGB_Gray,		gRGBToGray,		Codes,		Codes)
+DEFINE_FLOATCODES(CMYK_XYZ,		gRGBToXYZ,		CMYK,		Codes)
+DEFINE_FLOATCODES(XYZ_CMYK,		gXYZToRGB,		Codes,		CMYK)
+DEFINE_FLOATCODES(CMYK_LAB,		gRGBToLab,		CMYK,		Lab)
+DEFINE_FLOATCODES(LAB_CMYK,		gLabToRGB,		Lab,		CMYK)
+DEFINE_FLOATCODES(CMYK_Gray,	gRGBToGray,		CMYK,		Codes)
+DEFINE_FLOATCODES(RGB_CMYK,		gIdentity,		Codes,		CMYK)
+DEFINE_FLOATCODES(CMYK_RGB,		gIdentity,		CMYK,		Codes)
+DEFINE_FLOATCODES(XYZ_Gray,		gXYZToGray,		Codes,		Codes)
+DEFINE_FLOATCODES(Gray_RGB,		gGrayToRGB,		Codes,		Codes)
+
+// The rest only move channels, as their MatchOne procs do
+
+static void
+MatchFloat_LAB_Gray (CMMTransformPtr xform, float* chan, UInt32 count)
+{
+	(void)xform;
+	(void)chan;
+	(void)count;
+	// nothing to do gray = L
+}
+
+static void
+MatchFloat_Gray_LAB (CMMTransformPtr xform, float* chan, UInt32 count)
+{
+	(void)xform;
+	for ( ; count > 0; count--, chan += 4)
+		chan[1] = chan[2] = 0.0f;
+}
+
+static void
+MatchFloat_Gray_CMYK (CMMTransformPtr xform, float* chan, UInt32 count)
+{
+	(void)xform;
+	for ( ; count > 0; count--, chan += 4)
+	{
+		chan[3] = chan[0];
+		chan[0] = chan[1] = chan[2] = 0.0f;
+	}
+}
+
+
+//---------------------------------------------------------------------
+//	Integer conversions of a block, used for kEnginePrecisionFixed and
+//	for the matrix conversions at normal quality. No floating point is
+//	touched while matching; the tables below are built once, by the
+//	first transform that needs them.
+//
+//	A matrix row is applied as floor((sum C[j] * x[j] + 2^(S-1)) / 2^S),
+//	with C[j] the coefficient scaled from input code values straight to
+//	output code values and rounded to S fraction bits. Each C[j] is
+//	split into H[j] * 2^15 + L[j] with H and L both 16 bit, and the
+//	inputs are taken less 32768 so they are signed 16 bit too; then both
+//	halves are two pmaddwd away and the sum comes out exact in 32 bit
+//	steps. S is chosen per row, as large as keeps every partial sum
+//	within 32 bits: 31 or 32 bits for RGB to XYZ and 27 or 28 for XYZ to
+//	RGB. That is close enough to the doubles that the results round as
+//	DoubToFract and DoubToUInt16 do except within 0.001 of a half, about
+//	one result in 100000, and are never more than one code value away.
+//	Results are clamped to 0...65535 as the macros do.
+//---------------------------------------------------------------------
+
+typedef struct
+{
+	SInt16				h[3][8];		// H of each row, twice, for two pixels
+	SInt16				l[3][8];		// L of each row, likewise
+	SInt32				kh[3];			// bias and rounding, above S,
+	SInt32				km[3];			// between bit 15 and S,
+	SInt32				kl[3];			// and below bit 15
+	SInt32				shift[3];		// S - 15
+} MatrixFixedRec;
+
+static MatrixFixedRec	gRGBToXYZFixed;
+static MatrixFixedRec	gXYZToRGBFixed;
+static MatrixFixedRec	gGrayToXYZFixed;
+static MatrixFixedRec	gRGBToGrayFixed;
+
+static const double		gRGBToXYZCoefs[3][3] =
+{
+	{ 0.418, 0.363, 0.183 },
+	{ 0.213, 0.715, 0.072 },
+	{ 0.015, 0.090, 0.720 },
+};
+
+static const double		gXYZToRGBCoefs[3][3] =
+{
+	{  3.202, -1.543, -0.660 },
+	{ -0.959,  1.879,  0.056 },
+	{  0.053, -0.203,  1.396 },
+};
+
+static const double		gGrayToXYZCoefs[3][3] =
+{
+	{ 0.96417, 0, 0 },
+	{ 1.0, 0, 0 },
+	{ 0.82489, 0, 0 },
+};
+
+static const double		gRGBToGrayCoefs[3][3] =
+{
+	{ 0.213, 0.715, 0.072 },
+	{ 0.213, 0.715, 0.072 },
+	{ 0.213, 0.715, 0.072 },
+};
+
+static void
+BuildMatrixFixed (const double coefs[3][3], double scale, MatrixFixedRec* mat)
+{
+	SInt64			c[3], h[3], l[3], k, sumH, maxH;
+	UInt32			i, j, bits;
+	
+	for (i=0; i < 3; i++)
+	{
+		// Largest S whose partial sums fit in 32 bits
+		for (bits=46; bits > 15; bits--)
+		{
+			sumH = maxH = 0;
+			for (j=0; j < 3; j++)
+			{
+				c[j] = (SInt64)floor(coefs[i][j] * scale * (double)((SInt64)1 << bits) + 0.5);
+				l[j] = ((c[j] + 16384) & 32767) - 16384;
+				h[j] = (c[j] - l[j]) >> 15;
+				sumH += (h[j] < 0) ? -h[j] : h[j];
+				if (h[j] > maxH || -h[j] > maxH)
+					maxH = (h[j] < 0) ? -h[j] : h[j];
+			}
+			if (maxH < 32768 && sumH * 32768 + ((SInt64)1 << (bits - 15)) + 65536 < 0x7FFFFFFF)
+				break;
+		}
+		
+		k = (SInt64)1 << (bits - 1);
+		for (j=0; j < 3; j++)
+			k += c[j] * 32768;
+		
+		for (j=0; j < 8; j++)
+		{
+			mat->h[i][j] = (j % 4 < 3) ? (SInt16)h[j % 4] : 0;
+			mat->l[i][j] = (j % 4 < 3) ? (SInt16)l[j % 4] : 0;
+		}
+		mat->kh[i] = (SInt32)(k >> bits);
+		mat->km[i] = (SInt32)((k >> 15) & (((SInt64)1 << (bits - 15)) - 1));
+		mat->kl[i] = (SInt32)(k & 32767);
+		mat->shift[i] = bits - 15;
+	}
+}
+
+static inline UInt16
+MatrixRowFixed (const MatrixFixedRec* mat, UInt32 i, SInt32 x, SInt32 y, SInt32 z)
+{
+	SInt32			a, b, r;
+	
+	a = mat->h[i][0] * x + mat->h[i][1] * y + mat->h[i][2] * z;
+	b = mat->l[i][0] * x + mat->l[i][1] * y + mat->l[i][2] * z;
+	r = ((a + mat->km[i] + ((b + mat->kl[i]) >> 15)) >> mat->shift[i]) + mat->kh[i];
+	
+	return (r <= 0) ? 0 : ((r >= 65535) ? 65535 : (UInt16)r);
+}
+
+#if USE_SSE2
+
+// One row for four colors, given as (x, y) and (z, 0) pairs
+static inline __m128i
+MatrixRowFixed4 (__m128i xy, __m128i z0, __m128i hxy, __m128i hz, __m128i lxy, __m128i lz,
+				 __m128i kh, __m128i km, __m128i kl, __m128i shift)
+{
+	__m128i			a, b;
+	
+	a = _mm_add_epi32(_mm_madd_epi16(xy, hxy), _mm_madd_epi16(z0, hz));
+	b = _mm_add_epi32(_mm_madd_epi16(xy, lxy), _mm_madd_epi16(z0, lz));
+	b = _mm_srai_epi32(_mm_add_epi32(b, kl), 15);
+	return _mm_add_epi32(_mm_sra_epi32(_mm_add_epi32(_mm_add_epi32(a, km), b), shift), kh);
+}
+
+#endif // USE_SSE2
+
+// RGB may be loaded from CMYK and stored as CMYK
+static void
+MatrixBlockFixed (const MatrixFixedRec* mat, UInt16* chan, UInt32 count, Boolean fromCMYK, Boolean toCMYK)
+{
+	SInt32			x, y, z;
+#if USE_SSE2
+	const __m128i	sign = _mm_set1_epi16((short)0x8000);
+	const __m128i	ones = _mm_set1_epi32(-1);
+	const __m128i	bias = _mm_set1_epi32(32768);
+	const __m128i	low = _mm_set1_epi32(0xFFFF);
+	__m128i			hxy[3], hz[3], lxy[3], lz[3], kh[3], km[3], kl[3], shift[3];
+	__m128i			t0, t1, xy, zw, z0, r0, r1, r2, k;
+	UInt32			i;
+	
+	for (i=0; i < 3; i++)
+	{
+		hxy[i] = _mm_set1_epi32((UInt16)mat->h[i][0] | ((UInt32)(UInt16)mat->h[i][1] << 16));
+		hz[i] = _mm_set1_epi32((UInt16)mat->h[i][2]);
+		lxy[i] = _mm_set1_epi32((UInt16)mat->l[i][0] | ((UInt32)(UInt16)mat->l[i][1] << 16));
+		lz[i] = _mm_set1_epi32((UInt16)mat->l[i][2]);
+		kh[i] = _mm_set1_epi32(mat->kh[i]);
+		km[i] = _mm_set1_epi32(mat->km[i]);
+		kl[i] = _mm_set1_epi32(mat->kl[i]);
+		shift[i] = _mm_cvtsi32_si128(mat->shift[i]);
+	}
+	
+	// Four colors at a time, less 32768 and rearranged into (x y) and
+	// (z w) pairs for pmaddwd
+	for ( ; count >= 4; count -= 4, chan += 16)
+	{
+		t0 = _mm_loadu_si128((const __m128i*)chan);
+		t1 = _mm_loadu_si128((const __m128i*)(chan + 8));
+		if (fromCMYK)
+		{
+			t0 = CMYKToRGB2(t0);
+			t1 = CMYKToRGB2(t1);
+		}
+		
+		t0 = _mm_shuffle_epi32(_mm_xor_si128(t0, sign), _MM_SHUFFLE(3, 1, 2, 0));
+		t1 = _mm_shuffle_epi32(_mm_xor_si128(t1, sign), _MM_SHUFFLE(3, 1, 2, 0));
+		xy = _mm_unpacklo_epi64(t0, t1);
+		zw = _mm_unpackhi_epi64(t0, t1);
+		z0 = _mm_and_si128(zw, low);
+		
+		r0 = MatrixRowFixed4(xy, z0, hxy[0], hz[0], lxy[0], lz[0], kh[0], km[0], kl[0], shift[0]);
+		r1 = MatrixRowFixed4(xy, z0, hxy[1], hz[1], lxy[1], lz[1], kh[1], km[1], kl[1], shift[1]);
+		r2 = MatrixRowFixed4(xy, z0, hxy[2], hz[2], lxy[2], lz[2], kh[2], km[2], kl[2], shift[2]);
+		
+		// Clamp by packing around 0x8000, as StorePlanes does; w is
+		// still less 32768
+		t0 = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(r0, bias), _mm_sub_epi32(r1, bias)), sign);
+		t1 = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(r2, bias), _mm_srai_epi32(zw, 16)), sign);
+		
+		// CMY are 65535 less RGB, and K the unsigned min of the three
+		// planes, taken out of each
+		if (toCMYK)
+		{
+			t0 = _mm_xor_si128(t0, ones);
+			t1 = _mm_xor_si128(t1, ones);
+			k = MinU16(MinU16(t0, _mm_unpackhi_epi64(t0, t0)), t1);
+			k = _mm_unpacklo_epi64(k, k);
+			t0 = _mm_subs_epu16(t0, k);
+			t1 = _mm_unpacklo_epi64(_mm_subs_epu16(t1, k), k);
+		}
+		
+		// Planes back to x y z w order
+		t0 = _mm_unpacklo_epi16(t0, _mm_unpackhi_epi64(t0, t0));
+		t1 = _mm_unpacklo_epi16(t1, _mm_unpackhi_epi64(t1, t1));
+		_mm_storeu_si128((__m128i*)chan, _mm_unpacklo_epi32(t0, t1));
+		_mm_storeu_si128((__m128i*)(chan + 8), _mm_unpackhi_epi32(t0, t1));
+	}
+#endif
+	
+	for ( ; count > 0; count--, chan += 4)
+	{
+		if (fromCMYK)
+			MatchOne_CMYK_RGB(chan);
+		
+		x = (SInt32)chan[0] - 32768;
+		y = (SInt32)chan[1] - 32768;
+		z = (SInt32)chan[2] - 32768;
+		
+		chan[0] = MatrixRowFixed(mat, 0, x, y, z);
+		chan[1] = MatrixRowFixed(mat, 1, x, y, z);
+		chan[2] = MatrixRowFixed(mat, 2, x, y, z);
+		
+		if (toCMYK)
+			MatchOne_RGB_CMYK(chan);
+	}
+}
+
+#define DEFINE_FIXEDMATRIX(name,	mat,				fromCMYK,	toCMYK)				\
+static void																		\
+MatchBlockFixed_##name (CMMTransformPtr xform, UInt16* chan, UInt32 count)		\
+{																				\
+	(void)xform;  																\
+	MatrixBlockFixed(&mat, chan, count, fromCMYK, toCMYK);						\
+}
+
+DEFINE_FIXEDMATRIX(RGB_XYZ,		gRGBToXYZFixed,		false,		false)
+DEFINE_FIXEDMATRIX(XYZ_RGB,		gXYZToRGBFixed,		false,		false)
+DEFINE_FIXEDMATRIX(Gray_XYZ,	gGrayToXYZFixed,	false,		false)
+DEFINE_FIXEDMATRIX(RGB_Gray,	gRGBToGrayFixed,	false,		false)
+DEFINE_FIXEDMATRIX(CMYK_XYZ,	gRGBToXYZFixed,		true,		false)
+DEFINE_FIXEDMATRIX(XYZ_CMYK,	gXYZToRGBFixed,		false,		true)
+DEFINE_FIXEDMATRIX(CMYK_Gray,	gRGBToGrayFixed,	true,		false)
+
+
+//---------------------------------------------------------------------
+//	Integer Lab conversions. The cube root of f(t) in XYZ to Lab is read
+//	from a table over t in [0, kLabFTableMax] and interpolated linearly;
+//	it is filled from the same pow(t, 0.3333) as the double proc. That
+//	does not quite meet the linear segment near black, so the segment is
+//	computed apart rather than interpolated across the step. The inverse
+//	only needs a cube, which is done in s7.24.
+//---------------------------------------------------------------------
+
+#define kLabBits			24
+#define kLabOne				((SInt64)1 << kLabBits)
+#define LabFixed(c)			((SInt64)((c) * (double)kLabOne + 0.5))
+#define kLabFTableSize		8192
+#define kLabFTableMax		2.5
+
+// XYZ Fract codes to table positions in 32.32 fixed point
+#define LabFPosition(white)	((SInt64)(kLabFTableSize / kLabFTableMax / (32768.0 * (white)) * 4294967296.0 + 0.5))
+
+static SInt32			gLabFTable[kLabFTableSize + 2];
+static pthread_once_t	gFixedTablesOnce = PTHREAD_ONCE_INIT;
+
+static void
+BuildFixedTables (void)
+{
+	double			t;
+	UInt32			i;
+	
+	BuildMatrixFixed(gRGBToXYZCoefs, 32768.0 / 65535.0, &gRGBToXYZFixed);
+	BuildMatrixFixed(gXYZToRGBCoefs, 65535.0 / 32768.0, &gXYZToRGBFixed);
+	BuildMatrixFixed(gGrayToXYZCoefs, 32768.0 / 65535.0, &gGrayToXYZFixed);
+	BuildMatrixFixed(gRGBToGrayCoefs, 1.0, &gRGBToGrayFixed);
+	
+	for (i=0; i < kLabFTableSize + 2; i++)
+	{
+		t = i * kLabFTableMax / kLabFTableSize;
+		gLabFTable[i] = (SInt32)(pow(t, 0.3333) * kLabOne + 0.5);
+	}
+}
+
+static void
+InitFixedTables (void)
+{
+	pthread_once(&gFixedTablesOnce, &BuildFixedTables);
+}
+
+// Table positions of the end of the linear segment, and its slope per
+// position in 32.32 fixed point
+#define kLabKneePosition	((SInt64)(0.008856 * kLabFTableSize / kLabFTableMax * 4294967296.0))
+#define kLabSlopeFixed		((SInt64)(7.787 * kLabFTableMax / kLabFTableSize * 4294967296.0 + 0.5))
+
+// f(t) in s7.24 of a table position in 32.32
+static inline SInt64
+LabFFixed (SInt64 pos)
+{
+	UInt32			i = (UInt32)(pos >> 32);
+	SInt64			f0 = gLabFTable[i];
+	
+	if (pos <= kLabKneePosition)
+		return ((pos * kLabSlopeFixed) >> (64 - kLabBits)) + LabFixed(16.0 / 116.0);
+	
+	return f0 + (((gLabFTable[i + 1] - f0) * ((pos >> 16) & 0xFFFF)) >> 16);
+}
+
+// Inverse of f, s7.24 in and out
+static inline SInt64
+LabFInvFixed (SInt64 f)
+{
+	SInt64			cube = (((f * f) >> kLabBits) * f) >> kLabBits;
+	SInt64			line = ((f - LabFixed(16.0 / 116.0)) * LabFixed(1.0 / 7.787)) >> kLabBits;
+	
+	// both, so the choice is a select rather than a branch
+	return (f > LabFixed(0.20696)) ? cube : line;
+}
+
+// Lab codes are s7.24 f values times these, in 32.32 fixed point
+#define kLFixed				((SInt64)(65535.0 * 116.0 / 100.0 * 256.0 + 0.5))
+#define kAFixed				((SInt64)(65535.0 * 500.0 / 256.0 * 256.0 + 0.5))
+#define kBFixed				((SInt64)(65535.0 * 200.0 / 256.0 * 256.0 + 0.5))
+#define kLOffsetFixed		((SInt64)(65535.0 * 16.0 / 100.0 * 4294967296.0 + 0.5))
+#define kLabHalf			((SInt64)1 << 31)
+
+// Integer part of a 32.32 sum as a code. Out of gamut colors are common,
+// so clamp without branches.
+static inline UInt16
+LabToUInt16 (SInt64 sum)
+{
+	sum >>= 32;
+	sum = (sum < 0) ? 0 : sum;
+	sum = (sum > 65535) ? 65535 : sum;
+	return (UInt16)sum;
+}
+
+// Lab codes to s7.24 f values, in 24.40 fixed point
+#define kLInvFixed			((SInt64)(100.0 / 116.0 / 65535.0 * 1099511627776.0 + 0.5))
+#define kAInvFixed			((SInt64)(256.0 / 500.0 / 65535.0 * 1099511627776.0 + 0.5))
+#define kBInvFixed			((SInt64)(256.0 / 200.0 / 65535.0 * 1099511627776.0 + 0.5))
+
+
+//---------------------------------------------------------------------
+//	Each integer conversion to or from Lab is one pass, loaded and stored
+//	as the single precision ones are, through one matrix in 32.32 fixed
+//	point, without rounding in between. Going to Lab, the matrix gives
+//	table positions for LabFFixed, so RGB to XYZ to Lab is one matrix;
+//	coming from Lab it takes relative XYZ in s7.24 to output codes.
+//---------------------------------------------------------------------
+
+typedef struct
+{
+	SInt64				m[3][3];
+} MatrixLabFixedRec;
+
+// RGB codes to table positions, and relative XYZ to RGB codes
+#define RGBToLabFixed(c, white)	((SInt64)((c) / (65535.0 * (white)) * kLabFTableSize / kLabFTableMax * 4294967296.0 + 0.5))
+#define LabToRGBFixed(c, white)	((SInt64)((c) * (white) * 65535.0 * 256.0 + (((c) < 0) ? -0.5 : 0.5)))
+
+static const MatrixLabFixedRec	gXYZToLabFixed =
+{{
+	{ LabFPosition(0.9642), 0, 0 },
+	{ 0, LabFPosition(1.0), 0 },
+	{ 0, 0, LabFPosition(0.8249) },
+}};
+
+static const MatrixLabFixedRec	gRGBToLabFixed =
+{{
+	{ RGBToLabFixed(0.418, 0.9642), RGBToLabFixed(0.363, 0.9642), RGBToLabFixed(0.183, 0.9642) },
+	{ RGBToLabFixed(0.213, 1.0), RGBToLabFixed(0.715, 1.0), RGBToLabFixed(0.072, 1.0) },
+	{ RGBToLabFixed(0.015, 0.8249), RGBToLabFixed(0.090, 0.8249), RGBToLabFixed(0.720, 0.8249) },
+}};
+
+// f^3 to XYZ Fract codes
+static const MatrixLabFixedRec	gLabToXYZFixed =
+{{
+	{ (SInt64)(0.9642 * 32768.0 * 256.0 + 0.5), 0, 0 },
+	{ 0, (SInt64)(32768.0 * 256.0), 0 },
+	{ 0, 0, (SInt64)(0.8249 * 32768.0 * 256.0 + 0.5) },
+}};
+
+static const MatrixLabFixedRec	gLabToRGBFixed =
+{{
+	{ LabToRGBFixed( 3.202, 0.9642), LabToRGBFixed(-1.543, 1.0), LabToRGBFixed(-0.660, 0.8249) },
+	{ LabToRGBFixed(-0.959, 0.9642), LabToRGBFixed( 1.879, 1.0), LabToRGBFixed( 0.056, 0.8249) },
+	{ LabToRGBFixed( 0.053, 0.9642), LabToRGBFixed(-0.203, 1.0), LabToRGBFixed( 1.396, 0.8249) },
+}};
+
+// Largest relative XYZ an XYZ Fract code holds, in s7.24
+#define kXMaxFixed			LabFixed(65535.0 / 32768.0 / 0.9642)
+#define kYMaxFixed			LabFixed(65535.0 / 32768.0)
+#define kZMaxFixed			LabFixed(65535.0 / 32768.0 / 0.8249)
+
+static inline SInt64
+ClampFixed (SInt64 x, SInt64 max)
+{
+	x = (x < 0) ? 0 : x;
+	return (x > max) ? max : x;
+}
+
+static inline void
+FixedLoadCodes (UInt16* chan, SInt64* v)
+{
+	v[0] = chan[0];
+	v[1] = chan[1];
+	v[2] = chan[2];
+}
+
+// The same as MatchOne_CMYK_RGB, without going through memory
+static inline void
+FixedLoadCMYK (UInt16* chan, SInt64* v)
+{
+	SInt64			k = chan[3];
+	
+	v[0] = 0xFFFF - chan[0] - k;
+	v[1] = 0xFFFF - chan[1] - k;
+	v[2] = 0xFFFF - chan[2] - k;
+	v[0] = (v[0] < 0) ? 0 : v[0];
+	v[1] = (v[1] < 0) ? 0 : v[1];
+	v[2] = (v[2] < 0) ? 0 : v[2];
+}
+
+static inline void
+FixedLoadLab (UInt16* chan, SInt64* v)
+{
+	SInt64			fx, fy, fz;
+	
+	// a and b are centered on 32767.5, so work in half codes
+	fy = ((chan[0] * kLInvFixed) >> 16) + LabFixed(16.0 / 116.0);
+	fx = fy + ((((SInt64)chan[1] * 2 - 65535) * kAInvFixed) >> 17);
+	fz = fy - ((((SInt64)chan[2] * 2 - 65535) * kBInvFixed) >> 17);
+	
+	fx = LabFInvFixed(fx);
+	fy = LabFInvFixed(fy);
+	fz = LabFInvFixed(fz);
+	v[0] = ClampFixed(fx, kXMaxFixed);
+	v[1] = ClampFixed(fy, kYMaxFixed);
+	v[2] = ClampFixed(fz, kZMaxFixed);
+}
+
+static inline void
+FixedMatrix (const MatrixLabFixedRec* mat, SInt64* v)
+{
+	SInt64			x = v[0], y = v[1], z = v[2];
+	
+	v[0] = mat->m[0][0] * x + mat->m[0][1] * y + mat->m[0][2] * z;
+	v[1] = mat->m[1][0] * x + mat->m[1][1] * y + mat->m[1][2] * z;
+	v[2] = mat->m[2][0] * x + mat->m[2][1] * y + mat->m[2][2] * z;
+}
+
+static inline void
+FixedStoreCodes (UInt16* chan, const SInt64* v)
+{
+	chan[0] = LabToUInt16(v[0] + kLabHalf);
+	chan[1] = LabToUInt16(v[1] + kLabHalf);
+	chan[2] = LabToUInt16(v[2] + kLabHalf);
+}
+
+// The same as MatchOne_RGB_CMYK, without going through memory
+static inline void
+FixedStoreCMYK (UInt16* chan, const SInt64* v)
+{
+	UInt32			c, m, y, k;
+	
+	c = 0xFFFF - LabToUInt16(v[0] + kLabHalf);
+	m = 0xFFFF - LabToUInt16(v[1] + kLabHalf);
+	y = 0xFFFF - LabToUInt16(v[2] + kLabHalf);
+	k = (c < m) ? c : m;
+	k = (k < y) ? k : y;
+	chan[0] = c - k;
+	chan[1] = m - k;
+	chan[2] = y - k;
+	chan[3] = k;
+}
+
+static inline void
+FixedStoreLab (UInt16* chan, const SInt64* v)
+{
+	SInt64			fx, fy, fz, sum;
+	
+	fx = LabFFixed(v[0]);
+	fy = LabFFixed(v[1]);
+	fz = LabFFixed(v[2]);
+	
+	sum = fy * kLFixed - kLOffsetFixed + kLabHalf;
+	chan[0] = LabToUInt16(sum);
+	sum = (fx - fy) * kAFixed + ((SInt64)32768 << 32);
+	chan[1] = LabToUInt16(sum);
+	sum = (fy - fz) * kBFixed + ((SInt64)32768 << 32);
+	chan[2] = LabToUInt16(sum);
+}
+
+#define DEFINE_FIXEDLAB(name,		mat,				load,		store)				\
+static void																		\
+MatchBlockFixed_##name (CMMTransformPtr xform, UInt16* chan, UInt32 count)		\
+{																				\
+	SInt64			v[3];														\
+																				\
+	(void)xform;  																\
+	for ( ; count > 0; count--, chan += 4)										\
+	{																			\
+		FixedLoad##load(chan, v);												\
+		FixedMatrix(&mat, v);													\
+		FixedStore##store(chan, v);												\
+	}																			\
+}
+
+DEFINE_FIXEDLAB(XYZ_LAB,		gXYZToLabFixed,		Codes,		Lab)
+DEFINE_FIXEDLAB(LAB_XYZ,		gLabToXYZFixed,		Lab,		Codes)
+DEFINE_FIXEDLAB(RGB_LAB,		gRGBToLabFixed,		Codes,		Lab)
+DEFINE_FIXEDLAB(LAB_RGB,		gLabToRGBFixed,		Lab,		Codes)
+DEFINE_FIXEDLAB(CMYK_LAB,		gRGBToLabFixed,		CMYK,		Lab)
+DEFINE_FIXEDLAB(LAB_CMYK,		gLabToRGBFixed,		Lab,		CMYK)
+
+
+//---------------------------------------------------------------------
+//	Conversions of a block of colors with 8 bits-per-channel. These give
+//	the same bytes as widening, calling the 16 bit proc and narrowing.
+//---------------------------------------------------------------------
+
+static void
+MatchBlock8_RGB_CMYK (UInt8* chan, UInt32 count)
+{
+	UInt8			c, m, y, k;
+#if USE_SSE2
+	const __m128i	ones = _mm_set1_epi32(-1);
+	const __m128i	low = _mm_set1_epi32(0xFF);
+	const __m128i	cmy = _mm_set1_epi32(0x00FFFFFF);
+	__m128i			v, kv;
+	
+	for ( ; count >= 4; count -= 4, chan += 16)
+	{
+		v = _mm_xor_si128(_mm_loadu_si128((__m128i*)chan), ones);
+		kv = _mm_min_epu8(v, _mm_min_epu8(_mm_srli_epi32(v, 8), _mm_srli_epi32(v, 16)));
+		kv = _mm_and_si128(kv, low);
+		v = _mm_subs_epu8(v, _mm_or_si128(kv, _mm_or_si128(_mm_slli_epi32(kv, 8), _mm_slli_epi32(kv, 16))));
+		v = _mm_or_si128(_mm_and_si128(v, cmy), _mm_slli_epi32(kv, 24));
+		_mm_storeu_si128((__m128i*)chan, v);
+	}
+#endif
+	
+	for ( ; count > 0; count--, chan += 4)
+	{
+		c = 0xFF - chan[0];
+		m = 0xFF - chan[1];
+		y = 0xFF - chan[2];
+		k = (c < m) ? ((c < y) ? c : y) : ((m < y) ? m : y);
+		chan[0] = c - k;
+		chan[1] = m - k;
+		chan[2] = y - k;
+		chan[3] = k;
+	}
+}
+
+static void
+MatchBlock8_CMYK_RGB (UInt8* chan, UInt32 count)
+{
+	UInt8			r, g, b, k;
+#if USE_SSE2
+	const __m128i	cmy = _mm_set1_epi32(0x00FFFFFF);
+	__m128i			v, kv;
+	
+	for ( ; count >= 4; count -= 4, chan += 16)
+	{
+		v = _mm_loadu_si128((__m128i*)chan);
+		kv = _mm_srli_epi32(v, 24);
+		kv = _mm_or_si128(kv, _mm_or_si128(_mm_slli_epi32(kv, 8), _mm_slli_epi32(kv, 16)));
+		v = _mm_subs_epu8(_mm_andnot_si128(v, cmy), kv);
+		_mm_storeu_si128((__m128i*)chan, v);
+	}
+#endif
+	
+	for ( ; count > 0; count--, chan += 4)
+	{
+		r = 0xFF - chan[0];
+		g = 0xFF - chan[1];
+		b = 0xFF - chan[2];
+		k = chan[3];
+		chan[0] = (r > k) ? (r - k) : 0;
+		chan[1] = (g > k) ? (g - k) : 0;
+		chan[2] = (b > k) ? (b - k) : 0;
+		chan[3] = 0;
+	}
+}
+
+static void
+MatchBlock8_Gray_RGB (UInt8* chan, UInt32 count)
+{
+	for ( ; count > 0; count--, chan += 4)
+	{
+		chan[3] = chan[1]; // preserve alpha
+		chan[1] = chan[2] = chan[0];
+	}
+}
+
+static void
+MatchBlock8_Gray_CMYK (UInt8* chan, UInt32 count)
+{
+	for ( ; count > 0; count--, chan += 4)
+	{
+		chan[3] = chan[0]; // K = gray
+		chan[0] = chan[1] = chan[2] = 0; // CMY = 0
+	}
+}
+
+static void
+MatchBlock8_LAB_Gray (UInt8* chan, UInt32 count)
+{
+	(void)chan;
+	(void)count;
+	// nothing to do gray = L
+}
+
+static void
+MatchBlock8_Gray_LAB (UInt8* chan, UInt32 count)
+{
+	for ( ; count > 0; count--, chan += 4)
+		chan[1] = chan[2] = 0;
+}
+
+
+//---------------------------------------------------------------------					
+//	Simple conversions of one color with 16 bits-per-channel.
+//---------------------------------------------------------------------
+
+
+static void
+MatchOne_RGB_CMYK (UInt16* chan)
+{
+	chan[0] = 0xFFFF - chan[0];
+	chan[1] = 0xFFFF - chan[1];
+	chan[2] = 0xFFFF - chan[2];
+	chan[3] = (chan[0] < chan[1]) ?
+				( (chan[0] < chan[2]) ? (chan[0]) : (chan[2]) ) :
+				( (chan[1] < chan[2]) ? (chan[1]) : (chan[2]) );
+	chan[0] -= chan[3];
+	chan[1] -= chan[3];
+	chan[2] -= chan[3];
+}
+
+static void
+MatchOne_CMYK_RGB (UInt16* chan)
+{
+	chan[0] = 0xFFFF - chan[0];
+	chan[1] = 0xFFFF - chan[1];
+	chan[2] = 0xFFFF - chan[2];
+	chan[0] = (chan[0] > chan[3]) ? (chan[0] - chan[3]) : 0;
+	chan[1] = (chan[1] > chan[3]) ? (chan[1] - chan[3]) : 0;
+	chan[2] = (chan[2] > chan[3]) ? (chan[2] - chan[3]) : 0;
+	chan[3] = 0;
+}
+
+#define DoubToUInt16(x)		(((x)<=0.0)?(0):(((x)>=1.0)?(65535):((x)*65535.0 + 0.5)))
+#define UInt16ToDoub(x)		((double)(x)/65535.0)
+#define DoubToFract(x)		(((x)<=0.0)?(0):(((x)>=2.0)?(65535):((x)*32768.0 + 0.5)))
+#define FractToDoub(x)		((double)(x)/32768.0)
+#define UInt16ToFract(x)	((x)>>1)
+#define FractToUInt16(x)	((x)<<1)
+#define ClampFract(x)		(((x)<=0.0)?(0.0):(((x)>=65535.0/32768.0)?(65535.0/32768.0):(x)))
+
+//---------------------------------------------------------------------
+//	The steps of the XYZ conversions, from or to doubles. The compound
+//	procs chain them without rounding the XYZ in between to Fract codes.
+//---------------------------------------------------------------------
+
+static inline void
+RGBToXYZ (const UInt16* chan, double* X, double* Y, double* Z)
+{
+	double r,g,b;
+	
+	r = UInt16ToDoub(chan[0]);
+	g = UInt16ToDoub(chan[1]);
+	b = UInt16ToDoub(chan[2]);
+	
+	// map through 2.2 gamma
+	// r = pow( r, 2.2)
+	// g = pow( g, 2.2)
+	// b = pow( b, 2.2)
+	
+	// sRGB phosphors matrix
+	*X = (0.418 * r) + (0.363 * g) + (0.183 * b);
+	*Y = (0.213 * r) + (0.715 * g) + (0.072 * b);
+	*Z = (0.015 * r) + (0.090 * g) + (0.720 * b);
+}
+
+// Unclamped, 1.0 is code 65535
+static inline void
+XYZToRGBDoub (double X, double Y, double Z, double* rgb)
+{
+	double r,g,b;
+	
+	// sRGB phosphors inverse matrix
+	r = ( 3.202 * X) + (-1.543 * Y) + (-0.660 * Z);
+	g = (-0.959 * X) + ( 1.879 * Y) + ( 0.056 * Z);
+	b = ( 0.053 * X) + (-0.203 * Y) + ( 1.396 * Z);
+	
+	// map through inverse of 2.2 gamma
+	// r = pow( r, 1.0 / 2.2)
+	// g = pow( g, 1.0 / 2.2)
+	// b = pow( b, 1.0 / 2.2)
+	
+	rgb[0] = r;
+	rgb[1] = g;
+	rgb[2] = b;
+}
+
+static inline void
+XYZToRGB (double X, double Y, double Z, UInt16* chan)
+{
+	double rgb[3];
+	
+	XYZToRGBDoub(X, Y, Z, rgb);
+	
+	chan[0] = DoubToUInt16(rgb[0]);
+	chan[1] = DoubToUInt16(rgb[1]);
+	chan[2] = DoubToUInt16(rgb[2]);
+}
+
+// Unclamped, 1.0 is code 65535
+static inline void
+XYZToLabDoub (double X, double Y, double Z, double* lab)
+{
+	double				L, a, b;
+	double				fx, fy, fz;
+
+	// Assume XYZ white is D50
+	X /= 0.9642;
+	Z /= 0.8249;
+
+	if (X > 0.008856)
+		fx = pow(X, 0.3333);
+	else
+		fx = 7.787 * X + 16.0 / 116.0;
+	
+	if (Y > 0.008856)
+		fy = pow(Y, 0.3333);
+	else
+		fy = 7.787 * Y + 16.0 / 116.0;
+	
+	if (Z > 0.008856)
+		fz = pow(Z, 0.3333);
+	else
+		fz = 7.787 * Z + 16.0 / 116.0;
+
+	L = 116.0 * fy - 16;
+	a = 500.0 * (fx - fy);
+	b = 200.0 * (fy - fz);
+	
+	lab[0] = L / 100.0;
+	lab[1] = (a + 128.0) / 256.0;
+	lab[2] = (b + 128.0) / 256.0;
+}
+
+static inline void
+XYZToLab (double X, double Y, double Z, UInt16* chan)
+{
+	double lab[3];
+	
+	XYZToLabDoub(X, Y, Z, lab);
+	
+	chan[0] = DoubToUInt16(lab[0]);
+	chan[1] = DoubToUInt16(lab[1]);
+	chan[2] = DoubToUInt16(lab[2]);
+}
+
+// Unclamped
+static inline void
+LabToXYZDoub (const UInt16* chan, double* X, double* Y, double* Z)
+{
+	double				L, a, b;
+	double				fx, fy, fz;
+
+	L = UInt16ToDoub(chan[0]) * 100.0;
+	a = UInt16ToDoub(chan[1]) * 256.0 - 128.0;
+	b = UInt16ToDoub(chan[2]) * 256.0 - 128.0;
+	
+	fy = (L + 16.0) / 116.0;
+	fx = a / 500.0 + fy;
+	fz = fy - b / 200.0;
+	
+	if (fx > 0.20696) 
+		*X = pow(fx, 3);
+	else
+		*X = (fx - 16.0 / 116.0) / 7.787;
+	
+	if (fy > 0.20696) 
+		*Y = pow(fy, 3);
+	else
+		*Y = (fy - 16.0 / 116.0) / 7.787;
+	
+	if (fz > 0.20696) 
+		*Z = pow(fz, 3);
+	else
+		*Z = (fz - 16.0 / 116.0) / 7.787;
+	
+	*X *= 0.9642;
+	*Z *= 0.8249;
+}
+
+// The XYZ is clamped to what a Fract code holds
+static inline void
+LabToXYZ (const UInt16* chan, double* X, double* Y, double* Z)
+{
+	LabToXYZDoub(chan, X, Y, Z);
+	
+	*X = ClampFract(*X);
+	*Y = ClampFract(*Y);
+	*Z = ClampFract(*Z);
+}
+
+
+//---------------------------------------------------------------------
+//	Conversions of one color with 16 bits-per-channel through XYZ.
+//---------------------------------------------------------------------
+
+static void
+MatchOne_RGB_XYZ (UInt16* chan)
+{
+	double X,Y,Z;
+	
+	RGBToXYZ(chan, &X, &Y, &Z);
+	
+	chan[0] = DoubToFract(X);
+	chan[1] = DoubToFract(Y);
+	chan[2] = DoubToFract(Z);
+}
+
+static void
+MatchOne_XYZ_RGB (UInt16* chan)
+{
+	XYZToRGB(FractToDoub(chan[0]), FractToDoub(chan[1]), FractToDoub(chan[2]), chan);
+}
+
+static void
+MatchOne_RGB_LAB (UInt16* chan)
+{
+	double X,Y,Z;
+	
+	RGBToXYZ(chan, &X, &Y, &Z);
+	XYZToLab(X, Y, Z, chan);
+}
+
+static void
+MatchOne_LAB_RGB (UInt16* chan)
+{
+	double X,Y,Z;
+	
+	LabToXYZ(chan, &X, &Y, &Z);
+	XYZToRGB(X, Y, Z, chan);
+}
+
+static void
+MatchOne_XYZ_LAB (UInt16* chan)
+{
+#if 0
+	CMXYZColor white;
+	white.X = 31594;
+	white.Y = 32768;
+	white.Z = 27030;
+	CMConvertXYZToLab( (CMColor*)chan, &white, (CMColor*)chan,1);
+#else
+	XYZToLab(FractToDoub(chan[0]), FractToDoub(chan[1]), FractToDoub(chan[2]), chan);
+#endif
+}
+
+static void
+MatchOne_LAB_XYZ (UInt16* chan)
+{
+#if 0
+	CMXYZColor white;
+	white.X = 31594;
+	white.Y = 32768;
+	white.Z = 27030;
+	CMConvertLabToXYZ( (CMColor*)chan, &white, (CMColor*)chan,1);
+#else
+	double X,Y,Z;
+	
+	LabToXYZ(chan, &X, &Y, &Z);
+	
+	chan[0] = DoubToFract(X);
+	chan[1] = DoubToFract(Y);
+	chan[2] = DoubToFract(Z);
+#endif
+}
+
+static void
+MatchOne_CMYK_LAB (UInt16* chan)
+{
+	MatchOne_CMYK_RGB(chan);
+	MatchOne_RGB_LAB(chan);
+}
+
+static void
+MatchOne_LAB_CMYK (UInt16* chan)
+{
+	MatchOne_LAB_RGB(chan);
+	MatchOne_RGB_CMYK(chan);
+}
+
+static void
+MatchOne_CMYK_XYZ (UInt16* chan)
+{
+	MatchOne_CMYK_RGB(chan);
+	MatchOne_RGB_XYZ(chan);
+}
+
+static void
+MatchOne_XYZ_CMYK (UInt16* chan)
+{
+	MatchOne_XYZ_RGB(chan);
+	MatchOne_RGB_CMYK(chan);
+}
+
+static void
+MatchOne_RGB_Gray (UInt16* chan)
+{
+	UInt16 alpha;
+	double X,Y,Z;
+	alpha = chan[3]; // preserve alpha
+	RGBToXYZ(chan, &X, &Y, &Z);
+	chan[0] = DoubToUInt16(Y); // gray = Y
+	chan[1] = alpha; // preserve alpha
+}
+
+static void
+MatchOne_Gray_RGB (UInt16* chan)
+{
+	chan[3] = chan[1]; // preserve alpha
+	chan[1] = chan[2] = chan[0];
+}
+
+static void
+MatchOne_LAB_Gray (UInt16* chan)
+{
+	(void)chan;
+	// nothing to do gray = L
+}
+
+static void
+MatchOne_Gray_LAB (UInt16* chan)
+{
+	chan[1] = chan[2] = 0;
+}
+
+static void
+MatchOne_CMYK_Gray (UInt16* chan)
+{
+	MatchOne_CMYK_RGB(chan);
+	MatchOne_RGB_Gray(chan);
+}
+
+static void
+MatchOne_Gray_CMYK (UInt16* chan)
+{
+	chan[3] = chan[0]; // K = gray
+	chan[0] = chan[1] = chan[2] = 0; // CMY = 0
+}
+
+static void
+MatchOne_XYZ_Gray (UInt16* chan)
+{
+	chan[0] = (chan[1] >= 0x8000) ? 0xFFFF : FractToUInt16(chan[1]); // gray = Y
+}
+
+static void
+MatchOne_Gray_XYZ (UInt16* chan)
+{
+	double X,Y,Z;
+	
+	Y = UInt16ToDoub(chan[0]);
+	X = Y * 0.96417;
+	Z = Y * 0.82489;
+	
+	chan[0] = DoubToFract(X);
+	chan[1] = DoubToFract(Y);
+	chan[2] = DoubToFract(Z);
+}
+
+
+//---------------------------------------------------------------------
+//	The procs of the conversions a grid may end in, for its nodes. They
+//	leave the result unclamped so that colors between a node inside the
+//	range of the destination and one beyond it interpolate as the proc
+//	would match them; GridInterp clamps instead.
+//---------------------------------------------------------------------
+
+static void
+Sample_RGB_XYZ (const UInt16* chan, double* codes)
+{
+	double X,Y,Z;
+	
+	RGBToXYZ(chan, &X, &Y, &Z);
+	
+	codes[0] = X * 32768.0;
+	codes[1] = Y * 32768.0;
+	codes[2] = Z * 32768.0;
+}
+
+static void
+Sample_XYZ_RGB (const UInt16* chan, double* codes)
+{
+	XYZToRGBDoub(FractToDoub(chan[0]), FractToDoub(chan[1]), FractToDoub(chan[2]), codes);
+	
+	codes[0] *= 65535.0;
+	codes[1] *= 65535.0;
+	codes[2] *= 65535.0;
+}
+
+static void
+Sample_RGB_LAB (const UInt16* chan, double* codes)
+{
+	double X,Y,Z;
+	
+	RGBToXYZ(chan, &X, &Y, &Z);
+	XYZToLabDoub(X, Y, Z, codes);
+	
+	codes[0] *= 65535.0;
+	codes[1] *= 65535.0;
+	codes[2] *= 65535.0;
+}
+
+// The XYZ is clamped in between, as MatchOne_LAB_RGB does
+static void
+Sample_LAB_RGB (const UInt16* chan, double* codes)
+{
+	double X,Y,Z;
+	
+	LabToXYZ(chan, &X, &Y, &Z);
+	XYZToRGBDoub(X, Y, Z, codes);
+	
+	codes[0] *= 65535.0;
+	codes[1] *= 65535.0;
+	codes[2] *= 65535.0;
+}
+
+static void
+Sample_XYZ_LAB (const UInt16* chan, double* codes)
+{
+	XYZToLabDoub(FractToDoub(chan[0]), FractToDoub(chan[1]), FractToDoub(chan[2]), codes);
+	
+	codes[0] *= 65535.0;
+	codes[1] *= 65535.0;
+	codes[2] *= 65535.0;
+}
+
+static void
+Sample_LAB_XYZ (const UInt16* chan, double* codes)
+{
+	double X,Y,Z;
+	
+	LabToXYZDoub(chan, &X, &Y, &Z);
+	
+	codes[0] = X * 32768.0;
+	codes[1] = Y * 32768.0;
+	codes[2] = Z * 32768.0;
+}
+
+static void
+Sample_RGB_Gray (const UInt16* chan, double* codes)
+{
+	double X,Y,Z;
+	
+	RGBToXYZ(chan, &X, &Y, &Z);
+	
+	codes[0] = Y * 65535.0;
+}
+
@@ -0,0 +1,370 @@
+/*
+	File:		DemoCMMEngine.h
+
+	Contains:	Color conversion engine of the Demo CMM.
+
+				The engine knows nothing about ColorSync. Transforms are
+				described by plain color space codes and bitmaps by a
+				layout, so the engine builds and runs on any system with
+				a C compiler and POSIX threads. DemoCMM.c adapts the CMM
+				component calls to it.
+
+	Version:	ColorSync 2 or later
+
+	Copyright:	2002 by Apple Computer, Inc., all rights reserved.
+*/
+
+#ifndef __DEMOCMMENGINE__
+#define __DEMOCMMENGINE__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Color spaces, the same four character codes as the ColorSync data spaces
+enum
+{
+	kEngineRGBData				= 0x52474220,	// 'RGB '
+	kEngineCMYKData				= 0x434D594B,	// 'CMYK'
+	kEngineLabData				= 0x4C616220,	// 'Lab '
+	kEngineXYZData				= 0x58595A20,	// 'XYZ '
+	kEngineGrayData				= 0x47524159	// 'GRAY'
+};
+
+// Quality, the same values as cmNormalMode, cmDraftMode and cmBestMode
+enum
+{
+	kEngineNormalMode			= 0,
+	kEngineDraftMode			= 1,
+	kEngineBestMode				= 2
+};
+
+// Arithmetic of the analytic conversions. The default follows the quality:
+// best is exact, normal is fixed except to or from Lab, where it is float,
+// and draft is fixed with the costly conversions sampled into a grid.
+// Bounds are against the exact procs, in output code values (of 65535, XYZ
+// in u1.15) and in dE*ab for Lab output, and are checked by
+// EngineCheckAccuracy, which DemoCMMAccuracy runs at every quality and
+// precision.
+//
+//	exact	double precision, the reference
+//	float	single precision; 2 code values, and 0.03 dE*ab to Lab
+//	fixed	integer only; 1 code value, 2 from Lab to CMYK where C and K
+//			may each be one off, and 0.01 dE*ab to Lab
+//
+// The grids of draft quality, by their nodes a channel, see gridPoints:
+//
+//	17		1.5 dE*ab to Lab, 12 code values from Lab to XYZ, 48 to RGB
+//			or CMYK, and 8 otherwise
+//	33		0.5 dE*ab to Lab, 8 code values from Lab to XYZ, 40 to RGB
+//			or CMYK, and 8 otherwise
+//	65		0.2 dE*ab to Lab, 8 code values from Lab to XYZ, 40 to RGB
+//			or CMYK, and 8 otherwise
+//
+// Compound conversions like CMYK to Lab are one pass at every precision;
+// the color is not rounded to 16 bits between the steps.
+//
+// A chain of profiles, see EngineTransformKey, runs each of its
+// conversions in turn at the precision asked for, as a single one would,
+// and rounds the color to 16 bits between them; no chain is sampled into
+// a grid, not even at draft quality. Exact chains match the exact procs
+// run in turn, and the others stay within 16 code values of them, as the
+// error of each step is carried through the steps after it.
+enum
+{
+	kEnginePrecisionDefault		= 0,
+	kEnginePrecisionExact		= 1,
+	kEnginePrecisionFloat		= 2,
+	kEnginePrecisionFixed		= 3
+};
+
+// Memo of the colors already matched. Each band remembers up to 4096 of
+// the colors it matched and repeats the result when a color comes again, and
+// copies the color before through flat areas, so images of few colors
+// pay for each only once. It turns itself off for the rest of a band
+// whose colors are found less than half of the time, and bands of fewer
+// than 4096 pixels, single colors included, never use it. The default is
+// on at exact precision only, for chains and for the conversions draft
+// quality samples into a grid, the pow heavy ones through Lab or CMYK;
+// the float and fixed kernels match about as fast as the memo looks up.
+enum
+{
+	kEngineMemoDefault			= 0,
+	kEngineMemoOn				= 1,
+	kEngineMemoOff				= 2
+};
+
+// Transform tags, the same values as kDeviceToPCS, kPCSToDevice and kPCSToPCS
+enum
+{
+	kEngineDeviceToPCS			= 1,
+	kEnginePCSToDevice			= 2,
+	kEnginePCSToPCS				= 3
+};
+
+typedef int32_t EngineError;
+enum
+{
+	kEngineNoErr				= 0,
+	kEngineParamErr				= 1,
+	kEngineMemFullErr			= 2,
+	kEngineUnsupportedErr		= 3,	// no conversion between the two spaces
+	kEngineInvalidSrcMapErr		= 4,
+	kEngineInvalidDstMapErr		= 5,
+	kEngineCanceledErr			= 6
+};
+
+// Bitmap layouts. Channels are interleaved in the order of the space.
+// 16 bit layouts are big endian unless their name ends in L. RGB32 has
+// an unused leading byte. RGB555, RGB565 and RGB101010 hold a pixel in
+// one 16 or 32 bit word, red in the high bits and any unused bits above
+// it, which are written as zero. Their channels are widened to 16 bits
+// by repeating their bits and narrowed by dropping the low bits, as the
+// 8 bit layouts are.
+//
+// Float and Half layouts hold native endian 32 bit floats and 16 bit half
+// floats in the units of their space: 0 to 1 for Gray, RGB and CMYK, Y 1
+// for the D50 white in XYZ, and L* from 0 to 100 and a* and b* from -128
+// to 128 for Lab. Colors go from and to them in single precision, through
+// the float form of each conversion of the transform whatever its
+// quality and precision, and are neither rounded nor clamped to the 16
+// bit codes on the way; a destination may hold values outside the range
+// of its space.
+//
+// The ARGB, RGBA and BGRA layouts add an alpha channel to RGB, before or
+// after the color channels, which are in the order of their name. Alpha
+// goes around the match: it is copied to the destination, widened or
+// narrowed as the color channels are, and written as opaque into an
+// alpha layout matched from one without. The colors of the Pmul layouts
+// are premultiplied by their alpha; they are divided by it before they
+// are matched and multiplied by it again after, in the same pass, and a
+// color of zero alpha comes out as zero.
+//
+// Gamut1 is the result of EngineCheckBitmap, one bit per pixel with the
+// first pixel in the high bit, and cannot be matched. Indexed8 is a byte
+// per pixel, an index into the color table of the bitmap, and can only be
+// matched from.
+typedef enum
+{
+	kEngineGray8,
+	kEngineGray16,
+	kEngineGray16L,
+	kEngineRGB24,
+	kEngineRGB32,
+	kEngineRGB48,
+	kEngineRGB48L,
+	kEngineRGB555,
+	kEngineRGB555L,
+	kEngineRGB565,
+	kEngineRGB565L,
+	kEngineRGB101010,
+	kEngineCMYK32,
+	kEngineCMYK64,
+	kEngineCMYK64L,
+	kEngineLAB24,
+	kEngineLAB48,
+	kEngineLAB48L,
+	kEngineXYZ24,
+	kEngineXYZ48,
+	kEngineXYZ48L,
+	kEngineGrayFloat,
+	kEngineGrayHalf,
+	kEngineRGBFloat,
+	kEngineRGBHalf,
+	kEngineCMYKFloat,
+	kEngineCMYKHalf,
+	kEngineLABFloat,
+	kEngineLABHalf,
+	kEngineXYZFloat,
+	kEngineXYZHalf,
+	kEngineARGB32,
+	kEngineRGBA32,
+	kEngineBGRA32,
+	kEngineARGB64,
+	kEngineARGB64L,
+	kEngineRGBA64,
+	kEngineRGBA64L,
+	kEngineARGB32Pmul,
+	kEngineRGBA32Pmul,
+	kEngineBGRA32Pmul,
+	kEngineARGB64Pmul,
+	kEngineARGB64LPmul,
+	kEngineRGBA64Pmul,
+	kEngineRGBA64LPmul,
+	kEngineGamut1,
+	kEngineIndexed8
+} EngineLayout;
+
+// What the tools need to know of a layout. The layouts packed into a word
+// give their channels as 16 bits.
+typedef struct
+{
+	const char*			name;			// the constant less kEngine, like "RGB48L"
+	uint32_t			space;
+	uint32_t			channels;		// color channels, alpha not counted
+	uint32_t			channelBits;	// of each channel
+	uint32_t			pixelBytes;
+	int					floating;		// float or half float channels
+	int					alpha;			// has an alpha channel
+} EngineLayoutInfo;
+
+// The color table of an Indexed8 bitmap holds up to 256 colors of four
+// native endian 16 bit channels, in the source space of the transform,
+// as EngineMatchColors takes them. Indexes past its end stand for a color
+// of all zero channels. The other layouts do not use it.
+typedef struct
+{
+	void*				image;
+	uint32_t			width;
+	uint32_t			height;
+	uint32_t			rowBytes;
+	EngineLayout		layout;
+	const void*			colors;			// color table of an Indexed8 bitmap
+	uint32_t			colorCount;
+} EngineBitmap;
+
+// A bitmap whose channels each start where they like and step by their
+// own distances, in the order of the space and then alpha, if any. One
+// plane per channel is a planar bitmap; channels sharing a plane may be
+// interleaved, so one description covers planar, semi-planar and
+// interleaved images alike. The layout gives the space, the sample format
+// and alpha only: 8 or 16 bit, either byte order, float or half, and
+// whether alpha is premultiplied. Layouts packed into a word, Gamut1 and
+// Indexed8 have no planar form, and the channels of a float or half
+// bitmap all step by the same colBytes.
+typedef struct
+{
+	void*				planes[4];		// first sample of each channel
+	uint32_t			rowBytes[4];	// from a row of a channel to the next
+	uint32_t			colBytes[4];	// from a sample of a channel to the next
+	uint32_t			width;
+	uint32_t			height;
+	EngineLayout		layout;
+} EnginePlanarBitmap;
+
+// Most spaces a chain of profiles may pass through between the source and
+// the destination
+#define kEngineMaxVia				6
+
+// Everything a compiled transform depends on. Clear the whole key before
+// filling it in; the digests may stay zero when the profiles have none.
+// Colors are converted from srcSpace through each of the via spaces in
+// turn to dstSpace, each at the precision asked for. The grids draft
+// quality samples into have gridPoints nodes a channel, 33 when it is 0;
+// 65 is closer but takes 1.6 MB and eight times as long to build, 17 the
+// other way round.
+typedef struct
+{
+	uint32_t			srcSpace;
+	uint32_t			srcClass;
+	uint32_t			dstSpace;
+	uint32_t			dstClass;
+	uint32_t			viaCount;
+	uint32_t			via[kEngineMaxVia];	// spaces of the profiles in between
+	uint32_t			srcTransform;	// transformTag of the first profile
+	uint32_t			dstTransform;	// transformTag of the last profile
+	uint32_t			quality;
+	uint32_t			precision;		// kEnginePrecisionDefault unless overridden
+	uint32_t			memo;			// kEngineMemoDefault unless overridden
+	uint32_t			gridPoints;		// 17, 33 or 65, 0 for 33
+	uint8_t				srcMD5[16];
+	uint8_t				dstMD5[16];
+} EngineTransformKey;
+
+// Colors matched through the memo of a transform since it was made, summed
+// over every call and thread
+typedef struct
+{
+	uint64_t			runs;			// same as the color before
+	uint64_t			hits;			// found in the memo
+	uint64_t			misses;			// matched and remembered
+	uint64_t			bypassed;		// matched after the memo turned itself off
+} EngineMemoStats;
+
+typedef struct EngineTransform* EngineTransformRef;
+typedef struct EngineSession* EngineSessionRef;
+
+// Called with the number of rows still to be matched. Returning non zero
+// cancels the match, unless no rows are left.
+typedef int (*EngineProgressProc) (uint32_t rowsLeft, void* refCon);
+
+
+// Returns a transform with one reference for the caller. EngineFindTransform
+// shares transforms through a process wide cache and needs the digests set,
+// EngineNewTransform always compiles a new one.
+EngineError	EngineNewTransform		(const EngineTransformKey* key, EngineTransformRef* result);
+EngineError	EngineFindTransform		(const EngineTransformKey* key, EngineTransformRef* result);
+void		EngineRetainTransform	(EngineTransformRef xform);
+void		EngineReleaseTransform	(EngineTransformRef xform);
+
+// Sets the memory the transform cache of EngineFindTransform may hold on
+// to, in bytes, and drops the least recently used transforms that no longer
+// fit. Transforms still in use keep their own reference. 0 empties the
+// cache and turns it off. The budget is TRANSFORM_CACHE_BYTES, 8 MB unless
+// the engine is built with another, until it is set.
+void		EngineSetCacheBudget	(uint32_t bytes);
+
+// Matches count colors of four native endian 16 bit channels each, colorBytes
+// apart, in place. A transform may be used by any number of threads at once.
+EngineError	EngineMatchColors		(EngineTransformRef xform, void* colors, uint32_t count, uint32_t colorBytes);
+
+// Matches srcMap into dstMap, which may be the same bitmap. Large bitmaps
+// are matched in bands on several threads; progressProc, if any, is only
+// called on the calling thread. An Indexed8 source costs one match of its
+// color table and a copy of the matched color of every pixel; it may only
+// share its image with a Gray8 destination. To remap the palette instead,
+// match the color table with EngineMatchColors.
+EngineError	EngineMatchBitmap		(EngineTransformRef xform, const EngineBitmap* srcMap, const EngineBitmap* dstMap,
+									 EngineProgressProc progressProc, void* refCon);
+
+// Matches srcMap into dstMap as EngineMatchBitmap does, reading and writing
+// each channel where it lies, without copying either into an interleaved
+// bitmap. Channels in planes of their own go through vector kernels.
+EngineError	EngineMatchPlanar		(EngineTransformRef xform, const EnginePlanarBitmap* srcMap,
+									 const EnginePlanarBitmap* dstMap, EngineProgressProc progressProc, void* refCon);
+
+// Matches a bitmap that arrives a strip of rows at a time, so neither the
+// source nor the destination need ever be in memory whole. The row kernels
+// for the two layouts are chosen once by EngineBeginSession; each strip
+// is then matched as EngineMatchBitmap would, into a destination strip
+// that may be the source strip. A session holds a reference to xform and
+// may be used by one thread at a time.
+EngineError	EngineBeginSession		(EngineTransformRef xform, EngineLayout srcLayout, EngineLayout dstLayout,
+									 uint32_t width, EngineSessionRef* result);
+EngineError	EngineMatchStrip		(EngineSessionRef session, const void* src, uint32_t srcRowBytes,
+									 void* dst, uint32_t dstRowBytes, uint32_t rowCount);
+void		EngineEndSession		(EngineSessionRef session);
+
+// Sets the bit of every color the transform cannot reproduce, that is
+// whose conversion has to clamp a channel by more than 64 code values,
+// what RGB through XYZ and back may miss by, and clears the others. Colors
+// are as for EngineMatchColors and are left unchanged; result holds 32 to
+// a word, the first color in the high bit.
+EngineError	EngineCheckColors		(EngineTransformRef xform, const void* colors, uint32_t count, uint32_t colorBytes,
+									 uint32_t* result);
+
+// Checks srcMap into chkMap, a Gamut1 bitmap of the same size, in bands
+// on several threads as EngineMatchBitmap does
+EngineError	EngineCheckBitmap		(EngineTransformRef xform, const EngineBitmap* srcMap, const EngineBitmap* chkMap,
+									 EngineProgressProc progressProc, void* refCon);
+
+// Describes every layout a bitmap can be matched into, from Gray8 up to
+// but not including Gamut1, and returns kEngineParamErr for the others
+EngineError	EngineGetLayoutInfo		(EngineLayout layout, EngineLayoutInfo* info);
+
+// Returns the memo counters of xform, all zero if it does not use a memo
+void		EngineGetMemoStats		(EngineTransformRef xform, EngineMemoStats* stats);
+
+// Prints the largest error of every conversion at the given quality and
+// precision and returns how many exceed the published bounds
+int			EngineCheckAccuracy		(uint32_t quality, uint32_t precision);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __DEMOCMMENGINE__
@@ -0,0 +1,169 @@
+/*
+	File:		DemoCMMRoundTrip.c
+
+	Contains:	Round trip check of the Demo CMM batch converter.
+
+				Writes a 16 bit P6 file whose header is 15 bytes long, so
+				every sample of it sits at an odd offset, converts it with
+				DemoCMMConvert to LAB48, whose P7 header is odd too, and
+				back to RGB48, and compares the result with the source.
+				Needs nothing but POSIX:
+
+					cc -O2 -o DemoCMMRoundTrip DemoCMMRoundTrip.c
+
+				Usage:
+
+					DemoCMMRoundTrip converter [directory]
+
+				The files are written into directory, the current one by
+				default. Exits 1 if the converter fails, the header of the
+				result differs from the source's, or a sample is further
+				than kMaxError codes from the source's.
+
+	Version:	ColorSync 2 or later
+
+	Copyright:	2002 by Apple Computer, Inc., all rights reserved.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+// An odd size, so rows are an odd number of samples long as well
+#define		kWidth				37
+#define		kHeight				23
+#define		kHeader				"P6\n37 23\n65535\n"
+
+// Largest difference in codes of 65535 after the trip through LAB48 at
+// exact precision
+#define		kMaxError			64
+
+#define		kSampleCount		(kWidth * kHeight * 3)
+#define		kFileBytes			(sizeof(kHeader) - 1 + kSampleCount * 2)
+
+
+// function prototypes
+static int		RunConverter	(const char* converter, const char* layout, const char* src, const char* dst);
+static int		ReadFile		(const char* path, uint8_t* data, size_t bytes);
+
+
+//--------------------------------------------------------------------- main
+
+int
+main (int argc, char** argv)
+{
+	static uint8_t		src[kFileBytes], dst[kFileBytes];
+	char				srcPath[1024], midPath[1024], dstPath[1024];
+	const char*			dir = (argc > 2) ? argv[2] : ".";
+	uint8_t*			p;
+	FILE*				file;
+	uint32_t			i, value, other, worst = 0;
+	
+	if (argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "usage: %s converter [directory]\n", argv[0]);
+		return 1;
+	}
+	
+	snprintf(srcPath, sizeof(srcPath), "%s/roundtrip-src.ppm", dir);
+	snprintf(midPath, sizeof(midPath), "%s/roundtrip-mid.pam", dir);
+	snprintf(dstPath, sizeof(dstPath), "%s/roundtrip-dst.ppm", dir);
+	
+	// Ramps of every channel against the others, big endian
+	memcpy(src, kHeader, sizeof(kHeader) - 1);
+	p = src + sizeof(kHeader) - 1;
+	for (i=0; i < kSampleCount; i++, p += 2)
+	{
+		value = (i * 40503u + (i % 3) * 21845u) & 0xFFFF;
+		p[0] = (uint8_t)(value >> 8);
+		p[1] = (uint8_t)value;
+	}
+	
+	file = fopen(srcPath, "wb");
+	if (file == NULL || fwrite(src, 1, sizeof(src), file) != sizeof(src) || fclose(file) != 0)
+	{
+		fprintf(stderr, "%s: cannot write\n", srcPath);
+		return 1;
+	}
+	
+	if (RunConverter(argv[1], "LAB48", srcPath, midPath) != 0 ||
+		RunConverter(argv[1], "RGB48", midPath, dstPath) != 0)
+		return 1;
+	
+	if (ReadFile(dstPath, dst, sizeof(dst)) != 0)
+		return 1;
+	
+	if (memcmp(dst, kHeader, sizeof(kHeader) - 1) != 0)
+	{
+		fprintf(stderr, "%s: header differs from the source's\n", dstPath);
+		return 1;
+	}
+	
+	for (i=sizeof(kHeader) - 1; i < sizeof(src); i += 2)
+	{
+		value = ((uint32_t)src[i] << 8) | src[i+1];
+		other = ((uint32_t)dst[i] << 8) | dst[i+1];
+		value = (value > other) ? value - other : other - value;
+		if (value > worst)
+			worst = value;
+	}
+	
+	printf("RGB48 to LAB48 and back, odd offsets: largest error %u codes, bound %u\n", worst, kMaxError);
+	return (worst > kMaxError) ? 1 : 0;
+}
+
+
+//--------------------------------------------------------------------- RunConverter
+
+static int
+RunConverter (const char* converter, const char* layout, const char* src, const char* dst)
+{
+	pid_t				pid;
+	int					status;
+	
+	pid = fork();
+	if (pid == 0)
+	{
+		execl(converter, converter, "-p", "1", "-o", layout, src, dst, (char*)NULL);
+		_exit(127);
+	}
+	
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		fprintf(stderr, "%s -o %s %s %s failed\n", converter, layout, src, dst);
+		return 1;
+	}
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------- ReadFile
+
+static int
+ReadFile (const char* path, uint8_t* data, size_t bytes)
+{
+	FILE*				file = fopen(path, "rb");
+	size_t				got = 0;
+	
+	if (file)
+	{
+		got = fread(data, 1, bytes, file);
+		if (fgetc(file) != EOF)
+			got = 0;
+		fclose(file);
+	}
+	
+	if (got != bytes)
+	{
+		fprintf(stderr, "%s: not the %zu bytes expected\n", path, bytes);
+		return 1;
+	}
+	
+	return 0;
+}